@@ -0,0 +1,881 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Resident retimer update service. StartUpdate/StartRead requests are
+ * queued as jobs and run one at a time by a worker thread, the bus
+ * descriptors, the sd-bus connection used for log events and the
+ * verified firmware images stay warm between jobs. A request matching
+ * a job that is still queued is merged into it instead of queued twice.
+ * Every update job is exported as UPDATE_JOB_PATH<id> with its live
+ * progress, property changes are emitted from the main loop. The
+ * trigger and status polls of a job are driven by timers of the main
+ * loop (see startFpgaOp()) while the worker waits, so CancelJob can
+ * stop a running job there. A cancelled job triggers nothing more, an
+ * FPGA left flashing fails the preflight of the next update until idle.
+ * StartUpdate, StartRead and CancelJob are restricted to privileged
+ * callers, read images are only written below READ_OUTPUT_DIR. Only
+ * FPGA buses with a known sideband bus (see fpgaSidebandBus()) are
+ * accepted.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <systemd/sd-bus.h>
+#include <systemd/sd-event.h>
+
+#include "updateRetimerFwOverI2C.h"
+#include "updateRetimerFw_dbus_log_event.h"
+#include "updateRetimerFw_fpgaop.h"
+#include "updateRetimerFw_job.h"
+#include "updateRetimerFw_journal.h"
+#include "updateRetimerFw_lease.h"
+#include "updateRetimerFw_progress.h"
+#include "updateRetimerFw_trace.h"
+
+#define UPDATE_OBJ_PATH "/com/Nvidia/RetimerUpdate"
+#define UPDATE_INTERFACE "com.Nvidia.RetimerUpdate"
+#define UPDATE_JOB_PATH UPDATE_OBJ_PATH "/Job"
+#define ACTIVATION_PROGRESS_INTERFACE \
+	"xyz.openbmc_project.Software.ActivationProgress"
+#define PROGRESS_INTERFACE "com.Nvidia.RetimerUpdate.Progress"
+#define DBUS_ERR "org.openbmc.error"
+// Set to a file name to record the I2C transactions of all jobs
+#define I2C_TRACE_ENV "RETIMER_I2C_TRACE"
+// Set to override the RETIMER_COUNT retimers of the platform
+#define RETIMER_COUNT_ENV "RETIMER_COUNT"
+// finished jobs kept for GetJob
+#define MAX_FINISHED_JOBS 64
+// StartRead takes a file name in this directory
+#define READ_OUTPUT_DIR DPRAM_STAMP_DIR "/read"
+
+typedef enum {
+	JOB_UPDATE,
+	JOB_READ,
+} JobKind;
+
+typedef enum {
+	JOB_QUEUED,
+	JOB_RUNNING,
+	JOB_SUCCEEDED,
+	JOB_FAILED,
+	JOB_CANCELLED,
+} JobState;
+
+static const char *const jobStateNames[] = { "Queued", "Running", "Succeeded",
+					     "Failed", "Cancelled" };
+
+typedef struct job {
+	uint32_t id;
+	JobKind kind;
+	JobState state;
+	int result;
+	bool signalled; // JobFinished was emitted
+	unsigned int bus;
+	RetimerBitmap bitmap; // retimers to update, or the retimer to read
+	char path[MAX_NAME_SIZE]; // firmware file, or read output file name
+	char version[MAX_NAME_SIZE];
+	UpdateProgress *progress; // update jobs only
+	bool progressChanged; // properties not emitted yet
+	sd_bus_slot *slots[2]; // D-Bus interfaces of the update job
+	FpgaOp *op; // trigger and polls the worker handed to the main loop
+	bool opStarted; // op is driven by timers of the main loop
+	bool cancelling; // CancelJob of the running job
+	struct job *next;
+} Job;
+
+static sd_bus *busHandle = NULL;
+static sd_event *eventHandle = NULL;
+static int notifyFd = -1;
+static int readDirFd = -1;
+
+static pthread_mutex_t jobLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jobCond = PTHREAD_COND_INITIALIZER;
+// signalled when the main loop is done with the FpgaOp of a job
+static pthread_cond_t opCond = PTHREAD_COND_INITIALIZER;
+// all known jobs, oldest first
+static Job *jobs = NULL;
+static uint32_t nextJobId = 1;
+
+static Job *findJob(uint32_t id)
+{
+	for (Job *j = jobs; j; j = j->next) {
+		if (j->id == id) {
+			return j;
+		}
+	}
+	return NULL;
+}
+
+static int property_get_progress(__attribute__((unused)) sd_bus *bus,
+				 __attribute__((unused)) const char *path,
+				 __attribute__((unused)) const char *interface,
+				 const char *property, sd_bus_message *reply,
+				 void *userdata,
+				 __attribute__((unused)) sd_bus_error *error)
+{
+	Job *job = userdata;
+	UpdateProgressState state;
+	int ret;
+
+	getUpdateProgressState(job->progress, &state);
+	if (!strcmp(property, "Progress")) {
+		return sd_bus_message_append(reply, "y", state.percent);
+	}
+	if (!strcmp(property, "Phase")) {
+		return sd_bus_message_append(reply, "s",
+					     updatePhaseNames[state.phase]);
+	}
+	if (!strcmp(property, "BytesTransferred")) {
+		return sd_bus_message_append(reply, "t",
+					     (uint64_t)state.bytesDone);
+	}
+	if (!strcmp(property, "BytesTotal")) {
+		return sd_bus_message_append(reply, "t",
+					     (uint64_t)state.bytesTotal);
+	}
+	if (!strcmp(property, "RemainingSeconds")) {
+		return sd_bus_message_append(
+			reply, "t",
+			(state.etaUs + DELAY_1SEC - 1) / DELAY_1SEC);
+	}
+	// Retimers, status of every retimer by index
+	ret = sd_bus_message_open_container(reply, 'a', "s");
+	for (unsigned int index = 0; ret >= 0 && index < getRetimerCount();
+	     index++) {
+		ret = sd_bus_message_append(
+			reply, "s", retimerProgressNames[state.retimer[index]]);
+	}
+	if (ret < 0) {
+		return ret;
+	}
+	return sd_bus_message_close_container(reply);
+}
+
+static const sd_bus_vtable activationProgressVtable[] = {
+	SD_BUS_VTABLE_START(0),
+	SD_BUS_PROPERTY("Progress", "y", property_get_progress, 0,
+			SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+	SD_BUS_VTABLE_END
+};
+
+static const sd_bus_vtable progressVtable[] = {
+	SD_BUS_VTABLE_START(0),
+	SD_BUS_PROPERTY("Phase", "s", property_get_progress, 0,
+			SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+	SD_BUS_PROPERTY("Retimers", "as", property_get_progress, 0,
+			SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+	SD_BUS_PROPERTY("BytesTransferred", "t", property_get_progress, 0,
+			SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+	SD_BUS_PROPERTY("BytesTotal", "t", property_get_progress, 0, 0),
+	SD_BUS_PROPERTY("RemainingSeconds", "t", property_get_progress, 0,
+			SD_BUS_VTABLE_PROPERTY_EMITS_CHANGE),
+	SD_BUS_VTABLE_END
+};
+
+/**************************************************************
+ * onJobProgress()
+ *
+ * Worker side of a progress change, already rate limited by the
+ * progress, the main loop emits the properties
+ *****************************************************************/
+static void onJobProgress(__attribute__((unused)) UpdateProgress *progress,
+			  void *userdata)
+{
+	Job *job = userdata;
+	uint64_t one = 1;
+
+	pthread_mutex_lock(&jobLock);
+	job->progressChanged = true;
+	pthread_mutex_unlock(&jobLock);
+	if (write(notifyFd, &one, sizeof(one)) != sizeof(one)) {
+		fprintf(stderr, "job %u progress not signalled\n", job->id);
+	}
+}
+
+/**************************************************************
+ * exportJob()
+ *
+ * Give an update job its progress and D-Bus object. The job still
+ * runs without them if either fails.
+ *****************************************************************/
+static void exportJob(Job *job)
+{
+	char path[MAX_NAME_SIZE];
+	int ret;
+
+	job->progress = malloc(sizeof(*job->progress));
+	if (!job->progress) {
+		return;
+	}
+	initUpdateProgress(job->progress, onJobProgress, job);
+	snprintf(path, sizeof(path), "%s%u", UPDATE_JOB_PATH, job->id);
+	ret = sd_bus_add_object_vtable(busHandle, &job->slots[0], path,
+				       ACTIVATION_PROGRESS_INTERFACE,
+				       activationProgressVtable, job);
+	if (ret >= 0) {
+		ret = sd_bus_add_object_vtable(busHandle, &job->slots[1], path,
+					       PROGRESS_INTERFACE,
+					       progressVtable, job);
+	}
+	if (ret < 0) {
+		fprintf(stderr, "job %u progress not exported: %s\n", job->id,
+			strerror(-ret));
+		job->slots[0] = sd_bus_slot_unref(job->slots[0]);
+		return;
+	}
+	sd_bus_emit_object_added(busHandle, path);
+}
+
+static void freeJob(Job *job)
+{
+	char path[MAX_NAME_SIZE];
+
+	if (job->slots[1]) {
+		snprintf(path, sizeof(path), "%s%u", UPDATE_JOB_PATH,
+			 job->id);
+		sd_bus_emit_object_removed(busHandle, path);
+	}
+	sd_bus_slot_unref(job->slots[0]);
+	sd_bus_slot_unref(job->slots[1]);
+	if (job->progress) {
+		destroyUpdateProgress(job->progress);
+		free(job->progress);
+	}
+	free(job);
+}
+
+/**************************************************************
+ * queueJob()
+ *
+ * Queue a job, or merge it into a queued job of the same kind on
+ * the same bus: updates from the same file and version OR their
+ * retimers together, identical reads are done once.
+ *
+ * RETURN: id of the job that serves the request
+ *****************************************************************/
+static uint32_t queueJob(const Job *req)
+{
+	Job **tail = &jobs;
+	Job *job;
+	uint32_t id;
+	int finished = 0;
+
+	pthread_mutex_lock(&jobLock);
+	for (job = jobs; job; job = job->next) {
+		if (job->state != JOB_QUEUED || job->kind != req->kind ||
+		    job->bus != req->bus || strcmp(job->path, req->path)) {
+			continue;
+		}
+		if (job->kind == JOB_UPDATE &&
+		    !strcmp(job->version, req->version)) {
+			job->bitmap |= req->bitmap;
+			break;
+		}
+		if (job->kind == JOB_READ && job->bitmap == req->bitmap) {
+			break;
+		}
+	}
+	if (job) {
+		id = job->id;
+		pthread_mutex_unlock(&jobLock);
+		fprintf(stdout, "request merged into job %u\n", id);
+		return id;
+	}
+
+	// forget the oldest finished jobs, GetJob only serves recent ones
+	for (job = jobs; job; job = job->next) {
+		finished += job->state > JOB_RUNNING && job->signalled;
+	}
+	while (*tail) {
+		job = *tail;
+		if (finished >= MAX_FINISHED_JOBS && job->state > JOB_RUNNING &&
+		    job->signalled) {
+			*tail = job->next;
+			freeJob(job);
+			finished--;
+			continue;
+		}
+		tail = &job->next;
+	}
+
+	job = malloc(sizeof(*job));
+	if (!job) {
+		pthread_mutex_unlock(&jobLock);
+		return 0;
+	}
+	*job = *req;
+	job->id = id = nextJobId++;
+	job->state = JOB_QUEUED;
+	job->result = 0;
+	job->signalled = false;
+	job->next = NULL;
+	if (job->kind == JOB_UPDATE) {
+		exportJob(job);
+	}
+	*tail = job;
+	pthread_cond_signal(&jobCond);
+	pthread_mutex_unlock(&jobLock);
+	fprintf(stdout, "job %u queued\n", id);
+	return id;
+}
+
+static int runUpdateJob(int fd, const Job *job)
+{
+	RetimerUpdateOptions options = { 0 };
+	char journalPath[MAX_NAME_SIZE];
+	DpramLease lease = { .fd = -1 };
+	update_operation *ops = NULL;
+	const RetimerImage *c;
+	int ret;
+
+	updateJournalPath(journalPath, sizeof(journalPath), RETIMER_JOURNAL_FILE,
+			  job->bus, FPGA_I2C_CNTRL_ADDR, 0);
+	options.journalPath = journalPath;
+
+	// only the worker thread loads images
+	c = getRetimerImage(job->path, job->version, &ret);
+	if (!c) {
+		prepareMessageRegistry(
+			job->bitmap, "VerificationFailed", (char *)job->version,
+			MSG_REG_VER_FOLLOWED_BY_DEV,
+			"xyz.openbmc_project.Logging.Entry.Level.Critical",
+			NULL, 0);
+		return ret;
+	}
+	// targets are filtered and merged in place, the cache keeps the original
+	ops = malloc((c->opsCount ? c->opsCount : 1) * sizeof(*ops));
+	if (!ops) {
+		return -ERROR_MALLOC_FAILURE;
+	}
+	memcpy(ops, c->ops, c->opsCount * sizeof(*ops));
+
+	ret = acquireFpgaLease(&lease, job->bus, FPGA_I2C_CNTRL_ADDR,
+			       DPRAM_LEASE_HIGH, DPRAM_LEASE_UPDATE_TIMEOUT_MS,
+			       "dbus-service-retimer-update");
+	// the FPGA status is only stable while the lease is held
+	if (!ret) {
+		ret = preflightRetimerUpdate(fd, FPGA_I2C_CNTRL_ADDR);
+	}
+	if (ret) {
+		releaseDpramLease(&lease);
+		prepareMessageRegistry(
+			job->bitmap, "TransferFailed", (char *)job->version,
+			MSG_REG_VER_FOLLOWED_BY_DEV,
+			"xyz.openbmc_project.Logging.Entry.Level.Critical",
+			NULL, 0);
+		free(ops);
+		return ret;
+	}
+	ret = runRetimerUpdate(fd, c->image, c->size, ops, c->opsCount,
+			       job->bitmap, &options);
+	releaseDpramLease(&lease);
+	free(ops);
+	return ret;
+}
+
+static int runReadJob(int fd, const Job *job)
+{
+	DpramLease lease = { .fd = -1 };
+	int outFd;
+	int ret;
+
+	// never follow a link planted in the output directory
+	outFd = openat(readDirFd, job->path,
+		       O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC,
+		       0640);
+	if (outFd < 0) {
+		fprintf(stderr, "Error creating file: %s\n", strerror(errno));
+		return -ERROR_OPEN_FIRMWARE;
+	}
+	// a read yields to updates waiting for the DPRAM
+	ret = acquireFpgaLease(&lease, job->bus, FPGA_I2C_CNTRL_ADDR,
+			       DPRAM_LEASE_LOW, DPRAM_LEASE_HASH_TIMEOUT_MS,
+			       "dbus-service-retimer-update");
+	if (!ret) {
+		ret = runRetimerRead(fd, job->bitmap, outFd);
+	}
+	releaseDpramLease(&lease);
+	close(outFd);
+	return ret;
+}
+
+// give the FpgaOp of job back to the worker, call with jobLock held
+static void finishJobFpgaOp(Job *job)
+{
+	job->op = NULL;
+	job->opStarted = false;
+	pthread_cond_broadcast(&opCond);
+}
+
+static void onJobFpgaOpDone(__attribute__((unused)) FpgaOp *op,
+			    void *userdata)
+{
+	pthread_mutex_lock(&jobLock);
+	finishJobFpgaOp(userdata);
+	pthread_mutex_unlock(&jobLock);
+}
+
+/**************************************************************
+ * startJobFpgaOp()
+ *
+ * Main loop side of runJobFpgaOp(), drive the FpgaOp of job from
+ * timers of the main loop. Call with jobLock held.
+ *****************************************************************/
+static void startJobFpgaOp(Job *job)
+{
+	int ret;
+
+	// status decode reads the regtbl of the baseboard of the job
+	setFpgaSidebandBus(fpgaSidebandBus(job->bus));
+	job->opStarted = true;
+	ret = startFpgaOp(eventHandle, job->op, onJobFpgaOpDone, job);
+	if (ret < 0) {
+		fprintf(stderr, "job %u FPGA operation not started: %s\n",
+			job->id, strerror(-ret));
+		cancelFpgaOp(job->op);
+		job->op->result = ret;
+		finishJobFpgaOp(job);
+	}
+}
+
+/**************************************************************
+ * runJobFpgaOp()
+ *
+ * Runner of the worker (see setFpgaOpRunner()), hand op to the
+ * main loop and wait until it is finished or cancelled
+ *
+ * RETURN: result of op, -ECANCELED once the job is cancelled
+ *****************************************************************/
+static int runJobFpgaOp(FpgaOp *op, void *userdata)
+{
+	Job *job = userdata;
+	uint64_t one = 1;
+
+	pthread_mutex_lock(&jobLock);
+	if (job->cancelling) {
+		pthread_mutex_unlock(&jobLock);
+		return -ECANCELED;
+	}
+	job->op = op;
+	pthread_mutex_unlock(&jobLock);
+	if (write(notifyFd, &one, sizeof(one)) != sizeof(one)) {
+		fprintf(stderr, "job %u FPGA operation not signalled\n",
+			job->id);
+	}
+	pthread_mutex_lock(&jobLock);
+	while (job->op) {
+		pthread_cond_wait(&opCond, &jobLock);
+	}
+	pthread_mutex_unlock(&jobLock);
+	return op->result;
+}
+
+static void *jobWorker(__attribute__((unused)) void *arg)
+{
+	uint64_t one = 1;
+
+	for (;;) {
+		Job *job = NULL;
+		Job snapshot;
+		int fd;
+		int ret;
+
+		pthread_mutex_lock(&jobLock);
+		while (!job) {
+			for (job = jobs; job && job->state != JOB_QUEUED;
+			     job = job->next)
+				;
+			if (!job) {
+				pthread_cond_wait(&jobCond, &jobLock);
+			}
+		}
+		// no more merging once the job runs
+		job->state = JOB_RUNNING;
+		snapshot = *job;
+		pthread_mutex_unlock(&jobLock);
+
+		fprintf(stdout, "job %u running, bus %u retimers %#x\n",
+			snapshot.id, snapshot.bus, snapshot.bitmap);
+		// CPLD and regtbl checks must reach the baseboard of the job
+		setFpgaSidebandBus(fpgaSidebandBus(snapshot.bus));
+		// pooled descriptor, stays open across jobs
+		fd = openI2CBus(snapshot.bus);
+		// waits on the FPGA happen in the main loop, see runJobFpgaOp()
+		setFpgaOpRunner(runJobFpgaOp, job);
+		if (fd < 0) {
+			ret = -ERROR_OPEN_I2C_DEVICE;
+		} else if (snapshot.kind == JOB_UPDATE) {
+			// the job outlives the run, only finished jobs are freed
+			setUpdateProgress(snapshot.progress);
+			ret = runUpdateJob(fd, &snapshot);
+			setUpdateProgress(NULL);
+		} else {
+			ret = runReadJob(fd, &snapshot);
+		}
+		setFpgaOpRunner(NULL, NULL);
+		fprintf(stdout, "job %u finished: %d\n", snapshot.id, ret);
+		// deleted firmware files are not kept in memory by the cache
+		pruneRetimerImages();
+		if (snapshot.progress) {
+			UpdateProgressState state;
+
+			// failures before the update run still end the progress
+			getUpdateProgressState(snapshot.progress, &state);
+			if (state.phase < UPDATE_PHASE_COMPLETE) {
+				setUpdateProgress(snapshot.progress);
+				progressFinished(ret);
+				setUpdateProgress(NULL);
+			}
+		}
+
+		pthread_mutex_lock(&jobLock);
+		if (job->cancelling) {
+			job->result = -ECANCELED;
+			job->state = JOB_CANCELLED;
+		} else {
+			job->result = ret;
+			job->state = ret ? JOB_FAILED : JOB_SUCCEEDED;
+		}
+		pthread_mutex_unlock(&jobLock);
+		if (write(notifyFd, &one, sizeof(one)) != sizeof(one)) {
+			fprintf(stderr, "job %u completion not signalled\n",
+				snapshot.id);
+		}
+	}
+	return NULL;
+}
+
+/**************************************************************
+ * onJobsFinished()
+ *
+ * Main loop side of the worker notification, start the FpgaOp a
+ * worker handed over, emit the changed progress properties and
+ * JobFinished for every job that finished since the last call.
+ *****************************************************************/
+static int onJobsFinished(__attribute__((unused)) sd_event_source *s, int fd,
+			  __attribute__((unused)) uint32_t revents,
+			  __attribute__((unused)) void *userdata)
+{
+	uint64_t count;
+
+	if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+		fprintf(stderr, "Failed to read job notification: %s\n",
+			strerror(errno));
+	}
+	pthread_mutex_lock(&jobLock);
+	for (Job *job = jobs; job; job = job->next) {
+		char path[MAX_NAME_SIZE];
+
+		if (job->op && !job->opStarted) {
+			startJobFpgaOp(job);
+		}
+		if (job->progressChanged && job->slots[1]) {
+			job->progressChanged = false;
+			snprintf(path, sizeof(path), "%s%u", UPDATE_JOB_PATH,
+				 job->id);
+			sd_bus_emit_properties_changed(
+				busHandle, path, ACTIVATION_PROGRESS_INTERFACE,
+				"Progress", NULL);
+			sd_bus_emit_properties_changed(
+				busHandle, path, PROGRESS_INTERFACE, "Phase",
+				"Retimers", "BytesTransferred",
+				"RemainingSeconds", NULL);
+		}
+		if (job->state <= JOB_RUNNING || job->signalled) {
+			continue;
+		}
+		job->signalled = true;
+		sd_bus_emit_signal(busHandle, UPDATE_OBJ_PATH, UPDATE_INTERFACE,
+				   "JobFinished", "ui", job->id, job->result);
+	}
+	pthread_mutex_unlock(&jobLock);
+	return 0;
+}
+
+/* D-Bus method implementations */
+static int method_startUpdate(sd_bus_message *m,
+			      __attribute__((unused)) void *userdata,
+			      sd_bus_error *ret_error)
+{
+	Job req = { .kind = JOB_UPDATE };
+	const char *path = NULL;
+	const char *version = NULL;
+	uint16_t bus = 0;
+	uint32_t id;
+	int ret;
+
+	ret = sd_bus_message_read(m, "qsus", &bus, &path, &req.bitmap,
+				  &version);
+	if (ret < 0) {
+		return ret;
+	}
+	// preflight and error checks need the sideband bus of the FPGA
+	if (bus >= MAX_I2C_BUS_NUM || fpgaSidebandBus(bus) < 0 ||
+	    !req.bitmap || (req.bitmap & ~retimerAllMask()) || !*path ||
+	    strlen(path) >= sizeof(req.path) ||
+	    strlen(version) >= sizeof(req.version)) {
+		return sd_bus_error_set_const(
+			ret_error, DBUS_ERR,
+			"xyz.openbmc_project.Common.Error.InvalidArgument");
+	}
+	req.bus = bus;
+	strcpy(req.path, path);
+	strcpy(req.version, *version ? version : DEFAULT_VERSION);
+
+	id = queueJob(&req);
+	if (!id) {
+		return -ENOMEM;
+	}
+	return sd_bus_reply_method_return(m, "u", id);
+}
+
+static int method_startRead(sd_bus_message *m,
+			    __attribute__((unused)) void *userdata,
+			    sd_bus_error *ret_error)
+{
+	Job req = { .kind = JOB_READ };
+	const char *path = NULL;
+	uint16_t bus = 0;
+	uint8_t retimer = 0;
+	uint32_t id;
+	int ret;
+
+	ret = sd_bus_message_read(m, "qys", &bus, &retimer, &path);
+	if (ret < 0) {
+		return ret;
+	}
+	// a plain file name below READ_OUTPUT_DIR
+	if (bus >= MAX_I2C_BUS_NUM || fpgaSidebandBus(bus) < 0 ||
+	    retimer >= getRetimerCount() || !*path || strlen(path) >= sizeof(req.path) || strchr(path, '/') ||
+	    !strcmp(path, ".") || !strcmp(path, "..")) {
+		return sd_bus_error_set_const(
+			ret_error, DBUS_ERR,
+			"xyz.openbmc_project.Common.Error.InvalidArgument");
+	}
+	req.bus = bus;
+	req.bitmap = retimer;
+	strcpy(req.path, path);
+
+	id = queueJob(&req);
+	if (!id) {
+		return -ENOMEM;
+	}
+	return sd_bus_reply_method_return(m, "u", id);
+}
+
+static int method_getJob(sd_bus_message *m,
+			 __attribute__((unused)) void *userdata,
+			 sd_bus_error *ret_error)
+{
+	const char *state;
+	uint32_t id = 0;
+	int result;
+	Job *job;
+	int ret;
+
+	ret = sd_bus_message_read(m, "u", &id);
+	if (ret < 0) {
+		return ret;
+	}
+	pthread_mutex_lock(&jobLock);
+	job = findJob(id);
+	if (job) {
+		state = jobStateNames[job->state];
+		result = job->result;
+	}
+	pthread_mutex_unlock(&jobLock);
+	if (!job) {
+		return sd_bus_error_set_const(
+			ret_error, DBUS_ERR,
+			"xyz.openbmc_project.Common.Error.ResourceNotFound");
+	}
+	return sd_bus_reply_method_return(m, "si", state, result);
+}
+
+static int method_cancelJob(sd_bus_message *m,
+			    __attribute__((unused)) void *userdata,
+			    sd_bus_error *ret_error)
+{
+	uint32_t id = 0;
+	bool cancelled = false;
+	Job *job;
+	int ret;
+
+	ret = sd_bus_message_read(m, "u", &id);
+	if (ret < 0) {
+		return ret;
+	}
+	pthread_mutex_lock(&jobLock);
+	job = findJob(id);
+	if (job && job->state == JOB_QUEUED) {
+		job->state = JOB_CANCELLED;
+		job->result = -ECANCELED;
+		cancelled = true;
+	} else if (job && job->state == JOB_RUNNING) {
+		// stop the trigger or poll in flight, the worker finishes
+		// the job without triggering again. A running upload is
+		// not interrupted.
+		job->cancelling = true;
+		if (job->op) {
+			cancelFpgaOp(job->op);
+			finishJobFpgaOp(job);
+		}
+		cancelled = true;
+	}
+	pthread_mutex_unlock(&jobLock);
+	if (!cancelled) {
+		return sd_bus_error_set_const(
+			ret_error, DBUS_ERR,
+			"xyz.openbmc_project.Common.Error.Unavailable");
+	}
+	onJobsFinished(NULL, notifyFd, 0, NULL);
+	return sd_bus_reply_method_return(m, NULL);
+}
+
+static const sd_bus_vtable updateVtable[] = {
+	SD_BUS_VTABLE_START(0),
+	// flashing and reading retimers is limited to privileged callers
+	SD_BUS_METHOD("StartUpdate", "qsus", "u", method_startUpdate, 0),
+	SD_BUS_METHOD("StartRead", "qys", "u", method_startRead, 0),
+	SD_BUS_METHOD("GetJob", "u", "si", method_getJob,
+		      SD_BUS_VTABLE_UNPRIVILEGED),
+	SD_BUS_METHOD("CancelJob", "u", NULL, method_cancelJob, 0),
+	SD_BUS_SIGNAL("JobFinished", "ui", 0),
+	SD_BUS_VTABLE_END
+};
+
+int main()
+{
+	sd_event *event = NULL;
+	pthread_t worker;
+	int ret;
+
+	/* set stdout to line-buffered so it interleaves correctly with stderr */
+	setvbuf(stdout, NULL, _IOLBF, 0);
+
+	/* Optionally size the service for a denser baseboard */
+	const char *retimerCountEnv = getenv(RETIMER_COUNT_ENV);
+	if (retimerCountEnv && *retimerCountEnv &&
+	    setRetimerCount(strtoul(retimerCountEnv, NULL, 0))) {
+		fprintf(stderr, "Invalid " RETIMER_COUNT_ENV "=%s\n",
+			retimerCountEnv);
+		return EXIT_FAILURE;
+	}
+	fprintf(stdout, "%u retimers per FPGA\n", getRetimerCount());
+
+	/* Optionally record all I2C transactions, the trace lives as long as the service */
+	const char *traceFile = getenv(I2C_TRACE_ENV);
+	if (traceFile && *traceFile) {
+		I2CTrace *trace = i2cTraceRecord(traceFile, NULL);
+		if (trace) {
+			setI2CTransport(i2cTraceTransport(trace));
+		}
+	}
+
+	if ((mkdir(DPRAM_STAMP_DIR, 0755) && errno != EEXIST) ||
+	    (mkdir(READ_OUTPUT_DIR, 0750) && errno != EEXIST)) {
+		fprintf(stderr, "Failed to create %s: %s\n", READ_OUTPUT_DIR,
+			strerror(errno));
+		return EXIT_FAILURE;
+	}
+	readDirFd = open(READ_OUTPUT_DIR,
+			 O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+	if (readDirFd < 0) {
+		fprintf(stderr, "Failed to open %s: %s\n", READ_OUTPUT_DIR,
+			strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	notifyFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (notifyFd < 0) {
+		fprintf(stderr, "Failed to create eventfd: %s\n",
+			strerror(errno));
+		return EXIT_FAILURE;
+	}
+
+	ret = sd_event_default(&event);
+	if (ret < 0) {
+		fprintf(stderr, "Failed to create event loop: %s\n",
+			strerror(-ret));
+		return EXIT_FAILURE;
+	}
+	eventHandle = event;
+
+	/* Connect to the system bus */
+	ret = sd_bus_open_system(&busHandle);
+	if (ret < 0) {
+		fprintf(stderr, "Failed to connect to system bus: %s\n",
+			strerror(-ret));
+		return EXIT_FAILURE;
+	}
+
+	ret = sd_bus_add_object_vtable(busHandle, NULL, UPDATE_OBJ_PATH,
+				       UPDATE_INTERFACE, updateVtable, NULL);
+	if (ret >= 0) {
+		// job objects below UPDATE_OBJ_PATH come and go
+		ret = sd_bus_add_object_manager(busHandle, NULL,
+						UPDATE_OBJ_PATH);
+	}
+	if (ret < 0) {
+		fprintf(stderr, "Failed to register object: %s\n",
+			strerror(-ret));
+		return EXIT_FAILURE;
+	}
+
+	/* Request a well-known name */
+	ret = sd_bus_request_name(busHandle, UPDATE_DBUS_SERVICE_NAME, 0);
+	if (ret < 0) {
+		fprintf(stderr, "Failed to request service name: %s\n",
+			strerror(-ret));
+		return EXIT_FAILURE;
+	}
+
+	ret = sd_bus_attach_event(busHandle, event, SD_EVENT_PRIORITY_NORMAL);
+	if (ret >= 0) {
+		ret = sd_event_add_io(event, NULL, notifyFd, EPOLLIN,
+				      onJobsFinished, NULL);
+	}
+	if (ret < 0) {
+		fprintf(stderr, "Failed to set up event loop: %s\n",
+			strerror(-ret));
+		return EXIT_FAILURE;
+	}
+
+	// log events of the worker go out on its own sd-bus connection
+	ret = pthread_create(&worker, NULL, jobWorker, NULL);
+	if (ret) {
+		fprintf(stderr, "Failed to start job worker: %s\n",
+			strerror(ret));
+		return EXIT_FAILURE;
+	}
+
+	/* Run the bus loop */
+	ret = sd_event_loop(event);
+	fprintf(stderr, "Event loop exited: %s\n", strerror(-ret));
+	sd_bus_unref(busHandle);
+	sd_event_unref(event);
+	return EXIT_FAILURE;
+}
@@ -29,15 +29,19 @@
 #include <sys/stat.h>
 
 #include "updateRetimerFwOverI2C.h"
+#include "updateRetimerFw_trace.h"
+#include "updateRetimerFw_lease.h"
 
 // SHA384 Hash compute
-#define BLOCK_SIZE (64 * 1024) // 64 KB block size
 #define HASH_LENGTH 48
 
 #define RETIMER_PATH "/com/Nvidia/ComputeHash/HGX_FW_PCIeRetimer_"
-#define MAX_RETIMERS 8
 #define DBUS_ERR "org.openbmc.error"
 #define INIT_INT -1
+// Set to a file name to record the I2C transactions of hash runs
+#define I2C_TRACE_ENV "RETIMER_I2C_TRACE"
+// Set to override the RETIMER_COUNT retimers of the platform
+#define RETIMER_COUNT_ENV "RETIMER_COUNT"
 
 sd_bus *busHandle = NULL;
 
@@ -48,20 +52,31 @@ typedef struct hash_compute {
 
 const char hashingAlgorithm[64] = "SHA384";
 
-hash_t g_retimerHash[MAX_RETIMERS];
+hash_t g_retimerHash[RETIMER_MAX_NUM];
+
+static int hashPageSink(void *ctx, __attribute__((unused)) size_t offset,
+			const unsigned char *data, size_t len)
+{
+	if (!EVP_DigestUpdate((EVP_MD_CTX *)ctx, data, len)) {
+		fprintf(stderr, "Failed to update SHA384 context\n");
+		return EXIT_FAILURE;
+	}
+	return 0;
+}
 
 int readFWImagenComputeHash(unsigned retimerId)
 {
-	int dummyfd = INIT_INT;
-	char i2c_device[MAX_NAME_SIZE] = { 0 };
 	int fd = INIT_INT;
 	int ret = INIT_INT;
 	int bus = FPGA_I2C_BUS;
-	char hashValue[HASH_LENGTH * 2] = { 0 };
-
-	sprintf(i2c_device, "/dev/i2c-%u", bus);
+	char hashValue[HASH_LENGTH * 2 + 1] = { 0 };
+	DpramLease lease = { .fd = -1 };
+	EVP_MD_CTX *ctx = NULL;
+	unsigned char hash[HASH_LENGTH];
+	unsigned int hash_len = HASH_LENGTH;
 
-	fd = open(i2c_device, O_RDWR | O_NONBLOCK);
+	// pooled descriptor, stays open across hash requests
+	fd = openI2CBus(bus);
 
 	if (fd < 0) {
 		fprintf(stderr, "Error opening i2c file: %s\n",
@@ -70,37 +85,33 @@ int readFWImagenComputeHash(unsigned retimerId)
 		goto exit;
 	}
 
-	// Check if directory does not exists
-	if (access("/tmp/hash", F_OK) == -1) {
-		// Create the directory
-		if (mkdir("/tmp/hash", 0700) == -1) {
-			fprintf(stderr, "Error creating file: %s\n",
-				strerror(errno));
-			ret = EXIT_FAILURE;
-			goto exit;
-		}
+	// wait for a running update instead of corrupting its DPRAM
+	ret = acquireDpramLease(&lease, DPRAM_LEASE_LOW,
+				DPRAM_LEASE_HASH_TIMEOUT_MS,
+				"dbus-service-retimer");
+	if (ret) {
+		ret = EXIT_FAILURE;
+		goto exit;
 	}
 
-	dummyfd = open("/tmp/hash/RetimerFW.dat", O_RDWR | O_CREAT, 0644);
-
-	if (dummyfd < 0) {
-		fprintf(stderr, "Error creating file: %s\n", strerror(errno));
+	// Create and initialize the SHA384 context
+	ctx = EVP_MD_CTX_new();
+	if (ctx == NULL) {
+		fprintf(stderr, "Failed to create SHA384 context\n");
 		ret = EXIT_FAILURE;
 		goto exit;
 	}
-
-	if (ftruncate(dummyfd, MAX_FW_IMAGE_SIZE) < 0) {
-		fprintf(stderr, "ftruncate failed with  %s\n!!!",
-			strerror(errno));
+	if (!EVP_DigestInit_ex(ctx, EVP_sha384(), NULL)) {
+		fprintf(stderr, "Failed to initialize SHA384 context\n");
 		ret = EXIT_FAILURE;
 		goto exit;
 	}
 
-	// Create and Pass dummy blank FILE of 256KB to clear DPRAM before reading content from Retimer
-	ret = copyImageFromFileToFpga(dummyfd, fd, FPGA_I2C_CNTRL_ADDR);
+	// Clear DPRAM before reading content from Retimer
+	ret = clearFpgaDpram(fd, FPGA_I2C_CNTRL_ADDR);
 	if (ret) {
 		fprintf(stderr,
-			"FW read FW image copy to FPGA failed  error code%d!!!",
+			"FW read DPRAM clear failed error code%d!!!",
 			ret);
 		ret = EXIT_FAILURE;
 		goto exit;
@@ -114,14 +125,9 @@ int readFWImagenComputeHash(unsigned retimerId)
 		goto exit;
 	}
 
-	// Reset the file offset to the beginning of the file
-	if (lseek(dummyfd, 0, SEEK_SET) == -1) {
-		fprintf(stderr, "lseek failed %s\n!!!", strerror(errno));
-		ret = EXIT_FAILURE;
-		goto exit;
-	}
-
-	ret = copyImageFromFpga(dummyfd, fd, FPGA_I2C_CNTRL_ADDR);
+	// Hash every DPRAM page as it arrives, no local copy of the image
+	ret = readFpgaDpramPages(fd, FPGA_I2C_CNTRL_ADDR, 0, MAX_FW_IMAGE_SIZE,
+				 hashPageSink, ctx);
 	if (ret) {
 		fprintf(stderr,
 			"FW read FW image copy from FPGA failed  error code%d!!!",
@@ -129,56 +135,12 @@ int readFWImagenComputeHash(unsigned retimerId)
 		ret = EXIT_FAILURE;
 		goto exit;
 	}
-
-	unsigned char hash[HASH_LENGTH];
-	unsigned char block[BLOCK_SIZE];
-
-	// Reset the file offset to the beginning of the file
-	if (lseek(dummyfd, 0, SEEK_SET) == -1) {
-		fprintf(stderr, "lseek failed %s\n!!!", strerror(errno));
-		ret = EXIT_FAILURE;
-		goto exit;
-	}
-	// Create and initialize the SHA384 context
-	EVP_MD_CTX *ctx = EVP_MD_CTX_new();
-	if (ctx == NULL) {
-		fprintf(stderr, "Failed to create SHA384 context\n");
-		ret = EXIT_FAILURE;
-		goto exit;
-	}
-	if (!EVP_DigestInit_ex(ctx, EVP_sha384(), NULL)) {
-		fprintf(stderr, "Failed to initialize SHA384 context\n");
-		EVP_MD_CTX_free(ctx);
-		ret = EXIT_FAILURE;
-		goto exit;
-	}
-
-	// Read the file in blocks and update the SHA384 context
-	int bytes_read = 0;
-	while ((bytes_read = read(dummyfd, block, sizeof(block))) > 0) {
-		//EVP_DigestUpdate(ctx, buffer, bytes_read);
-		if (!EVP_DigestUpdate(ctx, block, bytes_read)) {
-			fprintf(stderr, "Failed to update SHA384 context\n");
-			EVP_MD_CTX_free(ctx);
-			ret = EXIT_FAILURE;
-			goto exit;
-		}
-	}
-
-	if (bytes_read == -1) {
-		// Handle error
-		fprintf(stderr,
-			"Read failed over RetimerFW.dat file error code %s \n",
-			strerror(errno));
-		ret = EXIT_FAILURE;
-		goto exit;
-	}
+	// DPRAM is no longer needed
+	releaseDpramLease(&lease);
 
 	// Finalize the SHA384 hash
-	unsigned int hash_len = HASH_LENGTH;
 	if (!EVP_DigestFinal_ex(ctx, hash, &hash_len)) {
 		fprintf(stderr, "Failed to finalize SHA384 hash\n");
-		EVP_MD_CTX_free(ctx);
 		ret = EXIT_FAILURE;
 		goto exit;
 	}
@@ -190,20 +152,10 @@ int readFWImagenComputeHash(unsigned retimerId)
 	strncpy(g_retimerHash[retimerId].hashDigest, hashValue,
 		sizeof(g_retimerHash[retimerId].hashDigest));
 
+exit:
+	releaseDpramLease(&lease);
 	// Free the SHA384 context
 	EVP_MD_CTX_free(ctx);
-
-exit:
-	// Close the file
-	if (dummyfd != -1) {
-		// Deleting RetimerFW.dat
-		if (unlink("/tmp/hash/RetimerFW.dat") == -1) {
-			fprintf(stderr, "unlink  failed error code!!!");
-			ret = EXIT_FAILURE;
-		}
-		close(dummyfd);
-	}
-	close(fd);
 	return ret;
 }
 
@@ -223,7 +175,7 @@ static int method_computeHash(sd_bus_message *m,
 		return EXIT_FAILURE;
 	}
 
-	if (retimerId >= MAX_RETIMERS) {
+	if (retimerId >= getRetimerCount()) {
 		fprintf(stderr, "Invalid retimer Id");
 		sd_bus_error_set_const(
 			ret_error, DBUS_ERR,
@@ -274,7 +226,8 @@ static int property_get_hashDigest(sd_bus *bus, const char *path,
 	assert(property);
 	unsigned retimerId = 0xFF;
 	if (!sscanf(path, "/com/Nvidia/ComputeHash/HGX_FW_PCIeRetimer_%u",
-		    &retimerId)) {
+		    &retimerId) ||
+	    retimerId >= getRetimerCount()) {
 		return EXIT_FAILURE;
 	}
 	return sd_bus_message_append(reply, "s",
@@ -300,6 +253,24 @@ int main()
 	/* set stdout to line-buffered so it interleaves correctly with stderr */
 	setvbuf(stdout, NULL, _IOLBF, 0);
 
+	/* Optionally size the service for a denser baseboard */
+	const char *retimerCountEnv = getenv(RETIMER_COUNT_ENV);
+	if (retimerCountEnv && *retimerCountEnv &&
+	    setRetimerCount(strtoul(retimerCountEnv, NULL, 0))) {
+		fprintf(stderr, "Invalid " RETIMER_COUNT_ENV "=%s\n",
+			retimerCountEnv);
+		return EXIT_FAILURE;
+	}
+
+	/* Optionally record all I2C transactions, the trace lives as long as the service */
+	const char *traceFile = getenv(I2C_TRACE_ENV);
+	if (traceFile && *traceFile) {
+		I2CTrace *trace = i2cTraceRecord(traceFile, NULL);
+		if (trace) {
+			setI2CTransport(i2cTraceTransport(trace));
+		}
+	}
+
 	/* Connect to the system bus */
 	int ret = sd_bus_open_system(&busHandle);
 	if (ret < 0) {
@@ -327,11 +298,11 @@ int main()
 		return EXIT_FAILURE;
 	}
 
-	/* Register 8 D-Bus objects, one for each value */
-	for (int i = 0; i < 8; i++) {
+	/* Register one D-Bus object per retimer of the platform */
+	for (unsigned int i = 0; i < getRetimerCount(); i++) {
 		/* Construct the object path */
 		char path[64];
-		snprintf(path, sizeof(path), "%s%d", RETIMER_PATH, i);
+		snprintf(path, sizeof(path), "%s%u", RETIMER_PATH, i);
 		/* Construct the interface name */
 		char interface[64];
 		snprintf(interface, sizeof(interface),
@@ -26,23 +26,32 @@
 #include <time.h>
 #include <fcntl.h> // for open
 #include <unistd.h> // for close
+#include <pthread.h>
 #include <systemd/sd-bus.h>
 #include "updateRetimerFwOverI2C.h"
-
-const uint8_t mask_retimer[] = { RETIMER0, RETIMER1, RETIMER2,
-				 RETIMER3, RETIMER4, RETIMER5,
-				 RETIMER6, RETIMER7, RETIMERALL };
+#include "updateRetimerFw_transport.h"
+#include "updateRetimerFw_poll.h"
+#include "updateRetimerFw_fpgaop.h"
+#include "updateRetimerFw_progress.h"
 
 uint8_t verbosity = 0;
 
-char *arrRetimer[] = {
-	"HGX_FW_PCIeRetimer_0", "HGX_FW_PCIeRetimer_1", "HGX_FW_PCIeRetimer_2",
-	"HGX_FW_PCIeRetimer_3", "HGX_FW_PCIeRetimer_4", "HGX_FW_PCIeRetimer_5",
-	"HGX_FW_PCIeRetimer_6", "HGX_FW_PCIeRetimer_7",
+/*
+* Retimers behind the FPGA, set once at startup before any worker runs
+**/
+static unsigned int retimerCount = RETIMER_COUNT;
+
+FpgaTransferConfig fpgaTransferConfig = {
+	.batchMsgs = I2C_BATCH_MSGS,
+	.burstSize = FPGA_BURST_SIZE,
+	.probeBurst = false,
+	.deltaUpload = false,
+	.pageRetries = I2C_PAGE_RETRIES,
+	.retryBackoffUs = DELAY_1MS,
+	.skipReadClear = FPGA_REPORTS_READ_LENGTH,
+	.verifyUpload = false,
 };
 
-uint8_t retimerBitmap = INIT_UINT8;
-
 /*
 * Extended Error handling for Retimer FW update, ERR_PCIE_TIMEOUT_STOPPED_RT_EEPROM_UPDATE 
 * only applicable when Retimer FW update trigger over PCIe path
@@ -57,7 +66,32 @@ ErrorCodeMapTable table[] = {
 	{ 0x15, "ERR_PCIE_TIMEOUT_STOPPED_RT_EEPROM_UPDATE " }
 };
 
-volatile extendedErrorCode *dumpExtendedI2CReg = NULL;
+// per thread, workers of a multi-FPGA update check their own baseboard
+_Thread_local volatile extendedErrorCode *dumpExtendedI2CReg = NULL;
+static _Thread_local extendedErrorCode extendedErrorRegs;
+
+/*
+* FPGA controller the calling thread works with, see setFpgaCntrlAddr()
+**/
+static _Thread_local uint8_t fpgaCntrlAddr = FPGA_I2C_CNTRL_ADDR;
+
+/*
+* Bus of the CPLD and secondary regtbl the calling thread checks,
+* see setFpgaSidebandBus()
+**/
+static _Thread_local unsigned int fpgaSideband = HMC_I2CBUS_FPGA_SEC_REGTBL;
+
+/*
+* Bus descriptors stay open for the life of the process, indexed by bus number
+**/
+static int i2cBusFds[MAX_I2C_BUS_NUM];
+static bool i2cBusFdsInit = false;
+static pthread_mutex_t i2cBusLock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+* Directory of the DPRAM stamps and leases, see setDpramStampDir()
+**/
+static char dpramStampDir[MAX_NAME_SIZE] = DPRAM_STAMP_DIR;
 
 const uint8_t CompositeImageHeaderUuid[16] = { 0x8c, 0x28, 0xd7, 0x7a,
 					       0x97, 0x07, 0x43, 0xd7,
@@ -76,6 +110,62 @@ void debug_print(char *fmt, ...)
 	}
 }
 
+/**************************************************************
+ * setRetimerCount()
+ *
+ * Override the RETIMER_COUNT platform default. Bitmaps and names
+ * follow it.
+ *
+ * RETURN: 0 if success, -ERROR_INPUT_ARGUMENTS if count is not
+ *	   1-RETIMER_MAX_NUM
+ *****************************************************************/
+int setRetimerCount(unsigned int count)
+{
+	if (count < 1 || count > RETIMER_MAX_NUM) {
+		fprintf(stderr, "Retimer count %u not in 1-%u\n", count,
+			RETIMER_MAX_NUM);
+		return -ERROR_INPUT_ARGUMENTS;
+	}
+	retimerCount = count;
+	return 0;
+}
+
+unsigned int getRetimerCount(void)
+{
+	return retimerCount;
+}
+
+/**************************************************************
+ * retimerAllMask()
+ *
+ * RETURN: bitmap of every retimer of the platform
+ *****************************************************************/
+RetimerBitmap retimerAllMask(void)
+{
+	return RETIMER_BIT(retimerCount) - 1;
+}
+
+unsigned int countRetimers(RetimerBitmap bitmap)
+{
+	unsigned int n = 0;
+
+	for (; bitmap; bitmap &= bitmap - 1) {
+		n++;
+	}
+	return n;
+}
+
+/**************************************************************
+ * retimerName()
+ *
+ * Firmware inventory name of a retimer, used in message registry
+ * entries and D-Bus paths
+ *****************************************************************/
+void retimerName(unsigned int index, char *name, size_t len)
+{
+	snprintf(name, len, RETIMER_NAME_FMT, index);
+}
+
 /***********************************************************************
  * 
  * prepareMessageRegistry()
@@ -87,21 +177,24 @@ void debug_print(char *fmt, ...)
  *
  * RETURN: void 
  **********************************************************************/
-void prepareMessageRegistry(uint8_t retimer, char *message, char *versionStr,
-			    bool VerBeforeDevice, char *severity,
-			    char *resolution, bool genericMessage)
+void prepareMessageRegistry(RetimerBitmap retimer, char *message,
+			    char *versionStr, bool VerBeforeDevice,
+			    char *severity, char *resolution,
+			    bool genericMessage)
 {
+	char name[RETIMER_NAME_SIZE];
+
 	if (retimer) {
-		for (uint8_t index = 0; index < 8; index++) {
+		for (unsigned int index = 0; index < retimerCount; index++) {
 			if (retimer & 1) {
+				retimerName(index, name, sizeof(name));
 				if (VerBeforeDevice) {
 					emitLogMessage(message, versionStr,
-						       arrRetimer[index],
-						       severity, resolution,
+						       name, severity,
+						       resolution,
 						       genericMessage);
 				} else {
-					emitLogMessage(message,
-						       arrRetimer[index],
+					emitLogMessage(message, name,
 						       versionStr, severity,
 						       resolution,
 						       genericMessage);
@@ -208,6 +301,53 @@ unsigned int crc32(const unsigned char *buf, int length)
 	return crc;
 }
 
+/**************************************************************
+ * i2cTransfer()
+ *
+ * Single combined transfer on the active transport without any
+ * error reporting
+ *
+ * fd: file describe
+ * msgs: messages to transfer
+ * nmsgs: number of messages
+ * i2c_errno: outgoing, errno of the failed ioctl, 0 on success
+ *
+ * RETURN: 0 if success
+ *****************************************************************/
+static int i2cTransfer(int fd, struct i2c_msg *msgs, unsigned int nmsgs,
+		       int *i2c_errno)
+{
+	const I2CTransport *transport = getI2CTransport();
+	int ret = transport->transfer(transport->priv, fd, msgs, nmsgs);
+
+	if (ret < 0) {
+		*i2c_errno = -ret;
+		errno = -ret;
+		return -1;
+	}
+	*i2c_errno = 0;
+	return 0;
+}
+
+/**************************************************************
+ * reportI2CError()
+ *
+ * Log a failed I2C transfer and raise ResourceErrorsDetected
+ *****************************************************************/
+static void reportI2CError(int i2c_errno, unsigned char slaveId)
+{
+	char *message = NULL;
+	char *resolution = NULL;
+
+	fprintf(stderr, "ret:%d  error %s \n", -1, strerror(i2c_errno));
+	maperrnoToI2CError(i2c_errno, slaveId, &message, &resolution);
+	genericMessageRegistry(
+		"ResourceEvent.1.0.ResourceErrorsDetected",
+		"HGX_PCIeRetimer Update Service", message,
+		"xyz.openbmc_project.Logging.Entry.Level.Critical",
+		resolution);
+}
+
 /**************************************************************
  * send_i2c_cmd()
  *
@@ -226,14 +366,9 @@ int send_i2c_cmd(int fd, int isRead, unsigned char slaveId,
 		 unsigned char *write_data, unsigned char *read_data,
 		 unsigned int write_count, unsigned int read_count)
 {
-	struct i2c_rdwr_ioctl_data rdwr_msg;
 	struct i2c_msg msg[2];
-	int ret = -1;
-	int i2c_errno = 0;
-	char *message = NULL;
-	char *resolution = NULL;
+	unsigned int nmsgs = 0;
 
-	memset(&rdwr_msg, 0, sizeof(rdwr_msg));
 	memset(&msg, 0, sizeof(msg));
 
 	debug_print("%d %x %d \n", write_count, slaveId, slaveId);
@@ -254,8 +389,7 @@ int send_i2c_cmd(int fd, int isRead, unsigned char slaveId,
 		msg[1].len = read_count;
 		msg[1].buf = read_data;
 
-		rdwr_msg.msgs = msg;
-		rdwr_msg.nmsgs = 2;
+		nmsgs = 2;
 	} else {
 		//-	Write 3 bytes at DPram location 0x02_ABCD
 		// Start -> 0x62 (7bits) + w -> 0x02 -> 0xAB -> 0xCD -> wdata1 -> wdata2 -> wdata3-> Stop
@@ -272,19 +406,38 @@ int send_i2c_cmd(int fd, int isRead, unsigned char slaveId,
 		msg[0].len = write_count;
 		msg[0].buf = write_data;
 
-		rdwr_msg.msgs = msg;
-		rdwr_msg.nmsgs = 1;
+		nmsgs = 1;
 	}
-	if ((ret = ioctl(fd, I2C_RDWR, &rdwr_msg)) < 0) {
-		i2c_errno = errno;
-		fprintf(stderr, "ret:%d  error %s \n", ret,
-			strerror(i2c_errno));
-		maperrnoToI2CError(i2c_errno, slaveId, &message, &resolution);
-		genericMessageRegistry(
-			"ResourceEvent.1.0.ResourceErrorsDetected",
-			"HGX_PCIeRetimer Update Service", message,
-			"xyz.openbmc_project.Logging.Entry.Level.Critical",
-			resolution);
+
+	return send_i2c_batch(fd, slaveId, msg, nmsgs);
+}
+
+/**************************************************************
+ * send_i2c_batch()
+ *
+ * Issue a list of prepared I2C messages in one I2C_RDWR ioctl,
+ * messages are separated by repeated START on the bus.
+ *
+ * fd: file describe
+ * slaveId: slave address, used for error reporting
+ * msgs: messages to transfer
+ * nmsgs: number of messages, at most I2C_RDWR_IOCTL_MAX_MSGS
+ *
+ * RETURN: 0 if success
+ *****************************************************************/
+int send_i2c_batch(int fd, unsigned char slaveId, struct i2c_msg *msgs,
+		   unsigned int nmsgs)
+{
+	int i2c_errno = 0;
+
+	if (!msgs || nmsgs == 0 || nmsgs > I2C_RDWR_IOCTL_MAX_MSGS) {
+		fprintf(stderr, "In send_i2c_batch, invalid message count %u\n",
+			nmsgs);
+		return -1;
+	}
+
+	if (i2cTransfer(fd, msgs, nmsgs, &i2c_errno)) {
+		reportI2CError(i2c_errno, slaveId);
 		return -ERROR_IOCTL_I2C_RDWR_FAILURE;
 	}
 
@@ -292,162 +445,1180 @@ int send_i2c_cmd(int fd, int isRead, unsigned char slaveId,
 }
 
 /**************************************************************
- * maperrnoToI2CError()
+ * sendPagesWithRetry()
  *
- * this function is mapping generic I2C driver error reported in form of 
- * errno in specific I2C ERROR string to make it more readable to user
+ * Send a batch of DPRAM page transfers. If the batch fails with a
+ * transient error (see isTransientI2CError) each page is re-sent
+ * on its own with exponential backoff, pages are idempotent so the
+ * ones that already went through before the failure do no harm.
+ * Every re-send counts against fpgaTransferConfig.pageRetries.
  *
- * RETURN: string as per mapping or default strerror 
+ * fd: file describe
+ * slaveId: FPGA I2C controller slave id
+ * msgs: messages of the batch
+ * nmsgs: number of messages
+ * group: messages per page, 1 for writes and 2 for reads
+ *
+ * RETURN: 0 if success
  *****************************************************************/
-
-int maperrnoToI2CError(int errnoval, unsigned char slaveId, char **msg,
-		       char **resolution)
+static int sendPagesWithRetry(int fd, unsigned char slaveId,
+			      struct i2c_msg *msgs, unsigned int nmsgs,
+			      unsigned int group)
 {
-	static char buf[64];
-	static char res[256];
+	FpgaTransferCtx *ctx = getFpgaTransferCtx();
+	I2CRetryStats dummy = { 0 };
+	I2CRetryStats *stats = ctx ? &ctx->retryStats : &dummy;
+	int i2c_errno = 0;
 
-	switch (errnoval) {
-	case ENODEV:
-		sprintf(buf, "Slave not found, slave address 0x%x", slaveId);
-		*msg = buf;
-		sprintf(res,
-			"Reach out to the Nvidia support team for further action");
-		*resolution = res;
-		break;
-	case EAGAIN:
-		sprintf(buf,
-			"ARB_LOST:ASPEED_I2CD_INTR_ARBIT_LOSS, slave address 0x%x",
-			slaveId);
-		*msg = buf;
-		sprintf(res, "Retry the firmware update");
-		*resolution = res;
-		break;
-	case ETIMEDOUT:
-		sprintf(buf, "SCL Clock stretching too far, slave address 0x%x",
-			slaveId);
-		*msg = buf;
-		sprintf(res,
-			"Perform Power Cycle of HGX baseboard and retry the firmware update");
-		*resolution = res;
-		break;
-	case ENXIO:
-		sprintf(buf,
-			"Address phase NACK:ASPEED_I2CD_INTR_TX_NAK, slave address 0x%x",
-			slaveId);
-		*msg = buf;
-		sprintf(res,
-			"Perform Power Cycle of HGX baseboard and retry the firmware update");
-		*resolution = res;
-		break;
-	case EBUSY:
-		sprintf(buf, "BUS BUSY:SDA/SCL Timeout, slave address 0x%x",
-			slaveId);
-		*msg = buf;
-		sprintf(res,
-			"Perform Power Cycle of HGX baseboard and retry the firmware update");
-		*resolution = res;
-		break;
-	default:
-		sprintf(buf, "Error %s, slave address 0x%x", strerror(errnoval),
-			slaveId);
-		*msg = buf;
-		sprintf(res,
-			"Reach out to the Nvidia support team for further action");
-		*resolution = res;
-		break;
+	if (i2cTransfer(fd, msgs, nmsgs, &i2c_errno) == 0) {
+		return 0;
+	}
+
+	for (unsigned int page = 0;
+	     page < nmsgs && fpgaTransferConfig.pageRetries; page += group) {
+		unsigned int backoff = fpgaTransferConfig.retryBackoffUs;
+		unsigned int attempt = 0;
+
+		if (i2c_errno && !isTransientI2CError(i2c_errno)) {
+			break;
+		}
+		// pages of a failed multi-page batch are first re-sent at once,
+		// the error of a single page batch is already known
+		if (nmsgs > group) {
+			stats->retries++;
+			attempt++;
+			if (i2cTransfer(fd, msgs + page, group, &i2c_errno) ==
+			    0) {
+				stats->recovered++;
+				continue;
+			}
+		}
+		while (isTransientI2CError(i2c_errno) &&
+		       attempt < fpgaTransferConfig.pageRetries) {
+			switch (i2c_errno) {
+			case EAGAIN:
+				stats->arbLost++;
+				break;
+			case ETIMEDOUT:
+				stats->timeouts++;
+				break;
+			case EBUSY:
+				stats->busy++;
+				break;
+			}
+			stats->retries++;
+			attempt++;
+			debug_print("I2C error %d at msg %u, re-send %u in %uus\n",
+				    i2c_errno, page, attempt, backoff);
+			usleep(backoff);
+			backoff = backoff * 2 < I2C_RETRY_MAX_BACKOFF_US ?
+					  backoff * 2 :
+					  I2C_RETRY_MAX_BACKOFF_US;
+			if (i2cTransfer(fd, msgs + page, group, &i2c_errno) ==
+			    0) {
+				stats->recovered++;
+			}
+		}
+		if (i2c_errno) {
+			break;
+		}
 	}
 
+	if (i2c_errno) {
+		stats->failed++;
+		reportI2CError(i2c_errno, slaveId);
+		return -ERROR_IOCTL_I2C_RDWR_FAILURE;
+	}
 	return 0;
 }
 
 /**************************************************************
- * parseExI2CErrorCode()
- *
- * FPFA Seconday regtbl capture I2C errors during FW update operation
- * Each error code captured in ERRORCODE register is as per definition 
- * captured in FPGA IAS.
- * Applicable errors to FW update controller over I2C are maintained in table[] 
+ * setFpgaAddr()
  *
- * RETURN: error string if success
+ * Encode a DPRAM offset or register address as the 3 address
+ * bytes that lead every FPGA transaction, MSB first.
+ * 0x02_ABCD-> 0x02(BYTE2) -> 0xAB(BYTE1) -> 0xCD(BYTE0)
  *****************************************************************/
+static void setFpgaAddr(unsigned char *buf, size_t offset)
+{
+	buf[0] = (offset & BYTE2) >> 16;
+	buf[1] = (offset & BYTE1) >> 8;
+	buf[2] = (offset & BYTE0) >> 0;
+}
 
-char *parseExI2CErrorCode(uint8_t errorCode)
+/**************************************************************
+ * writeFpgaReg()
+ *
+ * Write a 32 bit FPGA control register, frame is the 3 byte
+ * register address followed by wdata1(LSB) .. wdata4(MSB)
+ *
+ * fd: file describe
+ * slaveId: FPGA I2C controller slave id
+ * reg: register address, e.g. FPGA_IMG_SIZE_REG
+ * value: register value
+ *
+ * RETURN: 0 if success
+ *****************************************************************/
+int writeFpgaReg(int fd, unsigned int slaveId, uint32_t reg, uint32_t value)
 {
-	for (int i = 0; i < (int)(sizeof(table) / (sizeof table[0])); ++i) {
-		if (table[i].errorCode == errorCode) {
-			return table[i].errorString;
-		}
+	unsigned char frame[W_BYTE_COUNT_WITHPAYLOAD];
+	int ret = 0;
+
+	setFpgaAddr(frame, reg);
+	frame[3] = (value & BYTE0) >> 0;
+	frame[4] = (value & BYTE1) >> 8;
+	frame[5] = (value & BYTE2) >> 16;
+	frame[6] = (value & BYTE3) >> 24;
+
+	ret = send_i2c_cmd(fd, FPGA_WRITE, slaveId, frame, NULL,
+			   sizeof(frame), 0);
+	if (ret) {
+		fprintf(stderr,
+			"FPGA_WRITE failed register: 0x%x 0x%x 0x%x\n",
+			frame[0], frame[1], frame[2]);
 	}
-	return UNKNOWN_ERROR;
+	return ret;
 }
 
 /**************************************************************
- * checkExtenedErrorReg()
+ * readFpgaReg()
  *
- * Dump Extended I2C register at offset 0x1 secondary regtbl of 
- * FPGA regmap at slave ID 0x31.
- * Refer to Vulcan IAS chapter 3.15.4 for details
+ * Read a 32 bit FPGA control register
+ *
+ * fd: file describe
+ * slaveId: FPGA I2C controller slave id
+ * reg: register address, e.g. FPGA_UPDATE_STATUS_REG
+ * value: R_BYTE_COUNT bytes read back, LSB first
  *
  * RETURN: 0 if success
  *****************************************************************/
-
-int checkExtenedErrorReg()
+int readFpgaReg(int fd, unsigned int slaveId, uint32_t reg,
+		unsigned char *value)
 {
-	uint8_t write_buffer[2];
-	uint8_t read_buffer[EXTENDED_ERR_MAX_PAGE_SZ];
-	char i2c_device[MAX_NAME_SIZE] = { 0 };
-	int exfd = -1;
-	uint8_t slaveID = FPGA_SECONDARY_REGTBL;
-	uint8_t bus =
-		HMC_I2CBUS_FPGA_SEC_REGTBL; //On HMC, FPGA_SECONDARY_REGTBL is enumerated on bus 2
-	int ret = -1;
+	unsigned char frame[W_BYTE_COUNT];
+	int ret = 0;
 
-	sprintf(i2c_device, "/dev/i2c-%d", bus);
+	setFpgaAddr(frame, reg);
+	ret = send_i2c_cmd(fd, FPGA_READ, slaveId, frame, value,
+			   W_BYTE_COUNT, R_BYTE_COUNT);
+	if (ret) {
+		fprintf(stderr, "FPGA_READ failed register: 0x%x 0x%x 0x%x\n",
+			frame[0], frame[1], frame[2]);
+	}
+	return ret;
+}
 
-	exfd = open(i2c_device, O_RDWR | O_NONBLOCK);
+/**************************************************************
+ * xferChunkSize()
+ *
+ * Payload bytes per message, fpgaTransferConfig.burstSize clamped
+ * to a multiple of BYTE_PER_PAGE in [MIN_BURST_SIZE, MAX_BURST_SIZE]
+ *****************************************************************/
+size_t xferChunkSize(void)
+{
+	size_t chunk = fpgaTransferConfig.burstSize;
 
-	if (exfd < 0) {
-		fprintf(stderr, "checkExDumpReg Error opening i2c file: %s\n",
-			strerror(errno));
-		return ERROR_OPEN_I2C_DEVICE;
+	if (chunk < MIN_BURST_SIZE) {
+		chunk = MIN_BURST_SIZE;
+	} else if (chunk > MAX_BURST_SIZE) {
+		chunk = MAX_BURST_SIZE;
 	}
+	return chunk - (chunk % BYTE_PER_PAGE);
+}
 
-	memset(write_buffer, 0x00, sizeof(write_buffer));
-	memset(read_buffer, 0x00, sizeof(read_buffer));
-
-	write_buffer[0] = 0x0;
-	write_buffer[1] = 0x1; // Read from offset 0x1
+/**************************************************************
+ * xferBatchMsgs()
+ *
+ * Messages per ioctl, fpgaTransferConfig.batchMsgs clamped
+ * to [1, I2C_RDWR_IOCTL_MAX_MSGS]
+ *****************************************************************/
+unsigned int xferBatchMsgs(void)
+{
+	unsigned int batch = fpgaTransferConfig.batchMsgs;
 
-	ret = send_i2c_cmd(exfd, FPGA_READ, slaveID, write_buffer, read_buffer,
-			   2, EXTENDED_ERR_MAX_PAGE_SZ);
-	if (ret) {
-		fprintf(stderr,
-			"checkExDumpReg FPGA_WRITE failed write_buffer: 0x%x 0x%x \n",
-			write_buffer[0], write_buffer[1]);
-		close(exfd);
-		return -1;
+	if (batch < 1) {
+		batch = 1;
+	} else if (batch > I2C_RDWR_IOCTL_MAX_MSGS) {
+		batch = I2C_RDWR_IOCTL_MAX_MSGS;
 	}
+	return batch;
+}
 
-	dumpExtendedI2CReg =
-		(extendedErrorCode
-			 *)&read_buffer[FPGA_SEC_REGTBL_FWCONTROLLER_OFFSET];
+/**************************************************************
+ * getFpgaTransferCtx()
+ *
+ * Transfer context of the calling thread. Frame buffers are
+ * allocated on first use and kept for the whole session, they
+ * only grow when batchMsgs or burstSize is raised.
+ *
+ * RETURN: context, NULL on allocation failure
+ *****************************************************************/
+static _Thread_local FpgaTransferCtx sessionCtx;
 
-	// parse extended i2c error register dump as per extendedErrorCode
-	for (int index = 0; index < RETIMER_MAX_NUM; index++) {
-		if ((dumpExtendedI2CReg->AddrErrorCode[index]
-			     .RET_EEPROM_I2C_ERROR_ADDR != NO_ERR) &&
-		    (dumpExtendedI2CReg->AddrErrorCode[index]
-			     .RET_EEPROM_I2C_ERROR_CODE != NO_ERR)) {
-			char *arg = parseExI2CErrorCode(
-				dumpExtendedI2CReg->AddrErrorCode[index]
-					.RET_EEPROM_I2C_ERROR_CODE);
-			genericMessageRegistry(
-				"ResourceEvent.1.0.ResourceErrorsDetected",
-				arrRetimer[index], arg,
-				"xyz.openbmc_project.Logging.Entry.Level.Critical",
-				NULL);
+FpgaTransferCtx *getFpgaTransferCtx(void)
+{
+	unsigned int frameCount = xferBatchMsgs();
+	size_t frameSize = DPRAM_ADDR_BYTES + xferChunkSize();
+
+	if (sessionCtx.frames == NULL || sessionCtx.frameCount < frameCount ||
+	    sessionCtx.frameSize < frameSize) {
+		unsigned char *frames = realloc(sessionCtx.frames,
+						frameCount * frameSize);
+		if (frames == NULL) {
+			return NULL;
 		}
+		sessionCtx.frames = frames;
+		sessionCtx.frameCount = frameCount;
+		sessionCtx.frameSize = frameSize;
 	}
+	return &sessionCtx;
+}
+
+/**************************************************************
+ * releaseFpgaTransferCtx()
+ *
+ * Free the calling thread's transfer context at end of session
+ *****************************************************************/
+void releaseFpgaTransferCtx(void)
+{
+	free(sessionCtx.frames);
+	free(sessionCtx.shadow);
+	memset(&sessionCtx, 0, sizeof(sessionCtx));
+}
+
+/**************************************************************
+ * pageDigest()
+ *
+ * 64 bit FNV-1a digest of one DPRAM page
+ *****************************************************************/
+static uint64_t pageDigest(const unsigned char *buf, size_t len)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+
+	while (len--) {
+		hash ^= *buf++;
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+/**************************************************************
+ * setDpramStampDir()
+ *
+ * Keep the DPRAM stamps and lease files in dir instead of
+ * DPRAM_STAMP_DIR, so tests stay away from the stamps and leases
+ * of the running services.
+ * NULL selects DPRAM_STAMP_DIR again. Set before any transfer.
+ *****************************************************************/
+void setDpramStampDir(const char *dir)
+{
+	snprintf(dpramStampDir, sizeof(dpramStampDir), "%s",
+		 dir ? dir : DPRAM_STAMP_DIR);
+}
+
+const char *getDpramStampDir(void)
+{
+	return dpramStampDir;
+}
+
+/**************************************************************
+ * i2cBusOfFd()
+ *
+ * RETURN: bus number fd was pooled for by openI2CBus(),
+ *	   MAX_I2C_BUS_NUM if it was not
+ *****************************************************************/
+static unsigned int i2cBusOfFd(int fd)
+{
+	unsigned int bus = MAX_I2C_BUS_NUM;
+
+	pthread_mutex_lock(&i2cBusLock);
+	for (unsigned int i = 0; i2cBusFdsInit && i < MAX_I2C_BUS_NUM; i++) {
+		if (i2cBusFds[i] == fd) {
+			bus = i;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&i2cBusLock);
+	return bus;
+}
+
+/**************************************************************
+ * dpramStampPath()
+ *
+ * Every process that writes DPRAM of an FPGA stamps a per FPGA
+ * file under getDpramStampDir() with a fresh token first. A shadow
+ * is only trusted while the stamp still holds our own token.
+ *
+ * bus: outgoing, bus of fd
+ *
+ * RETURN: 0 if fd is a pooled bus and path is filled
+ *****************************************************************/
+static int dpramStampPath(int fd, unsigned int slaveId, char *path,
+			  size_t size, unsigned int *bus)
+{
+	*bus = i2cBusOfFd(fd);
+	if (fd < 0 || *bus >= MAX_I2C_BUS_NUM) {
+		return -1;
+	}
+	if (snprintf(path, size, "%s/dpram-%u-%02x", dpramStampDir, *bus,
+		     slaveId) >= (int)size) {
+		return -1;
+	}
+	return 0;
+}
+
+static uint64_t readDpramStamp(const char *path)
+{
+	uint64_t token = 0;
+	int stampfd = open(path, O_RDONLY);
+
+	if (stampfd < 0) {
+		return 0;
+	}
+	if (read(stampfd, &token, sizeof(token)) != sizeof(token)) {
+		token = 0;
+	}
+	close(stampfd);
+	return token;
+}
+
+static int writeDpramStamp(const char *path, uint64_t token)
+{
+	int stampfd = -1;
+	int ret = -1;
+
+	if (mkdir(dpramStampDir, 0755) && errno != EEXIST) {
+		return -1;
+	}
+	stampfd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (stampfd < 0) {
+		return -1;
+	}
+	if (write(stampfd, &token, sizeof(token)) == sizeof(token)) {
+		ret = 0;
+	}
+	close(stampfd);
+	return ret;
+}
+
+static uint64_t newDpramToken(void)
+{
+	static uint32_t counter;
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)getpid() << 32) ^ ((uint64_t)ts.tv_sec << 20) ^
+	       (uint64_t)ts.tv_nsec ^ ++counter;
+}
+
+/**************************************************************
+ * syncDpramShadow()
+ *
+ * Drop the shadow if it belongs to another FPGA or if any other
+ * writer stamped the DPRAM since this process last did.
+ *****************************************************************/
+static void syncDpramShadow(FpgaTransferCtx *ctx, int fd, unsigned int slaveId)
+{
+	char path[MAX_NAME_SIZE];
+	unsigned int bus = MAX_I2C_BUS_NUM;
+	bool stamped = dpramStampPath(fd, slaveId, path, sizeof(path), &bus) ==
+		       0;
+
+	if (ctx->shadow == NULL) {
+		ctx->shadow = calloc(DPRAM_PAGES, sizeof(*ctx->shadow));
+		ctx->shadowTrusted = false;
+	}
+	if (ctx->shadow == NULL) {
+		return;
+	}
+	if (!ctx->shadowTrusted || ctx->shadowBus != bus ||
+	    ctx->shadowSlave != slaveId ||
+	    (stamped && readDpramStamp(path) != ctx->shadowToken)) {
+		memset(ctx->shadow, 0, DPRAM_PAGES * sizeof(*ctx->shadow));
+		ctx->shadowBus = bus;
+		ctx->shadowSlave = slaveId;
+		ctx->shadowTrusted = false;
+	}
+}
+
+/**************************************************************
+ * claimDpramShadow()
+ *
+ * Stamp the DPRAM with a fresh token before writing it so other
+ * processes drop their shadow. If stamping fails the shadow is
+ * not trusted for this write.
+ *****************************************************************/
+static void claimDpramShadow(FpgaTransferCtx *ctx, int fd,
+			     unsigned int slaveId)
+{
+	char path[MAX_NAME_SIZE];
+	unsigned int bus = MAX_I2C_BUS_NUM;
+	uint64_t token = newDpramToken();
+
+	if (ctx->shadow == NULL) {
+		return;
+	}
+	if (dpramStampPath(fd, slaveId, path, sizeof(path), &bus) == 0 &&
+	    writeDpramStamp(path, token)) {
+		memset(ctx->shadow, 0, DPRAM_PAGES * sizeof(*ctx->shadow));
+		ctx->shadowTrusted = false;
+		return;
+	}
+	ctx->shadowToken = token;
+	ctx->shadowTrusted = true;
+}
+
+/**************************************************************
+ * recordDpramShadow()
+ *
+ * Remember the digest of every page written by a successful
+ * transfer, pages written partially or off page boundary are
+ * marked unknown.
+ *****************************************************************/
+static void recordDpramShadow(FpgaTransferCtx *ctx, size_t offset,
+			      const unsigned char *src, size_t len, bool ok)
+{
+	size_t first = offset / BYTE_PER_PAGE;
+	size_t last = (offset + len + BYTE_PER_PAGE - 1) / BYTE_PER_PAGE;
+
+	if (ctx->shadow == NULL) {
+		return;
+	}
+	for (size_t page = first; page < last && page < DPRAM_PAGES; page++) {
+		size_t start = page * BYTE_PER_PAGE;
+		size_t bytes = offset + len - start < BYTE_PER_PAGE ?
+				       offset + len - start :
+				       BYTE_PER_PAGE;
+
+		if (!ok || !ctx->shadowTrusted || start < offset) {
+			ctx->shadow[page].len = 0;
+			continue;
+		}
+		ctx->shadow[page].digest =
+			pageDigest(src + (start - offset), bytes);
+		ctx->shadow[page].len = bytes;
+	}
+}
+
+/**************************************************************
+ * invalidateDpramShadow()
+ *
+ * Called before the FPGA itself fills DPRAM (retimer read), drops
+ * the local shadow and restamps so other processes drop theirs.
+ *****************************************************************/
+void invalidateDpramShadow(int fd, unsigned int slaveId)
+{
+	FpgaTransferCtx *ctx = getFpgaTransferCtx();
+
+	if (ctx == NULL) {
+		return;
+	}
+	syncDpramShadow(ctx, fd, slaveId);
+	claimDpramShadow(ctx, fd, slaveId);
+	if (ctx->shadow) {
+		memset(ctx->shadow, 0, DPRAM_PAGES * sizeof(*ctx->shadow));
+	}
+}
+
+/**************************************************************
+ * sendFpgaDpram()
+ *
+ * Batched DPRAM write shared by writeFpgaDpram and clearFpgaDpram.
+ * With fill set src holds one chunk that is sent for every message
+ * instead of a len byte buffer.
+ *
+ * fd: file describe
+ * slaveId: FPGA I2C controller slave id
+ * offset: DPRAM start offset
+ * src: data to write, or the fill chunk
+ * len: number of bytes to write
+ * fill: src is a single repeated chunk
+ *
+ * RETURN: 0 if success
+ *****************************************************************/
+static int sendFpgaDpram(int fd, unsigned int slaveId, size_t offset,
+			 const unsigned char *src, size_t len, bool fill)
+{
+	struct i2c_msg msgs[I2C_RDWR_IOCTL_MAX_MSGS];
+	FpgaTransferCtx *ctx = getFpgaTransferCtx();
+	size_t chunk = xferChunkSize();
+	unsigned int batch = xferBatchMsgs();
+	size_t done = 0;
+	int ret = 0;
+
+	if (!src && len) {
+		return -1;
+	}
+	if (ctx == NULL) {
+		return -ERROR_MALLOC_FAILURE;
+	}
+
+	syncDpramShadow(ctx, fd, slaveId);
+	claimDpramShadow(ctx, fd, slaveId);
+
+	while (done < len) {
+		unsigned int nmsgs = 0;
+		size_t batchStart = done;
+
+		for (; nmsgs < batch && done < len; nmsgs++) {
+			unsigned char *frame =
+				ctx->frames + nmsgs * ctx->frameSize;
+			size_t bytes = len - done < chunk ? len - done : chunk;
+
+			setFpgaAddr(frame, offset + done);
+			memcpy(frame + DPRAM_ADDR_BYTES, fill ? src : src + done,
+			       bytes);
+			msgs[nmsgs].addr = slaveId;
+			msgs[nmsgs].flags = 0;
+			msgs[nmsgs].len = DPRAM_ADDR_BYTES + bytes;
+			msgs[nmsgs].buf = frame;
+			done += bytes;
+		}
+
+		ret = sendPagesWithRetry(fd, slaveId, msgs, nmsgs, 1);
+		if (!fill) {
+			recordDpramShadow(ctx, offset + batchStart,
+					  src + batchStart, done - batchStart,
+					  ret == 0);
+		}
+		for (size_t at = batchStart; fill && at < done;
+		     at += BYTE_PER_PAGE) {
+			size_t bytes = done - at < BYTE_PER_PAGE ?
+					       done - at :
+					       BYTE_PER_PAGE;
+
+			recordDpramShadow(ctx, offset + at, src, bytes,
+					  ret == 0);
+		}
+		if (ret) {
+			fprintf(stderr,
+				"FW update FPGA_WRITE failed batch of %u ending at DPRAM 0x%zx\n",
+				nmsgs, offset + done);
+			break;
+		}
+		if (!fill) {
+			progressUploaded(done - batchStart);
+		}
+	}
+
+	return ret;
+}
+
+/**************************************************************
+ * writeFpgaDpram()
+ *
+ * Copy a memory buffer into FPGA DPRAM. Each chunk of burstSize
+ * bytes is one write message and up to batchMsgs messages are
+ * packed into one I2C_RDWR ioctl.
+ *
+ * fd: file describe
+ * slaveId: FPGA I2C controller slave id
+ * offset: DPRAM start offset
+ * src: data to write
+ * len: number of bytes to write
+ *
+ * RETURN: 0 if success
+ *****************************************************************/
+int writeFpgaDpram(int fd, unsigned int slaveId, size_t offset,
+		   const unsigned char *src, size_t len)
+{
+	return sendFpgaDpram(fd, slaveId, offset, src, len, false);
+}
+
+/**************************************************************
+ * zeroFpgaDpram()
+ *
+ * Write zeros to a DPRAM range from one static zero burst, no
+ * buffer of len bytes is needed.
+ *
+ * fd: file describe
+ * slaveId: FPGA I2C controller slave id
+ * offset: DPRAM start offset
+ * len: number of bytes to clear
+ *
+ * RETURN: 0 if success
+ *****************************************************************/
+int zeroFpgaDpram(int fd, unsigned int slaveId, size_t offset, size_t len)
+{
+	static const unsigned char zeroBurst[MAX_BURST_SIZE];
+
+	return sendFpgaDpram(fd, slaveId, offset, zeroBurst, len, true);
+}
+
+/**************************************************************
+ * zeroImageCrc()
+ *
+ * CRC32 of MAX_FW_IMAGE_SIZE zero bytes. The value only depends on
+ * the build time image size so it is computed once and cached.
+ *
+ * RETURN: crc 32 checksum of the blank image
+ *****************************************************************/
+unsigned int zeroImageCrc(void)
+{
+	static unsigned int crc;
+	static bool valid;
+
+	if (!valid) {
+		crc = 0xFFFFFFFF;
+		for (size_t i = 0; i < MAX_FW_IMAGE_SIZE; i++) {
+			crc = (crc << 8) ^ crc32_table[(crc >> 24) & 255];
+		}
+		valid = true;
+	}
+	return crc;
+}
+
+/**************************************************************
+ * clearFpgaDpram()
+ *
+ * Blank the whole DPRAM and program size and checksum of the blank
+ * image, so a failed retimer read can not return what an earlier
+ * transfer left in DPRAM. Nothing is sent when
+ * fpgaTransferConfig.skipReadClear says the FPGA reports the read
+ * length itself.
+ *
+ * fd: file describe
+ * slaveId: FPGA I2C controller slave id
+ *
+ * RETURN: 0 if success
+ *****************************************************************/
+int clearFpgaDpram(int fd, unsigned int slaveId)
+{
+	int ret;
+
+	if (fpgaTransferConfig.skipReadClear) {
+		debug_print("DPRAM clear skipped, FPGA reports read length\n");
+		return 0;
+	}
+	fprintf(stdout, "Clear FPGA DPRAM...\n");
+	ret = zeroFpgaDpram(fd, slaveId, 0, MAX_FW_IMAGE_SIZE);
+	if (ret) {
+		return ret;
+	}
+	return setFpgaImageInfo(fd, slaveId, MAX_FW_IMAGE_SIZE,
+				zeroImageCrc());
+}
+
+/**************************************************************
+ * writeFpgaDpramDelta()
+ *
+ * Write an image to DPRAM offset 0 but only send the runs of pages
+ * whose shadow digest differs from the image.
+ *
+ * fd: file describe
+ * slaveId: FPGA I2C controller slave id
+ * src: image
+ * len: image length
+ * pagesSent: outgoing, number of pages written
+ *
+ * RETURN: 0 if success
+ *****************************************************************/
+static int writeFpgaDpramDelta(int fd, unsigned int slaveId,
+			       const unsigned char *src, size_t len,
+			       unsigned int *pagesSent)
+{
+	FpgaTransferCtx *ctx = getFpgaTransferCtx();
+	size_t pages = (len + BYTE_PER_PAGE - 1) / BYTE_PER_PAGE;
+	size_t page = 0;
+	int ret = 0;
+
+	*pagesSent = 0;
+	if (ctx == NULL) {
+		return -ERROR_MALLOC_FAILURE;
+	}
+	syncDpramShadow(ctx, fd, slaveId);
+	if (ctx->shadow == NULL || !ctx->shadowTrusted) {
+		*pagesSent = pages;
+		return writeFpgaDpram(fd, slaveId, 0, src, len);
+	}
+
+	while (page < pages) {
+		size_t runStart = page;
+
+		// collect a run of pages that differ from the shadow
+		for (; page < pages; page++) {
+			size_t start = page * BYTE_PER_PAGE;
+			size_t bytes = len - start < BYTE_PER_PAGE ?
+					       len - start :
+					       BYTE_PER_PAGE;
+
+			if (ctx->shadow[page].len == bytes &&
+			    ctx->shadow[page].digest ==
+				    pageDigest(src + start, bytes)) {
+				break;
+			}
+		}
+		if (page > runStart) {
+			size_t start = runStart * BYTE_PER_PAGE;
+			size_t end = page * BYTE_PER_PAGE < len ?
+					     page * BYTE_PER_PAGE :
+					     len;
+
+			ret = writeFpgaDpram(fd, slaveId, start, src + start,
+					     end - start);
+			if (ret) {
+				return ret;
+			}
+			*pagesSent += page - runStart;
+		}
+		// skip the page that already matches
+		if (page < pages) {
+			size_t start = page * BYTE_PER_PAGE;
+
+			progressUploaded(len - start < BYTE_PER_PAGE ?
+						 len - start :
+						 BYTE_PER_PAGE);
+		}
+		page++;
+	}
+	return 0;
+}
+
+/**************************************************************
+ * readFpgaDpram()
+ *
+ * Read FPGA DPRAM straight into a memory buffer. Each chunk is an
+ * address write followed by a read, up to batchMsgs / 2 chunks are
+ * packed into one I2C_RDWR ioctl.
+ *
+ * fd: file describe
+ * slaveId: FPGA I2C controller slave id
+ * offset: DPRAM start offset
+ * dst: destination buffer, at least len bytes
+ * len: number of bytes to read
+ *
+ * RETURN: 0 if success
+ *****************************************************************/
+int readFpgaDpram(int fd, unsigned int slaveId, size_t offset,
+		  unsigned char *dst, size_t len)
+{
+	struct i2c_msg msgs[I2C_RDWR_IOCTL_MAX_MSGS];
+	unsigned char addr[I2C_RDWR_IOCTL_MAX_MSGS / 2][DPRAM_ADDR_BYTES];
+	size_t chunk = xferChunkSize();
+	unsigned int batch = xferBatchMsgs() / 2;
+	size_t done = 0;
+	int ret = 0;
+
+	if (!dst && len) {
+		return -1;
+	}
+	if (batch < 1) {
+		batch = 1;
+	}
+
+	while (done < len) {
+		unsigned int pages = 0;
+
+		for (; pages < batch && done < len; pages++) {
+			size_t bytes = len - done < chunk ? len - done : chunk;
+
+			setFpgaAddr(addr[pages], offset + done);
+			msgs[2 * pages].addr = slaveId;
+			msgs[2 * pages].flags = 0;
+			msgs[2 * pages].len = DPRAM_ADDR_BYTES;
+			msgs[2 * pages].buf = addr[pages];
+			msgs[2 * pages + 1].addr = slaveId;
+			msgs[2 * pages + 1].flags = I2C_M_RD;
+			msgs[2 * pages + 1].len = bytes;
+			msgs[2 * pages + 1].buf = dst + done;
+			done += bytes;
+		}
+
+		ret = sendPagesWithRetry(fd, slaveId, msgs, 2 * pages, 2);
+		if (ret) {
+			fprintf(stderr,
+				"FW read FPGA_READ failed batch of %u ending at DPRAM 0x%zx\n",
+				pages, offset + done);
+			break;
+		}
+	}
+
+	return ret;
+}
+
+/**************************************************************
+ * probeFpgaBurstSize()
+ *
+ * Find the largest payload the FPGA accepts in one message by
+ * writing a pattern that differs per page and reading it back in
+ * one message. Without address auto-increment across pages the
+ * readback does not match. DPRAM content is overwritten.
+ *
+ * fd: file describe
+ * slaveId: FPGA I2C controller slave id
+ *
+ * RETURN: supported burst size, BYTE_PER_PAGE if none larger works
+ *****************************************************************/
+unsigned int probeFpgaBurstSize(int fd, unsigned int slaveId)
+{
+	unsigned char *pattern = NULL;
+	unsigned char *readback = NULL;
+	unsigned int burst = MAX_BURST_SIZE;
+	unsigned int saveBurst = fpgaTransferConfig.burstSize;
+	unsigned int saveBatch = fpgaTransferConfig.batchMsgs;
+
+	pattern = malloc(MAX_BURST_SIZE);
+	readback = malloc(MAX_BURST_SIZE);
+	if (pattern == NULL || readback == NULL) {
+		free(pattern);
+		free(readback);
+		return BYTE_PER_PAGE;
+	}
+	for (unsigned int i = 0; i < MAX_BURST_SIZE; i++) {
+		pattern[i] = (uint8_t)(i + (i / BYTE_PER_PAGE) * 0x3B);
+	}
+
+	// one message per ioctl so the probe only measures auto-increment
+	fpgaTransferConfig.batchMsgs = 1;
+	for (; burst > BYTE_PER_PAGE; burst /= 2) {
+		fpgaTransferConfig.burstSize = burst;
+		memset(readback, 0, burst);
+		if (writeFpgaDpram(fd, slaveId, 0, pattern, burst) == 0 &&
+		    readFpgaDpram(fd, slaveId, 0, readback, burst) == 0 &&
+		    memcmp(pattern, readback, burst) == 0) {
+			break;
+		}
+		debug_print("probeFpgaBurstSize: burst %u not supported\n",
+			    burst);
+	}
+	fpgaTransferConfig.burstSize = saveBurst;
+	fpgaTransferConfig.batchMsgs = saveBatch;
+
+	fprintf(stdout, "FPGA DPRAM burst size: %u\n", burst);
+	free(pattern);
+	free(readback);
+	return burst;
+}
+
+/**************************************************************
+ * maperrnoToI2CError()
+ *
+ * this function is mapping generic I2C driver error reported in form of 
+ * errno in specific I2C ERROR string to make it more readable to user
+ *
+ * RETURN: string as per mapping or default strerror 
+ *****************************************************************/
+
+int maperrnoToI2CError(int errnoval, unsigned char slaveId, char **msg,
+		       char **resolution)
+{
+	static char buf[64];
+	static char res[256];
+
+	switch (errnoval) {
+	case ENODEV:
+		sprintf(buf, "Slave not found, slave address 0x%x", slaveId);
+		*msg = buf;
+		sprintf(res,
+			"Reach out to the Nvidia support team for further action");
+		*resolution = res;
+		break;
+	case EAGAIN:
+		sprintf(buf,
+			"ARB_LOST:ASPEED_I2CD_INTR_ARBIT_LOSS, slave address 0x%x",
+			slaveId);
+		*msg = buf;
+		sprintf(res, "Retry the firmware update");
+		*resolution = res;
+		break;
+	case ETIMEDOUT:
+		sprintf(buf, "SCL Clock stretching too far, slave address 0x%x",
+			slaveId);
+		*msg = buf;
+		sprintf(res,
+			"Perform Power Cycle of HGX baseboard and retry the firmware update");
+		*resolution = res;
+		break;
+	case ENXIO:
+		sprintf(buf,
+			"Address phase NACK:ASPEED_I2CD_INTR_TX_NAK, slave address 0x%x",
+			slaveId);
+		*msg = buf;
+		sprintf(res,
+			"Perform Power Cycle of HGX baseboard and retry the firmware update");
+		*resolution = res;
+		break;
+	case EBUSY:
+		sprintf(buf, "BUS BUSY:SDA/SCL Timeout, slave address 0x%x",
+			slaveId);
+		*msg = buf;
+		sprintf(res,
+			"Perform Power Cycle of HGX baseboard and retry the firmware update");
+		*resolution = res;
+		break;
+	default:
+		sprintf(buf, "Error %s, slave address 0x%x", strerror(errnoval),
+			slaveId);
+		*msg = buf;
+		sprintf(res,
+			"Reach out to the Nvidia support team for further action");
+		*resolution = res;
+		break;
+	}
+
+	return 0;
+}
+
+/**************************************************************
+ * isTransientI2CError()
+ *
+ * errno classes from maperrnoToI2CError() that a page re-send can
+ * clear: lost arbitration, clock stretch timeout and bus busy.
+ * Address NACK and missing slave need operator action.
+ *
+ * RETURN: true if the transfer is worth retrying
+ *****************************************************************/
+bool isTransientI2CError(int errnoval)
+{
+	switch (errnoval) {
+	case EAGAIN:
+	case ETIMEDOUT:
+	case EBUSY:
+		return true;
+	default:
+		return false;
+	}
+}
+
+/**************************************************************
+ * printI2CRetryStats()
+ *
+ * Print page re-send counters of the calling thread's session
+ *****************************************************************/
+void printI2CRetryStats(void)
+{
+	FpgaTransferCtx *ctx = getFpgaTransferCtx();
+
+	if (ctx == NULL || ctx->retryStats.retries == 0) {
+		return;
+	}
+	fprintf(stdout,
+		"I2C page re-sends: %lu (arbitration lost %lu, timeout %lu, "
+		"busy %lu), recovered %lu, failed %lu\n",
+		ctx->retryStats.retries, ctx->retryStats.arbLost,
+		ctx->retryStats.timeouts, ctx->retryStats.busy,
+		ctx->retryStats.recovered, ctx->retryStats.failed);
+}
+
+/**************************************************************
+ * parseExI2CErrorCode()
+ *
+ * FPFA Seconday regtbl capture I2C errors during FW update operation
+ * Each error code captured in ERRORCODE register is as per definition 
+ * captured in FPGA IAS.
+ * Applicable errors to FW update controller over I2C are maintained in table[] 
+ *
+ * RETURN: error string if success
+ *****************************************************************/
+
+char *parseExI2CErrorCode(uint8_t errorCode)
+{
+	for (int i = 0; i < (int)(sizeof(table) / (sizeof table[0])); ++i) {
+		if (table[i].errorCode == errorCode) {
+			return table[i].errorString;
+		}
+	}
+	return UNKNOWN_ERROR;
+}
+
+/**************************************************************
+ * setFpgaCntrlAddr()
+ *
+ * Select the FPGA I2C controller address used by the update, read
+ * and poll helpers of the calling thread. Threads start with the
+ * build time FPGA_I2C_CNTRL_ADDR.
+ *
+ * slaveId: 7 bit I2C address of the FPGA controller
+ *****************************************************************/
+void setFpgaCntrlAddr(uint8_t slaveId)
+{
+	fpgaCntrlAddr = slaveId;
+}
+
+uint8_t getFpgaCntrlAddr(void)
+{
+	return fpgaCntrlAddr;
+}
+
+/**************************************************************
+ * fpgaSidebandBus()
+ *
+ * Map the bus of an FPGA to the bus of the CPLD and secondary
+ * regtbl of its baseboard. Only the HMC wiring is known: the FPGA
+ * on FPGA_I2C_BUS has both on HMC_I2CBUS_FPGA_SEC_REGTBL.
+ *
+ * RETURN: sideband bus, -1 if it is not known for bus
+ *****************************************************************/
+int fpgaSidebandBus(unsigned int bus)
+{
+	return bus == FPGA_I2C_BUS ? HMC_I2CBUS_FPGA_SEC_REGTBL : -1;
+}
+
+/**************************************************************
+ * setFpgaSidebandBus()
+ *
+ * Select the bus of the CPLD and secondary regtbl checked by the
+ * preflight and extended error helpers of the calling thread.
+ * Threads start with HMC_I2CBUS_FPGA_SEC_REGTBL.
+ *****************************************************************/
+void setFpgaSidebandBus(unsigned int bus)
+{
+	fpgaSideband = bus;
+}
+
+unsigned int getFpgaSidebandBus(void)
+{
+	return fpgaSideband;
+}
+
+/**************************************************************
+ * openI2CBus()
+ *
+ * Return the pooled descriptor of i2c bus <bus>, the bus is
+ * opened through the active transport on first use and kept open
+ * until closeI2CBuses().
+ *
+ * bus: i2c bus number
+ *
+ * RETURN: file descriptor, -1 on failure
+ *****************************************************************/
+int openI2CBus(unsigned int bus)
+{
+	const I2CTransport *transport = getI2CTransport();
+	int fd = -1;
+
+	if (bus >= MAX_I2C_BUS_NUM) {
+		fprintf(stderr, "I2C bus %u out of range\n", bus);
+		return -1;
+	}
+
+	pthread_mutex_lock(&i2cBusLock);
+	if (!i2cBusFdsInit) {
+		for (int i = 0; i < MAX_I2C_BUS_NUM; i++) {
+			i2cBusFds[i] = -1;
+		}
+		i2cBusFdsInit = true;
+	}
+	if (i2cBusFds[bus] < 0) {
+		i2cBusFds[bus] = transport->open(transport->priv, bus);
+		if (i2cBusFds[bus] < 0) {
+			fprintf(stderr, "Error opening i2c bus %u (%s): %s\n",
+				bus, transport->name, strerror(errno));
+		}
+	}
+	fd = i2cBusFds[bus];
+	pthread_mutex_unlock(&i2cBusLock);
+	return fd;
+}
+
+/**************************************************************
+ * closeI2CBuses()
+ *
+ * Close every descriptor held by the bus pool
+ *****************************************************************/
+void closeI2CBuses(void)
+{
+	const I2CTransport *transport = getI2CTransport();
+
+	pthread_mutex_lock(&i2cBusLock);
+	for (int bus = 0; i2cBusFdsInit && bus < MAX_I2C_BUS_NUM; bus++) {
+		if (i2cBusFds[bus] >= 0) {
+			transport->close(transport->priv, i2cBusFds[bus]);
+			i2cBusFds[bus] = -1;
+		}
+	}
+	pthread_mutex_unlock(&i2cBusLock);
+}
+
+/**************************************************************
+ * readExtendedErrorRegs()
+ *
+ * Read the extendedErrorCode window of the FPGA secondary regtbl
+ * in one transaction
+ *
+ * regs: outgoing, register window
+ *
+ * RETURN: 0 if success, ERROR_OPEN_I2C_DEVICE or -1 on I2C error
+ *****************************************************************/
+static int readExtendedErrorRegs(extendedErrorCode *regs)
+{
+	uint8_t write_buffer[2];
+	int exfd = -1;
+	uint8_t slaveID = FPGA_SECONDARY_REGTBL;
+	//On HMC, FPGA_SECONDARY_REGTBL is enumerated on bus 2
+	unsigned int bus = getFpgaSidebandBus();
+	int ret = -1;
+
+	exfd = openI2CBus(bus);
+
+	if (exfd < 0) {
+		fprintf(stderr, "checkExDumpReg Error opening i2c file: %s\n",
+			strerror(errno));
+		return ERROR_OPEN_I2C_DEVICE;
+	}
+
+	memset(regs, 0x00, sizeof(*regs));
+
+	write_buffer[0] = (EXTENDED_ERR_REG_OFFSET >> 8) & 0xFF;
+	write_buffer[1] = EXTENDED_ERR_REG_OFFSET & 0xFF;
+
+	ret = send_i2c_cmd(exfd, FPGA_READ, slaveID, write_buffer,
+			   (unsigned char *)regs, 2, sizeof(*regs));
+	if (ret) {
+		fprintf(stderr,
+			"checkExDumpReg FPGA_WRITE failed write_buffer: 0x%x 0x%x \n",
+			write_buffer[0], write_buffer[1]);
+		return -1;
+	}
+	return 0;
+}
+
+static void logRetimerI2CErrors(volatile extendedErrorCode *regs)
+{
+	char name[RETIMER_NAME_SIZE];
+
+	for (unsigned int i = 0; i < retimerCount; i++) {
+		if ((regs->AddrErrorCode[i].RET_EEPROM_I2C_ERROR_ADDR !=
+		     NO_ERR) &&
+		    (regs->AddrErrorCode[i].RET_EEPROM_I2C_ERROR_CODE !=
+		     NO_ERR)) {
+			char *arg = parseExI2CErrorCode(
+				regs->AddrErrorCode[i].RET_EEPROM_I2C_ERROR_CODE);
+
+			retimerName(i, name, sizeof(name));
+			genericMessageRegistry(
+				"ResourceEvent.1.0.ResourceErrorsDetected",
+				name, arg,
+				"xyz.openbmc_project.Logging.Entry.Level.Critical",
+				NULL);
+		}
+	}
+}
+
+/**************************************************************
+ * checkExtenedErrorReg()
+ *
+ * Dump Extended I2C register at offset 0x1 secondary regtbl of 
+ * FPGA regmap at slave ID 0x31.
+ * Only the extendedErrorCode window is read, starting at
+ * EXTENDED_ERR_REG_OFFSET, instead of the full regtbl page.
+ * Refer to Vulcan IAS chapter 3.15.4 for details
+ *
+ * RETURN: 0 if success
+ *****************************************************************/
+
+int checkExtenedErrorReg()
+{
+	int ret = readExtendedErrorRegs(&extendedErrorRegs);
+
+	if (ret) {
+		return ret;
+	}
+
+	dumpExtendedI2CReg = &extendedErrorRegs;
+
+	// parse extended i2c error register dump as per extendedErrorCode
+	logRetimerI2CErrors(dumpExtendedI2CReg);
 
 	debug_print(
 		"checkExDumpReg Dump Ex Reg  ...globalWp :0x%x retimerEEPROMmuxSel :0x%x\n",
@@ -491,8 +1662,91 @@ int checkExtenedErrorReg()
 			"Reach out to the nNvidia support team for further action");
 	}
 
-	if (exfd != -1) {
-		close(exfd);
+	return 0;
+}
+
+/**************************************************************
+ * preflightFail()
+ *
+ * Log why the preflight refused the update
+ *
+ * RETURN: err
+ *****************************************************************/
+static int preflightFail(int err, char *reason, char *resolution)
+{
+	fprintf(stderr, "Preflight failed: %s\n", reason);
+	genericMessageRegistry("ResourceEvent.1.0.ResourceErrorsDetected",
+			       "HGX_FW_PCIeRetimer update service", reason,
+			       "xyz.openbmc_project.Logging.Entry.Level.Critical",
+			       resolution);
+	return err;
+}
+
+/**************************************************************
+ * preflightRetimerUpdate()
+ *
+ * Check that an update can succeed before any image byte is sent,
+ * one small transaction each for the baseboard CPLD, the FPGA
+ * update controller and the secondary regtbl. The CPLD and regtbl
+ * are reached on getFpgaSidebandBus().
+ *
+ * fd: file descriptor of the FPGA bus
+ * slaveId: FPGA I2C controller slave id
+ *
+ * RETURN: 0 if ready, -ERROR_RETIMER_NOT_READY, -ERROR_FPGA_NOT_READY,
+ *	   -ERROR_GLOBAL_WP or -ERROR_RETIMER_MUX_SEL
+ *****************************************************************/
+int preflightRetimerUpdate(int fd, unsigned int slaveId)
+{
+	unsigned char offset = CPLD_GB_OFFSET;
+	unsigned char gb = 0;
+	unsigned char status[READ_BUF_SIZE] = { 0 };
+	extendedErrorCode regs;
+	int cpldfd = openI2CBus(getFpgaSidebandBus());
+
+	// baseboard present (active low) and CPLD ready
+	if (cpldfd < 0 || send_i2c_cmd(cpldfd, FPGA_READ, CPLD_SLAVE_ID,
+				       &offset, &gb, 1, 1)) {
+		return preflightFail(-ERROR_RETIMER_NOT_READY,
+				     "Baseboard CPLD not responding",
+				     "Check the baseboard power state and retry the firmware update operation.");
+	}
+	debug_print("Preflight CPLD 0x%x: 0x%x\n", CPLD_GB_OFFSET, gb);
+	if ((gb & GPU_BASE1_PRSNT_N_MASK) || !(gb & GPU_BASE1_CPLD_READY_MASK)) {
+		return preflightFail(-ERROR_RETIMER_NOT_READY,
+				     "Baseboard not present or not ready",
+				     "Power on the baseboard and retry the firmware update operation.");
+	}
+
+	// FPGA update controller answers and is idle
+	if (readFpgaReg(fd, slaveId, FPGA_UPDATE_STATUS_REG, status)) {
+		return preflightFail(-ERROR_FPGA_NOT_READY,
+				     "FPGA not responding",
+				     "Check the FPGA and retry the firmware update operation.");
+	}
+	if (status[0] != FW_UPDATE_COMPLETE_FLAG) {
+		return preflightFail(-ERROR_FPGA_NOT_READY,
+				     "FPGA busy with a previous update",
+				     "Wait for the running update to finish and retry.");
+	}
+
+	// write protect and EEPROM mux selection
+	if (readExtendedErrorRegs(&regs)) {
+		return preflightFail(-ERROR_FPGA_NOT_READY,
+				     "FPGA secondary regtbl not responding",
+				     "Check the FPGA and retry the firmware update operation.");
+	}
+	debug_print("Preflight globalWp 0x%x retimerEEPROMmuxSel 0x%x\n",
+		    regs.globalWp, regs.retimerEEPROMmuxSel);
+	if ((regs.globalWp & GLOBAL_WP_L_MASK) == 0x00) {
+		return preflightFail(-ERROR_GLOBAL_WP,
+				     "Global Write Protect Enabled",
+				     "Disable write protect on the device and retry the firmware update operation.");
+	}
+	if (regs.retimerEEPROMmuxSel & RET_MUX_SEL_MASK) {
+		return preflightFail(-ERROR_RETIMER_MUX_SEL,
+				     "Retimer EEPROM mux selected",
+				     "Reach out to the nNvidia support team for further action");
 	}
 	return 0;
 }
@@ -525,7 +1779,7 @@ int checkDigit_i2c(char *str)
 }
 
 /******************************************************
- * parseCompositeImage()
+ * parseImage()
  *
  * Parse a composite image header block and create an array of update_operation
  *
@@ -534,20 +1788,22 @@ int checkDigit_i2c(char *str)
  * pldmVersionStr: Retimer version string from the PLDM package
  * update_ops: outgoing, pointer to update_ops array (needs to be freed)
  * update_ops_count: outgoing, number of elements in update_ops array
+ * verifyData: check image data CRCs, otherwise only headers are
+ *             verified and imageCrcPending is set
  *
  *
  * RETURN: 0 if success
  *****************************************************/
-int parseCompositeImage(const unsigned char *imageMappedAddr, size_t fw_size,
-			const char *pldmVersionStr,
-			update_operation **update_ops, int *update_ops_count)
+static int parseImage(const unsigned char *imageMappedAddr, size_t fw_size,
+		      const char *pldmVersionStr, update_operation **update_ops,
+		      int *update_ops_count, bool verifyData)
 {
 	int ret = 0;
 	char msg[MAX_NAME_SIZE] = { 0 };
 	const CompositeImageHeader *compositeImageHeader = NULL;
 	const ComponentHeader *componentHeaders = NULL;
 	size_t nextImageOffset = 0;
-	uint32_t coveredRetimerBitmap = 0;
+	RetimerBitmap coveredRetimerBitmap = 0;
 	*update_ops = NULL;
 	*update_ops_count = 0;
 	// Check minimum length. If less than minimum length treat as bare image
@@ -575,8 +1831,14 @@ int parseCompositeImage(const unsigned char *imageMappedAddr, size_t fw_size,
 		*update_ops_count = 1;
 		(*update_ops)[0].startOffset = 0;
 		(*update_ops)[0].imageLength = fw_size;
-		(*update_ops)[0].applyBitmap = RETIMERALL;
-		(*update_ops)[0].imageCrc = crc32(imageMappedAddr, fw_size);
+		(*update_ops)[0].applyBitmap = retimerAllMask();
+		if (verifyData) {
+			(*update_ops)[0].imageCrc =
+				crc32(imageMappedAddr, fw_size);
+		} else {
+			(*update_ops)[0].imageCrcPending = true;
+			(*update_ops)[0].crcFromData = true;
+		}
 		strncpy((*update_ops)[0].versionString, pldmVersionStr,
 			sizeof((*update_ops)[0].versionString) - 1);
 	} else {
@@ -632,7 +1894,7 @@ int parseCompositeImage(const unsigned char *imageMappedAddr, size_t fw_size,
 		}
 
 		// verify the component count
-		if (compositeImageHeader->componentCount > RETIMER_MAX_NUM) {
+		if (compositeImageHeader->componentCount > retimerCount) {
 			ret = -ERROR_COMPOSITE_IMAGE_TOO_MANY_COMPS;
 			snprintf(
 				msg, sizeof(msg) - 1,
@@ -806,7 +2068,7 @@ int parseCompositeImage(const unsigned char *imageMappedAddr, size_t fw_size,
 
 		// raise an error if any retimers that do not exist on this platform
 		// are targeted.
-		if (coveredRetimerBitmap > RETIMERALL) {
+		if (coveredRetimerBitmap & ~retimerAllMask()) {
 			ret = -ERROR_COMPOSITE_TARGETED_INDEX_OUT_OF_RANGE;
 			snprintf(msg, sizeof(msg) - 1,
 				 "Targeting a retimer that "
@@ -822,7 +2084,7 @@ int parseCompositeImage(const unsigned char *imageMappedAddr, size_t fw_size,
 		}
 
 		// verify that all retimers on this platform were targeted (nonfatal)
-		if (coveredRetimerBitmap != RETIMERALL) {
+		if (coveredRetimerBitmap != retimerAllMask()) {
 			fprintf(stderr,
 				"[WARN] Not all retimers targeted! Only targeted %#x\n",
 				coveredRetimerBitmap);
@@ -831,6 +2093,12 @@ int parseCompositeImage(const unsigned char *imageMappedAddr, size_t fw_size,
 		// Now file size is known OK, so we can safely read image data
 		for (int comp = 0; comp < compositeImageHeader->componentCount;
 		     comp++) {
+			if (!verifyData) {
+				(*update_ops)[comp].imageCrc =
+					componentHeaders[comp].imageCrc;
+				(*update_ops)[comp].imageCrcPending = true;
+				continue;
+			}
 			// Verify the image data CRC
 			if (crc32(imageMappedAddr +
 					  (*update_ops)[comp].startOffset,
@@ -863,10 +2131,135 @@ exit:
 	return ret;
 }
 
+/******************************************************
+ * parseCompositeImage()
+ *
+ * Parse a bare or composite image and verify all image CRCs
+ *
+ * RETURN: 0 if success
+ *****************************************************/
+int parseCompositeImage(const unsigned char *imageMappedAddr, size_t fw_size,
+			const char *pldmVersionStr,
+			update_operation **update_ops, int *update_ops_count)
+{
+	return parseImage(imageMappedAddr, fw_size, pldmVersionStr, update_ops,
+			  update_ops_count, true);
+}
+
+/******************************************************
+ * parseCompositeImageHeaders()
+ *
+ * Like parseCompositeImage() but image data is not read. Every
+ * update_operation has imageCrcPending set, the caller has to
+ * verify the data (see verifyUpdateOperation()) before flashing.
+ *
+ * RETURN: 0 if success
+ *****************************************************/
+int parseCompositeImageHeaders(const unsigned char *imageMappedAddr,
+			       size_t fw_size, const char *pldmVersionStr,
+			       update_operation **update_ops,
+			       int *update_ops_count)
+{
+	return parseImage(imageMappedAddr, fw_size, pldmVersionStr, update_ops,
+			  update_ops_count, false);
+}
+
+/******************************************************
+ * verifyUpdateOperation()
+ *
+ * Compute the image CRC of an update_operation parsed by
+ * parseCompositeImageHeaders(). A bare image takes the computed
+ * CRC, a composite component must match its header.
+ *
+ * imageMappedAddr: pointer to start of FW image
+ * op: update operation, imageCrc and imageCrcPending are updated
+ *
+ * RETURN: 0 if success, -ERROR_WRONG_CRC32_CHKSM on mismatch
+ *****************************************************/
+int verifyUpdateOperation(const unsigned char *imageMappedAddr,
+			  update_operation *op)
+{
+	unsigned int crc;
+
+	if (!op->imageCrcPending) {
+		return 0;
+	}
+	crc = crc32(imageMappedAddr + op->startOffset, op->imageLength);
+	if (op->crcFromData) {
+		op->imageCrc = crc;
+	} else if (crc != op->imageCrc) {
+		fprintf(stderr, "Image at %#zx CRC mismatch\n", op->startOffset);
+		genericMessageRegistry(
+			"ResourceEvent.1.0.ResourceErrorsDetected",
+			"HGX_PCIeRetimer Update Service", "Image CRC mismatch",
+			"xyz.openbmc_project.Logging.Entry.Level.Critical",
+			"Contact NVIDIA support.");
+		return -ERROR_WRONG_CRC32_CHKSM;
+	}
+	op->imageCrcPending = false;
+	return 0;
+}
+
+/**************************************************************
+ * mergeUpdateOperations()
+ *
+ * Fold update operations carrying byte identical images into the
+ * first one, so the image is uploaded once and all retimers of the
+ * folded operations are flashed by one trigger. Images are matched
+ * by length and imageCrc and confirmed by comparing the data, the
+ * version strings must be equal too as they name the retimers in
+ * log messages.
+ *
+ * imageMappedAddr: firmware file
+ * update_ops: update operations, compacted in place
+ * update_ops_count: in/out, number of update operations
+ *
+ * RETURN: number of operations folded away
+ *****************************************************************/
+int mergeUpdateOperations(const unsigned char *imageMappedAddr,
+			  update_operation *update_ops, int *update_ops_count)
+{
+	int kept = 0;
+	int merged = 0;
+
+	for (int uo = 0; uo < *update_ops_count; uo++) {
+		update_operation *op = &update_ops[uo];
+		int into = 0;
+
+		for (; into < kept; into++) {
+			update_operation *prev = &update_ops[into];
+
+			if (!op->crcFromData && !prev->crcFromData &&
+			    prev->imageLength == op->imageLength &&
+			    prev->imageCrc == op->imageCrc &&
+			    strncmp(prev->versionString, op->versionString,
+				    sizeof(op->versionString)) == 0 &&
+			    memcmp(imageMappedAddr + prev->startOffset,
+				   imageMappedAddr + op->startOffset,
+				   op->imageLength) == 0) {
+				break;
+			}
+		}
+		if (into == kept) {
+			update_ops[kept++] = *op;
+			continue;
+		}
+		fprintf(stdout,
+			"update operation %d (applyBitmap %#x) has the image of %d, merged\n",
+			uo, op->applyBitmap, into);
+		update_ops[into].applyBitmap |= op->applyBitmap;
+		merged++;
+	}
+
+	*update_ops_count = kept;
+	return merged;
+}
+
 /*****************************************************
  * checkDigit_retimer()
  *
- * confirm if input retimer is number between 0 ~ 8
+ * confirm if input retimer is a bitmap of the retimers of the
+ * platform, see retimerAllMask()
  *
  * str: input string
  *
@@ -875,8 +2268,8 @@ exit:
  *****************************************************/
 int checkDigit_retimer(char *str)
 {
-	uint8_t i;
-	if (atoi(str) > 255) {
+	size_t i;
+	if (strlen(str) > 10 || strtoull(str, NULL, 10) > retimerAllMask()) {
 		fprintf(stderr, "Retimer number Out of Range\n");
 		return 1;
 	}
@@ -949,26 +2342,22 @@ int copyImageFromFileToFpga(int fw_fd, int fd, unsigned int slaveId)
 }
 
 /********************************************************************
- * copyImageFromMemToFpga()
+ * uploadImageToFpga()
  *
- * Load FW from memory buffer
- * Calculate CRC32 and update CRC32 value in FPGA control register
- * Copy FW image from memory to DPRAM
+ * Copy FW image from memory to DPRAM, the size and CRC registers
+ * are left alone (see setFpgaImageInfo())
  *
  * fw_addr: address in memory of retimer FW
+ * fw_size: image length
  * fd: file describe
  * slaveId: FPGA I2C controller slave id
  *
  * RETURN: 0 if success
  ********************************************************************/
-
-int copyImageFromMemToFpga(const unsigned char *fw_addr, size_t fw_size,
-			   unsigned int fw_crc32, int fd, unsigned int slaveId)
+int uploadImageToFpga(const unsigned char *fw_addr, size_t fw_size, int fd,
+		      unsigned int slaveId)
 {
 	int ret = -1;
-	unsigned char write_buffer[WRITE_BUF_SIZE] = { 0 };
-	unsigned char read_buffer[READ_BUF_SIZE] = { 0 };
-	unsigned int pageCount = 0;
 
 	// because size_t is unsigned, fw_size <= 0 check doesn't make sense
 	if (fw_size > MAX_FW_IMAGE_SIZE) {
@@ -980,82 +2369,73 @@ int copyImageFromMemToFpga(const unsigned char *fw_addr, size_t fw_size,
 	fprintf(stdout, "Initiate Copy to FPGA RAM...\n");
 	fprintf(stdout, "RETIMER FW Image size: 0x%lx \n", (long int)fw_size);
 
-	pageCount = ((unsigned int)fw_size / BYTE_PER_PAGE);
+	if (fpgaTransferConfig.probeBurst) {
+		fpgaTransferConfig.burstSize = probeFpgaBurstSize(fd, slaveId);
+		fpgaTransferConfig.probeBurst = false;
+	}
+
 	//Copy FW image to FPGA DP RAM 0x0_0000
-	//Write to DPRAM address to write_buffer0, write_buffer1, write_buffer 2 and then upto 256 bytes of payload till
-	//the complete image is transferred
-	for (uint32_t i = 0; i <= pageCount; i++) {
-		size_t bytes_to_transfer = 0;
-		if (i < pageCount) {
-			bytes_to_transfer = BYTE_PER_PAGE;
-		} else {
-			bytes_to_transfer =
-				fw_size - (pageCount * BYTE_PER_PAGE);
-		}
-		if (bytes_to_transfer <= 0) {
-			break;
-		}
-		memset(write_buffer, 0x00, sizeof(write_buffer));
-		memset(read_buffer, 0x00, sizeof(read_buffer));
-		write_buffer[0] = (0x00 | (i & 0xFF00) >> 8);
-		write_buffer[1] = (0x00 | (i & 0x00FF));
-		write_buffer[2] = 0x00;
-		memcpy(&write_buffer[3], fw_addr + (i * BYTE_PER_PAGE),
-		       bytes_to_transfer);
-		ret = send_i2c_cmd(fd, FPGA_WRITE, slaveId, write_buffer,
-				   read_buffer, bytes_to_transfer + 3, 1);
+	//Each message carries the 3 byte DPRAM address followed by up to burstSize bytes of payload,
+	//batchMsgs messages are sent per ioctl till the complete image is transferred
+	if (fpgaTransferConfig.deltaUpload) {
+		unsigned int pagesSent = 0;
+
+		ret = writeFpgaDpramDelta(fd, slaveId, fw_addr, fw_size,
+					  &pagesSent);
+		fprintf(stdout, "Delta upload: %u of %zu pages sent\n",
+			pagesSent, (fw_size + BYTE_PER_PAGE - 1) / BYTE_PER_PAGE);
+	} else {
+		ret = writeFpgaDpram(fd, slaveId, 0, fw_addr, fw_size);
+	}
+	if (ret) {
+		return ret;
+	}
+	if (fpgaTransferConfig.verifyUpload) {
+		unsigned int pagesResent = 0;
+
+		ret = verifyFpgaDpram(fd, slaveId, fw_addr, fw_size,
+				      &pagesResent);
+		fprintf(stdout, "DPRAM verify: %u pages re-sent\n",
+			pagesResent);
 		if (ret) {
-			fprintf(stderr,
-				"FW update FPGA_WRITE failed write_buffer: 0x%x 0x%x 0x%x\n",
-				write_buffer[0], write_buffer[1],
-				write_buffer[2]);
 			return ret;
 		}
 	}
-	fprintf(stdout, "Image copy to FPGA completed 0x%x \n", read_buffer[0]);
+	fprintf(stdout, "Image copy to FPGA completed\n");
+	return 0;
+}
+
+/********************************************************************
+ * setFpgaImageInfo()
+ *
+ * Write and read back image size and CRC32 in the FPGA control
+ * registers, last step before an update can be triggered
+ *
+ * fd: file describe
+ * slaveId: FPGA I2C controller slave id
+ * fw_size: image length
+ * fw_crc32: CRC32 of the image
+ *
+ * RETURN: 0 if success
+ ********************************************************************/
+int setFpgaImageInfo(int fd, unsigned int slaveId, size_t fw_size,
+		     unsigned int fw_crc32)
+{
+	int ret = -1;
+	unsigned char read_buffer[READ_BUF_SIZE] = { 0 };
 
 	// 6. Copy Image size to 0x04_0000
 	fprintf(stdout, " Copy Image size...\n");
-	memset(write_buffer, 0x00, sizeof(write_buffer));
-	memset(read_buffer, 0x00, sizeof(read_buffer));
-	//Write to FPGA register @ 0x02_ABCD-> 0x02(BYTE2) -> 0xAB(BYTE1) -> 0xCD(BYTE0)
-	write_buffer[0] = ((FPGA_IMG_SIZE_REG & BYTE2) >> 16); //0x04;
-	write_buffer[1] = ((FPGA_IMG_SIZE_REG & BYTE1) >> 8); //0x00;
-	write_buffer[2] = ((FPGA_IMG_SIZE_REG & BYTE0) >> 0); //0x00;
-
-	//payload -> wdata1(LSB) -> wdata2 -> wdata3 -> wdata4 (MSB)
-	write_buffer[3] = ((fw_size & BYTE0) >> 0);
-	write_buffer[4] = ((fw_size & BYTE1) >> 8);
-	write_buffer[5] = ((fw_size & BYTE2) >> 16);
-	write_buffer[6] = ((fw_size & BYTE3) >> 24);
-
-	for (int index = 3; index < 7; index++) {
-		debug_print("# Retimer %d 0x%lx write_buffer: 0x%x\n", index,
-			    (long int)fw_size, write_buffer[index]);
-	}
-
-	ret = send_i2c_cmd(fd, FPGA_WRITE, slaveId, write_buffer, 0, 7, 0);
+	debug_print("# Retimer image size 0x%lx\n", (long int)fw_size);
+	ret = writeFpgaReg(fd, slaveId, FPGA_IMG_SIZE_REG, fw_size);
 	if (ret) {
-		fprintf(stderr,
-			"FW update FPGA_WRITE failed write_buffer: 0x%x 0x%x 0x%x\n",
-			write_buffer[0], write_buffer[1], write_buffer[2]);
 		return ret;
 	}
 
 	// Verify Write
 	fprintf(stdout, "Read Image Size.\n");
-	memset(write_buffer, 0x00, sizeof(write_buffer));
-	memset(read_buffer, 0x00, sizeof(read_buffer));
-	write_buffer[0] = ((FPGA_IMG_SIZE_REG & BYTE2) >> 16); //0x04;
-	write_buffer[1] = ((FPGA_IMG_SIZE_REG & BYTE1) >> 8); //0x00;
-	write_buffer[2] = ((FPGA_IMG_SIZE_REG & BYTE0) >> 0); //0x00;
-
-	ret = send_i2c_cmd(fd, FPGA_READ, slaveId, write_buffer, read_buffer, 3,
-			   4);
+	ret = readFpgaReg(fd, slaveId, FPGA_IMG_SIZE_REG, read_buffer);
 	if (ret) {
-		fprintf(stderr,
-			"FW update FPGA_READ failed write_buffer: 0x%x 0x%x 0x%x\n",
-			write_buffer[0], write_buffer[1], write_buffer[2]);
 		return ret;
 	}
 
@@ -1066,42 +2446,14 @@ int copyImageFromMemToFpga(const unsigned char *fw_addr, size_t fw_size,
 
 	//Copy CheckSum size to 0x04_0004
 	fprintf(stdout, "Copy CheckSum ...\n");
-	memset(write_buffer, 0x00, sizeof(write_buffer));
-	memset(read_buffer, 0x00, sizeof(read_buffer));
-	//Write to FPGA register @ 0x02_ABCD-> 0x02(BYTE2) -> 0xAB(BYTE1) -> 0xCD(BYTE0)
-	write_buffer[0] = ((FPGA_CHKSUM_REG & BYTE2) >> 16); //0x04;
-	write_buffer[1] = ((FPGA_CHKSUM_REG & BYTE1) >> 8); //0x00;
-	write_buffer[2] = ((FPGA_CHKSUM_REG & BYTE0) >> 0); //0x04;
-
-	//crc 32
-	//payload -> wdata1(LSB) -> wdata2 -> wdata3 -> wdata4 (MSB)
-	write_buffer[3] = ((fw_crc32 & BYTE0) >> 0);
-	write_buffer[4] = ((fw_crc32 & BYTE1) >> 8);
-	write_buffer[5] = ((fw_crc32 & BYTE2) >> 16);
-	write_buffer[6] = ((fw_crc32 & BYTE3) >> 24);
-
-	ret = send_i2c_cmd(fd, FPGA_WRITE, slaveId, write_buffer, 0, 7, 0);
+	ret = writeFpgaReg(fd, slaveId, FPGA_CHKSUM_REG, fw_crc32);
 	if (ret) {
-		fprintf(stderr,
-			"FW update FPGA_WRITE failed write_buffer: 0x%x 0x%x 0x%x\n",
-			write_buffer[0], write_buffer[1], write_buffer[2]);
 		return ret;
 	}
 
 	fprintf(stdout, "Read Checksum .\n");
-	memset(write_buffer, 0x00, sizeof(write_buffer));
-	memset(read_buffer, 0x00, sizeof(read_buffer));
-	//Write to FPGA register @ 0x02_ABCD-> 0x02(BYTE2) -> 0xAB(BYTE1) -> 0xCD(BYTE0)
-	write_buffer[0] = ((FPGA_CHKSUM_REG & BYTE2) >> 16); //0x04;
-	write_buffer[1] = ((FPGA_CHKSUM_REG & BYTE1) >> 8); //0x00;
-	write_buffer[2] = ((FPGA_CHKSUM_REG & BYTE0) >> 0); //0x04;
-
-	ret = send_i2c_cmd(fd, FPGA_READ, slaveId, write_buffer, read_buffer,
-			   W_BYTE_COUNT, R_BYTE_COUNT);
+	ret = readFpgaReg(fd, slaveId, FPGA_CHKSUM_REG, read_buffer);
 	if (ret) {
-		fprintf(stderr,
-			"FW update FPGA_READ failed write_buffer: 0x%x 0x%x 0x%x\n",
-			write_buffer[0], write_buffer[1], write_buffer[2]);
 		return ret;
 	}
 
@@ -1112,6 +2464,126 @@ int copyImageFromMemToFpga(const unsigned char *fw_addr, size_t fw_size,
 	return 0;
 }
 
+/********************************************************************
+ * copyImageFromMemToFpga()
+ *
+ * Load FW from memory buffer
+ * Calculate CRC32 and update CRC32 value in FPGA control register
+ * Copy FW image from memory to DPRAM
+ *
+ * fw_addr: address in memory of retimer FW
+ * fd: file describe
+ * slaveId: FPGA I2C controller slave id
+ *
+ * RETURN: 0 if success
+ ********************************************************************/
+
+int copyImageFromMemToFpga(const unsigned char *fw_addr, size_t fw_size,
+			   unsigned int fw_crc32, int fd, unsigned int slaveId)
+{
+	int ret = uploadImageToFpga(fw_addr, fw_size, fd, slaveId);
+
+	if (ret) {
+		return ret;
+	}
+	return setFpgaImageInfo(fd, slaveId, fw_size, fw_crc32);
+}
+
+/********************************************************************
+ * readFpgaDpramPages()
+ *
+ * Stream FPGA DPRAM to a sink, sink is called once per 256 byte
+ * page in address order as soon as the page arrived. Only one
+ * batch of pages is buffered.
+ *
+ * fd: file descriptor
+ * slaveId: FPGA I2C controller slave id
+ * offset: DPRAM start offset, page aligned
+ * len: number of bytes, the last page may be partial
+ * sink: consumer, a non zero return aborts the readback
+ * sinkCtx: passed to sink
+ *
+ * RETURN: 0 if success, sink return value if it aborted
+ ********************************************************************/
+int readFpgaDpramPages(int fd, unsigned int slaveId, size_t offset,
+		       size_t len, DpramPageSink sink, void *sinkCtx)
+{
+	unsigned int pairs = xferBatchMsgs() / 2;
+	size_t batch = xferChunkSize() * (pairs ? pairs : 1);
+	unsigned char *buf = NULL;
+	size_t done = 0;
+	int ret = 0;
+
+	if (!sink || offset % BYTE_PER_PAGE || len == 0) {
+		return -ERROR_INPUT_ARGUMENTS;
+	}
+	if (batch > len) {
+		batch = len;
+	}
+	buf = malloc(batch);
+	if (!buf) {
+		return -ERROR_MALLOC_FAILURE;
+	}
+
+	while (!ret && done < len) {
+		size_t bytes = len - done < batch ? len - done : batch;
+
+		ret = readFpgaDpram(fd, slaveId, offset + done, buf, bytes);
+		for (size_t page = 0; !ret && page < bytes;
+		     page += BYTE_PER_PAGE) {
+			size_t n = bytes - page < BYTE_PER_PAGE ? bytes - page :
+								  BYTE_PER_PAGE;
+
+			ret = sink(sinkCtx, offset + done + page, buf + page, n);
+		}
+		done += bytes;
+	}
+
+	free(buf);
+	return ret;
+}
+
+static int memPageSink(void *ctx, size_t offset, const unsigned char *data,
+		       size_t len)
+{
+	memcpy((unsigned char *)ctx + offset, data, len);
+	return 0;
+}
+
+/********************************************************************
+ * copyImageFromFpgaToMem()
+ *
+ * Copy DPRAM from offset 0 into a caller buffer
+ *
+ * fd: file descriptor
+ * slaveId: FPGA I2C controller slave id
+ * dst: outgoing, len bytes
+ * len: number of bytes, at most MAX_FW_IMAGE_SIZE
+ *
+ * RETURN: 0 if success
+ ********************************************************************/
+int copyImageFromFpgaToMem(int fd, unsigned int slaveId, unsigned char *dst,
+			   size_t len)
+{
+	if (!dst || len > MAX_FW_IMAGE_SIZE) {
+		return -ERROR_INPUT_ARGUMENTS;
+	}
+	return readFpgaDpramPages(fd, slaveId, 0, len, memPageSink, dst);
+}
+
+static int filePageSink(void *ctx, size_t offset, const unsigned char *data,
+			size_t len)
+{
+	int fw_fd = *(int *)ctx;
+
+	if (pwrite(fw_fd, data, len, offset) != (ssize_t)len) {
+		fprintf(stderr, "unable to write FW file error %s \n",
+			strerror(errno));
+		return -ERROR_OPEN_FIRMWARE;
+	}
+	return 0;
+}
+
 /********************************************************************
  * copyImageFromFpga()
  *
@@ -1127,11 +2599,6 @@ int copyImageFromMemToFpga(const unsigned char *fw_addr, size_t fw_size,
 int copyImageFromFpga(int fw_fd, int fd, unsigned int slaveId)
 {
 	struct stat st;
-	unsigned char *fw_buf = NULL;
-	int ret = -1;
-	unsigned char write_buffer[WRITE_BUF_SIZE] = { 0 };
-	unsigned char read_buffer[BYTE_PER_PAGE] = { 0 };
-	unsigned int pageCount = 0;
 
 	if (fstat(fw_fd, &st)) {
 		fprintf(stderr, "\nfstat error: [%s]\n", strerror(errno));
@@ -1146,148 +2613,92 @@ int copyImageFromFpga(int fw_fd, int fd, unsigned int slaveId)
 		return -ERROR_WRONG_FIRMWARE;
 	}
 
-	fw_buf = (unsigned char *)malloc(st.st_size);
-
-	memset(fw_buf, 0, st.st_size);
+	//Stream DPRAM 0x0_0000 page by page into the file,
+	//batchMsgs / 2 address+read message pairs are sent per ioctl
+	return readFpgaDpramPages(fd, slaveId, 0, st.st_size, filePageSink,
+				  &fw_fd);
+}
+/*******************************************************************************
+ * checkStatusError()
+ *
+ * Collect the retimers of one status byte. A byte with every retimer
+ * set is logged once, as HGX_FW_PCIeRetimer_8.
+ *
+ * status: error bit per retimer
+ * retimer: outgoing, failing retimers of status are added
+ *
+ * RETURN: ERROR code formed as (err | (failing retimers of status))
+ *
+ ******************************************************************************/
+static int checkStatusError(uint8_t status, RetimerBitmap *retimer, int err,
+			    char *what, char *arg1, char *resolution)
+{
+	RetimerBitmap present = retimerAllMask();
+	char arg[MAX_NAME_SIZE] = { 0 };
 
-	if (fw_buf == NULL) {
-		return -ERROR_MALLOC_FAILURE;
+	status &= present;
+	*retimer = *retimer | status;
+	if (status && status == present) {
+		fprintf(stderr, "Retimer %s error...%u retimer 0x%x\n", what,
+			RETIMER_MAX_NUM, *retimer);
+		snprintf(arg, sizeof(arg), RETIMER_NAME_FMT, RETIMER_MAX_NUM);
+		genericMessageRegistry(
+			"ResourceEvent.1.0.ResourceErrorsDetected", arg, arg1,
+			"xyz.openbmc_project.Logging.Entry.Level.Critical",
+			resolution);
+		return err | status;
 	}
-
-	pageCount = ((unsigned int)st.st_size / BYTE_PER_PAGE);
-	//Copy FW image to FPGA DP RAM 0x0_0000
-	//Write to DPRAM address to write_buffer0, write_buffer1, write_buffer 2 and then 256 bytes of payload till pageCount
-	for (uint32_t i = 0; i < pageCount; i++) {
-		memset(write_buffer, 0x00, sizeof(write_buffer));
-		memset(read_buffer, 0x00, sizeof(read_buffer));
-		write_buffer[0] = (0x00 | (i & 0xFF00) >> 8);
-		write_buffer[1] = (0x00 | (i & 0x00FF));
-		write_buffer[2] = 0x00;
-		memcpy(&write_buffer[3], fw_buf + (i * BYTE_PER_PAGE),
-		       BYTE_PER_PAGE);
-		ret = send_i2c_cmd(fd, FPGA_READ, slaveId, write_buffer,
-				   read_buffer, W_BYTE_COUNT, BYTE_PER_PAGE);
-		if (ret) {
+	for (int i = retimerCount - 1; i >= 0; i--) {
+		if (status & RETIMER_BIT(i)) {
 			fprintf(stderr,
-				"FW update FPGA_WRITE failed write_buffer: 0x%x 0x%x 0x%x\n",
-				write_buffer[0], write_buffer[1],
-				write_buffer[2]);
-			free(fw_buf);
-			return ret;
+				"Retimer %s error...%d retimer 0x%x\n", what, i,
+				*retimer);
+			retimerName(i, arg, sizeof(arg));
+			genericMessageRegistry(
+				"ResourceEvent.1.0.ResourceErrorsDetected", arg,
+				arg1,
+				"xyz.openbmc_project.Logging.Entry.Level.Critical",
+				resolution);
 		}
-
-		memcpy(fw_buf + (i * BYTE_PER_PAGE), &read_buffer[0],
-		       BYTE_PER_PAGE);
-	}
-	lseek(fw_fd, 0, 0);
-	ret = write(fw_fd, fw_buf, st.st_size);
-	if (ret < 0) {
-		fprintf(stderr, "ret:%d  unable to read FW file error %s \n",
-			ret, strerror(errno));
-		close(fw_fd);
-		free(fw_buf);
-		return -ERROR_OPEN_FIRMWARE;
 	}
 
-	free(fw_buf);
-	return 0;
+	return err | status;
 }
+
 /*******************************************************************************
  * checkWriteNackError()
  *
  * status: Write NACK error bit 15-8 of "EEprom Update/Verify Control Status Register"
- * mask:
- * retimer: Failure seen for retimer number 0-7 & 8 for all
+ * retimer: Failure seen for retimer number 0-(getRetimerCount() - 1)
  *
  * RETURN: ERROR code formed as (ERROR_WRITE_NACK | (Retimer Number))
  *
  ******************************************************************************/
 
-int checkWriteNackError(uint8_t status, const uint8_t mask[], uint8_t *retimer)
+int checkWriteNackError(uint8_t status, RetimerBitmap *retimer)
 {
-	int ret = -ERROR_WRITE_NACK;
-	char arg[MAX_NAME_SIZE] = { 0 };
-	// read NACK error
-	for (int i = 8; i >= 0; i--) {
-		if ((i == 8) && ((status & mask[i]) == 0xFF)) {
-			*retimer = *retimer | mask[i];
-			fprintf(stderr,
-				"Retimer WRITE NACK error...%d retimer 0x%x\n",
-				i, *retimer);
-			sprintf(arg, "HGX_FW_PCIeRetimer_%d", i);
-			genericMessageRegistry(
-				"ResourceEvent.1.0.ResourceErrorsDetected", arg,
-				"Write Nack Error",
-				"xyz.openbmc_project.Logging.Entry.Level.Critical",
-				"Perform Power Cycle of HGX baseboard and retry the firmware update");
-			break;
-		}
-		if (((status & mask[i]) >> i) == 1) {
-			*retimer = *retimer | mask[i];
-			fprintf(stderr,
-				"Retimer WRITE NACK error...%d retimer 0x%x\n",
-				i, *retimer);
-			sprintf(arg, "HGX_FW_PCIeRetimer_%d", i);
-			genericMessageRegistry(
-				"ResourceEvent.1.0.ResourceErrorsDetected", arg,
-				"Write Nack ERROR",
-				"xyz.openbmc_project.Logging.Entry.Level.Critical",
-				"Perform Power Cycle of HGX baseboard and retry the firmware update");
-		}
-	}
-
-	ret = (ret | (*retimer & 0xFF));
-
-	return ret;
+	return checkStatusError(
+		status, retimer, -ERROR_WRITE_NACK, "WRITE NACK",
+		"Write Nack Error",
+		"Perform Power Cycle of HGX baseboard and retry the firmware update");
 }
 
 /*******************************************************************************
  * checkReadNackError()
  *
  * status: Read NACK error bit 23-16 of "EEprom Update/Verify Control Status Register
- * mask: retimer number
- * retimer: Failure seen for retimer number 0-7 & 8 for all
+ * retimer: Failure seen for retimer number 0-(getRetimerCount() - 1)
  *
  * RETURN: ERROR code formed as (ERROR_READ_NACK | (Retimer Number))
  *
  ******************************************************************************/
 
-int checkReadNackError(uint8_t status, const uint8_t mask[], uint8_t *retimer)
+int checkReadNackError(uint8_t status, RetimerBitmap *retimer)
 {
-	int ret = -ERROR_READ_NACK;
-	char arg[MAX_NAME_SIZE] = { 0 };
-	// read NACK error
-	for (int i = 8; i >= 0; i--) {
-		if ((i == 8) && ((status & mask[i]) == 0xFF)) {
-			*retimer = *retimer | mask[i];
-			fprintf(stderr,
-				"Retimer READ NACK error...%d retimer 0x%x\n",
-				i, *retimer);
-			sprintf(arg, "HGX_FW_PCIeRetimer_%d", i);
-			genericMessageRegistry(
-				"ResourceEvent.1.0.ResourceErrorsDetected", arg,
-				"Read NACK Error",
-				"xyz.openbmc_project.Logging.Entry.Level.Critical",
-				"Perform Power Cycle of HGX baseboard and retry the firmware update");
-			break;
-		}
-		if (((status & mask[i]) >> i) == 1) {
-			*retimer = *retimer | mask[i];
-			fprintf(stderr,
-				"Retimer READ NACK error...%d retimer 0x%x\n",
-				i, *retimer);
-			sprintf(arg, "HGX_FW_PCIeRetimer_%d", i);
-			genericMessageRegistry(
-				"ResourceEvent.1.0.ResourceErrorsDetected", arg,
-				"Read NACK Error",
-				"xyz.openbmc_project.Logging.Entry.Level.Critical",
-				"Perform Power Cycle of HGX baseboard and retry the firmware update");
-		}
-	}
-
-	ret = (ret | (*retimer & 0xFF));
-
-	return ret;
+	return checkStatusError(
+		status, retimer, -ERROR_READ_NACK, "READ NACK",
+		"Read NACK Error",
+		"Perform Power Cycle of HGX baseboard and retry the firmware update");
 }
 
 /******************************************************************************
@@ -1295,48 +2706,16 @@ int checkReadNackError(uint8_t status, const uint8_t mask[], uint8_t *retimer)
  *
  * status: Retimer EEprom verify checksum status
  *         bit 31-24 of "EEprom Update/Verify Control Status Register"
- * mask: retimer number
- * retimer: Failure seen for retimer number 0-7 & 8 for all
+ * retimer: Failure seen for retimer number 0-(getRetimerCount() - 1)
  *
  * RETURN: ERROR code formed as (ERROR_CHECKSUM | (Retimer Number))
  *
  ******************************************************************************/
-int checkChecksumError(uint8_t status, const uint8_t mask[], uint8_t *retimer)
+int checkChecksumError(uint8_t status, RetimerBitmap *retimer)
 {
-	int ret = -ERROR_CHECKSUM;
-	char arg[MAX_NAME_SIZE] = { 0 };
-	// read CheckSum error
-	for (int i = 8; i >= 0; i--) {
-		if ((i == 8) && ((status & mask[i]) == 0xFF)) {
-			*retimer = *retimer | mask[i];
-			fprintf(stderr,
-				"Retimer CheckSum error...%d retimer 0x%x\n", i,
-				*retimer);
-			sprintf(arg, "HGX_FW_PCIeRetimer_%d", i);
-			genericMessageRegistry(
-				"ResourceEvent.1.0.ResourceErrorsDetected", arg,
-				"CheckSum mismatch",
-				"xyz.openbmc_project.Logging.Entry.Level.Critical",
-				"Retry the Retimer FW update");
-			break;
-		}
-		if (((status & mask[i]) >> i) == 1) {
-			*retimer = *retimer | mask[i];
-			fprintf(stderr,
-				"Retimer CheckSum error...%d retimer 0x%x\n", i,
-				*retimer);
-			sprintf(arg, "HGX_FW_PCIeRetimer_%d", i);
-			genericMessageRegistry(
-				"ResourceEvent.1.0.ResourceErrorsDetected", arg,
-				"CheckSum mismatch",
-				"xyz.openbmc_project.Logging.Entry.Level.Critical",
+	return checkStatusError(status, retimer, -ERROR_CHECKSUM,
+				"CheckSum", "CheckSum mismatch",
 				"Retry the Retimer FW update");
-		}
-	}
-
-	ret = (ret | (*retimer & 0xFF));
-
-	return ret;
 }
 
 /********************************************************************
@@ -1345,282 +2724,401 @@ int checkChecksumError(uint8_t status, const uint8_t mask[], uint8_t *retimer)
  * Trigger Retimer FW update for passed RetimerNumber
  *
  * fd: file descriptor
- * retimerNumber: update retimer 0-7 or all
+ * retimerNumber: bitmap of the retimers to update
  * versionStr: versions string of the retimer FW (for log messages)
  *
  * RETURN: 0 if success
  ********************************************************************/
-int startRetimerFwUpdate(int fd, uint8_t retimerNumber, char *versionStr,
-			 uint8_t *retimerNotupdated)
+int startRetimerFwUpdate(int fd, RetimerBitmap retimerNumber,
+			 char *versionStr, RetimerBitmap *retimerNotupdated)
 {
-	unsigned char write_buffer[WRITE_BUF_SIZE] = { 0 };
-	unsigned char read_buffer[READ_BUF_SIZE] = { 0 };
+	FpgaOp op;
+	int ret;
+
+	initFpgaUpdateOp(&op, fd, retimerNumber, versionStr);
+	ret = runFpgaOp(&op);
+	if (op.retried) {
+		*retimerNotupdated = op.notUpdated;
+	}
+	return ret;
+}
+
+/********************************************************************
+ * readRetimerfw()
+ *
+ * Trigger Retimer Read for passed RetimerNumber
+ *
+ * fd: file descriptor
+ * retimerNumber: index of the retimer to read
+ *
+ * RETURN: 0 if success
+ ********************************************************************/
+int readRetimerfw(int fd, uint8_t retimerNumber)
+{
+	FpgaOp op;
+
+	initFpgaReadOp(&op, fd, retimerNumber);
+	return runFpgaOp(&op);
+}
+
+/********************************************************************
+ * readRetimerFwRange()
+ *
+ * Read part of a retimer image. The FPGA still copies the EEPROM
+ * into DPRAM, but only the DPRAM pages covering the range are
+ * cleared beforehand and read back over I2C. Size and checksum
+ * registers are programmed as by clearFpgaDpram(), the FPGA sees
+ * the same register state as for a full read.
+ *
+ * fd: file descriptor
+ * retimerNumber: retimer index
+ * offset: image offset
+ * dst: outgoing, len bytes of image data
+ * len: number of bytes
+ *
+ * RETURN: 0 if success
+ ********************************************************************/
+int readRetimerFwRange(int fd, uint8_t retimerNumber, size_t offset,
+		       unsigned char *dst, size_t len)
+{
+	size_t first = offset & ~(size_t)(BYTE_PER_PAGE - 1);
+	size_t end;
+	unsigned char *pages = NULL;
 	int ret = 0;
 
-	// 8. Trigger update to 0x04_0008
-	fprintf(stdout, "Trigger FW update...retimerNumber %d \n",
-		retimerNumber);
-	// Trigger FW update
-	for (uint8_t updateRetryCount = 0;
-	     updateRetryCount < MAX_UPDATE_RETRYCOUNT; updateRetryCount++) {
-		fprintf(stdout, "Trigger FW update...\n");
-		memset(write_buffer, 0x00, sizeof(write_buffer));
-		memset(read_buffer, 0x00, sizeof(read_buffer));
-		//Write to FPGA register @ 0x02_ABCD-> 0x02(BYTE2) -> 0xAB(BYTE1) -> 0xCD(BYTE0)
-		write_buffer[0] =
-			((FPGA_UPDATE_STATUS_REG & BYTE2) >> 16); //0x04;
-		write_buffer[1] =
-			((FPGA_UPDATE_STATUS_REG & BYTE1) >> 8); //0x00;
-		write_buffer[2] =
-			((FPGA_UPDATE_STATUS_REG & BYTE0) >> 0); //0x08;
-
-		write_buffer[3] =
-			retimerNumber; // Initiate FW update use Update4Retimer
-		write_buffer[4] = 0x00;
-		write_buffer[5] = 0x00;
-		write_buffer[6] = 0x00;
-		// Trigger update, writing 3 bytes address followed by 4 bytes 4 bytes 4 bytes 4 bytes value in FPGA Update control register to trigger update for retimerNumber and reading back
-		// value from 0x04_0008 AKA FPGA_Control and udpate status register
-		ret = send_i2c_cmd(fd, FPGA_WRITE, FPGA_I2C_CNTRL_ADDR,
-				   write_buffer, read_buffer,
-				   W_BYTE_COUNT_WITHPAYLOAD, R_BYTE_COUNT);
-		if (ret) {
-			fprintf(stderr,
-				"Retimer Fw Update failed!!,send_i2c_cmd command failed with  %d errno %s ...\n",
-				ret, strerror(errno));
-			return ret;
+	if (!dst || len == 0 || offset >= MAX_FW_IMAGE_SIZE ||
+	    len > MAX_FW_IMAGE_SIZE - offset) {
+		return -ERROR_INPUT_ARGUMENTS;
+	}
+	// whole pages, a chunk never crosses a page without auto-increment
+	end = (offset + len + BYTE_PER_PAGE - 1) &
+	      ~(size_t)(BYTE_PER_PAGE - 1);
+	pages = malloc(end - first);
+	if (!pages) {
+		return -ERROR_MALLOC_FAILURE;
+	}
+
+	// a failed read must not return what an earlier read left in DPRAM
+	if (!fpgaTransferConfig.skipReadClear) {
+		ret = zeroFpgaDpram(fd, getFpgaCntrlAddr(), first,
+				    end - first);
+		if (!ret) {
+			ret = setFpgaImageInfo(fd, getFpgaCntrlAddr(),
+					       MAX_FW_IMAGE_SIZE,
+					       zeroImageCrc());
 		}
+	}
+	if (!ret) {
+		ret = readRetimerfw(fd, retimerNumber);
+	}
+	if (!ret) {
+		ret = readFpgaDpram(fd, getFpgaCntrlAddr(), first, pages,
+				    end - first);
+	}
+	if (!ret) {
+		memcpy(dst, pages + (offset - first), len);
+	}
+	free(pages);
+	return ret;
+}
 
-		// 9. Monitor update progress by reading to 0x04_0008
-		fprintf(stdout, "Monitor FW update...updateRetryCount %d \n",
-			updateRetryCount);
+typedef struct {
+	const unsigned char *src;
+	unsigned char *bad;
+	unsigned int badPages;
+} DpramVerifyCtx;
 
-		uint8_t timeout = 0;
-		do {
-			if (timeout >= MAX_TIMEOUT_SEC) {
-				fprintf(stderr,
-					"Retimer FW update : Timeout!!, update still not completed for retimer %d...\n",
-					retimerNumber);
-				break;
-			}
-			usleep(DELAY_1SEC); // sleep for 1 second
-
-			memset(write_buffer, 0x00, sizeof(write_buffer));
-			memset(read_buffer, 0x00, sizeof(read_buffer));
-			//Write to FPGA register @ 0x02_ABCD-> 0x02(BYTE2) -> 0xAB(BYTE1) -> 0xCD(BYTE0)
-			write_buffer[0] = ((FPGA_UPDATE_STATUS_REG & BYTE2) >>
-					   16); //0x04;
-			write_buffer[1] =
-				((FPGA_UPDATE_STATUS_REG & BYTE1) >> 8); //0x00;
-			write_buffer[2] =
-				((FPGA_UPDATE_STATUS_REG & BYTE0) >> 0); //0x08;
-
-			ret = send_i2c_cmd(fd, FPGA_READ, FPGA_I2C_CNTRL_ADDR,
-					   write_buffer, read_buffer,
-					   W_BYTE_COUNT, R_BYTE_COUNT);
-			if (ret) {
-				fprintf(stderr,
-					"Retimer FW update failed!!,send_i2c_cmd command failed with  %d errno %s ...\n",
-					ret, strerror(errno));
-				return ret;
-			}
+static int verifyPageSink(void *ctx, size_t offset, const unsigned char *data,
+			  size_t len)
+{
+	DpramVerifyCtx *v = ctx;
+	size_t page = offset / BYTE_PER_PAGE;
 
-			fprintf(stdout,
-				"FW update out: 0x%x 0x%x 0x%x 0x%x 0x%x\n",
-				read_buffer[0], read_buffer[1], read_buffer[2],
-				read_buffer[3], retimerNumber);
-			timeout++;
-
-		} while (read_buffer[0] != FW_UPDATE_COMPLETE_FLAG);
-
-		// read status register and check for any error in read, write and verify stage
-		uint8_t status_verfication = read_buffer[0];
-		uint8_t status_writeNack = read_buffer[1];
-		uint8_t status_readNack = read_buffer[2];
-		uint8_t status_checksum = read_buffer[3];
-		uint8_t retryUpdate4Retimer = 0;
-
-		if (status_verfication || status_writeNack || status_readNack ||
-		    status_checksum) {
-			fprintf(stdout,
-				"FW update...completed, checking status !!! \n");
-			if (status_writeNack) {
-				ret = checkWriteNackError(status_writeNack,
-							  mask_retimer,
-							  &retryUpdate4Retimer);
-				prepareMessageRegistry(
-					retryUpdate4Retimer, "TransferFailed",
-					versionStr, MSG_REG_VER_FOLLOWED_BY_DEV,
-					"xyz.openbmc_project.Logging.Entry.Level.Critical",
-					"Reach out to the NVIDIA support team for further action",
-					0);
-			}
-			if (status_readNack) {
-				ret |= checkReadNackError(status_readNack,
-							  mask_retimer,
-							  &retryUpdate4Retimer);
-				prepareMessageRegistry(
-					retryUpdate4Retimer,
-					"VerificationFailed", versionStr,
-					MSG_REG_VER_FOLLOWED_BY_DEV,
-					"xyz.openbmc_project.Logging.Entry.Level.Critical",
-					"Reach out to the NVIDIA support team for further action",
-					0);
-			}
+	v->bad[page] = memcmp(v->src + offset, data, len) != 0;
+	if (v->bad[page] && ++v->badPages > DPRAM_VERIFY_MAX_BAD_PAGES) {
+		// page re-sends will not fix a systematic transfer problem
+		return -ERROR_TRANS_PAGE;
+	}
+	return 0;
+}
 
-			if (status_checksum) {
-				ret |= checkChecksumError(status_checksum,
-							  mask_retimer,
-							  &retryUpdate4Retimer);
-				prepareMessageRegistry(
-					retryUpdate4Retimer,
-					"VerificationFailed", versionStr,
-					MSG_REG_VER_FOLLOWED_BY_DEV,
-					"xyz.openbmc_project.Logging.Entry.Level.Critical",
-					"Reach out to the NVIDIA support team for further action",
-					0);
-			}
+/********************************************************************
+ * forEachBadRun()
+ *
+ * Read back (resend false) or re-send (resend true) every run of
+ * consecutive pages marked bad
+ *
+ * RETURN: 0 if success
+ ********************************************************************/
+static int forEachBadRun(int fd, unsigned int slaveId, DpramVerifyCtx *v,
+			 size_t len, bool resend, unsigned int *pagesResent)
+{
+	size_t pages = (len + BYTE_PER_PAGE - 1) / BYTE_PER_PAGE;
+	size_t page = 0;
+	int ret = 0;
 
-			// Check ExtenededI2CErrorRegister
-			if (checkExtenedErrorReg() < 0) {
-				fprintf(stderr,
-					" unable to parse extended error register %s \n",
-					strerror(errno));
-				return -ERROR_OPEN_FIRMWARE;
-			}
+	while (!ret && page < pages) {
+		size_t end = page;
+		size_t start = page * BYTE_PER_PAGE;
+		size_t bytes;
 
-			retimerNumber = retryUpdate4Retimer;
-			*retimerNotupdated = retryUpdate4Retimer;
-			fprintf(stderr,
-				"FW update...not succeeded, Retry !!! \n");
+		if (!v->bad[page]) {
+			page++;
+			continue;
+		}
+		while (end < pages && v->bad[end]) {
+			end++;
+		}
+		bytes = (end * BYTE_PER_PAGE < len ? end * BYTE_PER_PAGE :
+						     len) -
+			start;
+		if (resend) {
+			ret = writeFpgaDpram(fd, slaveId, start, v->src + start,
+					     bytes);
+			*pagesResent += end - page;
 		} else {
-			fprintf(stdout,
-				"FW update...completed, No Retry !!! \n");
-			break;
+			ret = readFpgaDpramPages(fd, slaveId, start, bytes,
+						 verifyPageSink, v);
 		}
-		// End of retry loop for FW update
+		page = end;
 	}
 	return ret;
 }
 
 /********************************************************************
- * readRetimerfw()
+ * verifyFpgaDpram()
  *
- * Trigger Retimer Read for passed RetimerNumber
+ * Read the uploaded image back from DPRAM, compare each page as it
+ * arrives and re-send only the pages that differ, up to
+ * fpgaTransferConfig.pageRetries rounds. Gives up on the first batch
+ * once more than DPRAM_VERIFY_MAX_BAD_PAGES pages differ.
+ *
+ * fd: file descriptor
+ * slaveId: FPGA I2C controller slave id
+ * src: image uploaded to DPRAM offset 0
+ * len: image length
+ * pagesResent: outgoing, number of pages written again
+ *
+ * RETURN: 0 if DPRAM holds the image, -ERROR_TRANS_PAGE on mismatch
+ ********************************************************************/
+int verifyFpgaDpram(int fd, unsigned int slaveId, const unsigned char *src,
+		    size_t len, unsigned int *pagesResent)
+{
+	DpramVerifyCtx v = { .src = src, .badPages = 0 };
+	unsigned int round = 0;
+	int ret;
+
+	*pagesResent = 0;
+	if (!src || len == 0 || len > MAX_FW_IMAGE_SIZE) {
+		return -ERROR_INPUT_ARGUMENTS;
+	}
+	v.bad = calloc((len + BYTE_PER_PAGE - 1) / BYTE_PER_PAGE, 1);
+	if (!v.bad) {
+		return -ERROR_MALLOC_FAILURE;
+	}
+
+	ret = readFpgaDpramPages(fd, slaveId, 0, len, verifyPageSink, &v);
+	for (; !ret && v.badPages && round < fpgaTransferConfig.pageRetries;
+	     round++) {
+		ret = forEachBadRun(fd, slaveId, &v, len, true, pagesResent);
+		v.badPages = 0;
+		if (!ret) {
+			ret = forEachBadRun(fd, slaveId, &v, len, false, NULL);
+		}
+	}
+	if (!ret && v.badPages) {
+		ret = -ERROR_TRANS_PAGE;
+	}
+	if (ret) {
+		fprintf(stderr,
+			"DPRAM verify failed after %u rounds, %u pages differ, error %d\n",
+			round, v.badPages, ret);
+		invalidateDpramShadow(fd, slaveId);
+	}
+
+	free(v.bad);
+	return ret;
+}
+
+/********************************************************************
+ * parseStr()
+ *
+ * Copy characters [startid, endid) of in to op, op is terminated
+ *
+ * RETURN: number of characters copied, -1 on invalid range
+ ********************************************************************/
+int parseStr(const char *in, int startid, int endid, char *op)
+{
+	if (!in || !op || startid < 0 || endid < startid ||
+	    (size_t)endid > strlen(in)) {
+		return -1;
+	}
+	memcpy(op, in + startid, endid - startid);
+	op[endid - startid] = '\0';
+	return endid - startid;
+}
+
+/********************************************************************
+ * readFwVersion()
+ *
+ * Format a raw firmware version record as major.minor.build
+ *
+ * str: RETIMER_FW_VERSION_SIZE bytes from FW_VERSION_OFFSET
+ * ver: outgoing, allocated version string (needs to be freed)
+ *
+ * RETURN: 0 if success, -ERROR_WRONG_FIRMWARE for a blank record
+ ********************************************************************/
+int readFwVersion(char *str, char **ver)
+{
+	const unsigned char *rec = (const unsigned char *)str;
+	bool blank = true;
+
+	*ver = NULL;
+	for (int i = 0; i < RETIMER_FW_VERSION_SIZE; i++) {
+		if (rec[i] != 0x00 && rec[i] != 0xFF) {
+			blank = false;
+		}
+	}
+	if (blank) {
+		return -ERROR_WRONG_FIRMWARE;
+	}
+	*ver = malloc(RETIMER_FW_VERSION_STR_LEN);
+	if (!*ver) {
+		return -ERROR_MALLOC_FAILURE;
+	}
+	snprintf(*ver, RETIMER_FW_VERSION_STR_LEN, "%u.%u.%u", rec[0], rec[1],
+		 rec[2] | (rec[3] << 8));
+	return 0;
+}
+
+/********************************************************************
+ * readRetimerFwVersion()
+ *
+ * Query the firmware version of one retimer by reading only the
+ * DPRAM page holding its version record. Platforms without a
+ * configured fw_version_offset have no version record.
  *
  * fd: file descriptor
- * retimerNumber: read one of the retimer out of 0 to 7
+ * retimerNumber: retimer index
+ * version: outgoing, major.minor.build
+ * len: size of version, at least RETIMER_FW_VERSION_STR_LEN
  *
  * RETURN: 0 if success
  ********************************************************************/
-int readRetimerfw(int fd, uint8_t retimerNumber)
+int readRetimerFwVersion(int fd, uint8_t retimerNumber, char *version,
+			 size_t len)
 {
-	unsigned char write_buffer[WRITE_BUF_SIZE] = { 0 };
-	unsigned char read_buffer[READ_BUF_SIZE] = { 0 };
-	int ret = 0;
+#ifndef FW_VERSION_OFFSET
+	(void)fd;
+	(void)version;
+	(void)len;
+	fprintf(stderr,
+		"Retimer %u version query disabled, fw_version_offset not configured\n",
+		retimerNumber);
+	return -ERROR_INPUT_ARGUMENTS;
+#else
+	char rec[RETIMER_FW_VERSION_SIZE];
+	char *ver = NULL;
+	int ret;
+
+	ret = readRetimerFwRange(fd, retimerNumber, FW_VERSION_OFFSET,
+				 (unsigned char *)rec, sizeof(rec));
+	if (ret) {
+		return ret;
+	}
+	ret = readFwVersion(rec, &ver);
+	if (ret) {
+		fprintf(stderr, "Retimer %u has no valid firmware version\n",
+			retimerNumber);
+		return ret;
+	}
+	snprintf(version, len, "%s", ver);
+	free(ver);
+	return 0;
+#endif
+}
 
-	// Trigger Retimer Read
-	for (uint8_t update4retimerCount = 0;
-	     update4retimerCount < MAX_UPDATE_RETRYCOUNT;
-	     update4retimerCount++) {
-		fprintf(stdout,
-			"Retimer FW Read : Initiate retimer read ...\n");
-		memset(write_buffer, 0x00, sizeof(write_buffer));
-		memset(read_buffer, 0x00, sizeof(read_buffer));
-		//Write to FPGA register @ 0x02_ABCD-> 0x02(BYTE2) -> 0xAB(BYTE1) -> 0xCD(BYTE0)
-		write_buffer[0] =
-			((FPGA_READ_STATUS_REG & BYTE2) >> 16); //0x04;
-		write_buffer[1] = ((FPGA_READ_STATUS_REG & BYTE1) >> 8); //0x00;
-		write_buffer[2] = ((FPGA_READ_STATUS_REG & BYTE0) >> 0); //0x0C;
-
-		//write number of byte to be read from retimer
-		write_buffer[3] =
-			((((retimerNumber)&NIBBLE) << 4) |
-			 (SET_RETIMER_FW_READ)); // trigger read for specified retimer
-		write_buffer[4] = 0x0;
-		write_buffer[5] = 0x0;
-		write_buffer[6] = 0x0;
-
-		// trigger retimer read
-		ret = send_i2c_cmd(fd, FPGA_WRITE, FPGA_I2C_CNTRL_ADDR,
-				   write_buffer, read_buffer,
-				   W_BYTE_COUNT_WITHPAYLOAD, R_BYTE_COUNT);
+static int crcPageSink(void *ctx, size_t offset, const unsigned char *data,
+		       size_t len)
+{
+	unsigned int *crc = ctx;
+
+	(void)offset;
+	while (len--) {
+		*crc = (*crc << 8) ^ crc32_table[((*crc >> 24) ^ *data++) & 255];
+	}
+	return 0;
+}
+
+/********************************************************************
+ * checkRetimerFwCurrent()
+ *
+ * Find out if a retimer already runs the image of an update
+ * operation. A versionString of the form major.minor.build is
+ * compared with the version record of the retimer. With readback
+ * any other versionString is compared by the CRC32 of the first
+ * imageLength bytes of the retimer image, which reads the whole
+ * EEPROM of the retimer into DPRAM and imageLength bytes over I2C.
+ *
+ * fd: file descriptor
+ * retimerNumber: retimer index
+ * imageMappedAddr: firmware file, used to compute a bare image CRC
+ * op: update operation
+ * readback: compare the image CRC if versionString is no version
+ * current: outgoing, true if the retimer needs no update
+ *
+ * RETURN: 0 if success, current is false on error
+ ********************************************************************/
+int checkRetimerFwCurrent(int fd, uint8_t retimerNumber,
+			  const unsigned char *imageMappedAddr,
+			  update_operation *op, bool readback, bool *current)
+{
+	char version[RETIMER_FW_VERSION_STR_LEN];
+	char target[RETIMER_FW_VERSION_STR_LEN];
+	unsigned int major, minor, build;
+	unsigned int crc = 0xFFFFFFFF;
+	char tail;
+	int ret;
+
+	*current = false;
+	if (sscanf(op->versionString, "%u.%u.%u%c", &major, &minor, &build,
+		   &tail) == 3) {
+		ret = readRetimerFwVersion(fd, retimerNumber, version,
+					   sizeof(version));
 		if (ret) {
-			fprintf(stderr,
-				"Retimer FW Read : failed!, send_i2c_cmd not completed for retimer %d...errno %s\n",
-				retimerNumber, strerror(errno));
 			return ret;
 		}
+		snprintf(target, sizeof(target), "%u.%u.%u", major, minor,
+			 build);
+		*current = strcmp(version, target) == 0;
+		debug_print("Retimer %u runs %s, component %s\n", retimerNumber,
+			    version, target);
+		return 0;
+	}
+	if (!readback) {
+		return 0;
+	}
 
-		fprintf(stdout, "out: 0x%x 0x%x 0x%x 0x%x 0x%x \n",
-			read_buffer[0], read_buffer[1], read_buffer[2],
-			read_buffer[3], retimerNumber);
-
-		// 9. Monitor FW read progress by reading to 0x04_000C
-		fprintf(stdout,
-			"Retimer FW Read : Monitor Read progress update...\n");
-
-		uint8_t timeout = 0;
-		do {
-			if (timeout >= MAX_TIMEOUT_SEC) {
-				fprintf(stderr,
-					"Retimer FW Read : Timeout!!, read still not completed for retimer %d...\n",
-					retimerNumber);
-				break;
-			}
-			usleep(DELAY_1SEC); // sleep for 1 second
-			fprintf(stdout,
-				"Retimer FW Read : Monitor Read progress update...\n");
-			memset(write_buffer, 0x00, sizeof(write_buffer));
-			memset(read_buffer, 0x00, sizeof(read_buffer));
-			//Write to FPGA register @ 0x02_ABCD-> 0x02(BYTE2) -> 0xAB(BYTE1) -> 0xCD(BYTE0)
-			write_buffer[0] =
-				((FPGA_READ_STATUS_REG & BYTE2) >> 16); //0x04;
-			write_buffer[1] =
-				((FPGA_READ_STATUS_REG & BYTE1) >> 8); //0x00;
-			write_buffer[2] =
-				((FPGA_READ_STATUS_REG & BYTE0) >> 0); //0x0C;
-
-			ret = send_i2c_cmd(fd, FPGA_READ, FPGA_I2C_CNTRL_ADDR,
-					   write_buffer, read_buffer,
-					   W_BYTE_COUNT, R_BYTE_COUNT);
-			if (ret) {
-				fprintf(stderr,
-					"Retimer FW Read : failed!, send_i2c_cmd not completed for retimer %d...errno %s\n",
-					retimerNumber, strerror(errno));
-				return ret;
-			}
-			debug_print(
-				"Retimer FW Read : out: 0x%x 0x%x 0x%x 0x%x %d\n",
-				read_buffer[0], read_buffer[1], read_buffer[2],
-				read_buffer[3], retimerNumber);
-			timeout++;
-		} while ((read_buffer[0] & FW_READ_STATUS_MASK) != 0x0);
-
-		uint8_t status_verification =
-			read_buffer[0] & FW_READ_STATUS_MASK;
-		uint8_t status_nackverification =
-			read_buffer[1] & FW_READ_NACK_MASK;
-
-		// read NACK error
-		if (status_verification == 0x0) {
-			if (status_nackverification) {
-				// set retimerNumber bit to 1 for retimer.
-				fprintf(stderr,
-					"Retimer FW Read : failed for Retimer %d : \n",
-					retimerNumber);
-				continue;
-			} else {
-				fprintf(stdout,
-					"Retimer FW Read : Retimer Read completed for Retimer %d \n",
-					retimerNumber);
-				break;
-			}
-		} else {
-			fprintf(stdout,
-				"Retimer FW Read : Timeout !!! read still not completed for retimer %d...\n",
-				retimerNumber);
+	// no comparable version, compare the image digest instead
+	if (op->crcFromData) {
+		ret = verifyUpdateOperation(imageMappedAddr, op);
+		if (ret) {
+			return ret;
 		}
 	}
-	return ret;
+	ret = clearFpgaDpram(fd, getFpgaCntrlAddr());
+	if (!ret) {
+		ret = readRetimerfw(fd, retimerNumber);
+	}
+	if (!ret) {
+		ret = readFpgaDpramPages(fd, getFpgaCntrlAddr(), 0,
+					 op->imageLength, crcPageSink, &crc);
+	}
+	if (ret) {
+		return ret;
+	}
+	*current = crc == op->imageCrc;
+	debug_print("Retimer %u image crc 0x%x, component 0x%x\n",
+		    retimerNumber, crc, op->imageCrc);
+	return 0;
 }
@@ -21,12 +21,20 @@
 #include "config.h"
 #include "updateRetimerFw_dbus_log_event.h"
 #include <stddef.h>
+#include <stdint.h>
 #include <stdbool.h>
+#include <linux/i2c.h>
 
 #define UPDATE_STATUS 0x0F
 #define FPGA_READ 0x1
 #define FPGA_WRITE 0x0
+// RETIMER_COUNT is the platform default, setRetimerCount() overrides
+// it. The FPGA register map only documents one status byte and one
+// extendedErrorCode window of 8 retimers, so more are rejected.
 #define RETIMER_MAX_NUM 8
+#define RETIMER_BIT(index) ((RetimerBitmap)1 << (index))
+#define RETIMER_NAME_FMT "HGX_FW_PCIeRetimer_%u"
+#define RETIMER_NAME_SIZE 32
 #define RETIMER_EEPROM_WRITE 0
 #define RETIMER_EEPROM_READ 1
 #define BYTE_PER_PAGE 256
@@ -40,14 +48,26 @@
 #define MAX_TIMEOUT_SEC 60
 #define DELAY_1SEC 1000000
 #define DELAY_1MS 1000
+#define I2C_PAGE_RETRIES 3
+#define I2C_RETRY_MAX_BACKOFF_US (50 * DELAY_1MS)
+#define DPRAM_VERIFY_MAX_BAD_PAGES 16
 #define FW_UPDATE_COMPLETE_FLAG 0x00
 
 #define GPU_BASE1_PRSNT_N_MASK 0x1
 #define GPU_BASE1_CPLD_READY_MASK 0x4
 
-// WRITE_BUF_SIZE consist of WRITE_ADDRESS+FW_IMAGE_SIZE
-#define WRITE_BUF_SIZE (MAX_FW_IMAGE_SIZE + 4)
 #define READ_BUF_SIZE 4
+
+// Batched DPRAM transfer, each message is 3 address bytes + payload
+#define DPRAM_ADDR_BYTES 3
+#define MIN_BURST_SIZE BYTE_PER_PAGE
+#define MAX_BURST_SIZE 4096
+
+// DPRAM shadow for delta upload, one digest per page
+#define DPRAM_PAGES (MAX_FW_IMAGE_SIZE / BYTE_PER_PAGE)
+#define DPRAM_STAMP_DIR "/run/nvidia-retimer"
+// state that survives a BMC reboot
+#define RETIMER_STATE_DIR "/var/lib/nvidia-retimer"
 #define HOST_BMC_FPGA_I2C_BUS_NUM 12
 #define HMC_FPGA_I2C_BUS_NUM 3
 
@@ -85,13 +105,25 @@
 #define FPGA_SECONDARY_REGTBL 0x31
 #define FPGA_SEC_REGTBL_FWCONTROLLER_OFFSET 0x4B
 #define HMC_I2CBUS_FPGA_SEC_REGTBL 0x2
+// the CPLD and secondary regtbl of a baseboard share its sideband bus
+static_assert(CPLD_I2C_BUS == HMC_I2CBUS_FPGA_SEC_REGTBL,
+	      "CPLD and secondary regtbl on different buses");
 #define EXTENDED_ERR_MAX_PAGE_SZ 256
+// extendedErrorCode starts FPGA_SEC_REGTBL_FWCONTROLLER_OFFSET bytes after regtbl offset 0x1
+#define EXTENDED_ERR_BASE_OFFSET 0x1
+#define EXTENDED_ERR_REG_OFFSET                                                \
+	(EXTENDED_ERR_BASE_OFFSET + FPGA_SEC_REGTBL_FWCONTROLLER_OFFSET)
+#define MAX_I2C_BUS_NUM 32
 #define NO_ERR 0x0
 #define GLOBAL_WP_L_MASK 0x10
 #define RET_MUX_SEL_MASK 0x0F
 #define UNKNOWN_ERROR "Unknown Error"
 
 #define VERSION_LEN 10
+// firmware version record at FW_VERSION_OFFSET if the platform sets it:
+// major, minor, build (LE16)
+#define RETIMER_FW_VERSION_SIZE 4
+#define RETIMER_FW_VERSION_STR_LEN 16
 #define INVALID -1
 
 // Default Version
@@ -118,6 +150,9 @@ enum {
 	ERROR_TRANS_PAGE,
 	ERROR_FPGA_NOT_READY,
 	ERROR_RETIMER_NOT_READY,
+	ERROR_DPRAM_BUSY,
+	ERROR_GLOBAL_WP,
+	ERROR_RETIMER_MUX_SEL,
 	// FW UPDATE ERROR
 	ERROR_WRITE_NACK = 0x200,
 	ERROR_UPG_NACK_RETIMER0 = 0x200,
@@ -163,17 +198,11 @@ enum {
 	ERROR_UNKNOWN = 0xff,
 };
 
-enum RETIMER_MASK {
-	RETIMER0 = 0x01,
-	RETIMER1 = 0x02,
-	RETIMER2 = 0x04,
-	RETIMER3 = 0x08,
-	RETIMER4 = 0x10,
-	RETIMER5 = 0x20,
-	RETIMER6 = 0x40,
-	RETIMER7 = 0x80,
-	RETIMERALL = 0xFF,
-};
+/**
+* @brief *
+* One bit per retimer index, RETIMER_MAX_NUM bits
+**/
+typedef uint32_t RetimerBitmap;
 
 /**
  * @brief *
@@ -182,8 +211,18 @@ enum RETIMER_MASK {
 typedef enum command {
 	RETIMER_FW_UPDATE = 0x0, /**< To update FW */
 	RETIMER_FW_READ = 0x1, /**< To read Retimer FW */
+	RETIMER_FW_VERSION = 0x2, /**< To query Retimer FW version */
+	RETIMER_FW_VERIFY = 0x3, /**< To compare Retimer FW with an image */
 } RetimerFWCommand;
 
+/**
+* @brief *
+* Consumer of streamed DPRAM readback, called once per page with the
+* DPRAM offset of data. Return 0 to continue, anything else aborts.
+**/
+typedef int (*DpramPageSink)(void *ctx, size_t offset,
+			     const unsigned char *data, size_t len);
+
 /**
 * @brief *
 * structure for I2C Transaction based Error Codes for Retimer FW update 
@@ -202,10 +241,70 @@ typedef struct {
 * refer Vulcan I2C Request Form - Google Sheets for details
 **/
 typedef struct {
-	RetimerAddrErrorCode AddrErrorCode[8];
+	RetimerAddrErrorCode AddrErrorCode[RETIMER_MAX_NUM];
 	uint8_t globalWp;
 	uint8_t retimerEEPROMmuxSel;
 } extendedErrorCode;
+static_assert(sizeof(extendedErrorCode) == 18,
+	      "sizeof(extendedErrorCode) != 18");
+
+/**
+* @brief *
+* DPRAM transfer tuning, defaults come from meson options
+* i2c_batch_msgs, fpga_burst_size and fpga_reports_read_length
+**/
+typedef struct {
+	unsigned int batchMsgs; /**< i2c_msg per I2C_RDWR ioctl, 1 = legacy */
+	unsigned int burstSize; /**< DPRAM payload bytes per i2c_msg */
+	bool probeBurst; /**< probe FPGA auto-increment before next upload */
+	bool deltaUpload; /**< skip DPRAM pages the shadow says are current */
+	unsigned int pageRetries; /**< re-sends per page on transient errors */
+	unsigned int retryBackoffUs; /**< first backoff, doubled per re-send */
+	bool skipReadClear; /**< FPGA reports read length, no DPRAM clear */
+	bool verifyUpload; /**< read DPRAM back and re-send differing pages */
+} FpgaTransferConfig;
+
+extern FpgaTransferConfig fpgaTransferConfig;
+
+/**
+* @brief *
+* Page re-sends after transient I2C errors, by errno class
+**/
+typedef struct {
+	unsigned long retries; /**< page re-sends issued */
+	unsigned long arbLost; /**< EAGAIN */
+	unsigned long timeouts; /**< ETIMEDOUT */
+	unsigned long busy; /**< EBUSY */
+	unsigned long recovered; /**< pages that went through after re-send */
+	unsigned long failed; /**< pages that ran out of re-sends */
+} I2CRetryStats;
+
+/**
+* @brief *
+* Digest of what this process last wrote to one DPRAM page
+**/
+typedef struct {
+	uint64_t digest;
+	uint16_t len; /**< bytes covered by digest, 0 = unknown */
+} DpramPageShadow;
+
+/**
+* @brief *
+* Per-session DPRAM transfer buffers, frameCount frames of
+* DPRAM_ADDR_BYTES + burstSize bytes reused by every page transfer,
+* and the DPRAM shadow of the FPGA last written from this session
+**/
+typedef struct {
+	unsigned char *frames;
+	size_t frameSize;
+	unsigned int frameCount;
+	DpramPageShadow *shadow; /**< DPRAM_PAGES entries */
+	unsigned int shadowBus; /**< i2c bus of the shadowed FPGA */
+	unsigned int shadowSlave;
+	uint64_t shadowToken; /**< token this process last stamped */
+	bool shadowTrusted;
+	I2CRetryStats retryStats;
+} FpgaTransferCtx;
 
 typedef struct pair {
 	uint8_t errorCode;
@@ -231,7 +330,7 @@ extern const uint8_t CompositeImageHeaderUuid[16];
 typedef struct __attribute__((packed)) {
 	uint8_t magic[4]; // RTIH
 	uint32_t imageLength;
-	uint32_t applyBitmap; // Up to 16 devices for future expansion. Max retimer number (bitmap) is uint8_t in concurrent-updater, but allow for future growth
+	uint32_t applyBitmap; // RetimerBitmap, bits beyond getRetimerCount() are rejected
 	char versionString[36]; // null-terminated string
 	uint32_t reserved[2];
 	uint32_t imageCrc; // CRC32 of the corresponding image section
@@ -247,23 +346,63 @@ typedef struct {
 	uint32_t applyBitmap;
 	uint32_t imageCrc;
 	char versionString[36]; // same length as in the ComponentHeader
+	bool imageCrcPending; // image data not verified against imageCrc yet
+	bool crcFromData; // bare image, imageCrc is computed from the data
 } update_operation;
 static_assert(sizeof(((update_operation *)NULL)->versionString) ==
 	      sizeof(((ComponentHeader *)NULL)->versionString));
 
 void debug_print(char *fmt, ...);
-void prepareMessageRegistry(uint8_t retimer, char *message, char *versionStr,
-			    bool verBeforeDevice, char *severity,
-			    char *resolution, bool genericMessage);
+int setRetimerCount(unsigned int count);
+unsigned int getRetimerCount(void);
+RetimerBitmap retimerAllMask(void);
+unsigned int countRetimers(RetimerBitmap bitmap);
+void retimerName(unsigned int index, char *name, size_t len);
+void prepareMessageRegistry(RetimerBitmap retimer, char *message,
+			    char *versionStr, bool verBeforeDevice,
+			    char *severity, char *resolution,
+			    bool genericMessage);
 unsigned int crc32(const unsigned char *buf, int length);
 int send_i2c_cmd(int fd, int isRead, unsigned char slaveId,
 		 unsigned char *write_data, unsigned char *read_data,
 		 unsigned int write_count, unsigned int read_count);
+int send_i2c_batch(int fd, unsigned char slaveId, struct i2c_msg *msgs,
+		   unsigned int nmsgs);
+int writeFpgaReg(int fd, unsigned int slaveId, uint32_t reg, uint32_t value);
+int readFpgaReg(int fd, unsigned int slaveId, uint32_t reg,
+		unsigned char *value);
+size_t xferChunkSize(void);
+unsigned int xferBatchMsgs(void);
+FpgaTransferCtx *getFpgaTransferCtx(void);
+void releaseFpgaTransferCtx(void);
+void invalidateDpramShadow(int fd, unsigned int slaveId);
+void setDpramStampDir(const char *dir);
+const char *getDpramStampDir(void);
+int writeFpgaDpram(int fd, unsigned int slaveId, size_t offset,
+		   const unsigned char *src, size_t len);
+int readFpgaDpram(int fd, unsigned int slaveId, size_t offset,
+		  unsigned char *dst, size_t len);
+int zeroFpgaDpram(int fd, unsigned int slaveId, size_t offset, size_t len);
+unsigned int zeroImageCrc(void);
+int clearFpgaDpram(int fd, unsigned int slaveId);
+int verifyFpgaDpram(int fd, unsigned int slaveId, const unsigned char *src,
+		    size_t len, unsigned int *pagesResent);
+unsigned int probeFpgaBurstSize(int fd, unsigned int slaveId);
+void setFpgaCntrlAddr(uint8_t slaveId);
+uint8_t getFpgaCntrlAddr(void);
+int fpgaSidebandBus(unsigned int bus);
+void setFpgaSidebandBus(unsigned int bus);
+unsigned int getFpgaSidebandBus(void);
+int openI2CBus(unsigned int bus);
+void closeI2CBuses(void);
 int checkExtenedErrorReg();
+int preflightRetimerUpdate(int fd, unsigned int slaveId);
 void genericMessageRegistry(char *message, char *arg0, char *arg1,
 			    char *severity, char *resolution);
 int maperrnoToI2CError(int errnoval, unsigned char slaveId, char **msg,
 		       char **resolution);
+bool isTransientI2CError(int errnoval);
+void printI2CRetryStats(void);
 int checkDigit_i2c(char *str);
 int checkDigit_retimer(char *str);
 int parseStr(const char *in, int startid, int endid, char *op);
@@ -271,13 +410,36 @@ int readFwVersion(char *str, char **ver);
 int parseCompositeImage(const unsigned char *imageMappedAddr, size_t fw_size,
 			const char *pldmVersionStr,
 			update_operation **update_ops, int *update_ops_count);
+int parseCompositeImageHeaders(const unsigned char *imageMappedAddr,
+			       size_t fw_size, const char *pldmVersionStr,
+			       update_operation **update_ops,
+			       int *update_ops_count);
+int verifyUpdateOperation(const unsigned char *imageMappedAddr,
+			  update_operation *op);
+int mergeUpdateOperations(const unsigned char *imageMappedAddr,
+			  update_operation *update_ops, int *update_ops_count);
 int copyImageFromFileToFpga(int fw_fd, int fd, unsigned int slaveId);
 int copyImageFromMemToFpga(const unsigned char *fw_addr, size_t fw_size,
 			   unsigned int fw_crc32, int fd, unsigned int slaveId);
+int uploadImageToFpga(const unsigned char *fw_addr, size_t fw_size, int fd,
+		      unsigned int slaveId);
+int setFpgaImageInfo(int fd, unsigned int slaveId, size_t fw_size,
+		     unsigned int fw_crc32);
 int copyImageFromFpga(int fw_fd, int fd, unsigned int slaveId);
-int checkReadNackError(uint8_t status, const uint8_t mask[], uint8_t *retimer);
-int checkWriteNackError(uint8_t status, const uint8_t mask[], uint8_t *retimer);
-int checkChecksumError(uint8_t status, const uint8_t mask[], uint8_t *retimer);
-int startRetimerFwUpdate(int fd, uint8_t retimerNumber, char *versionStr,
-			 uint8_t *retimerNotUpdated);
+int copyImageFromFpgaToMem(int fd, unsigned int slaveId, unsigned char *dst,
+			   size_t len);
+int readFpgaDpramPages(int fd, unsigned int slaveId, size_t offset,
+		       size_t len, DpramPageSink sink, void *sinkCtx);
+int checkReadNackError(uint8_t status, RetimerBitmap *retimer);
+int checkWriteNackError(uint8_t status, RetimerBitmap *retimer);
+int checkChecksumError(uint8_t status, RetimerBitmap *retimer);
+int startRetimerFwUpdate(int fd, RetimerBitmap retimerNumber,
+			 char *versionStr, RetimerBitmap *retimerNotUpdated);
 int readRetimerfw(int fd, uint8_t retimerNumber);
+int readRetimerFwRange(int fd, uint8_t retimerNumber, size_t offset,
+		       unsigned char *dst, size_t len);
+int readRetimerFwVersion(int fd, uint8_t retimerNumber, char *version,
+			 size_t len);
+int checkRetimerFwCurrent(int fd, uint8_t retimerNumber,
+			  const unsigned char *imageMappedAddr,
+			  update_operation *op, bool readback, bool *current);
@@ -30,11 +30,15 @@
 #define LOG_CREATE_FUNCTION "Create"
 #define LOG_CREATE_SIGNATURE "ssa{ss}"
 
+// sd_bus is not thread safe, every thread logs on its own default bus
+static _Thread_local sd_bus *bus = NULL;
+
 void emitLogMessage(char *message, char *arg0, char *arg1, char *severity,
 		    char *resolution, bool genericMessage)
 {
-	static sd_bus *bus = NULL;
-	sd_bus_default_system(&bus);
+	if (bus == NULL) {
+		sd_bus_default_system(&bus);
+	}
 	if (bus == NULL) {
 		fprintf(stderr, "Bus is null");
 		return;
@@ -75,3 +79,14 @@ void emitLogMessage(char *message, char *arg0, char *arg1, char *severity,
 	}
 	debug_print("Call completed\n");
 }
+
+/**************************************************************
+ * closeLogMessageBus()
+ *
+ * Drop the sd-bus connection emitLogMessage() opened for the
+ * calling thread, threads that log call it before they exit
+ *****************************************************************/
+void closeLogMessageBus(void)
+{
+	bus = sd_bus_flush_close_unref(bus);
+}
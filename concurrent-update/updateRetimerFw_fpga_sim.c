@@ -0,0 +1,406 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2022-2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sys/eventfd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "updateRetimerFw_fpga_sim.h"
+
+// Retimer EEPROM address and NACK code reported in the regtbl on write NACK
+#define SIM_EEPROM_ADDR 0x50
+#define SIM_EEPROM_NACK 0x08
+
+static uint32_t simAddr(const unsigned char *buf)
+{
+	return ((uint32_t)buf[0] << 16) | ((uint32_t)buf[1] << 8) | buf[2];
+}
+
+static uint32_t simDpramAddr(FpgaSim *sim, uint32_t base, uint32_t i)
+{
+	if (sim->cfg.pageWrap) {
+		return (base & ~(uint32_t)(BYTE_PER_PAGE - 1)) |
+		       ((base + i) & (BYTE_PER_PAGE - 1));
+	}
+	return base + i;
+}
+
+static bool simIsReg(uint32_t addr)
+{
+	return addr >= FPGA_IMG_SIZE_REG && addr <= FPGA_READ_STATUS_REG &&
+	       !(addr & 0x3);
+}
+
+/**************************************************************
+ * simCompleteUpdate()
+ *
+ * Finish the update started by a write to FPGA_UPDATE_STATUS_REG.
+ * Retimers without an error get the DPRAM image, injected masks
+ * apply to this update only.
+ *****************************************************************/
+static void simCompleteUpdate(FpgaSim *sim)
+{
+	RetimerBitmap bitmap = sim->updateBitmap;
+	RetimerBitmap writeNack = bitmap & sim->cfg.writeNackMask;
+	RetimerBitmap readNack = bitmap & sim->cfg.readNackMask;
+	RetimerBitmap checksum = bitmap & sim->cfg.checksumMask;
+	extendedErrorCode *ext = fpgaSimExtendedErrors(sim);
+
+	if (sim->imgSize == 0 || sim->imgSize > MAX_FW_IMAGE_SIZE ||
+	    crc32(sim->dpram, sim->imgSize) != sim->imgCrc) {
+		checksum = bitmap;
+	}
+	sim->cfg.writeNackMask = 0;
+	sim->cfg.readNackMask = 0;
+	sim->cfg.checksumMask = 0;
+
+	for (unsigned int r = 0; r < sim->retimers; r++) {
+		RetimerBitmap bit = RETIMER_BIT(r);
+
+		if (!(bitmap & bit)) {
+			continue;
+		}
+		if (writeNack & bit) {
+			ext->AddrErrorCode[r].RET_EEPROM_I2C_ERROR_ADDR =
+				SIM_EEPROM_ADDR;
+			ext->AddrErrorCode[r].RET_EEPROM_I2C_ERROR_CODE =
+				SIM_EEPROM_NACK;
+		}
+		if ((writeNack | readNack | checksum) & bit) {
+			continue;
+		}
+		memcpy(sim->eeprom[r], sim->dpram, sim->imgSize);
+	}
+	sim->updateStatus = (writeNack << 8) | (readNack << 16) |
+			    (checksum << 24);
+	sim->updateBitmap = 0;
+	sim->updates++;
+}
+
+/**************************************************************
+ * simCompleteRead()
+ *
+ * Finish the retimer read started by a write to
+ * FPGA_READ_STATUS_REG, the EEPROM is copied into DPRAM.
+ *****************************************************************/
+static void simCompleteRead(FpgaSim *sim)
+{
+	uint8_t r = sim->readRetimer;
+
+	if (r >= sim->retimers || (sim->cfg.fwReadNackMask & RETIMER_BIT(r))) {
+		sim->readStatus = FW_READ_NACK_MASK << 8;
+	} else {
+		memcpy(sim->dpram, sim->eeprom[r], MAX_FW_IMAGE_SIZE);
+		sim->readStatus = 0;
+	}
+	sim->reads++;
+}
+
+static void simWriteReg(FpgaSim *sim, uint32_t addr, uint32_t value)
+{
+	switch (addr) {
+	case FPGA_IMG_SIZE_REG:
+		sim->imgSize = value;
+		break;
+	case FPGA_CHKSUM_REG:
+		sim->imgCrc = value;
+		break;
+	case FPGA_UPDATE_STATUS_REG:
+		sim->updateBitmap = value & (RETIMER_BIT(sim->retimers) - 1);
+		if (sim->updateBitmap) {
+			sim->updatePolls = sim->cfg.busyPolls;
+			sim->updateStatus = sim->updateBitmap;
+		}
+		break;
+	case FPGA_READ_STATUS_REG:
+		if (value & SET_RETIMER_FW_READ) {
+			sim->readRetimer = (value >> 4) & NIBBLE;
+			sim->readPolls = sim->cfg.busyPolls;
+			sim->readStatus = value & BYTE0;
+		}
+		break;
+	}
+}
+
+static uint32_t simReadReg(FpgaSim *sim, uint32_t addr)
+{
+	switch (addr) {
+	case FPGA_IMG_SIZE_REG:
+		return sim->imgSize;
+	case FPGA_CHKSUM_REG:
+		return sim->imgCrc;
+	case FPGA_UPDATE_STATUS_REG:
+		if (sim->updateBitmap && sim->updatePolls-- == 0) {
+			simCompleteUpdate(sim);
+		}
+		return sim->updateStatus;
+	case FPGA_READ_STATUS_REG:
+		if ((sim->readStatus & FW_READ_STATUS_MASK) &&
+		    sim->readPolls-- == 0) {
+			simCompleteRead(sim);
+		}
+		return sim->readStatus;
+	}
+	return 0;
+}
+
+/**************************************************************
+ * simFpgaMsg()
+ *
+ * One message to the FPGA controller. Writes carry the 3 byte
+ * address followed by DPRAM data or a 4 byte LSB first register
+ * value, reads continue at the last written address.
+ *
+ * RETURN: 0 or -errno
+ *****************************************************************/
+static int simFpgaMsg(FpgaSim *sim, struct i2c_msg *msg)
+{
+	if (!(msg->flags & I2C_M_RD)) {
+		if (msg->len < DPRAM_ADDR_BYTES) {
+			return -EIO;
+		}
+		sim->addr = simAddr(msg->buf);
+		const unsigned char *payload = msg->buf + DPRAM_ADDR_BYTES;
+		uint32_t len = msg->len - DPRAM_ADDR_BYTES;
+
+		if (len == 0) {
+			return 0;
+		}
+		if (simIsReg(sim->addr)) {
+			uint32_t value = 0;
+
+			if (len != R_BYTE_COUNT) {
+				return -EIO;
+			}
+			for (int i = R_BYTE_COUNT - 1; i >= 0; i--) {
+				value = (value << 8) | payload[i];
+			}
+			simWriteReg(sim, sim->addr, value);
+			return 0;
+		}
+		for (uint32_t i = 0; i < len; i++) {
+			uint32_t a = simDpramAddr(sim, sim->addr, i);
+
+			if (a >= MAX_FW_IMAGE_SIZE) {
+				return -ENXIO;
+			}
+			sim->dpram[a] = payload[i];
+		}
+		if (sim->cfg.corruptWrites) {
+			sim->cfg.corruptWrites--;
+			sim->dpram[simDpramAddr(sim, sim->addr, 0)] ^= 0x01;
+		}
+		return 0;
+	}
+
+	if (simIsReg(sim->addr)) {
+		uint32_t value = simReadReg(sim, sim->addr);
+
+		for (uint32_t i = 0; i < msg->len; i++) {
+			msg->buf[i] = i < R_BYTE_COUNT ? (value >> (8 * i)) : 0;
+		}
+		return 0;
+	}
+	for (uint32_t i = 0; i < msg->len; i++) {
+		uint32_t a = simDpramAddr(sim, sim->addr, i);
+
+		if (a >= MAX_FW_IMAGE_SIZE) {
+			return -ENXIO;
+		}
+		msg->buf[i] = sim->dpram[a];
+	}
+	return 0;
+}
+
+/**************************************************************
+ * simRegtblMsg()
+ *
+ * One message to a byte wide register table addressed with
+ * offsetBytes MSB first offset bytes.
+ *
+ * RETURN: 0 or -errno
+ *****************************************************************/
+static int simRegtblMsg(uint8_t *tbl, uint16_t *ptr, int offsetBytes,
+			struct i2c_msg *msg)
+{
+	uint16_t i = 0;
+
+	if (!(msg->flags & I2C_M_RD)) {
+		if (msg->len < offsetBytes) {
+			return -EIO;
+		}
+		*ptr = 0;
+		for (; i < offsetBytes; i++) {
+			*ptr = (*ptr << 8) | msg->buf[i];
+		}
+		for (; i < msg->len; i++) {
+			tbl[(*ptr)++ % FPGA_SIM_REGTBL_SIZE] = msg->buf[i];
+		}
+		return 0;
+	}
+	for (; i < msg->len; i++) {
+		msg->buf[i] = tbl[(*ptr)++ % FPGA_SIM_REGTBL_SIZE];
+	}
+	return 0;
+}
+
+static int simOpen(__attribute__((unused)) void *priv,
+		   __attribute__((unused)) unsigned int bus)
+{
+	// a real descriptor keeps the pool and fstat() callers happy,
+	// it is not a character device so no DPRAM stamp is kept
+	return eventfd(0, EFD_CLOEXEC);
+}
+
+static void simClose(__attribute__((unused)) void *priv, int fd)
+{
+	close(fd);
+}
+
+static int simTransfer(void *priv, __attribute__((unused)) int fd,
+		       struct i2c_msg *msgs, unsigned int nmsgs)
+{
+	FpgaSim *sim = priv;
+	unsigned long long ns;
+	unsigned long long bytes = 0;
+	int ret = 0;
+
+	pthread_mutex_lock(&sim->lock);
+	sim->transfers++;
+	if (sim->transfers > sim->cfg.failAfter &&
+	    sim->transfers <= (unsigned long)sim->cfg.failAfter +
+				      sim->cfg.failCount) {
+		ret = sim->cfg.failErrno ? -sim->cfg.failErrno : -EIO;
+	}
+	for (unsigned int i = 0; i < nmsgs && ret == 0; i++) {
+		bytes += msgs[i].len + 1;
+		if (msgs[i].addr == FPGA_I2C_CNTRL_ADDR) {
+			ret = simFpgaMsg(sim, &msgs[i]);
+		} else if (msgs[i].addr == FPGA_SECONDARY_REGTBL) {
+			ret = simRegtblMsg(sim->regtbl, &sim->regtblPtr, 2,
+					   &msgs[i]);
+		} else if (msgs[i].addr == CPLD_SLAVE_ID) {
+			ret = simRegtblMsg(sim->cpld, &sim->cpldPtr, 1,
+					   &msgs[i]);
+		} else {
+			ret = -ENXIO;
+		}
+	}
+	if (ret) {
+		sim->failed++;
+	}
+	ns = (unsigned long long)sim->cfg.latencyUs * 1000 +
+	     bytes * sim->cfg.byteTimeNs;
+	sim->bytes += bytes;
+	sim->busTimeNs += ns;
+	pthread_mutex_unlock(&sim->lock);
+
+	if (sim->cfg.realTime && ns >= 1000) {
+		usleep(ns / 1000);
+	}
+	return ret;
+}
+
+/**************************************************************
+ * fpgaSimCreate()
+ *
+ * Allocate an FPGA model, DPRAM is zeroed and every retimer EEPROM
+ * reads back erased (0xFF). CPLD reports the FPGA present and
+ * ready, global write protect is not asserted.
+ *
+ * cfg: behaviour, NULL for a fast fault free FPGA
+ *
+ * RETURN: simulator or NULL on allocation failure
+ *****************************************************************/
+FpgaSim *fpgaSimCreate(const FpgaSimConfig *cfg)
+{
+	FpgaSim *sim = calloc(1, sizeof(*sim));
+
+	if (!sim) {
+		return NULL;
+	}
+	if (cfg) {
+		sim->cfg = *cfg;
+	}
+	sim->retimers = sim->cfg.retimers ? sim->cfg.retimers : RETIMER_COUNT;
+	if (sim->retimers > RETIMER_MAX_NUM) {
+		sim->retimers = RETIMER_MAX_NUM;
+	}
+	pthread_mutex_init(&sim->lock, NULL);
+	sim->dpram = calloc(1, MAX_FW_IMAGE_SIZE);
+	for (unsigned int r = 0; r < sim->retimers; r++) {
+		sim->eeprom[r] = malloc(MAX_FW_IMAGE_SIZE);
+		if (sim->eeprom[r]) {
+			memset(sim->eeprom[r], 0xFF, MAX_FW_IMAGE_SIZE);
+		}
+	}
+	for (unsigned int r = 0; r < sim->retimers; r++) {
+		if (!sim->dpram || !sim->eeprom[r]) {
+			fpgaSimDestroy(sim);
+			return NULL;
+		}
+	}
+	fpgaSimExtendedErrors(sim)->globalWp = GLOBAL_WP_L_MASK;
+	sim->cpld[CPLD_GB_OFFSET] = GPU_BASE1_CPLD_READY_MASK;
+
+	sim->transport.name = "fpga-sim";
+	sim->transport.open = simOpen;
+	sim->transport.close = simClose;
+	sim->transport.transfer = simTransfer;
+	sim->transport.priv = sim;
+	return sim;
+}
+
+/**************************************************************
+ * fpgaSimDestroy()
+ *
+ * Free a simulator, it must not be the active transport anymore
+ *****************************************************************/
+void fpgaSimDestroy(FpgaSim *sim)
+{
+	if (!sim) {
+		return;
+	}
+	for (unsigned int r = 0; r < sim->retimers; r++) {
+		free(sim->eeprom[r]);
+	}
+	free(sim->dpram);
+	pthread_mutex_destroy(&sim->lock);
+	free(sim);
+}
+
+/**************************************************************
+ * fpgaSimTransport()
+ *
+ * RETURN: transport to pass to setI2CTransport()
+ *****************************************************************/
+const I2CTransport *fpgaSimTransport(FpgaSim *sim)
+{
+	return &sim->transport;
+}
+
+/**************************************************************
+ * fpgaSimExtendedErrors()
+ *
+ * RETURN: extendedErrorCode window inside the secondary regtbl
+ *****************************************************************/
+extendedErrorCode *fpgaSimExtendedErrors(FpgaSim *sim)
+{
+	return (extendedErrorCode *)(sim->regtbl + EXTENDED_ERR_REG_OFFSET);
+}
@@ -0,0 +1,91 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2022-2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UPDATERETIMERFW_FPGA_SIM_H_
+#define UPDATERETIMERFW_FPGA_SIM_H_
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "updateRetimerFwOverI2C.h"
+#include "updateRetimerFw_transport.h"
+
+// CPLD register table and FPGA secondary regtbl are one page each
+#define FPGA_SIM_REGTBL_SIZE 256
+
+/**
+* @brief *
+* Behaviour of the in-process FPGA model.
+* Zero initialised config is a fast, fault free FPGA.
+**/
+typedef struct FpgaSimConfig {
+	unsigned int latencyUs; /**< fixed cost of one combined transfer */
+	unsigned int byteTimeNs; /**< bus time per byte incl. ACK bit */
+	bool realTime; /**< sleep for the modelled bus time */
+	bool pageWrap; /**< DPRAM address wraps inside a 256 byte page */
+	unsigned int busyPolls; /**< status reads reporting busy per operation */
+	unsigned int failAfter; /**< transfers passed before fault injection */
+	unsigned int failCount; /**< consecutive transfers failed with failErrno */
+	int failErrno; /**< errno of injected failures, EIO if 0 */
+	unsigned int retimers; /**< retimer EEPROMs, RETIMER_COUNT if 0 */
+	RetimerBitmap writeNackMask; /**< retimers NACKing the next update */
+	RetimerBitmap readNackMask; /**< retimers failing verify on the next update */
+	RetimerBitmap checksumMask; /**< retimers failing checksum on the next update */
+	RetimerBitmap fwReadNackMask; /**< retimers NACKing a FW read */
+	unsigned int corruptWrites; /**< next DPRAM writes stored with a bit flip */
+} FpgaSimConfig;
+
+/**
+* @brief *
+* FPGA model: DPRAM, control registers 0x04_0000-0x04_000C,
+* retimer EEPROMs, secondary regtbl (0x31) and CPLD (0x3c).
+* Fields may be inspected and changed by tests while no transfer is
+* running.
+**/
+typedef struct FpgaSim {
+	FpgaSimConfig cfg;
+	I2CTransport transport;
+	pthread_mutex_t lock;
+	unsigned char *dpram;
+	unsigned int retimers;
+	unsigned char *eeprom[RETIMER_MAX_NUM]; /**< MAX_FW_IMAGE_SIZE each */
+	uint32_t imgSize;
+	uint32_t imgCrc;
+	uint32_t updateStatus;
+	uint32_t readStatus;
+	RetimerBitmap updateBitmap;
+	uint8_t readRetimer;
+	unsigned int updatePolls;
+	unsigned int readPolls;
+	uint32_t addr; /**< FPGA address latched by the last write */
+	uint8_t regtbl[FPGA_SIM_REGTBL_SIZE];
+	uint8_t cpld[FPGA_SIM_REGTBL_SIZE];
+	uint16_t regtblPtr;
+	uint16_t cpldPtr;
+	unsigned long transfers;
+	unsigned long failed;
+	unsigned long long bytes;
+	unsigned long long busTimeNs; /**< modelled bus time */
+	unsigned int updates;
+	unsigned int reads;
+} FpgaSim;
+
+FpgaSim *fpgaSimCreate(const FpgaSimConfig *cfg);
+void fpgaSimDestroy(FpgaSim *sim);
+const I2CTransport *fpgaSimTransport(FpgaSim *sim);
+extendedErrorCode *fpgaSimExtendedErrors(FpgaSim *sim);
+
+#endif
@@ -0,0 +1,408 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2022-2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include "updateRetimerFw_fpgaop.h"
+
+// set by setFpgaOpRunner(), runFpgaOp() blocks without
+static _Thread_local FpgaOpRunFn opRunner;
+static _Thread_local void *opRunnerData;
+
+static void initFpgaOp(FpgaOp *op, FpgaOpKind kind, int fd,
+		       RetimerBitmap retimers)
+{
+	memset(op, 0, sizeof(*op));
+	op->kind = kind;
+	op->state = FPGA_OP_TRIGGER;
+	op->fd = fd;
+	op->slaveId = getFpgaCntrlAddr();
+	op->retimers = retimers;
+	op->len = MAX_FW_IMAGE_SIZE;
+}
+
+/**************************************************************
+ * initFpgaUpdateOp()
+ *
+ * Prepare the update of the retimers in retimers from the image
+ * already programmed into the FPGA. The FPGA controller address of
+ * the calling thread is used.
+ *****************************************************************/
+void initFpgaUpdateOp(FpgaOp *op, int fd, RetimerBitmap retimers,
+		      char *versionStr)
+{
+	initFpgaOp(op, FPGA_OP_UPDATE, fd, retimers);
+	op->versionStr = versionStr;
+}
+
+/**************************************************************
+ * initFpgaReadOp()
+ *
+ * Prepare the read of one retimer into DPRAM
+ *****************************************************************/
+void initFpgaReadOp(FpgaOp *op, int fd, unsigned int retimer)
+{
+	// the FPGA always reads the complete EEPROM of one retimer
+	initFpgaOp(op, FPGA_OP_READ, fd, retimer);
+}
+
+static bool finishFpgaOp(FpgaOp *op, int result)
+{
+	op->result = result;
+	op->state = FPGA_OP_FINISHED;
+	return false;
+}
+
+static int triggerUpdate(FpgaOp *op, uint64_t *delayUs)
+{
+	int ret;
+
+	// completion time and deadline follow the programmed image size
+	if (op->attempts == 0 &&
+	    readFpgaReg(op->fd, op->slaveId, FPGA_IMG_SIZE_REG, op->status) ==
+		    0) {
+		size_t reported = op->status[0] | op->status[1] << 8 |
+				  op->status[2] << 16 |
+				  (uint32_t)op->status[3] << 24;
+
+		if (reported && reported <= MAX_FW_IMAGE_SIZE) {
+			op->len = reported;
+		}
+	}
+
+	// 8. Trigger update to 0x04_0008
+	fprintf(stdout, "Trigger FW update...retimerNumber %u \n",
+		op->retimers);
+	// Trigger update, writing 3 bytes address followed by 4 bytes value in FPGA Update control register to trigger update for retimerNumber
+	// (Initiate FW update use Update4Retimer), status is read back from 0x04_0008 AKA FPGA_Control and udpate status register
+	ret = writeFpgaReg(op->fd, op->slaveId, FPGA_UPDATE_STATUS_REG,
+			   op->retimers);
+	if (ret) {
+		fprintf(stderr,
+			"Retimer Fw Update failed!!,send_i2c_cmd command failed with  %d errno %s ...\n",
+			ret, strerror(errno));
+		return ret;
+	}
+
+	// 9. Monitor update progress by reading to 0x04_0008
+	fprintf(stdout, "Monitor FW update...updateRetryCount %u \n",
+		op->attempts);
+	*delayUs = startFpgaPoll(&op->poll, FPGA_OP_UPDATE, op->len,
+				 countRetimers(op->retimers));
+	return 0;
+}
+
+static int triggerRead(FpgaOp *op, uint64_t *delayUs)
+{
+	int ret;
+
+	fprintf(stdout, "Retimer FW Read : Initiate retimer read ...\n");
+	// FPGA fills DPRAM with the retimer image, shadow is stale
+	invalidateDpramShadow(op->fd, op->slaveId);
+
+	// trigger retimer read for specified retimer
+	ret = writeFpgaReg(op->fd, op->slaveId, FPGA_READ_STATUS_REG,
+			   (((op->retimers) & NIBBLE) << 4) |
+				   (SET_RETIMER_FW_READ));
+	if (ret) {
+		fprintf(stderr,
+			"Retimer FW Read : failed!, send_i2c_cmd not completed for retimer %u...errno %s\n",
+			op->retimers, strerror(errno));
+		return ret;
+	}
+
+	// 9. Monitor FW read progress by reading to 0x04_000C
+	fprintf(stdout, "Retimer FW Read : Monitor Read progress update...\n");
+	*delayUs = startFpgaPoll(&op->poll, FPGA_OP_READ, op->len, 1);
+	return 0;
+}
+
+/**************************************************************
+ * decodeUpdateStatus()
+ *
+ * Log the failures of a finished update attempt and narrow the
+ * next attempt down to the retimers that failed.
+ *
+ * RETURN: true if another attempt is needed
+ *****************************************************************/
+static bool decodeUpdateStatus(FpgaOp *op)
+{
+	// read status register and check for any error in read, write and verify stage
+	uint8_t status_verfication = op->status[0];
+	uint8_t status_writeNack = op->status[1];
+	uint8_t status_readNack = op->status[2];
+	uint8_t status_checksum = op->status[3];
+	RetimerBitmap retryUpdate4Retimer = 0;
+
+	if (!(status_verfication || status_writeNack || status_readNack ||
+	      status_checksum)) {
+		fprintf(stdout, "FW update...completed, No Retry !!! \n");
+		op->result = 0;
+		return false;
+	}
+
+	fprintf(stdout, "FW update...completed, checking status !!! \n");
+	op->result = 0;
+	if (status_writeNack) {
+		op->result = checkWriteNackError(status_writeNack,
+						 &retryUpdate4Retimer);
+		prepareMessageRegistry(
+			retryUpdate4Retimer, "TransferFailed", op->versionStr,
+			MSG_REG_VER_FOLLOWED_BY_DEV,
+			"xyz.openbmc_project.Logging.Entry.Level.Critical",
+			"Reach out to the NVIDIA support team for further action",
+			0);
+	}
+	if (status_readNack) {
+		op->result |= checkReadNackError(status_readNack,
+						 &retryUpdate4Retimer);
+		prepareMessageRegistry(
+			retryUpdate4Retimer, "VerificationFailed",
+			op->versionStr, MSG_REG_VER_FOLLOWED_BY_DEV,
+			"xyz.openbmc_project.Logging.Entry.Level.Critical",
+			"Reach out to the NVIDIA support team for further action",
+			0);
+	}
+	if (status_checksum) {
+		op->result |= checkChecksumError(status_checksum,
+						 &retryUpdate4Retimer);
+		prepareMessageRegistry(
+			retryUpdate4Retimer, "VerificationFailed",
+			op->versionStr, MSG_REG_VER_FOLLOWED_BY_DEV,
+			"xyz.openbmc_project.Logging.Entry.Level.Critical",
+			"Reach out to the NVIDIA support team for further action",
+			0);
+	}
+
+	// Check ExtenededI2CErrorRegister
+	if (checkExtenedErrorReg() < 0) {
+		fprintf(stderr,
+			" unable to parse extended error register %s \n",
+			strerror(errno));
+		op->result = -ERROR_OPEN_FIRMWARE;
+		return false;
+	}
+
+	op->retimers = retryUpdate4Retimer;
+	op->notUpdated = retryUpdate4Retimer;
+	op->retried = true;
+	fprintf(stderr, "FW update...not succeeded, Retry !!! \n");
+	return true;
+}
+
+/**************************************************************
+ * decodeReadStatus()
+ *
+ * RETURN: true if the read has to be triggered again
+ *****************************************************************/
+static bool decodeReadStatus(FpgaOp *op)
+{
+	uint8_t status_verification = op->status[0] & FW_READ_STATUS_MASK;
+	uint8_t status_nackverification = op->status[1] & FW_READ_NACK_MASK;
+
+	op->result = 0;
+	// read NACK error
+	if (status_verification) {
+		fprintf(stdout,
+			"Retimer FW Read : Timeout !!! read still not completed for retimer %u...\n",
+			op->retimers);
+		return true;
+	}
+	if (status_nackverification) {
+		fprintf(stderr, "Retimer FW Read : failed for Retimer %u : \n",
+			op->retimers);
+		return true;
+	}
+	fprintf(stdout,
+		"Retimer FW Read : Retimer Read completed for Retimer %u \n",
+		op->retimers);
+	return false;
+}
+
+/**************************************************************
+ * stepFpgaOp()
+ *
+ * Advance an operation by one state, only short I2C transfers are
+ * done here, never a sleep.
+ *
+ * op: operation from initFpgaUpdateOp() or initFpgaReadOp()
+ * delayUs: outgoing, time to wait before the next step
+ *
+ * RETURN: true if another step is needed, false when op->result
+ *	   is final
+ *****************************************************************/
+bool stepFpgaOp(FpgaOp *op, uint64_t *delayUs)
+{
+	bool retry;
+	int ret;
+
+	*delayUs = 0;
+	switch (op->state) {
+	case FPGA_OP_TRIGGER:
+		memset(op->status, 0x00, sizeof(op->status));
+		ret = op->kind == FPGA_OP_UPDATE ? triggerUpdate(op, delayUs) :
+						   triggerRead(op, delayUs);
+		if (ret) {
+			return finishFpgaOp(op, ret);
+		}
+		op->attempts++;
+		op->state = FPGA_OP_WAIT;
+		return true;
+
+	case FPGA_OP_WAIT:
+		ret = stepFpgaPoll(&op->poll, op->fd, op->slaveId, op->status,
+				   delayUs);
+		if (ret) {
+			fprintf(stderr,
+				"Retimer FW %s failed!!,send_i2c_cmd command failed with  %d errno %s ...\n",
+				op->kind == FPGA_OP_UPDATE ? "update" : "read",
+				ret, strerror(errno));
+			return finishFpgaOp(op, ret);
+		}
+		if (*delayUs) {
+			return true;
+		}
+		if (op->poll.result.timedOut) {
+			fprintf(stderr,
+				"Retimer FW %s : Timeout!!, still not completed for retimer %u...\n",
+				op->kind == FPGA_OP_UPDATE ? "update" : "read",
+				op->retimers);
+		}
+		fprintf(stdout,
+			"FW %s out: 0x%x 0x%x 0x%x 0x%x 0x%x after %llu ms, %u polls\n",
+			op->kind == FPGA_OP_UPDATE ? "update" : "read",
+			op->status[0], op->status[1], op->status[2],
+			op->status[3], op->retimers,
+			(unsigned long long)op->poll.result.elapsedUs /
+				DELAY_1MS,
+			op->poll.result.polls);
+
+		retry = op->kind == FPGA_OP_UPDATE ? decodeUpdateStatus(op) :
+						     decodeReadStatus(op);
+		if (!retry || op->attempts >= MAX_UPDATE_RETRYCOUNT) {
+			return finishFpgaOp(op, op->result);
+		}
+		op->state = FPGA_OP_TRIGGER;
+		return true;
+
+	case FPGA_OP_FINISHED:
+	default:
+		return false;
+	}
+}
+
+/**************************************************************
+ * runFpgaOp()
+ *
+ * Drive an operation to completion in the calling thread, or hand
+ * it to the runner of the thread and wait for it
+ *
+ * RETURN: result of the operation
+ *****************************************************************/
+int runFpgaOp(FpgaOp *op)
+{
+	uint64_t delayUs;
+
+	if (opRunner) {
+		return opRunner(op, opRunnerData);
+	}
+	while (stepFpgaOp(op, &delayUs)) {
+		if (delayUs) {
+			usleep(delayUs);
+		}
+	}
+	return op->result;
+}
+
+static int fpgaOpTimer(sd_event_source *s,
+		       __attribute__((unused)) uint64_t usec, void *userdata)
+{
+	FpgaOp *op = userdata;
+	uint64_t delayUs;
+	uint64_t now;
+
+	if (stepFpgaOp(op, &delayUs)) {
+		sd_event_now(sd_event_source_get_event(s), CLOCK_MONOTONIC,
+			     &now);
+		sd_event_source_set_time(s, now + delayUs);
+		sd_event_source_set_enabled(s, SD_EVENT_ONESHOT);
+		return 0;
+	}
+	// done may free op, the timer is gone before it is called
+	op->timer = sd_event_source_disable_unref(op->timer);
+	if (op->done) {
+		op->done(op, op->userdata);
+	}
+	return 0;
+}
+
+/**************************************************************
+ * startFpgaOp()
+ *
+ * Drive an operation from timers of event, done is called from
+ * the event loop once op->result is final. op must stay valid
+ * until then or until cancelFpgaOp().
+ *
+ * RETURN: 0 if success, negative errno if the timer failed
+ *****************************************************************/
+int startFpgaOp(sd_event *event, FpgaOp *op, FpgaOpDoneFn done,
+		void *userdata)
+{
+	uint64_t now;
+	int ret;
+
+	op->done = done;
+	op->userdata = userdata;
+	ret = sd_event_now(event, CLOCK_MONOTONIC, &now);
+	if (ret < 0) {
+		return ret;
+	}
+	return sd_event_add_time(event, &op->timer, CLOCK_MONOTONIC, now, 0,
+				 fpgaOpTimer, op);
+}
+
+/**************************************************************
+ * cancelFpgaOp()
+ *
+ * Stop an operation before or while startFpgaOp() drives it, done
+ * is not called and op->result is -ECANCELED. A triggered FPGA
+ * keeps working, DPRAM must not be reused before its status
+ * reports idle again.
+ *****************************************************************/
+void cancelFpgaOp(FpgaOp *op)
+{
+	op->timer = sd_event_source_disable_unref(op->timer);
+	if (op->state != FPGA_OP_FINISHED) {
+		finishFpgaOp(op, -ECANCELED);
+	}
+}
+
+/**************************************************************
+ * setFpgaOpRunner()
+ *
+ * Let run drive the operations runFpgaOp() is called for in the
+ * calling thread, NULL drives them blocking again. run returns the
+ * result once op is finished, op stays valid until then.
+ *****************************************************************/
+void setFpgaOpRunner(FpgaOpRunFn run, void *userdata)
+{
+	opRunner = run;
+	opRunnerData = userdata;
+}
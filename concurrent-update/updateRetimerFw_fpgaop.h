@@ -0,0 +1,75 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2022-2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UPDATERETIMERFW_FPGAOP_H_
+#define UPDATERETIMERFW_FPGAOP_H_
+#include <stdbool.h>
+#include <stdint.h>
+#include <systemd/sd-event.h>
+#include "updateRetimerFwOverI2C.h"
+#include "updateRetimerFw_poll.h"
+
+/*
+ * A retimer update or read is a state machine: trigger, wait,
+ * status read, decode, and trigger again for the retimers that
+ * failed. stepFpgaOp() advances it without sleeping and returns how
+ * long to wait before the next step, so the same machine runs
+ * blocking in runFpgaOp() or from sd-event timers in startFpgaOp().
+ * One thread can drive operations on several FPGAs at once. A
+ * thread may hand the operations behind runFpgaOp() to another
+ * driver with setFpgaOpRunner(), e.g. the event loop of a service.
+ */
+typedef enum {
+	FPGA_OP_TRIGGER = 0, /**< write the trigger register */
+	FPGA_OP_WAIT, /**< poll the status register until done */
+	FPGA_OP_FINISHED, /**< result is final */
+} FpgaOpState;
+
+typedef struct FpgaOp FpgaOp;
+typedef void (*FpgaOpDoneFn)(FpgaOp *op, void *userdata);
+typedef int (*FpgaOpRunFn)(FpgaOp *op, void *userdata);
+
+struct FpgaOp {
+	FpgaOpKind kind;
+	FpgaOpState state;
+	int fd; /**< bus of the FPGA */
+	unsigned int slaveId; /**< FPGA controller address */
+	RetimerBitmap retimers; /**< update bitmap, retimer index for a read */
+	char *versionStr; /**< for log messages of an update */
+	size_t len; /**< bytes the FPGA transfers per retimer */
+	unsigned int attempts; /**< triggers written so far */
+	bool retried; /**< an attempt failed, notUpdated is valid */
+	RetimerBitmap notUpdated; /**< retimers failing the last update attempt */
+	int result;
+	unsigned char status[READ_BUF_SIZE]; /**< last status read */
+	FpgaPoll poll;
+	sd_event_source *timer; /**< set while driven by startFpgaOp() */
+	FpgaOpDoneFn done;
+	void *userdata;
+};
+
+void initFpgaUpdateOp(FpgaOp *op, int fd, RetimerBitmap retimers,
+		      char *versionStr);
+void initFpgaReadOp(FpgaOp *op, int fd, unsigned int retimer);
+bool stepFpgaOp(FpgaOp *op, uint64_t *delayUs);
+int runFpgaOp(FpgaOp *op);
+int startFpgaOp(sd_event *event, FpgaOp *op, FpgaOpDoneFn done,
+		void *userdata);
+void cancelFpgaOp(FpgaOp *op);
+void setFpgaOpRunner(FpgaOpRunFn run, void *userdata);
+
+#endif
@@ -0,0 +1,733 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2022-2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "updateRetimerFw_job.h"
+#include "updateRetimerFw_journal.h"
+#include "updateRetimerFw_lease.h"
+#include "updateRetimerFw_pipeline.h"
+#include "updateRetimerFw_progress.h"
+
+// not locked, images are loaded by one thread of the process
+static RetimerImage imageCache[RETIMER_IMAGE_CACHE_SIZE];
+static unsigned long imageCacheClock = 0;
+
+/**************************************************************
+ * runRetimerUpdate()
+ *
+ * Flash the retimers of retimerBitmap from a parsed firmware file:
+ * target filtering, merging of identical images, optional skipping
+ * of current retimers, journaling, then upload, verify and trigger
+ * of every update operation. The caller holds the DPRAM lease.
+ *
+ * fd: file descriptor of the FPGA bus
+ * image: firmware file
+ * imageSize: firmware file size
+ * update_ops: update operations of the file, modified
+ * update_ops_count: number of update operations
+ * retimerBitmap: retimers to update
+ * options: see RetimerUpdateOptions
+ *
+ * RETURN: 0 if every retimer was updated, first error otherwise
+ *****************************************************************/
+int runRetimerUpdate(int fd, const unsigned char *image, size_t imageSize,
+		     update_operation *update_ops, int update_ops_count,
+		     RetimerBitmap retimerBitmap,
+		     const RetimerUpdateOptions *options)
+{
+	UpdatePipeline *pipeline = NULL;
+	UpdateJournal journal = { 0 };
+	RetimerBitmap retimerNotUpdated = 0;
+	int updateFirstErrRet = 0;
+	int ret = 0;
+
+	// Composite and bare images reconverge here with update_operations filled in
+	// Perform target filtering intersection and log TargetDetermined logs
+	for (int uo = 0; uo < update_ops_count; uo++) {
+		fprintf(stdout,
+			"update operation %d, startOffset %#zx, "
+			"imageLength %zu, applyBitmap %#x, actual bitmap %#x, "
+			"imageCrc %#x, versionString %s\n",
+			uo, update_ops[uo].startOffset,
+			update_ops[uo].imageLength,
+			update_ops[uo].applyBitmap,
+			update_ops[uo].applyBitmap & retimerBitmap,
+			update_ops[uo].imageCrc,
+			update_ops[uo].versionString);
+		update_ops[uo].applyBitmap &= retimerBitmap;
+		prepareMessageRegistry(
+			update_ops[uo].applyBitmap, "TargetDetermined",
+			update_ops[uo].versionString,
+			MSG_REG_DEV_FOLLOWED_BY_VER,
+			"xyz.openbmc_project.Logging.Entry.Level.Informational",
+			NULL, 0);
+	}
+
+	// identical images are uploaded once and flashed by one trigger
+	mergeUpdateOperations(image, update_ops,
+			      &update_ops_count);
+
+	// retimers already running a component are reported and dropped
+	for (int uo = 0; options->skipCurrent && uo < update_ops_count; uo++) {
+		RetimerBitmap current = 0;
+
+		for (uint8_t index = 0; index < getRetimerCount();
+		     index++) {
+			bool isCurrent = false;
+
+			if (!(update_ops[uo].applyBitmap &
+			      RETIMER_BIT(index))) {
+				continue;
+			}
+			if (checkRetimerFwCurrent(fd, index,
+						  image,
+						  &update_ops[uo],
+						  options->skipCurrentImage,
+						  &isCurrent) == 0 &&
+			    isCurrent) {
+				current |= RETIMER_BIT(index);
+			}
+		}
+		if (!current) {
+			continue;
+		}
+		fprintf(stdout,
+			"update operation %d: retimers %#x already current, skipping\n",
+			uo, current);
+		update_ops[uo].applyBitmap &= ~current;
+		progressRetimers(current, RETIMER_PROGRESS_CURRENT);
+		prepareMessageRegistry(
+			current, "UpdateSuccessful",
+			update_ops[uo].versionString,
+			MSG_REG_DEV_FOLLOWED_BY_VER,
+			"xyz.openbmc_project.Logging.Entry.Level.Informational",
+			NULL, 0);
+	}
+
+	// progress is journaled so an interrupted run can be resumed
+	if (options->journalPath) {
+		openUpdateJournal(&journal, options->journalPath, image,
+				  imageSize, update_ops, update_ops_count,
+				  options->resume);
+		for (int uo = 0; journal.entries && uo < update_ops_count;
+		     uo++) {
+			progressRetimers(journal.entries[uo].doneBitmap,
+					 RETIMER_PROGRESS_UPDATED);
+		}
+	}
+	progressPlan(update_ops, update_ops_count);
+
+	// verify components ahead while earlier ones upload and flash
+	pipeline = startUpdatePipeline(image, update_ops,
+				       update_ops_count);
+
+	for (int uo = 0; uo < update_ops_count; uo++) {
+		fprintf(stderr, "performing update_ops[%d]\n", uo);
+		if (!update_ops[uo].applyBitmap) {
+			fprintf(stdout,
+				"applyBitmap for update_ops[%d] is 0, skipping\n",
+				uo);
+			continue;
+		}
+		progressOperation(update_ops[uo].imageLength,
+				  update_ops[uo].applyBitmap);
+		prepareMessageRegistry(
+			update_ops[uo].applyBitmap,
+			"TransferringToComponent",
+			update_ops[uo].versionString,
+			MSG_REG_VER_FOLLOWED_BY_DEV,
+			"xyz.openbmc_project.Logging.Entry.Level.Informational",
+			NULL, 0);
+
+		// DPRAM upload starts while the image CRC may still be
+		// computed, the update is only triggered on a good CRC
+		ret = uploadImageToFpga(image +
+						update_ops[uo].startOffset,
+					update_ops[uo].imageLength, fd,
+					getFpgaCntrlAddr());
+		if (!ret) {
+			progressPhase(UPDATE_PHASE_VERIFYING);
+			ret = pipeline ? waitUpdateOperationVerified(
+						 pipeline, uo) :
+					 verifyUpdateOperation(
+						 image,
+						 &update_ops[uo]);
+			if (ret) {
+				prepareMessageRegistry(
+					update_ops[uo].applyBitmap,
+					"VerificationFailed",
+					update_ops[uo].versionString,
+					MSG_REG_VER_FOLLOWED_BY_DEV,
+					"xyz.openbmc_project.Logging.Entry.Level.Critical",
+					NULL, 0);
+				progressRetimers(update_ops[uo].applyBitmap,
+						 RETIMER_PROGRESS_FAILED);
+				// the image file is corrupt, stop here
+				updateFirstErrRet = ret;
+				break;
+			}
+		}
+		if (!ret) {
+			ret = setFpgaImageInfo(fd, getFpgaCntrlAddr(),
+					       update_ops[uo].imageLength,
+					       update_ops[uo].imageCrc);
+		}
+		if (!ret) {
+			journalPhase(&journal, uo, JOURNAL_UPLOADED);
+		}
+		if (ret) {
+			fprintf(stderr,
+				"FW Update FW image copy to FPGA failed  error code%d!!!\n",
+				ret);
+			progressRetimers(update_ops[uo].applyBitmap,
+					 RETIMER_PROGRESS_FAILED);
+			prepareMessageRegistry(
+				update_ops[uo].applyBitmap,
+				"TransferFailed",
+				update_ops[uo].versionString,
+				MSG_REG_VER_FOLLOWED_BY_DEV,
+				"xyz.openbmc_project.Logging.Entry.Level.Critical",
+				NULL, 0);
+			updateFirstErrRet = ret;
+			continue;
+		}
+
+		// Trigger FW Update to one or more retimer at a time and monitor the update progress and its completion
+		journalPhase(&journal, uo, JOURNAL_TRIGGERED);
+		progressPhase(UPDATE_PHASE_FLASHING);
+		progressRetimers(update_ops[uo].applyBitmap,
+				 RETIMER_PROGRESS_FLASHING);
+		// without a retry report, every targeted retimer failed
+		retimerNotUpdated = update_ops[uo].applyBitmap;
+		ret = startRetimerFwUpdate(fd,
+					   update_ops[uo].applyBitmap,
+					   update_ops[uo].versionString,
+					   &retimerNotUpdated);
+		progressRetimers(update_ops[uo].applyBitmap &
+					 ~(ret ? retimerNotUpdated : 0),
+				 RETIMER_PROGRESS_UPDATED);
+		progressRetimers(update_ops[uo].applyBitmap &
+					 (ret ? retimerNotUpdated : 0),
+				 RETIMER_PROGRESS_FAILED);
+		journalResult(&journal, uo,
+			      ret ? update_ops[uo].applyBitmap &
+					    ~retimerNotUpdated :
+				    update_ops[uo].applyBitmap,
+			      ret ? retimerNotUpdated : 0);
+		if (ret) {
+			fprintf(stderr,
+				"FW Update for Retimer %u failed for retimer with error code "
+				"%d retimerNotUpdated %u!!!\n",
+				update_ops[uo].applyBitmap, ret,
+				retimerNotUpdated);
+			prepareMessageRegistry(
+				retimerNotUpdated, "ApplyFailed",
+				update_ops[uo].versionString,
+				MSG_REG_VER_FOLLOWED_BY_DEV,
+				"xyz.openbmc_project.Logging.Entry.Level.Critical",
+				NULL, 0);
+
+			if (update_ops[uo].applyBitmap ^
+			    retimerNotUpdated) {
+				prepareMessageRegistry(
+					(update_ops[uo].applyBitmap ^
+					 retimerNotUpdated),
+					"UpdateSuccessful",
+					update_ops[uo].versionString,
+					MSG_REG_DEV_FOLLOWED_BY_VER,
+					"xyz.openbmc_project.Logging.Entry.Level.Informational",
+					NULL, 0);
+
+				prepareMessageRegistry(
+					(update_ops[uo].applyBitmap ^
+					 retimerNotUpdated),
+					"AwaitToActivate",
+					update_ops[uo].versionString,
+					MSG_REG_VER_FOLLOWED_BY_DEV,
+					"xyz.openbmc_project.Logging.Entry.Level.Informational",
+					"AC power cycle", 0);
+			}
+			updateFirstErrRet = ret;
+			// a cancelled run uploads and triggers nothing more
+			if (ret == -ECANCELED) {
+				break;
+			}
+			continue;
+		}
+		prepareMessageRegistry(
+			update_ops[uo].applyBitmap, "UpdateSuccessful",
+			update_ops[uo].versionString,
+			MSG_REG_DEV_FOLLOWED_BY_VER,
+			"xyz.openbmc_project.Logging.Entry.Level.Informational",
+			NULL, 0);
+
+		prepareMessageRegistry(
+			update_ops[uo].applyBitmap, "AwaitToActivate",
+			update_ops[uo].versionString,
+			MSG_REG_VER_FOLLOWED_BY_DEV,
+			"xyz.openbmc_project.Logging.Entry.Level.Informational",
+			"AC power cycle", 0);
+	}
+	stopUpdatePipeline(pipeline);
+	if (!ret && updateFirstErrRet) {
+		ret = updateFirstErrRet;
+	}
+	closeUpdateJournal(&journal, ret == 0);
+	progressFinished(ret);
+	return ret;
+}
+
+typedef struct {
+	RetimerTarget *target;
+	const unsigned char *image;
+	size_t imageSize;
+	const update_operation *update_ops;
+	int update_ops_count;
+	RetimerBitmap retimerBitmap;
+	RetimerUpdateOptions options;
+	char journalPath[MAX_NAME_SIZE];
+} TargetWorker;
+
+static int updateTarget(TargetWorker *w)
+{
+	RetimerTarget *target = w->target;
+	DpramLease lease = { .fd = -1 };
+	update_operation *ops = NULL;
+	char owner[DPRAM_LEASE_HOLDER_SIZE];
+	int ret = 0;
+	int fd;
+
+	fd = openI2CBus(target->bus);
+	if (fd < 0) {
+		return -ERROR_OPEN_I2C_DEVICE;
+	}
+	// every helper of this thread talks to this FPGA only
+	setFpgaCntrlAddr(target->slaveId);
+	setFpgaSidebandBus(target->sidebandBus);
+
+	snprintf(owner, sizeof(owner), "updateRetimerFw bus %u address %#x",
+		 target->bus, target->slaveId);
+	ret = acquireFpgaLease(&lease, target->bus, target->slaveId,
+			       DPRAM_LEASE_HIGH, DPRAM_LEASE_UPDATE_TIMEOUT_MS,
+			       owner);
+	// the FPGA status is only stable while the lease is held
+	if (!ret && w->options.preflight) {
+		ret = preflightRetimerUpdate(fd, target->slaveId);
+	}
+	if (ret) {
+		releaseDpramLease(&lease);
+		prepareMessageRegistry(
+			w->retimerBitmap, "TransferFailed", DEFAULT_VERSION,
+			MSG_REG_VER_FOLLOWED_BY_DEV,
+			"xyz.openbmc_project.Logging.Entry.Level.Critical",
+			NULL, 0);
+		return ret;
+	}
+	// targets are filtered and merged in place, each FPGA gets its copy
+	ops = malloc((w->update_ops_count ? w->update_ops_count : 1) *
+		     sizeof(*ops));
+	if (!ops) {
+		releaseDpramLease(&lease);
+		return -ERROR_MALLOC_FAILURE;
+	}
+	memcpy(ops, w->update_ops, w->update_ops_count * sizeof(*ops));
+	ret = runRetimerUpdate(fd, w->image, w->imageSize, ops,
+			       w->update_ops_count, w->retimerBitmap,
+			       &w->options);
+	releaseDpramLease(&lease);
+	free(ops);
+	return ret;
+}
+
+static void *targetWorker(void *arg)
+{
+	TargetWorker *w = arg;
+
+	w->target->result = updateTarget(w);
+	// the transfer context and log bus of this thread go with it
+	releaseFpgaTransferCtx();
+	closeLogMessageBus();
+	return NULL;
+}
+
+/**************************************************************
+ * runRetimerUpdateTargets()
+ *
+ * Update the retimers of several FPGAs at once, one worker thread
+ * per FPGA. Image CRCs are checked once up front. Each FPGA takes
+ * its own DPRAM lease and journal, the journal path of options is
+ * the base of updateJournalPath(). Preflight and
+ * extended error checks use the sidebandBus of the target.
+ *
+ * image: firmware file
+ * imageSize: firmware file size
+ * update_ops: update operations of the file, not modified
+ * update_ops_count: number of update operations
+ * retimerBitmap: retimers to update on every FPGA
+ * options: see RetimerUpdateOptions
+ * targets: FPGAs to update, result is filled in
+ * targetCount: number of targets, at most MAX_RETIMER_TARGETS
+ *
+ * RETURN: 0 if every FPGA was updated, result of the first failed
+ *	   target otherwise
+ *****************************************************************/
+int runRetimerUpdateTargets(const unsigned char *image, size_t imageSize,
+			    const update_operation *update_ops,
+			    int update_ops_count, RetimerBitmap retimerBitmap,
+			    const RetimerUpdateOptions *options,
+			    RetimerTarget *targets, int targetCount)
+{
+	TargetWorker workers[MAX_RETIMER_TARGETS];
+	pthread_t threads[MAX_RETIMER_TARGETS];
+	bool started[MAX_RETIMER_TARGETS] = { false };
+	update_operation *verified = NULL;
+	int ret = 0;
+
+	if (targetCount < 1 || targetCount > MAX_RETIMER_TARGETS) {
+		return -ERROR_INPUT_ARGUMENTS;
+	}
+	for (int i = 0; i < targetCount; i++) {
+		if (targets[i].sidebandBus >= MAX_I2C_BUS_NUM) {
+			fprintf(stderr, "No sideband bus for FPGA bus %u\n",
+				targets[i].bus);
+			return -ERROR_INPUT_ARGUMENTS;
+		}
+	}
+	verified = malloc((update_ops_count > 0 ? update_ops_count : 1) *
+			  sizeof(*verified));
+	if (!verified) {
+		return -ERROR_MALLOC_FAILURE;
+	}
+	memcpy(verified, update_ops, update_ops_count * sizeof(*verified));
+
+	// one CRC pass serves every FPGA
+	for (int uo = 0; uo < update_ops_count; uo++) {
+		ret = verifyUpdateOperation(image, &verified[uo]);
+		if (ret) {
+			prepareMessageRegistry(
+				verified[uo].applyBitmap & retimerBitmap,
+				"VerificationFailed",
+				verified[uo].versionString,
+				MSG_REG_VER_FOLLOWED_BY_DEV,
+				"xyz.openbmc_project.Logging.Entry.Level.Critical",
+				NULL, 0);
+			free(verified);
+			return ret;
+		}
+	}
+
+	for (int i = 0; i < targetCount; i++) {
+		TargetWorker *w = &workers[i];
+
+		w->target = &targets[i];
+		w->image = image;
+		w->imageSize = imageSize;
+		w->update_ops = verified;
+		w->update_ops_count = update_ops_count;
+		w->retimerBitmap = retimerBitmap;
+		w->options = *options;
+		if (options->journalPath) {
+			updateJournalPath(w->journalPath,
+					  sizeof(w->journalPath),
+					  options->journalPath, targets[i].bus,
+					  targets[i].slaveId, 0);
+			w->options.journalPath = w->journalPath;
+		}
+		targets[i].result = -ERROR_UNKNOWN;
+		started[i] = pthread_create(&threads[i], NULL, targetWorker,
+					    w) == 0;
+		if (!started[i]) {
+			fprintf(stderr, "Unable to start worker for bus %u\n",
+				targets[i].bus);
+		}
+	}
+
+	ret = 0;
+	for (int i = 0; i < targetCount; i++) {
+		if (started[i]) {
+			pthread_join(threads[i], NULL);
+		}
+		fprintf(stdout, "FPGA bus %u address %#x: %s (%d)\n",
+			targets[i].bus, targets[i].slaveId,
+			targets[i].result ? "failed" : "updated",
+			targets[i].result);
+		if (!ret) {
+			ret = targets[i].result;
+		}
+	}
+	free(verified);
+	return ret;
+}
+
+/**************************************************************
+ * runRetimerRead()
+ *
+ * Read the complete image of one retimer into a file. The caller
+ * holds the DPRAM lease.
+ *
+ * fd: file descriptor of the FPGA bus
+ * retimer: retimer index
+ * outFd: file the image is written to, MAX_FW_IMAGE_SIZE bytes
+ *
+ * RETURN: 0 if success
+ *****************************************************************/
+int runRetimerRead(int fd, uint8_t retimer, int outFd)
+{
+	int ret;
+
+	if (ftruncate(outFd, MAX_FW_IMAGE_SIZE) < 0) {
+		fprintf(stderr, "FW READ for Retimer failed for retimer !!!");
+		return -ERROR_OPEN_FIRMWARE;
+	}
+
+	// Clear DPRAM before reading content from Retimer
+	ret = clearFpgaDpram(fd, getFpgaCntrlAddr());
+	if (ret) {
+		fprintf(stderr, "FW read DPRAM clear failed error code%d!!!",
+			ret);
+		return ret;
+	}
+	// Initiate FW READ to one of the retimer at a time and monitor the read progress and status
+	ret = readRetimerfw(fd, retimer);
+	if (ret) {
+		fprintf(stderr, "FW READ for Retimer failed for retimer %d!!!",
+			retimer);
+		return ret;
+	}
+	// pages are streamed into the file as they arrive
+	ret = copyImageFromFpga(outFd, fd, getFpgaCntrlAddr());
+	if (ret) {
+		fprintf(stderr,
+			"FW read FW image copy from FPGA failed  error code%d!!!",
+			ret);
+	}
+	return ret;
+}
+
+/**************************************************************
+ * runRetimerVersion()
+ *
+ * Print the firmware version record of the retimers in retimerBitmap
+ *
+ * fd: file descriptor of the FPGA bus
+ * retimerBitmap: retimers to query
+ *
+ * RETURN: 0 if every version was read, first error otherwise
+ *****************************************************************/
+int runRetimerVersion(int fd, RetimerBitmap retimerBitmap)
+{
+	int ret = 0;
+
+	for (uint8_t index = 0; index < getRetimerCount(); index++) {
+		char fwVersion[RETIMER_FW_VERSION_STR_LEN];
+		int verRet;
+
+		if (!(retimerBitmap & RETIMER_BIT(index))) {
+			continue;
+		}
+		verRet = readRetimerFwVersion(fd, index, fwVersion,
+					      sizeof(fwVersion));
+		if (verRet) {
+			fprintf(stderr,
+				"FW version read failed for retimer %d error code %d\n",
+				index, verRet);
+			if (!ret) {
+				ret = verRet;
+			}
+			continue;
+		}
+		fprintf(stdout, "Retimer %d FW version %s\n", index, fwVersion);
+	}
+	return ret;
+}
+
+/**************************************************************
+ * verifyRetimerImage()
+ *
+ * Read back the retimers of retimerBitmap and compare them with
+ * the components of a parsed firmware file that target them.
+ * The caller holds the DPRAM lease.
+ *
+ * fd: file descriptor of the FPGA bus
+ * image: firmware file
+ * update_ops: update operations of the file, CRCs verified
+ * update_ops_count: number of update operations
+ * retimerBitmap: retimers to compare
+ * mismatch: outgoing, retimers not holding their component
+ *
+ * RETURN: 0 if every retimer could be compared, first error otherwise
+ *****************************************************************/
+int verifyRetimerImage(int fd, const unsigned char *image,
+		       const update_operation *update_ops,
+		       int update_ops_count, RetimerBitmap retimerBitmap,
+		       RetimerBitmap *mismatch)
+{
+	int firstErr = 0;
+
+	*mismatch = 0;
+	for (int uo = 0; uo < update_ops_count; uo++) {
+		update_operation op = update_ops[uo];
+
+		// an empty version string compares the image digest
+		op.versionString[0] = '\0';
+		for (uint8_t index = 0; index < getRetimerCount(); index++) {
+			bool current = false;
+			int ret;
+
+			if (!(op.applyBitmap & retimerBitmap &
+			      RETIMER_BIT(index))) {
+				continue;
+			}
+			ret = checkRetimerFwCurrent(fd, index, image, &op,
+						    true, &current);
+			if (ret && !firstErr) {
+				firstErr = ret;
+			}
+			if (!current) {
+				*mismatch |= RETIMER_BIT(index);
+			}
+		}
+	}
+	return firstErr;
+}
+
+static void dropRetimerImage(RetimerImage *c)
+{
+	if (c->image) {
+		munmap(c->image, c->size);
+		close(c->fd);
+	}
+	free(c->ops);
+	memset(c, 0, sizeof(*c));
+}
+
+/**************************************************************
+ * getRetimerImage()
+ *
+ * Map and fully verify a firmware file, or return the entry of an
+ * earlier call when the file did not change since. Verified update
+ * operations have no CRC pending, so runRetimerUpdate() does not
+ * compute the image CRCs again. Up to RETIMER_IMAGE_CACHE_SIZE
+ * files stay mapped, the least recently used one makes room.
+ * Deleted files are dropped first, see pruneRetimerImages().
+ *
+ * path: firmware file
+ * version: versionStr passed to parseCompositeImage()
+ * err: outgoing, error if NULL is returned
+ *
+ * RETURN: cache entry, NULL if the file can not be used
+ *****************************************************************/
+const RetimerImage *getRetimerImage(const char *path, const char *version,
+				    int *err)
+{
+	RetimerImage *c = NULL;
+	struct stat st;
+	int fd;
+
+	if (strlen(path) >= MAX_NAME_SIZE || strlen(version) >= MAX_NAME_SIZE ||
+	    stat(path, &st)) {
+		*err = -ERROR_OPEN_FIRMWARE;
+		return NULL;
+	}
+	pruneRetimerImages();
+	for (int i = 0; i < RETIMER_IMAGE_CACHE_SIZE; i++) {
+		RetimerImage *e = &imageCache[i];
+
+		if (e->image && !strcmp(e->path, path) &&
+		    !strcmp(e->version, version) && e->dev == st.st_dev &&
+		    e->ino == st.st_ino && e->size == st.st_size &&
+		    e->mtime.tv_sec == st.st_mtim.tv_sec &&
+		    e->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+			e->lastUse = ++imageCacheClock;
+			return e;
+		}
+		if (!c || !e->image || (c->image && e->lastUse < c->lastUse)) {
+			c = e;
+		}
+	}
+
+	dropRetimerImage(c);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		*err = -ERROR_OPEN_FIRMWARE;
+		return NULL;
+	}
+	c->image = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (c->image == MAP_FAILED) {
+		c->image = NULL;
+		close(fd);
+		*err = -ERROR_OPEN_FIRMWARE;
+		return NULL;
+	}
+	c->fd = fd;
+	c->size = st.st_size;
+	*err = parseCompositeImage(c->image, c->size, version, &c->ops,
+				   &c->opsCount);
+	if (*err || (c->opsCount > 0 && !c->ops)) {
+		fprintf(stderr, "parseCompositeImage returned: [%d]\n", *err);
+		dropRetimerImage(c);
+		*err = *err ? *err : -ERROR_UNKNOWN;
+		return NULL;
+	}
+	strcpy(c->path, path);
+	strcpy(c->version, version);
+	c->dev = st.st_dev;
+	c->ino = st.st_ino;
+	c->mtime = st.st_mtim;
+	c->lastUse = ++imageCacheClock;
+	return c;
+}
+
+/**************************************************************
+ * pruneRetimerImages()
+ *
+ * Unmap the firmware files that were deleted since they were
+ * cached, a mapping would keep e.g. a tmpfs file in memory
+ *****************************************************************/
+void pruneRetimerImages(void)
+{
+	for (int i = 0; i < RETIMER_IMAGE_CACHE_SIZE; i++) {
+		RetimerImage *e = &imageCache[i];
+		struct stat st;
+
+		if (e->image && (fstat(e->fd, &st) || st.st_nlink == 0)) {
+			debug_print("dropping deleted firmware file %s\n",
+				    e->path);
+			dropRetimerImage(e);
+		}
+	}
+}
+
+/**************************************************************
+ * releaseRetimerImages()
+ *
+ * Unmap every firmware file kept by getRetimerImage()
+ *****************************************************************/
+void releaseRetimerImages(void)
+{
+	for (int i = 0; i < RETIMER_IMAGE_CACHE_SIZE; i++) {
+		dropRetimerImage(&imageCache[i]);
+	}
+}
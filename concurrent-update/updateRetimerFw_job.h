@@ -0,0 +1,93 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2022-2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UPDATERETIMERFW_JOB_H_
+#define UPDATERETIMERFW_JOB_H_
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include "updateRetimerFwOverI2C.h"
+
+/**
+* @brief *
+* Optional steps of runRetimerUpdate()
+**/
+typedef struct {
+	bool skipCurrent; /**< drop retimers already running the image */
+	bool skipCurrentImage; /**< without a version compare the image CRC */
+	bool resume; /**< drop retimers the journal lists as done */
+	const char *journalPath; /**< journal file, NULL disables journaling */
+	bool preflight; /**< check each target with preflightRetimerUpdate() */
+} RetimerUpdateOptions;
+
+/**
+* @brief *
+* One FPGA of a multi-FPGA update
+**/
+typedef struct {
+	unsigned int bus; /**< i2c bus of the FPGA */
+	uint8_t slaveId; /**< FPGA controller address */
+	unsigned int sidebandBus; /**< CPLD and secondary regtbl bus, see fpgaSidebandBus() */
+	int result; /**< outgoing, result of the update on this FPGA */
+} RetimerTarget;
+
+#define MAX_RETIMER_TARGETS 8
+
+// verified firmware files kept mapped by getRetimerImage()
+#define RETIMER_IMAGE_CACHE_SIZE 4
+
+/**
+* @brief *
+* Firmware file mapped and fully verified by getRetimerImage()
+**/
+typedef struct {
+	char path[MAX_NAME_SIZE];
+	char version[MAX_NAME_SIZE]; /**< versionStr the file was parsed with */
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	int fd; /**< kept open to notice the file being deleted */
+	unsigned char *image;
+	update_operation *ops; /**< no CRC pending, copy before use */
+	int opsCount;
+	unsigned long lastUse;
+} RetimerImage;
+
+int runRetimerUpdate(int fd, const unsigned char *image, size_t imageSize,
+		     update_operation *update_ops, int update_ops_count,
+		     RetimerBitmap retimerBitmap,
+		     const RetimerUpdateOptions *options);
+int runRetimerUpdateTargets(const unsigned char *image, size_t imageSize,
+			    const update_operation *update_ops,
+			    int update_ops_count, RetimerBitmap retimerBitmap,
+			    const RetimerUpdateOptions *options,
+			    RetimerTarget *targets, int targetCount);
+int runRetimerRead(int fd, uint8_t retimer, int outFd);
+int runRetimerVersion(int fd, RetimerBitmap retimerBitmap);
+int verifyRetimerImage(int fd, const unsigned char *image,
+		       const update_operation *update_ops,
+		       int update_ops_count, RetimerBitmap retimerBitmap,
+		       RetimerBitmap *mismatch);
+const RetimerImage *getRetimerImage(const char *path, const char *version,
+				    int *err);
+void pruneRetimerImages(void);
+void releaseRetimerImages(void);
+
+#endif
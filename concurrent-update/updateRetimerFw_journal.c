@@ -0,0 +1,310 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2022-2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <unistd.h>
+#include "updateRetimerFw_journal.h"
+
+/**************************************************************
+ * writeJournal()
+ *
+ * Replace the journal file by writing a temporary file, syncing
+ * it and renaming it over the old one
+ *
+ * RETURN: 0 if success, -errno otherwise
+ *****************************************************************/
+static int writeJournal(const UpdateJournal *journal)
+{
+	char tmp[MAX_NAME_SIZE];
+	char dir[MAX_NAME_SIZE];
+	size_t len = journal->header.opCount * sizeof(JournalEntry);
+	int fd;
+	int ret = 0;
+
+	snprintf(dir, sizeof(dir), "%s", journal->path);
+	if (mkdir(dirname(dir), 0755) && errno != EEXIST) {
+		return -errno;
+	}
+	snprintf(tmp, sizeof(tmp), "%s.tmp", journal->path);
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		return -errno;
+	}
+	if (write(fd, &journal->header, sizeof(journal->header)) !=
+		    sizeof(journal->header) ||
+	    (len && write(fd, journal->entries, len) != (ssize_t)len) ||
+	    fsync(fd)) {
+		ret = errno ? -errno : -EIO;
+	}
+	close(fd);
+	if (!ret && rename(tmp, journal->path)) {
+		ret = -errno;
+	}
+	if (ret) {
+		fprintf(stderr, "Update journal %s not written: %s\n",
+			journal->path, strerror(-ret));
+		unlink(tmp);
+	}
+	return ret;
+}
+
+/**************************************************************
+ * loadJournal()
+ *
+ * Read a journal written for the same firmware file
+ *
+ * RETURN: entries of the old journal, NULL if there is none or it
+ *	   belongs to another image
+ *****************************************************************/
+static JournalEntry *loadJournal(const UpdateJournal *journal,
+				 unsigned int *count)
+{
+	JournalHeader header;
+	JournalEntry *entries = NULL;
+	size_t len;
+	int fd = open(journal->path, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0) {
+		fprintf(stdout, "No update journal to resume from\n");
+		return NULL;
+	}
+	if (read(fd, &header, sizeof(header)) != sizeof(header) ||
+	    memcmp(header.magic, RETIMER_JOURNAL_MAGIC, sizeof(header.magic)) ||
+	    header.version != RETIMER_JOURNAL_VERSION) {
+		fprintf(stderr, "Update journal %s is not valid\n",
+			journal->path);
+		close(fd);
+		return NULL;
+	}
+	if (header.imageSize != journal->header.imageSize ||
+	    header.imageCrc != journal->header.imageCrc) {
+		fprintf(stderr,
+			"Update journal is for another image (size %u crc 0x%x), not resuming\n",
+			header.imageSize, header.imageCrc);
+		close(fd);
+		return NULL;
+	}
+	len = header.opCount * sizeof(JournalEntry);
+	entries = malloc(len ? len : 1);
+	if (entries && len && read(fd, entries, len) != (ssize_t)len) {
+		fprintf(stderr, "Update journal %s is truncated\n",
+			journal->path);
+		free(entries);
+		entries = NULL;
+	}
+	close(fd);
+	*count = header.opCount;
+	return entries;
+}
+
+/**************************************************************
+ * updateJournalPath()
+ *
+ * Name the journal of the update of one FPGA, runs on other FPGAs
+ * and other manifest steps never overwrite it
+ *
+ * path: outgoing, journal file
+ * len: size of path
+ * base: journal file of the tool, RETIMER_JOURNAL_FILE
+ * bus: i2c bus of the FPGA
+ * slaveId: FPGA controller address
+ * step: manifest line, 0 outside a manifest
+ *****************************************************************/
+void updateJournalPath(char *path, size_t len, const char *base,
+		       unsigned int bus, unsigned int slaveId,
+		       unsigned int step)
+{
+	if (step) {
+		snprintf(path, len, "%s.%u-%02x.%u", base, bus, slaveId, step);
+	} else {
+		snprintf(path, len, "%s.%u-%02x", base, bus, slaveId);
+	}
+}
+
+/**************************************************************
+ * journalImageId()
+ *
+ * Identify a firmware file by the CRCs of its component headers,
+ * the image data is not read. A bare image has no header CRC, its
+ * journal entries carry the CRC of the data instead.
+ *
+ * RETURN: CRC32 of the header CRCs
+ *****************************************************************/
+static uint32_t journalImageId(const update_operation *update_ops,
+			       int update_ops_count)
+{
+	uint32_t *crcs = calloc(update_ops_count ? update_ops_count : 1,
+				sizeof(*crcs));
+	uint32_t id;
+
+	if (!crcs) {
+		return 0;
+	}
+	for (int uo = 0; uo < update_ops_count; uo++) {
+		if (!update_ops[uo].crcFromData) {
+			crcs[uo] = update_ops[uo].imageCrc;
+		}
+	}
+	id = crc32((const unsigned char *)crcs,
+		   update_ops_count * sizeof(*crcs));
+	free(crcs);
+	return id;
+}
+
+/**************************************************************
+ * openUpdateJournal()
+ *
+ * Start the journal of an update run. With resume set, retimers an
+ * earlier run of the same firmware file finished are removed from
+ * the applyBitmap of the matching update operations, operations are
+ * matched by offset, length and CRC. The CRC of a bare image is
+ * only computed here with resume, otherwise it is journaled once
+ * the upload verified it.
+ *
+ * journal: outgoing, journal to pass to the other functions
+ * path: journal file, RETIMER_JOURNAL_FILE
+ * image: firmware file
+ * imageSize: firmware file size
+ * update_ops: planned update operations, applyBitmap may be reduced,
+ *	       must stay valid until closeUpdateJournal()
+ * update_ops_count: number of update operations
+ * resume: continue an earlier run
+ *
+ * RETURN: 0 if success, -errno if the journal could not be written
+ *****************************************************************/
+int openUpdateJournal(UpdateJournal *journal, const char *path,
+		      const unsigned char *image, size_t imageSize,
+		      update_operation *update_ops, int update_ops_count,
+		      bool resume)
+{
+	JournalEntry *old = NULL;
+	unsigned int oldCount = 0;
+
+	memset(journal, 0, sizeof(*journal));
+	journal->path = path;
+	memcpy(journal->header.magic, RETIMER_JOURNAL_MAGIC,
+	       sizeof(journal->header.magic));
+	journal->header.version = RETIMER_JOURNAL_VERSION;
+	journal->header.opCount = update_ops_count;
+	journal->header.imageSize = imageSize;
+	journal->header.imageCrc = journalImageId(update_ops,
+						  update_ops_count);
+	journal->ops = update_ops;
+	journal->entries = calloc(update_ops_count ? update_ops_count : 1,
+				  sizeof(JournalEntry));
+	if (!journal->entries) {
+		return -ENOMEM;
+	}
+
+	if (resume) {
+		old = loadJournal(journal, &oldCount);
+	}
+	for (int uo = 0; uo < update_ops_count; uo++) {
+		JournalEntry *e = &journal->entries[uo];
+
+		// a bare image never fails, it takes the computed CRC
+		if (resume && update_ops[uo].crcFromData) {
+			verifyUpdateOperation(image, &update_ops[uo]);
+		}
+		e->startOffset = update_ops[uo].startOffset;
+		e->imageLength = update_ops[uo].imageLength;
+		e->imageCrc = update_ops[uo].imageCrc;
+		e->phase = JOURNAL_PARSED;
+		for (unsigned int i = 0; old && i < oldCount; i++) {
+			if (old[i].startOffset == e->startOffset &&
+			    old[i].imageLength == e->imageLength &&
+			    old[i].imageCrc == e->imageCrc) {
+				e->doneBitmap |= old[i].doneBitmap &
+						 update_ops[uo].applyBitmap;
+			}
+		}
+		if (e->doneBitmap) {
+			fprintf(stdout,
+				"update operation %d: retimers %#x finished in an earlier run\n",
+				uo, e->doneBitmap);
+		}
+		update_ops[uo].applyBitmap &= ~e->doneBitmap;
+		e->applyBitmap = update_ops[uo].applyBitmap;
+	}
+	free(old);
+
+	return writeJournal(journal);
+}
+
+/**************************************************************
+ * journalPhase()
+ *
+ * Record that update operation uo reached phase. From
+ * JOURNAL_UPLOADED on the image CRC of the operation is final.
+ *
+ * RETURN: 0 if success, -errno if the journal could not be written
+ *****************************************************************/
+int journalPhase(UpdateJournal *journal, int uo, JournalPhase phase)
+{
+	if (!journal->entries || uo < 0 || uo >= journal->header.opCount) {
+		return -EINVAL;
+	}
+	if (phase >= JOURNAL_UPLOADED && !journal->ops[uo].imageCrcPending) {
+		journal->entries[uo].imageCrc = journal->ops[uo].imageCrc;
+	}
+	journal->entries[uo].phase = phase;
+	return writeJournal(journal);
+}
+
+/**************************************************************
+ * journalResult()
+ *
+ * Record the retimers update operation uo did and did not update
+ *
+ * RETURN: 0 if success, -errno if the journal could not be written
+ *****************************************************************/
+int journalResult(UpdateJournal *journal, int uo, RetimerBitmap done,
+		  RetimerBitmap failed)
+{
+	if (!journal->entries || uo < 0 || uo >= journal->header.opCount) {
+		return -EINVAL;
+	}
+	journal->entries[uo].phase = JOURNAL_FINISHED;
+	journal->entries[uo].doneBitmap |= done;
+	journal->entries[uo].failedBitmap = failed & ~done;
+	return writeJournal(journal);
+}
+
+/**************************************************************
+ * closeUpdateJournal()
+ *
+ * End the journal of an update run
+ *
+ * done: every retimer was updated, nothing is left to resume and
+ *	 the journal file is removed
+ *****************************************************************/
+void closeUpdateJournal(UpdateJournal *journal, bool done)
+{
+	if (done && journal->entries && unlink(journal->path) &&
+	    errno != ENOENT) {
+		fprintf(stderr, "Update journal %s not removed: %s\n",
+			journal->path, strerror(errno));
+	}
+	free(journal->entries);
+	journal->entries = NULL;
+}
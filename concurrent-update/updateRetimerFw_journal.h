@@ -0,0 +1,85 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2022-2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UPDATERETIMERFW_JOURNAL_H_
+#define UPDATERETIMERFW_JOURNAL_H_
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "updateRetimerFwOverI2C.h"
+
+/*
+ * Progress of an update run, rewritten atomically at every phase
+ * boundary so an interrupted run can be resumed with only the
+ * retimers that did not finish. /var/lib survives a BMC reboot.
+ * Every FPGA and manifest step has its own journal, see
+ * updateJournalPath(), it is removed once the run updated all
+ * of its retimers.
+ */
+#define RETIMER_JOURNAL_DIR RETIMER_STATE_DIR
+#define RETIMER_JOURNAL_FILE RETIMER_JOURNAL_DIR "/update.journal"
+#define RETIMER_JOURNAL_MAGIC "RTJN"
+#define RETIMER_JOURNAL_VERSION 3
+
+typedef enum {
+	JOURNAL_PARSED = 0, /**< planned, nothing sent */
+	JOURNAL_UPLOADED, /**< image and image info in the FPGA */
+	JOURNAL_TRIGGERED, /**< update triggered, result unknown */
+	JOURNAL_FINISHED, /**< doneBitmap and failedBitmap are final */
+} JournalPhase;
+
+typedef struct __attribute__((packed)) {
+	char magic[4]; // RTJN
+	uint16_t version;
+	uint16_t opCount;
+	uint32_t imageSize;
+	uint32_t imageCrc; // CRC32 of the component header CRCs
+} JournalHeader;
+static_assert(sizeof(JournalHeader) == 16, "sizeof(JournalHeader) != 16");
+
+typedef struct __attribute__((packed)) {
+	uint32_t startOffset;
+	uint32_t imageLength;
+	uint32_t imageCrc;
+	uint8_t phase; // JournalPhase
+	uint8_t reserved[3];
+	uint32_t applyBitmap; // retimers still to update in this run
+	uint32_t doneBitmap; // retimers updated, in this or an earlier run
+	uint32_t failedBitmap;
+} JournalEntry;
+static_assert(sizeof(JournalEntry) == 28, "sizeof(JournalEntry) != 28");
+
+typedef struct {
+	const char *path;
+	JournalHeader header;
+	JournalEntry *entries;
+	const update_operation *ops; /**< operations of the run */
+} UpdateJournal;
+
+void updateJournalPath(char *path, size_t len, const char *base,
+		       unsigned int bus, unsigned int slaveId,
+		       unsigned int step);
+int openUpdateJournal(UpdateJournal *journal, const char *path,
+		      const unsigned char *image, size_t imageSize,
+		      update_operation *update_ops, int update_ops_count,
+		      bool resume);
+int journalPhase(UpdateJournal *journal, int uo, JournalPhase phase);
+int journalResult(UpdateJournal *journal, int uo, RetimerBitmap done,
+		  RetimerBitmap failed);
+void closeUpdateJournal(UpdateJournal *journal, bool done);
+
+#endif
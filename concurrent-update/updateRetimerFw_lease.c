@@ -0,0 +1,236 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2022-2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include "updateRetimerFw_lease.h"
+
+static const char *leasePriorityName[] = { "low", "high" };
+
+static long long leaseNowMs(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+/**************************************************************
+ * leaseFile()
+ *
+ * Lease or want file of the FPGA controller slaveId on bus
+ *****************************************************************/
+static void leaseFile(char *path, size_t len, unsigned int bus,
+		      unsigned int slaveId, bool want)
+{
+	snprintf(path, len, DPRAM_LEASE_FILE_FMT, getDpramStampDir(), bus,
+		 slaveId, want ? "want" : "lease");
+}
+
+static int openLeaseFile(const char *path)
+{
+	if (mkdir(getDpramStampDir(), 0755) && errno != EEXIST) {
+		return -1;
+	}
+	return open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+}
+
+/**************************************************************
+ * writeLeaseHolder()
+ *
+ * Publish who holds the lease, read back by getDpramLeaseHolder()
+ *****************************************************************/
+static void writeLeaseHolder(int fd, DpramLeasePriority priority,
+			     const char *owner)
+{
+	char holder[DPRAM_LEASE_HOLDER_SIZE];
+	int len;
+
+	len = snprintf(holder, sizeof(holder),
+		       "pid %d (%s) %s priority since %lld\n", getpid(),
+		       owner ? owner : "unknown", leasePriorityName[priority],
+		       (long long)time(NULL));
+	if (len > 0 && ftruncate(fd, 0) == 0 &&
+	    pwrite(fd, holder, len, 0) != len) {
+		fprintf(stderr, "Unable to publish DPRAM lease holder\n");
+	}
+}
+
+/**************************************************************
+ * acquireFpgaLease()
+ *
+ * Take exclusive ownership of the DPRAM and control registers of
+ * the FPGA controller slaveId on bus, other FPGAs have their own
+ * lease.
+ * A high priority caller announces itself while waiting, low
+ * priority callers do not take the lease while one is waiting.
+ * The lease is dropped by the kernel if the holder dies.
+ *
+ * lease: outgoing, lease to pass to releaseDpramLease()
+ * bus: i2c bus of the FPGA
+ * slaveId: FPGA controller address
+ * priority: DPRAM_LEASE_HIGH for updates, DPRAM_LEASE_LOW otherwise
+ * timeoutMs: how long to wait for the current holder
+ * owner: name published to other waiters
+ *
+ * RETURN: 0 if success, -ERROR_DPRAM_BUSY on timeout
+ *****************************************************************/
+int acquireFpgaLease(DpramLease *lease, unsigned int bus,
+		     unsigned int slaveId, DpramLeasePriority priority,
+		     unsigned int timeoutMs, const char *owner)
+{
+	char path[MAX_NAME_SIZE];
+	long long deadline = leaseNowMs() + timeoutMs;
+	unsigned int delayMs = 1;
+	int wantfd = -1;
+	int ret = -ERROR_DPRAM_BUSY;
+	char holder[DPRAM_LEASE_HOLDER_SIZE];
+
+	leaseFile(path, sizeof(path), bus, slaveId, true);
+	wantfd = openLeaseFile(path);
+	leaseFile(path, sizeof(path), bus, slaveId, false);
+	lease->fd = openLeaseFile(path);
+	if (lease->fd < 0 || wantfd < 0) {
+		fprintf(stderr, "Unable to open DPRAM lease: %s\n",
+			strerror(errno));
+		ret = -ERROR_OPEN_FIRMWARE;
+		goto exit;
+	}
+
+	if (priority == DPRAM_LEASE_HIGH) {
+		flock(wantfd, LOCK_SH);
+	}
+	for (;;) {
+		bool mayTake = true;
+
+		// a free want lock means no update is waiting
+		if (priority == DPRAM_LEASE_LOW) {
+			mayTake = flock(wantfd, LOCK_EX | LOCK_NB) == 0;
+		}
+		if (mayTake && flock(lease->fd, LOCK_EX | LOCK_NB) == 0) {
+			writeLeaseHolder(lease->fd, priority, owner);
+			ret = 0;
+			break;
+		}
+		if (priority == DPRAM_LEASE_LOW) {
+			flock(wantfd, LOCK_UN);
+		}
+		if (leaseNowMs() >= deadline) {
+			break;
+		}
+		usleep(delayMs * DELAY_1MS);
+		if (delayMs < DPRAM_LEASE_POLL_MS) {
+			delayMs *= 2;
+		}
+	}
+
+exit:
+	if (wantfd >= 0) {
+		close(wantfd);
+	}
+	if (ret) {
+		if (ret == -ERROR_DPRAM_BUSY &&
+		    getFpgaLeaseHolder(bus, slaveId, holder, sizeof(holder)) ==
+			    0) {
+			fprintf(stderr,
+				"DPRAM busy for %u ms, lease held by %s",
+				timeoutMs, holder);
+		}
+		if (lease->fd >= 0) {
+			close(lease->fd);
+		}
+		lease->fd = -1;
+	}
+	return ret;
+}
+
+/**************************************************************
+ * acquireDpramLease()
+ *
+ * acquireFpgaLease() for the FPGA_I2C_CNTRL_ADDR FPGA on FPGA_I2C_BUS
+ *****************************************************************/
+int acquireDpramLease(DpramLease *lease, DpramLeasePriority priority,
+		      unsigned int timeoutMs, const char *owner)
+{
+	return acquireFpgaLease(lease, FPGA_I2C_BUS, FPGA_I2C_CNTRL_ADDR,
+				priority, timeoutMs, owner);
+}
+
+/**************************************************************
+ * releaseDpramLease()
+ *
+ * Give up a lease taken by acquireDpramLease(), no-op if not held
+ *****************************************************************/
+void releaseDpramLease(DpramLease *lease)
+{
+	if (lease->fd < 0) {
+		return;
+	}
+	if (ftruncate(lease->fd, 0)) {
+		fprintf(stderr, "Unable to clear DPRAM lease holder\n");
+	}
+	flock(lease->fd, LOCK_UN);
+	close(lease->fd);
+	lease->fd = -1;
+}
+
+/**************************************************************
+ * getFpgaLeaseHolder()
+ *
+ * bus: i2c bus of the FPGA
+ * slaveId: FPGA controller address
+ * holder: outgoing, description of the current holder
+ * len: size of holder
+ *
+ * RETURN: 0 if the lease is held
+ *****************************************************************/
+int getFpgaLeaseHolder(unsigned int bus, unsigned int slaveId, char *holder,
+		       size_t len)
+{
+	char path[MAX_NAME_SIZE];
+	ssize_t n = 0;
+	int fd;
+
+	leaseFile(path, sizeof(path), bus, slaveId, false);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+
+	if (fd < 0) {
+		return -1;
+	}
+	// record of a holder that died is stale, its flock is gone
+	if (len && flock(fd, LOCK_SH | LOCK_NB)) {
+		n = pread(fd, holder, len - 1, 0);
+	}
+	close(fd);
+	if (n <= 0) {
+		return -1;
+	}
+	holder[n] = '\0';
+	return 0;
+}
+
+int getDpramLeaseHolder(char *holder, size_t len)
+{
+	return getFpgaLeaseHolder(FPGA_I2C_BUS, FPGA_I2C_CNTRL_ADDR, holder,
+				  len);
+}
@@ -0,0 +1,58 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2022-2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UPDATERETIMERFW_LEASE_H_
+#define UPDATERETIMERFW_LEASE_H_
+#include <stddef.h>
+#include "updateRetimerFwOverI2C.h"
+
+/*
+ * FPGA DPRAM and control registers are shared by updateRetimerFw and
+ * dbus-service-retimer. The lease is an flock() on the
+ * DPRAM_LEASE_FILE_FMT "lease" file of the FPGA, high priority
+ * waiters hold a shared flock() on its "want" file so low priority
+ * requests step back until they are served. Like the DPRAM stamp,
+ * the files are per bus and FPGA controller address and live in
+ * getDpramStampDir().
+ */
+#define DPRAM_LEASE_FILE_FMT "%s/dpram-%u-%02x.%s"
+#define DPRAM_LEASE_POLL_MS 100
+#define DPRAM_LEASE_HOLDER_SIZE 128
+// GetHash replies before reading, so a hash can wait out a whole update
+#define DPRAM_LEASE_HASH_TIMEOUT_MS (MAX_RETRY_WRITE_FLOCK * 1000)
+#define DPRAM_LEASE_UPDATE_TIMEOUT_MS (MAX_TIMEOUT_SEC * 1000)
+
+typedef enum {
+	DPRAM_LEASE_LOW = 0, /**< hash/readback, yields to waiting updates */
+	DPRAM_LEASE_HIGH = 1, /**< firmware update */
+} DpramLeasePriority;
+
+typedef struct {
+	int fd; /**< lease file, locked while held */
+} DpramLease;
+
+int acquireFpgaLease(DpramLease *lease, unsigned int bus,
+		     unsigned int slaveId, DpramLeasePriority priority,
+		     unsigned int timeoutMs, const char *owner);
+int acquireDpramLease(DpramLease *lease, DpramLeasePriority priority,
+		      unsigned int timeoutMs, const char *owner);
+void releaseDpramLease(DpramLease *lease);
+int getFpgaLeaseHolder(unsigned int bus, unsigned int slaveId, char *holder,
+		       size_t len);
+int getDpramLeaseHolder(char *holder, size_t len);
+
+#endif
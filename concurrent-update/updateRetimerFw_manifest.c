@@ -0,0 +1,365 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2022-2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "updateRetimerFw_manifest.h"
+#include "updateRetimerFw_lease.h"
+#include "updateRetimerFw_journal.h"
+
+static const char *const manifestCommands[] = { "update", "read", "version",
+						"verify" };
+
+static int parseNumber(const char *str, unsigned int max, unsigned int *value)
+{
+	char *end;
+	unsigned long v;
+
+	errno = 0;
+	v = strtoul(str, &end, 0);
+	if (errno || end == str || *end || v > max) {
+		return -1;
+	}
+	*value = v;
+	return 0;
+}
+
+/**************************************************************
+ * parseManifestLine()
+ *
+ * RETURN: 1 for a step, 0 for a blank or comment line, -1 on
+ *	   a malformed line
+ *****************************************************************/
+static int parseManifestLine(char *text, ManifestStep *step)
+{
+	char *save = NULL;
+	char *tok[6];
+	char *addr;
+	char *sideband = NULL;
+	unsigned int value;
+	int n = 0;
+	int cmd;
+
+	text[strcspn(text, "#\r\n")] = '\0';
+	for (char *t = strtok_r(text, " \t", &save); t;
+	     t = strtok_r(NULL, " \t", &save)) {
+		if (n == 6) {
+			return -1;
+		}
+		tok[n++] = t;
+	}
+	if (n == 0) {
+		return 0;
+	}
+	if (n < 3) {
+		return -1;
+	}
+
+	for (cmd = 0; cmd < (int)(sizeof(manifestCommands) /
+				  sizeof(manifestCommands[0]));
+	     cmd++) {
+		if (!strcmp(tok[0], manifestCommands[cmd])) {
+			break;
+		}
+	}
+	step->command = cmd;
+	switch (step->command) {
+	case RETIMER_FW_UPDATE:
+	case RETIMER_FW_VERIFY:
+		if (n < 4 || n > 5) {
+			return -1;
+		}
+		break;
+	case RETIMER_FW_READ:
+		if (n != 4) {
+			return -1;
+		}
+		break;
+	case RETIMER_FW_VERSION:
+		if (n != 3) {
+			return -1;
+		}
+		break;
+	default:
+		return -1;
+	}
+
+	step->slaveId = FPGA_I2C_CNTRL_ADDR;
+	addr = strchr(tok[1], ':');
+	if (addr) {
+		*addr++ = '\0';
+		sideband = strchr(addr, ':');
+		if (sideband) {
+			*sideband++ = '\0';
+			if (parseNumber(sideband, MAX_I2C_BUS_NUM - 1,
+					&step->sidebandBus)) {
+				return -1;
+			}
+		}
+		if (parseNumber(addr, 0x7F, &value)) {
+			return -1;
+		}
+		step->slaveId = value;
+	}
+	if (parseNumber(tok[1], MAX_I2C_BUS_NUM - 1, &step->bus)) {
+		return -1;
+	}
+	// CPLD and regtbl checks must reach the baseboard of the FPGA
+	if (!sideband) {
+		int bus = fpgaSidebandBus(step->bus);
+
+		if (bus < 0) {
+			fprintf(stderr,
+				"Sideband bus of FPGA bus %u unknown, use %u:%#x:<sideband bus>\n",
+				step->bus, step->bus, step->slaveId);
+			return -1;
+		}
+		step->sidebandBus = bus;
+	}
+	if (parseNumber(tok[2],
+			step->command == RETIMER_FW_READ ?
+				getRetimerCount() - 1 :
+				retimerAllMask(),
+			&value)) {
+		return -1;
+	}
+	step->retimers = value;
+	if (n > 3) {
+		if (strlen(tok[3]) >= sizeof(step->path)) {
+			return -1;
+		}
+		strcpy(step->path, tok[3]);
+	}
+	strcpy(step->version, DEFAULT_VERSION);
+	if (n > 4) {
+		if (strlen(tok[4]) >= sizeof(step->version)) {
+			return -1;
+		}
+		strcpy(step->version, tok[4]);
+	}
+	return 1;
+}
+
+/**************************************************************
+ * parseRetimerManifest()
+ *
+ * Parse every step of a manifest before anything is run, so a
+ * typo late in the file does not leave a half done sequence.
+ *
+ * f: manifest
+ * steps: outgoing, array of steps, free() when done
+ * count: outgoing, number of steps
+ *
+ * RETURN: 0 if success, -ERROR_INPUT_ARGUMENTS on a malformed line
+ *****************************************************************/
+int parseRetimerManifest(FILE *f, ManifestStep **steps, int *count)
+{
+	char text[3 * MAX_NAME_SIZE];
+	unsigned int line = 0;
+
+	*count = 0;
+	*steps = calloc(MANIFEST_MAX_STEPS, sizeof(**steps));
+	if (!*steps) {
+		return -ERROR_MALLOC_FAILURE;
+	}
+	while (fgets(text, sizeof(text), f)) {
+		ManifestStep *step = &(*steps)[*count];
+		int ret;
+
+		line++;
+		if (*count == MANIFEST_MAX_STEPS) {
+			ret = -1;
+		} else {
+			memset(step, 0, sizeof(*step));
+			ret = parseManifestLine(text, step);
+		}
+		if (ret < 0) {
+			fprintf(stderr, "manifest line %u: malformed step\n",
+				line);
+			free(*steps);
+			*steps = NULL;
+			*count = 0;
+			return -ERROR_INPUT_ARGUMENTS;
+		}
+		if (ret) {
+			step->line = line;
+			(*count)++;
+		}
+	}
+	return 0;
+}
+
+static int runUpdateStep(int fd, const ManifestStep *step,
+			 const RetimerUpdateOptions *options)
+{
+	RetimerUpdateOptions stepOptions = *options;
+	char journalPath[MAX_NAME_SIZE];
+	const RetimerImage *img;
+	update_operation *ops;
+	int ret;
+
+	// a resumed manifest finds the journal of each of its steps
+	if (options->journalPath) {
+		updateJournalPath(journalPath, sizeof(journalPath),
+				  options->journalPath, step->bus,
+				  step->slaveId, step->line);
+		stepOptions.journalPath = journalPath;
+	}
+
+	img = getRetimerImage(step->path, step->version, &ret);
+	if (!img) {
+		prepareMessageRegistry(
+			step->retimers, "VerificationFailed",
+			(char *)step->version, MSG_REG_VER_FOLLOWED_BY_DEV,
+			"xyz.openbmc_project.Logging.Entry.Level.Critical",
+			NULL, 0);
+		return ret;
+	}
+	// targets are filtered and merged in place, the cache keeps the original
+	ops = malloc((img->opsCount ? img->opsCount : 1) * sizeof(*ops));
+	if (!ops) {
+		return -ERROR_MALLOC_FAILURE;
+	}
+	memcpy(ops, img->ops, img->opsCount * sizeof(*ops));
+	ret = runRetimerUpdate(fd, img->image, img->size, ops, img->opsCount,
+			       step->retimers, &stepOptions);
+	free(ops);
+	return ret;
+}
+
+static int runVerifyStep(int fd, const ManifestStep *step)
+{
+	const RetimerImage *img;
+	RetimerBitmap mismatch = 0;
+	int ret;
+
+	img = getRetimerImage(step->path, step->version, &ret);
+	if (!img) {
+		return ret;
+	}
+	ret = verifyRetimerImage(fd, img->image, img->ops, img->opsCount,
+				 step->retimers, &mismatch);
+	if (mismatch) {
+		fprintf(stderr, "retimers %#x do not hold %s\n", mismatch,
+			step->path);
+		if (!ret) {
+			ret = -ERROR_WRONG_FIRMWARE;
+		}
+	}
+	return ret;
+}
+
+static int runReadStep(int fd, const ManifestStep *step)
+{
+	int outFd;
+	int ret;
+
+	outFd = open(step->path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (outFd < 0) {
+		fprintf(stderr, "Error creating file: %s\n", strerror(errno));
+		return -ERROR_OPEN_FIRMWARE;
+	}
+	ret = runRetimerRead(fd, step->retimers, outFd);
+	close(outFd);
+	return ret;
+}
+
+/**************************************************************
+ * runRetimerManifest()
+ *
+ * Run parsed manifest steps in order, the first failing step ends
+ * the run. Bus descriptors, verified firmware files and the log
+ * connection are shared by all steps. Each step takes the DPRAM
+ * lease of its FPGA for its own duration, preflight and extended
+ * error checks use the sidebandBus of the step.
+ *
+ * steps: steps from parseRetimerManifest()
+ * count: number of steps
+ * options: update options, preflight is checked before each update
+ *
+ * RETURN: 0 if every step succeeded, error of the failed step otherwise
+ *****************************************************************/
+int runRetimerManifest(const ManifestStep *steps, int count,
+		       const RetimerUpdateOptions *options)
+{
+	int ret = 0;
+
+	for (int i = 0; i < count && !ret; i++) {
+		const ManifestStep *step = &steps[i];
+		DpramLease lease = { .fd = -1 };
+		int fd;
+
+		fprintf(stdout, "manifest line %u: %s bus %u retimers %#x\n",
+			step->line, manifestCommands[step->command], step->bus,
+			step->retimers);
+		fd = openI2CBus(step->bus);
+		if (fd < 0) {
+			ret = -ERROR_OPEN_I2C_DEVICE;
+			break;
+		}
+		setFpgaCntrlAddr(step->slaveId);
+		setFpgaSidebandBus(step->sidebandBus);
+
+		ret = acquireFpgaLease(&lease, step->bus, step->slaveId,
+				       DPRAM_LEASE_HIGH,
+				       DPRAM_LEASE_UPDATE_TIMEOUT_MS,
+				       "updateRetimerFw");
+		// the FPGA status is only stable while the lease is held
+		if (!ret && step->command == RETIMER_FW_UPDATE &&
+		    options->preflight) {
+			ret = preflightRetimerUpdate(fd, step->slaveId);
+		}
+		if (ret) {
+			releaseDpramLease(&lease);
+			if (step->command == RETIMER_FW_UPDATE) {
+				prepareMessageRegistry(
+					step->retimers, "TransferFailed",
+					(char *)step->version,
+					MSG_REG_VER_FOLLOWED_BY_DEV,
+					"xyz.openbmc_project.Logging.Entry.Level.Critical",
+					NULL, 0);
+			}
+			break;
+		}
+
+		switch (step->command) {
+		case RETIMER_FW_UPDATE:
+			ret = runUpdateStep(fd, step, options);
+			break;
+		case RETIMER_FW_READ:
+			ret = runReadStep(fd, step);
+			break;
+		case RETIMER_FW_VERIFY:
+			ret = runVerifyStep(fd, step);
+			break;
+		case RETIMER_FW_VERSION:
+			ret = runRetimerVersion(fd, step->retimers);
+			break;
+		}
+		releaseDpramLease(&lease);
+		if (ret) {
+			fprintf(stderr, "manifest line %u failed: %d\n",
+				step->line, ret);
+		}
+	}
+	setFpgaCntrlAddr(FPGA_I2C_CNTRL_ADDR);
+	setFpgaSidebandBus(HMC_I2CBUS_FPGA_SEC_REGTBL);
+	return ret;
+}
@@ -0,0 +1,54 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2022-2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UPDATERETIMERFW_MANIFEST_H_
+#define UPDATERETIMERFW_MANIFEST_H_
+#include <stdint.h>
+#include <stdio.h>
+#include "updateRetimerFwOverI2C.h"
+#include "updateRetimerFw_job.h"
+
+/*
+ * A manifest runs a sequence of retimer commands in one process, one
+ * step per line, '#' starts a comment:
+ *
+ *   <update|read|verify|version> <bus>[:<addr>[:<sideband>]] <retimers> [<file> [<versionStr>]]
+ *
+ * retimers is a bitmap, except for read where it is one retimer
+ * index. file is the firmware file of update and verify and the
+ * output file of read. addr selects the FPGA controller address,
+ * sideband the bus of its CPLD and secondary regtbl. sideband is
+ * required where fpgaSidebandBus() does not know the bus.
+ */
+#define MANIFEST_MAX_STEPS 256
+
+typedef struct {
+	RetimerFWCommand command;
+	unsigned int bus; /**< i2c bus of the FPGA */
+	uint8_t slaveId; /**< FPGA controller address */
+	unsigned int sidebandBus; /**< CPLD and secondary regtbl bus, see fpgaSidebandBus() */
+	RetimerBitmap retimers; /**< bitmap, retimer index for read */
+	char path[MAX_NAME_SIZE];
+	char version[MAX_NAME_SIZE];
+	unsigned int line; /**< manifest line, for messages */
+} ManifestStep;
+
+int parseRetimerManifest(FILE *f, ManifestStep **steps, int *count);
+int runRetimerManifest(const ManifestStep *steps, int count,
+		       const RetimerUpdateOptions *options);
+
+#endif
@@ -0,0 +1,147 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2022-2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include "updateRetimerFw_pipeline.h"
+
+struct UpdatePipeline {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	const unsigned char *image;
+	update_operation *ops;
+	int count;
+	int verified; /**< ops [0, verified) have a result */
+	int *result;
+	bool stop;
+};
+
+static void *verifyThread(void *arg)
+{
+	UpdatePipeline *pipeline = arg;
+
+	for (int uo = 0; uo < pipeline->count; uo++) {
+		update_operation op;
+		int ret = 0;
+
+		pthread_mutex_lock(&pipeline->lock);
+		if (pipeline->stop) {
+			pthread_mutex_unlock(&pipeline->lock);
+			break;
+		}
+		op = pipeline->ops[uo];
+		pthread_mutex_unlock(&pipeline->lock);
+
+		// components not targeted are never flashed
+		if (op.applyBitmap) {
+			ret = verifyUpdateOperation(pipeline->image, &op);
+		}
+
+		pthread_mutex_lock(&pipeline->lock);
+		pipeline->ops[uo].imageCrc = op.imageCrc;
+		pipeline->ops[uo].imageCrcPending = op.imageCrcPending;
+		pipeline->result[uo] = ret;
+		pipeline->verified = uo + 1;
+		pthread_cond_broadcast(&pipeline->cond);
+		pthread_mutex_unlock(&pipeline->lock);
+	}
+	closeLogMessageBus();
+	return NULL;
+}
+
+/**************************************************************
+ * startUpdatePipeline()
+ *
+ * Start verifying update_ops in the background. update_ops must
+ * stay valid and applyBitmap unchanged until stopUpdatePipeline(),
+ * imageCrc of an entry may only be used after
+ * waitUpdateOperationVerified() succeeded for it.
+ *
+ * RETURN: pipeline or NULL, callers then verify synchronously
+ *****************************************************************/
+UpdatePipeline *startUpdatePipeline(const unsigned char *imageMappedAddr,
+				    update_operation *update_ops,
+				    int update_ops_count)
+{
+	UpdatePipeline *pipeline = calloc(1, sizeof(*pipeline));
+
+	if (!pipeline || update_ops_count <= 0) {
+		free(pipeline);
+		return NULL;
+	}
+	pipeline->result = calloc(update_ops_count, sizeof(int));
+	if (!pipeline->result) {
+		free(pipeline);
+		return NULL;
+	}
+	pipeline->image = imageMappedAddr;
+	pipeline->ops = update_ops;
+	pipeline->count = update_ops_count;
+	pthread_mutex_init(&pipeline->lock, NULL);
+	pthread_cond_init(&pipeline->cond, NULL);
+	if (pthread_create(&pipeline->thread, NULL, verifyThread, pipeline)) {
+		fprintf(stderr, "Unable to start image verification thread\n");
+		pthread_cond_destroy(&pipeline->cond);
+		pthread_mutex_destroy(&pipeline->lock);
+		free(pipeline->result);
+		free(pipeline);
+		return NULL;
+	}
+	return pipeline;
+}
+
+/**************************************************************
+ * waitUpdateOperationVerified()
+ *
+ * Block until image data of update_ops[uo] is verified
+ *
+ * RETURN: 0 if the image CRC is good and imageCrc is final
+ *****************************************************************/
+int waitUpdateOperationVerified(UpdatePipeline *pipeline, int uo)
+{
+	int ret;
+
+	pthread_mutex_lock(&pipeline->lock);
+	while (pipeline->verified <= uo) {
+		pthread_cond_wait(&pipeline->cond, &pipeline->lock);
+	}
+	ret = pipeline->result[uo];
+	pthread_mutex_unlock(&pipeline->lock);
+	return ret;
+}
+
+/**************************************************************
+ * stopUpdatePipeline()
+ *
+ * Stop verification and free the pipeline, NULL is ignored
+ *****************************************************************/
+void stopUpdatePipeline(UpdatePipeline *pipeline)
+{
+	if (!pipeline) {
+		return;
+	}
+	pthread_mutex_lock(&pipeline->lock);
+	pipeline->stop = true;
+	pthread_mutex_unlock(&pipeline->lock);
+	pthread_join(pipeline->thread, NULL);
+	pthread_cond_destroy(&pipeline->cond);
+	pthread_mutex_destroy(&pipeline->lock);
+	free(pipeline->result);
+	free(pipeline);
+}
@@ -0,0 +1,35 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2022-2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UPDATERETIMERFW_PIPELINE_H_
+#define UPDATERETIMERFW_PIPELINE_H_
+#include "updateRetimerFwOverI2C.h"
+
+/*
+ * Host side work of an update runs on a worker thread ahead of the
+ * I2C/flash loop: image data of every update_operation is CRC checked
+ * in order while earlier components are uploaded and flashed.
+ */
+typedef struct UpdatePipeline UpdatePipeline;
+
+UpdatePipeline *startUpdatePipeline(const unsigned char *imageMappedAddr,
+				    update_operation *update_ops,
+				    int update_ops_count);
+int waitUpdateOperationVerified(UpdatePipeline *pipeline, int uo);
+void stopUpdatePipeline(UpdatePipeline *pipeline);
+
+#endif
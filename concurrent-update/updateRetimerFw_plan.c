@@ -0,0 +1,227 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2022-2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include "updateRetimerFw_plan.h"
+#include "updateRetimerFw_poll.h"
+
+/**
+* @brief *
+* I2C transactions of one step of the plan
+**/
+typedef struct {
+	unsigned long transfers;
+	unsigned long msgs;
+	unsigned long long bytes;
+} PlanXfer;
+
+static void addXfer(PlanXfer *x, unsigned long transfers, unsigned long msgs,
+		    unsigned long long bytes)
+{
+	x->transfers += transfers;
+	x->msgs += msgs;
+	x->bytes += bytes;
+}
+
+// one register write, see writeFpgaReg()
+static void addRegWrite(PlanXfer *x)
+{
+	addXfer(x, 1, 1, W_BYTE_COUNT_WITHPAYLOAD);
+}
+
+// one register read, see readFpgaReg()
+static void addRegRead(PlanXfer *x)
+{
+	addXfer(x, 1, 2, W_BYTE_COUNT + R_BYTE_COUNT);
+}
+
+static uint64_t xferUs(const RetimerPlanModel *model, const PlanXfer *x)
+{
+	uint64_t bits = x->bytes * 9 + (uint64_t)x->msgs * PLAN_MSG_OVERHEAD_BITS;
+
+	return x->transfers * model->transferUs +
+	       bits * 1000000 / model->busHz;
+}
+
+// count x into the totals, poll reads overlap the flash time
+static uint64_t planXfer(RetimerPlan *plan, const RetimerPlanModel *model,
+			 const PlanXfer *x, bool timed)
+{
+	uint64_t us = timed ? xferUs(model, x) : 0;
+
+	plan->transfers += x->transfers;
+	plan->msgs += x->msgs;
+	plan->bytes += x->bytes;
+	plan->busUs += us;
+	return us;
+}
+
+/**************************************************************
+ * planUpload()
+ *
+ * DPRAM upload of len bytes as in uploadImageToFpga(), the
+ * optional read back verify included
+ *****************************************************************/
+static void planUpload(PlanXfer *x, size_t len)
+{
+	size_t chunk = xferChunkSize();
+	unsigned int batch = xferBatchMsgs();
+	unsigned int pairs = batch / 2 ? batch / 2 : 1;
+	unsigned long chunks = (len + chunk - 1) / chunk;
+
+	addXfer(x, (chunks + batch - 1) / batch, chunks,
+		len + chunks * DPRAM_ADDR_BYTES);
+	if (fpgaTransferConfig.verifyUpload) {
+		addXfer(x, (chunks + pairs - 1) / pairs, 2 * chunks,
+			len + chunks * DPRAM_ADDR_BYTES);
+	}
+}
+
+/**************************************************************
+ * planRetimerUpdate()
+ *
+ * Print the steps of an update without touching the device:
+ * target filtering and merging as in runRetimerUpdate(), then per
+ * update operation the upload, image info and trigger with their
+ * I2C transactions and expected time.
+ *
+ * image: firmware file
+ * update_ops: update operations of the file, modified
+ * update_ops_count: number of update operations
+ * retimerBitmap: retimers to update
+ * preflight: preflightRetimerUpdate() runs first
+ * model: bus timing
+ * out: plan output, NULL only fills plan
+ * plan: outgoing, totals
+ *
+ * RETURN: 0 if success
+ *****************************************************************/
+int planRetimerUpdate(const unsigned char *image,
+		      update_operation *update_ops, int update_ops_count,
+		      RetimerBitmap retimerBitmap, bool preflight,
+		      const RetimerPlanModel *model, FILE *out,
+		      RetimerPlan *plan)
+{
+	memset(plan, 0, sizeof(*plan));
+	if (!model->busHz) {
+		return -ERROR_INPUT_ARGUMENTS;
+	}
+	for (int uo = 0; uo < update_ops_count; uo++) {
+		update_ops[uo].applyBitmap &= retimerBitmap;
+	}
+	mergeUpdateOperations(image, update_ops, &update_ops_count);
+
+	if (out) {
+		fprintf(out,
+			"Plan: retimers %#x, %zu byte bursts, %u messages per transfer, %u Hz bus\n",
+			retimerBitmap, xferChunkSize(), xferBatchMsgs(),
+			model->busHz);
+	}
+	if (preflight) {
+		PlanXfer x = { 0 };
+		uint64_t us;
+
+		// CPLD byte, update status and secondary regtbl
+		addXfer(&x, 1, 2, 2);
+		addRegRead(&x);
+		addXfer(&x, 1, 2, 1 + sizeof(extendedErrorCode));
+		us = planXfer(plan, model, &x, true);
+		if (out) {
+			fprintf(out,
+				"  preflight: %lu transfers, %lu messages, %llu bytes, %llu us\n",
+				x.transfers, x.msgs, x.bytes,
+				(unsigned long long)us);
+		}
+	}
+
+	for (int uo = 0; uo < update_ops_count; uo++) {
+		update_operation *op = &update_ops[uo];
+		unsigned int targets = countRetimers(op->applyBitmap);
+		PlanXfer upload = { 0 };
+		PlanXfer trigger = { 0 };
+		PlanXfer polls = { 0 };
+		uint64_t uploadUs;
+		uint64_t triggerUs;
+		uint64_t flashUs;
+		unsigned int n;
+
+		if (!op->applyBitmap) {
+			if (out) {
+				fprintf(out,
+					"  [%d] %s at %#zx: no retimer targeted, skipped\n",
+					uo, op->versionString, op->startOffset);
+			}
+			continue;
+		}
+
+		// upload, then image size and CRC written and read back
+		planUpload(&upload, op->imageLength);
+		addRegWrite(&upload);
+		addRegRead(&upload);
+		addRegWrite(&upload);
+		addRegRead(&upload);
+		uploadUs = planXfer(plan, model, &upload, true);
+		plan->uploads++;
+
+		// image size read, trigger, status polls until done
+		addRegRead(&trigger);
+		addRegWrite(&trigger);
+		triggerUs = planXfer(plan, model, &trigger, true);
+		n = expectedFpgaPolls(FPGA_OP_UPDATE, op->imageLength,
+				      targets);
+		for (unsigned int i = 0; i < n; i++) {
+			addRegRead(&polls);
+		}
+		planXfer(plan, model, &polls, false);
+		flashUs = expectedFpgaOpUs(FPGA_OP_UPDATE, op->imageLength,
+					   targets);
+		plan->flashUs += flashUs;
+		plan->triggers++;
+
+		if (out) {
+			fprintf(out,
+				"  [%d] %s at %#zx, %zu bytes, retimers %#x\n",
+				uo, op->versionString, op->startOffset,
+				op->imageLength, op->applyBitmap);
+			fprintf(out,
+				"      upload: %lu transfers, %lu messages, %llu bytes, %llu ms\n",
+				upload.transfers, upload.msgs, upload.bytes,
+				(unsigned long long)uploadUs / DELAY_1MS);
+			fprintf(out,
+				"      trigger: %lu transfers, %llu us, flash %llu ms for %u retimers, %u status polls\n",
+				trigger.transfers + polls.transfers,
+				(unsigned long long)triggerUs,
+				(unsigned long long)flashUs / DELAY_1MS,
+				targets, n);
+		}
+	}
+
+	if (out) {
+		fprintf(out,
+			"Plan total: %u uploads, %u triggers, %lu I2C transfers, %lu messages, %llu bytes\n",
+			plan->uploads, plan->triggers, plan->transfers,
+			plan->msgs, plan->bytes);
+		fprintf(out,
+			"Estimated time: %llu s (bus %llu ms, flash %llu ms)\n",
+			(unsigned long long)(plan->busUs + plan->flashUs +
+					     DELAY_1SEC - 1) /
+				DELAY_1SEC,
+			(unsigned long long)plan->busUs / DELAY_1MS,
+			(unsigned long long)plan->flashUs / DELAY_1MS);
+	}
+	return 0;
+}
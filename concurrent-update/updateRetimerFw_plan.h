@@ -0,0 +1,69 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2022-2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UPDATERETIMERFW_PLAN_H_
+#define UPDATERETIMERFW_PLAN_H_
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include "updateRetimerFwOverI2C.h"
+
+/*
+ * Dry run of an update: the operations runRetimerUpdate() would
+ * execute, the I2C transactions they take with the current
+ * fpgaTransferConfig and the expected wall time. Bus time follows
+ * the bus speed of the model, flash time the learned poll history
+ * (see setFpgaPollUsPerKb()). Skipping of current retimers, resume
+ * and delta upload depend on the device and are not planned, every
+ * targeted retimer is assumed to be flashed from a full upload.
+ */
+#define PLAN_BUS_HZ 400000
+// driver and controller cost of one I2C_RDWR ioctl
+#define PLAN_TRANSFER_US 100
+// start, slave address with ACK and stop of one message
+#define PLAN_MSG_OVERHEAD_BITS 11
+
+/**
+* @brief *
+* Timing model of planRetimerUpdate()
+**/
+typedef struct {
+	unsigned int busHz; /**< I2C clock */
+	unsigned int transferUs; /**< fixed cost per I2C_RDWR ioctl */
+} RetimerPlanModel;
+
+/**
+* @brief *
+* Totals of a planned update
+**/
+typedef struct {
+	unsigned int uploads; /**< images sent to DPRAM */
+	unsigned int triggers; /**< update triggers */
+	unsigned long transfers; /**< I2C_RDWR ioctls */
+	unsigned long msgs; /**< i2c_msg */
+	unsigned long long bytes; /**< bytes after the slave address */
+	uint64_t busUs; /**< bus time, status polls excluded */
+	uint64_t flashUs; /**< expected time the FPGA flashes */
+} RetimerPlan;
+
+int planRetimerUpdate(const unsigned char *image,
+		      update_operation *update_ops, int update_ops_count,
+		      RetimerBitmap retimerBitmap, bool preflight,
+		      const RetimerPlanModel *model, FILE *out,
+		      RetimerPlan *plan);
+
+#endif
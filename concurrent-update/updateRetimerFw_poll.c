@@ -0,0 +1,515 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2022-2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sys/stat.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "updateRetimerFw_poll.h"
+
+static const char *const pollKindName[FPGA_OP_KINDS] = { "update", "read" };
+static const uint32_t pollStatusReg[FPGA_OP_KINDS] = {
+	FPGA_UPDATE_STATUS_REG,
+	FPGA_READ_STATUS_REG,
+};
+// busy bits in status byte 0
+static const uint8_t pollBusyMask[FPGA_OP_KINDS] = {
+	0xFF,
+	FW_READ_STATUS_MASK,
+};
+static const uint64_t pollDefaultUsPerKb[FPGA_OP_KINDS] = {
+	FPGA_POLL_UPDATE_US_PER_KB,
+	FPGA_POLL_READ_US_PER_KB,
+};
+
+// shared by the workers of a multi-FPGA update, guarded by pollLock.
+// us per KB by kind and targeted retimers - 1, 0 if never measured.
+static uint64_t usPerKb[FPGA_OP_KINDS][RETIMER_MAX_NUM];
+// values of the history file
+static uint64_t savedUsPerKb[FPGA_OP_KINDS][RETIMER_MAX_NUM];
+// set by setFpgaPollUsPerKb(), never saved
+static bool overridden[FPGA_OP_KINDS];
+static bool historyLoaded;
+static char historyFile[MAX_NAME_SIZE] = FPGA_POLL_HISTORY_FILE;
+static pthread_mutex_t pollLock = PTHREAD_MUTEX_INITIALIZER;
+
+static uint64_t pollNowUs(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/**************************************************************
+ * parseHistoryLine()
+ *
+ * "<kind> <us per KB for 1 retimer> ... <for RETIMER_MAX_NUM>",
+ * lines in any other format are ignored
+ *****************************************************************/
+static void parseHistoryLine(char *line)
+{
+	uint64_t v[RETIMER_MAX_NUM];
+	char *save = NULL;
+	char *tok = strtok_r(line, " \t\n", &save);
+	char *end;
+	int kind;
+
+	for (kind = 0; tok && kind < FPGA_OP_KINDS; kind++) {
+		if (!strcmp(tok, pollKindName[kind])) {
+			break;
+		}
+	}
+	if (!tok || kind == FPGA_OP_KINDS) {
+		return;
+	}
+	for (int i = 0; i < RETIMER_MAX_NUM; i++) {
+		tok = strtok_r(NULL, " \t\n", &save);
+		if (!tok) {
+			return;
+		}
+		errno = 0;
+		v[i] = strtoull(tok, &end, 10);
+		if (errno || *end) {
+			return;
+		}
+	}
+	if (strtok_r(NULL, " \t\n", &save)) {
+		return;
+	}
+	memcpy(savedUsPerKb[kind], v, sizeof(v));
+}
+
+/**************************************************************
+ * loadPollHistory()
+ *
+ * Read the learned durations once per process, or again after
+ * setFpgaPollHistoryFile(). Call with pollLock held.
+ *****************************************************************/
+static void loadPollHistory(void)
+{
+	char line[256];
+	FILE *f;
+
+	if (historyLoaded) {
+		return;
+	}
+	historyLoaded = true;
+	memset(savedUsPerKb, 0, sizeof(savedUsPerKb));
+
+	f = fopen(historyFile, "r");
+	if (f) {
+		while (fgets(line, sizeof(line), f)) {
+			parseHistoryLine(line);
+		}
+		fclose(f);
+	}
+	for (int k = 0; k < FPGA_OP_KINDS; k++) {
+		if (!overridden[k]) {
+			memcpy(usPerKb[k], savedUsPerKb[k], sizeof(usPerKb[k]));
+		}
+	}
+}
+
+/**************************************************************
+ * savePollHistory()
+ *
+ * Replace the history file by writing a temporary file and
+ * renaming it over the old one, so concurrent writers never tear
+ * it. Best effort, a read only /var/lib only costs the learning.
+ *****************************************************************/
+static void savePollHistory(void)
+{
+	char tmp[MAX_NAME_SIZE + 16];
+	char dir[MAX_NAME_SIZE];
+	FILE *f;
+	int err;
+
+	snprintf(dir, sizeof(dir), "%s", historyFile);
+	if (mkdir(dirname(dir), 0755) && errno != EEXIST) {
+		return;
+	}
+	snprintf(tmp, sizeof(tmp), "%s.%d", historyFile, (int)getpid());
+	f = fopen(tmp, "w");
+	if (!f) {
+		return;
+	}
+	for (int k = 0; k < FPGA_OP_KINDS; k++) {
+		fprintf(f, "%s", pollKindName[k]);
+		for (int i = 0; i < RETIMER_MAX_NUM; i++) {
+			fprintf(f, " %llu",
+				(unsigned long long)savedUsPerKb[k][i]);
+		}
+		fputc('\n', f);
+	}
+	err = fflush(f) || fsync(fileno(f));
+	if (fclose(f) || err || rename(tmp, historyFile)) {
+		unlink(tmp);
+	}
+}
+
+static uint64_t pollUnits(size_t len)
+{
+	uint64_t kb = (len + 1023) / 1024;
+
+	return kb ? kb : 1;
+}
+
+static unsigned int targetIndex(unsigned int targets)
+{
+	if (targets < 1) {
+		return 0;
+	}
+	return targets > RETIMER_MAX_NUM ? RETIMER_MAX_NUM - 1 : targets - 1;
+}
+
+/**************************************************************
+ * learnedUsPerKb()
+ *
+ * Duration per KB of kind for targets retimers. A retimer count
+ * that was never measured borrows the nearest measured count,
+ * fewer retimers first. Call with pollLock held.
+ *
+ * measured: outgoing, false if no count of kind was measured and
+ *	     the build time estimate is returned
+ *****************************************************************/
+static uint64_t learnedUsPerKb(FpgaOpKind kind, unsigned int targets,
+			       bool *measured)
+{
+	int index = targetIndex(targets);
+
+	loadPollHistory();
+	*measured = true;
+	for (int d = 0; d < RETIMER_MAX_NUM; d++) {
+		if (index - d >= 0 && usPerKb[kind][index - d]) {
+			return usPerKb[kind][index - d];
+		}
+		if (index + d < RETIMER_MAX_NUM && usPerKb[kind][index + d]) {
+			return usPerKb[kind][index + d];
+		}
+	}
+	*measured = false;
+	return pollDefaultUsPerKb[kind];
+}
+
+/**************************************************************
+ * expectedFpgaOpUs()
+ *
+ * kind: update or read
+ * len: image length the FPGA transfers per retimer
+ * targets: number of retimers in the operation
+ *
+ * RETURN: learned duration of the operation in us, the build time
+ *	   estimate if kind was never measured
+ *****************************************************************/
+uint64_t expectedFpgaOpUs(FpgaOpKind kind, size_t len, unsigned int targets)
+{
+	bool measured;
+	uint64_t us;
+
+	pthread_mutex_lock(&pollLock);
+	us = learnedUsPerKb(kind, targets, &measured) * pollUnits(len);
+	pthread_mutex_unlock(&pollLock);
+	return us;
+}
+
+/**************************************************************
+ * fpgaOpDeadlineUs()
+ *
+ * FPGA_POLL_DEADLINE_FACTOR times the expected duration, at least
+ * the MAX_TIMEOUT_SEC the trigger always had. Erase and flash time
+ * do not shrink with the image, so small images keep the floor.
+ *
+ * RETURN: time in us after which the operation is timed out
+ *****************************************************************/
+uint64_t fpgaOpDeadlineUs(FpgaOpKind kind, size_t len, unsigned int targets)
+{
+	uint64_t deadline = (uint64_t)MAX_TIMEOUT_SEC * DELAY_1SEC;
+	uint64_t learned = FPGA_POLL_DEADLINE_FACTOR *
+			   expectedFpgaOpUs(kind, len, targets);
+
+	return deadline > learned ? deadline : learned;
+}
+
+/**************************************************************
+ * recordFpgaOp()
+ *
+ * Learn from a finished operation. It completed between the last
+ * busy status read and the one that found it done, the estimate
+ * moves half way to the middle of both. A first read that already
+ * finds it done only bounds the duration from above, the estimate
+ * then drops to half of that and the busy reads of the next
+ * operation narrow it down again. Values of setFpgaPollUsPerKb()
+ * are never saved, others once they moved FPGA_POLL_SAVE_PCT.
+ *****************************************************************/
+static void recordFpgaOp(const FpgaPoll *poll)
+{
+	unsigned int index = targetIndex(poll->targets);
+	uint64_t *learned = &usPerKb[poll->kind][index];
+	uint64_t *saved = &savedUsPerKb[poll->kind][index];
+	uint64_t units = pollUnits(poll->len);
+	uint64_t measured;
+	uint64_t moved;
+
+	pthread_mutex_lock(&pollLock);
+	loadPollHistory();
+	if (poll->busyUs) {
+		measured = (poll->busyUs + poll->result.elapsedUs) / 2 / units;
+		*learned = *learned ? (*learned + measured) / 2 : measured;
+	} else {
+		measured = poll->result.elapsedUs / 2 / units;
+		if (!*learned || measured < *learned) {
+			*learned = measured;
+		}
+	}
+	if (*learned == 0) {
+		*learned = 1;
+	}
+	moved = *learned > *saved ? *learned - *saved : *saved - *learned;
+	if (!overridden[poll->kind] &&
+	    moved * 100 > *saved * FPGA_POLL_SAVE_PCT) {
+		*saved = *learned;
+		savePollHistory();
+	}
+	pthread_mutex_unlock(&pollLock);
+}
+
+// status read interval after the first read
+static uint64_t pollInterval(uint64_t expectedUs)
+{
+	uint64_t interval = expectedUs / 16;
+
+	if (interval < FPGA_POLL_MIN_US) {
+		interval = FPGA_POLL_MIN_US;
+	}
+	if (interval > FPGA_POLL_MAX_US) {
+		interval = FPGA_POLL_MAX_US;
+	}
+	return interval;
+}
+
+/**************************************************************
+ * pollSchedule()
+ *
+ * First status read and read interval of an operation. Until kind
+ * was measured the status is read every FPGA_POLL_MAX_US from the
+ * trigger on, waiting on the estimate could leave a finished
+ * operation unnoticed for seconds.
+ *
+ * expectedUs: outgoing, expected duration
+ * interval: outgoing, status read interval after the first read
+ *
+ * RETURN: delay in us until the first status read
+ *****************************************************************/
+static uint64_t pollSchedule(FpgaOpKind kind, size_t len,
+			     unsigned int targets, uint64_t *expectedUs,
+			     uint64_t *interval)
+{
+	bool measured;
+
+	pthread_mutex_lock(&pollLock);
+	*expectedUs = learnedUsPerKb(kind, targets, &measured) *
+		      pollUnits(len);
+	pthread_mutex_unlock(&pollLock);
+	if (!measured) {
+		*interval = FPGA_POLL_MAX_US;
+		return FPGA_POLL_MAX_US;
+	}
+	*interval = pollInterval(*expectedUs);
+	return *expectedUs * FPGA_POLL_FIRST_PCT / 100;
+}
+
+/**************************************************************
+ * expectedFpgaPolls()
+ *
+ * RETURN: status reads of an operation that takes as long as
+ *	   expected, first read included
+ *****************************************************************/
+unsigned int expectedFpgaPolls(FpgaOpKind kind, size_t len,
+			       unsigned int targets)
+{
+	uint64_t expected;
+	uint64_t interval;
+	uint64_t first = pollSchedule(kind, len, targets, &expected,
+				      &interval);
+	uint64_t left = expected > first ? expected - first : 0;
+
+	return 1 + (left + interval - 1) / interval;
+}
+
+/**************************************************************
+ * startFpgaPoll()
+ *
+ * Start timing a triggered retimer update or read, the caller
+ * reads the status with stepFpgaPoll() after the returned delay.
+ *
+ * poll: outgoing, state of the wait
+ * kind: update or read
+ * len: image length the FPGA transfers per retimer
+ * targets: number of retimers in the operation
+ *
+ * RETURN: delay in us until the first status read
+ *****************************************************************/
+uint64_t startFpgaPoll(FpgaPoll *poll, FpgaOpKind kind, size_t len,
+		       unsigned int targets)
+{
+	FpgaPollResult *r = &poll->result;
+	uint64_t first;
+
+	memset(poll, 0, sizeof(*poll));
+	poll->kind = kind;
+	poll->len = len;
+	poll->targets = targets;
+	poll->start = pollNowUs();
+	first = pollSchedule(kind, len, targets, &r->expectedUs,
+			     &poll->interval);
+	r->deadlineUs = fpgaOpDeadlineUs(kind, len, targets);
+	debug_print("FPGA %s: expected %llu us, first read %llu us, deadline %llu us\n",
+		    pollKindName[kind], (unsigned long long)r->expectedUs,
+		    (unsigned long long)first,
+		    (unsigned long long)r->deadlineUs);
+	return first;
+}
+
+/**************************************************************
+ * stepFpgaPoll()
+ *
+ * Read the status once. The operation is finished when it is no
+ * longer busy or the deadline passed (result.timedOut), otherwise
+ * delayUs tells when to read the status again.
+ *
+ * poll: state from startFpgaPoll()
+ * fd: file descriptor
+ * slaveId: FPGA controller address
+ * status: outgoing, READ_BUF_SIZE bytes of the status read
+ * delayUs: outgoing, 0 when finished
+ *
+ * RETURN: 0 if the status was read, error of the status read otherwise
+ *****************************************************************/
+int stepFpgaPoll(FpgaPoll *poll, int fd, unsigned int slaveId,
+		 unsigned char *status, uint64_t *delayUs)
+{
+	FpgaPollResult *r = &poll->result;
+	int ret;
+
+	*delayUs = 0;
+	memset(status, 0x00, READ_BUF_SIZE);
+	ret = readFpgaReg(fd, slaveId, pollStatusReg[poll->kind], status);
+	r->polls++;
+	r->elapsedUs = pollNowUs() - poll->start;
+	if (ret) {
+		return ret;
+	}
+	debug_print("FPGA status: 0x%x 0x%x 0x%x 0x%x after %llu us\n",
+		    status[0], status[1], status[2], status[3],
+		    (unsigned long long)r->elapsedUs);
+	if ((status[0] & pollBusyMask[poll->kind]) == 0) {
+		recordFpgaOp(poll);
+		return 0;
+	}
+	poll->busyUs = r->elapsedUs;
+	if (r->elapsedUs >= r->deadlineUs) {
+		r->timedOut = true;
+		return 0;
+	}
+	*delayUs = r->deadlineUs - r->elapsedUs < poll->interval ?
+			   r->deadlineUs - r->elapsedUs :
+			   poll->interval;
+	return 0;
+}
+
+/**************************************************************
+ * waitFpgaOperation()
+ *
+ * Wait for a triggered retimer update or read to finish. Sleeps
+ * until shortly before the expected finish, then polls the status
+ * register at a fraction of the expected duration.
+ *
+ * fd: file descriptor
+ * kind: update or read
+ * len: image length the FPGA transfers per retimer
+ * targets: number of retimers in the operation
+ * status: outgoing, READ_BUF_SIZE bytes of the last status read
+ * result: outgoing, timing of the wait, may be NULL
+ *
+ * RETURN: 0 when done or timed out (see result), error of the
+ *	   status read otherwise
+ *****************************************************************/
+int waitFpgaOperation(int fd, FpgaOpKind kind, size_t len,
+		      unsigned int targets, unsigned char *status,
+		      FpgaPollResult *result)
+{
+	FpgaPoll poll;
+	uint64_t delayUs = startFpgaPoll(&poll, kind, len, targets);
+	int ret;
+
+	do {
+		if (delayUs) {
+			usleep(delayUs);
+		}
+		ret = stepFpgaPoll(&poll, fd, getFpgaCntrlAddr(), status,
+				   &delayUs);
+	} while (!ret && delayUs);
+
+	if (result) {
+		*result = poll.result;
+	}
+	return ret;
+}
+
+/**************************************************************
+ * setFpgaPollUsPerKb()
+ *
+ * Override the learned duration of one operation kind for every
+ * retimer count, 0 returns to the history file. Measurements keep
+ * adjusting an overridden value in this process, but it is never
+ * saved to the history file.
+ *
+ * kind: update or read
+ * value: us per kilobyte
+ *****************************************************************/
+void setFpgaPollUsPerKb(FpgaOpKind kind, uint64_t value)
+{
+	pthread_mutex_lock(&pollLock);
+	loadPollHistory();
+	overridden[kind] = value != 0;
+	for (int i = 0; i < RETIMER_MAX_NUM; i++) {
+		usPerKb[kind][i] = value ? value : savedUsPerKb[kind][i];
+	}
+	pthread_mutex_unlock(&pollLock);
+}
+
+/**************************************************************
+ * setFpgaPollHistoryFile()
+ *
+ * Keep the learned durations in path instead of
+ * FPGA_POLL_HISTORY_FILE, NULL selects it again. The history is
+ * read again on next use, overridden values stay.
+ *****************************************************************/
+void setFpgaPollHistoryFile(const char *path)
+{
+	pthread_mutex_lock(&pollLock);
+	snprintf(historyFile, sizeof(historyFile), "%s",
+		 path ? path : FPGA_POLL_HISTORY_FILE);
+	historyLoaded = false;
+	pthread_mutex_unlock(&pollLock);
+}
@@ -0,0 +1,94 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2022-2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UPDATERETIMERFW_POLL_H_
+#define UPDATERETIMERFW_POLL_H_
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "updateRetimerFwOverI2C.h"
+
+/*
+ * FPGA update and read completion is polled adaptively. The expected
+ * duration is learned per kilobyte of the image and per number of
+ * targeted retimers from earlier operations, kept in the history file
+ * (FPGA_POLL_HISTORY_FILE, see setFpgaPollHistoryFile()) across
+ * reboots. A retimer count that was never measured borrows the
+ * nearest measured count. Once measured, the first status read
+ * happens shortly before the expected finish, then the status is
+ * polled every FPGA_POLL_MIN_US-FPGA_POLL_MAX_US. Until then it is
+ * read every FPGA_POLL_MAX_US from the trigger on.
+ */
+#define FPGA_POLL_HISTORY_FILE RETIMER_STATE_DIR "/poll.history"
+// first status read at this percentage of the expected duration
+#define FPGA_POLL_FIRST_PCT 80
+#define FPGA_POLL_MIN_US (10 * DELAY_1MS)
+#define FPGA_POLL_MAX_US (250 * DELAY_1MS)
+// deadline, never below the MAX_TIMEOUT_SEC the trigger always had
+#define FPGA_POLL_DEADLINE_FACTOR 3
+// estimates of plans and progress until an operation was measured,
+// polling never waits on them
+#define FPGA_POLL_UPDATE_US_PER_KB                                     \
+	((uint64_t)MAX_TIMEOUT_SEC * DELAY_1SEC /                      \
+	 FPGA_POLL_DEADLINE_FACTOR / (MAX_FW_IMAGE_SIZE / 1024))
+#define FPGA_POLL_READ_US_PER_KB 10000
+// the history file is only rewritten when a value moved this much
+#define FPGA_POLL_SAVE_PCT 10
+
+typedef enum {
+	FPGA_OP_UPDATE = 0, /**< retimer EEPROM update, FPGA_UPDATE_STATUS_REG */
+	FPGA_OP_READ = 1, /**< retimer EEPROM read, FPGA_READ_STATUS_REG */
+	FPGA_OP_KINDS,
+} FpgaOpKind;
+
+typedef struct {
+	uint64_t expectedUs; /**< learned duration of this operation */
+	uint64_t deadlineUs; /**< give up after this long */
+	uint64_t elapsedUs; /**< time until completion or timeout */
+	unsigned int polls; /**< status register reads */
+	bool timedOut;
+} FpgaPollResult;
+
+/**
+* @brief *
+* Wait in progress, see startFpgaPoll()/stepFpgaPoll()
+**/
+typedef struct {
+	FpgaOpKind kind;
+	size_t len;
+	unsigned int targets;
+	uint64_t start; /**< CLOCK_MONOTONIC us of the trigger */
+	uint64_t interval; /**< status read interval after the first one */
+	uint64_t busyUs; /**< time of the last status read that was busy */
+	FpgaPollResult result;
+} FpgaPoll;
+
+uint64_t expectedFpgaOpUs(FpgaOpKind kind, size_t len, unsigned int targets);
+uint64_t fpgaOpDeadlineUs(FpgaOpKind kind, size_t len, unsigned int targets);
+unsigned int expectedFpgaPolls(FpgaOpKind kind, size_t len,
+			       unsigned int targets);
+uint64_t startFpgaPoll(FpgaPoll *poll, FpgaOpKind kind, size_t len,
+		       unsigned int targets);
+int stepFpgaPoll(FpgaPoll *poll, int fd, unsigned int slaveId,
+		 unsigned char *status, uint64_t *delayUs);
+int waitFpgaOperation(int fd, FpgaOpKind kind, size_t len,
+		      unsigned int targets, unsigned char *status,
+		      FpgaPollResult *result);
+void setFpgaPollUsPerKb(FpgaOpKind kind, uint64_t value);
+void setFpgaPollHistoryFile(const char *path);
+
+#endif
@@ -0,0 +1,319 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2022-2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <string.h>
+#include <time.h>
+#include "updateRetimerFw_poll.h"
+#include "updateRetimerFw_progress.h"
+
+
+const char *const updatePhaseNames[UPDATE_PHASES] = {
+	"Idle",	     "Preparing", "Uploading", "Verifying",
+	"Flashing", "Complete",	 "Failed",
+};
+
+const char *const retimerProgressNames[RETIMER_PROGRESS_STATES] = {
+	"None", "Pending", "Flashing", "Updated", "Current", "Failed",
+};
+
+/**
+* @brief *
+* Progress the calling thread reports into, see setUpdateProgress()
+**/
+static _Thread_local UpdateProgress *currentProgress;
+
+static uint64_t progressNowUs(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+/**************************************************************
+ * initUpdateProgress()
+ *
+ * progress: outgoing, idle progress
+ * notify: called on changes, may be NULL
+ * userdata: passed to notify
+ *****************************************************************/
+void initUpdateProgress(UpdateProgress *progress, UpdateProgressFn notify,
+			void *userdata)
+{
+	memset(progress, 0, sizeof(*progress));
+	pthread_mutex_init(&progress->lock, NULL);
+	progress->minIntervalUs = UPDATE_PROGRESS_INTERVAL_US;
+	progress->notify = notify;
+	progress->userdata = userdata;
+}
+
+void destroyUpdateProgress(UpdateProgress *progress)
+{
+	pthread_mutex_destroy(&progress->lock);
+}
+
+/**************************************************************
+ * setUpdateProgress()
+ *
+ * Report the progress of the update run in the calling thread into
+ * progress, NULL stops reporting
+ *****************************************************************/
+void setUpdateProgress(UpdateProgress *progress)
+{
+	currentProgress = progress;
+}
+
+// called with the lock held
+static uint64_t progressEtaUs(const UpdateProgress *p, uint64_t now)
+{
+	size_t left = p->state.bytesTotal - p->state.bytesDone;
+	uint64_t uploadUs = p->uploadUs;
+	uint64_t eta = p->flashLeftUs + p->opFlashUs;
+
+	if (p->state.phase == UPDATE_PHASE_COMPLETE ||
+	    p->state.phase == UPDATE_PHASE_FAILED) {
+		return 0;
+	}
+	if (p->state.phase == UPDATE_PHASE_UPLOADING) {
+		uploadUs += now - p->phaseStart;
+	}
+	// remaining pages at the speed measured so far
+	if (p->state.bytesDone && uploadUs) {
+		eta += (uint64_t)left * uploadUs / p->state.bytesDone;
+	} else {
+		eta += (uint64_t)left * UPDATE_PROGRESS_UPLOAD_US_PER_KB / 1024;
+	}
+	if (p->state.phase == UPDATE_PHASE_FLASHING &&
+	    now - p->phaseStart < p->flashUs) {
+		eta += p->flashUs - (now - p->phaseStart);
+	}
+	return eta;
+}
+
+/**************************************************************
+ * getUpdateProgressState()
+ *
+ * Consistent copy of progress with percent and ETA as of now
+ *****************************************************************/
+void getUpdateProgressState(UpdateProgress *progress,
+			    UpdateProgressState *state)
+{
+	pthread_mutex_lock(&progress->lock);
+	*state = progress->state;
+	state->etaUs = progressEtaUs(progress, progressNowUs());
+	pthread_mutex_unlock(&progress->lock);
+
+	if (state->phase == UPDATE_PHASE_COMPLETE) {
+		state->percent = 100;
+	} else if (state->bytesTotal) {
+		// 100 is only reported once the retimers are flashed
+		state->percent = state->bytesDone * 99 / state->bytesTotal;
+	}
+}
+
+/**************************************************************
+ * progressNotify()
+ *
+ * Unlock p and call notify, page level changes are dropped until
+ * minIntervalUs passed since the last call
+ *****************************************************************/
+static void progressNotify(UpdateProgress *p, bool force)
+{
+	uint64_t now = progressNowUs();
+	bool call = force || now - p->lastNotify >= p->minIntervalUs;
+
+	if (call) {
+		p->lastNotify = now;
+	}
+	pthread_mutex_unlock(&p->lock);
+	if (call && p->notify) {
+		p->notify(p, p->userdata);
+	}
+}
+
+// called with the lock held
+static void setProgressPhase(UpdateProgress *p, UpdatePhase phase)
+{
+	uint64_t now = progressNowUs();
+
+	if (p->state.phase == UPDATE_PHASE_UPLOADING) {
+		p->uploadUs += now - p->phaseStart;
+	}
+	p->state.phase = phase;
+	p->phaseStart = now;
+}
+
+/**************************************************************
+ * progressPlan()
+ *
+ * Start a run over update_ops, applyBitmap already reduced to the
+ * retimers that will be flashed. Retimers already marked current
+ * keep their status.
+ *****************************************************************/
+void progressPlan(const update_operation *update_ops, int update_ops_count)
+{
+	UpdateProgress *p = currentProgress;
+
+	if (!p) {
+		return;
+	}
+	pthread_mutex_lock(&p->lock);
+	p->state.bytesDone = 0;
+	p->state.bytesTotal = 0;
+	p->uploadUs = 0;
+	p->opEnd = 0;
+	p->opFlashUs = 0;
+	p->flashUs = 0;
+	p->flashLeftUs = 0;
+	for (int uo = 0; uo < update_ops_count; uo++) {
+		if (!update_ops[uo].applyBitmap) {
+			continue;
+		}
+		p->state.bytesTotal += update_ops[uo].imageLength;
+		p->flashLeftUs += expectedFpgaOpUs(
+			FPGA_OP_UPDATE, update_ops[uo].imageLength,
+			countRetimers(update_ops[uo].applyBitmap));
+		for (int index = 0; index < RETIMER_MAX_NUM; index++) {
+			if (update_ops[uo].applyBitmap & RETIMER_BIT(index)) {
+				p->state.retimer[index] =
+					RETIMER_PROGRESS_PENDING;
+			}
+		}
+	}
+	setProgressPhase(p, UPDATE_PHASE_PREPARING);
+	progressNotify(p, true);
+}
+
+/**************************************************************
+ * progressOperation()
+ *
+ * Start the upload of the next planned update operation. Pages the
+ * previous operation did not upload, because it failed, count as
+ * done.
+ *
+ * len: image length of the operation
+ * retimerBitmap: retimers the operation targets
+ *****************************************************************/
+void progressOperation(size_t len, RetimerBitmap retimerBitmap)
+{
+	UpdateProgress *p = currentProgress;
+	uint64_t expected;
+
+	if (!p) {
+		return;
+	}
+	expected = expectedFpgaOpUs(FPGA_OP_UPDATE, len,
+				    countRetimers(retimerBitmap));
+	pthread_mutex_lock(&p->lock);
+	if (p->state.bytesDone < p->opEnd) {
+		p->state.bytesDone = p->opEnd;
+	}
+	p->opEnd = p->state.bytesDone + len;
+	p->opFlashUs = expected < p->flashLeftUs ? expected : p->flashLeftUs;
+	p->flashLeftUs -= p->opFlashUs;
+	setProgressPhase(p, UPDATE_PHASE_UPLOADING);
+	progressNotify(p, true);
+}
+
+/**************************************************************
+ * progressPhase()
+ *
+ * Enter phase, entering UPDATE_PHASE_FLASHING starts the expected
+ * flash time of the current operation
+ *****************************************************************/
+void progressPhase(UpdatePhase phase)
+{
+	UpdateProgress *p = currentProgress;
+
+	if (!p) {
+		return;
+	}
+	pthread_mutex_lock(&p->lock);
+	if (phase == UPDATE_PHASE_FLASHING) {
+		p->flashUs = p->opFlashUs;
+		p->opFlashUs = 0;
+	}
+	setProgressPhase(p, phase);
+	progressNotify(p, true);
+}
+
+/**************************************************************
+ * progressRetimers()
+ *
+ * Set the status of the retimers in retimerBitmap
+ *****************************************************************/
+void progressRetimers(RetimerBitmap retimerBitmap, RetimerProgress status)
+{
+	UpdateProgress *p = currentProgress;
+
+	if (!p || !retimerBitmap) {
+		return;
+	}
+	pthread_mutex_lock(&p->lock);
+	for (int index = 0; index < RETIMER_MAX_NUM; index++) {
+		if (retimerBitmap & RETIMER_BIT(index)) {
+			p->state.retimer[index] = status;
+		}
+	}
+	progressNotify(p, true);
+}
+
+/**************************************************************
+ * progressUploaded()
+ *
+ * Count bytes of the current operation as in DPRAM, pages sent
+ * again by DPRAM verification do not count twice
+ *****************************************************************/
+void progressUploaded(size_t bytes)
+{
+	UpdateProgress *p = currentProgress;
+
+	if (!p) {
+		return;
+	}
+	pthread_mutex_lock(&p->lock);
+	if (p->state.phase != UPDATE_PHASE_UPLOADING) {
+		pthread_mutex_unlock(&p->lock);
+		return;
+	}
+	p->state.bytesDone = p->opEnd - p->state.bytesDone > bytes ?
+				     p->state.bytesDone + bytes :
+				     p->opEnd;
+	progressNotify(p, false);
+}
+
+/**************************************************************
+ * progressFinished()
+ *
+ * End the run, result is the result of the run
+ *****************************************************************/
+void progressFinished(int result)
+{
+	UpdateProgress *p = currentProgress;
+
+	if (!p) {
+		return;
+	}
+	pthread_mutex_lock(&p->lock);
+	p->state.bytesDone = p->state.bytesTotal;
+	p->opFlashUs = 0;
+	p->flashLeftUs = 0;
+	p->flashUs = 0;
+	setProgressPhase(p, result ? UPDATE_PHASE_FAILED :
+				     UPDATE_PHASE_COMPLETE);
+	progressNotify(p, true);
+}
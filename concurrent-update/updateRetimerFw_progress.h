@@ -0,0 +1,107 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2022-2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UPDATERETIMERFW_PROGRESS_H_
+#define UPDATERETIMERFW_PROGRESS_H_
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "updateRetimerFwOverI2C.h"
+
+/*
+ * Live progress of an update run. The thread running the update
+ * reports into the UpdateProgress installed with setUpdateProgress(),
+ * DPRAM uploads report every page batch. Observers read consistent
+ * copies with getUpdateProgressState() from any thread. The notify
+ * callback runs on the reporting thread: at once for a phase or
+ * retimer status change, at most every minIntervalUs for page level
+ * progress.
+ */
+#define UPDATE_PROGRESS_INTERVAL_US (1000 * DELAY_1MS)
+// upload speed assumed until the first page batch is measured
+#define UPDATE_PROGRESS_UPLOAD_US_PER_KB 25000
+
+typedef enum {
+	UPDATE_PHASE_IDLE = 0, /**< nothing started */
+	UPDATE_PHASE_PREPARING, /**< targets and operations determined */
+	UPDATE_PHASE_UPLOADING, /**< image copied into DPRAM */
+	UPDATE_PHASE_VERIFYING, /**< image CRC and image info checked */
+	UPDATE_PHASE_FLASHING, /**< FPGA writes the retimer EEPROMs */
+	UPDATE_PHASE_COMPLETE, /**< all retimers updated */
+	UPDATE_PHASE_FAILED, /**< finished, some retimers not updated */
+	UPDATE_PHASES,
+} UpdatePhase;
+
+typedef enum {
+	RETIMER_PROGRESS_NONE = 0, /**< not part of the update */
+	RETIMER_PROGRESS_PENDING, /**< waiting for its update operation */
+	RETIMER_PROGRESS_FLASHING, /**< update triggered */
+	RETIMER_PROGRESS_UPDATED,
+	RETIMER_PROGRESS_CURRENT, /**< already running the image, skipped */
+	RETIMER_PROGRESS_FAILED,
+	RETIMER_PROGRESS_STATES,
+} RetimerProgress;
+
+extern const char *const updatePhaseNames[UPDATE_PHASES];
+extern const char *const retimerProgressNames[RETIMER_PROGRESS_STATES];
+
+/**
+* @brief *
+* Copy of the progress handed to observers
+**/
+typedef struct {
+	UpdatePhase phase;
+	uint8_t percent; /**< of the image pages in DPRAM, 100 when complete */
+	size_t bytesDone;
+	size_t bytesTotal;
+	uint64_t etaUs; /**< expected time until the run finishes */
+	RetimerProgress retimer[RETIMER_MAX_NUM];
+} UpdateProgressState;
+
+typedef struct UpdateProgress UpdateProgress;
+typedef void (*UpdateProgressFn)(UpdateProgress *progress, void *userdata);
+
+struct UpdateProgress {
+	pthread_mutex_t lock;
+	UpdateProgressState state;
+	uint64_t minIntervalUs;
+	uint64_t lastNotify;
+	uint64_t phaseStart; /**< CLOCK_MONOTONIC us */
+	uint64_t uploadUs; /**< time spent uploading, excl. current phase */
+	size_t opEnd; /**< bytesDone once the current operation is uploaded */
+	uint64_t opFlashUs; /**< expected flash time, current operation */
+	uint64_t flashLeftUs; /**< expected flash time, operations not triggered */
+	uint64_t flashUs; /**< expected flash time, triggered operation */
+	UpdateProgressFn notify;
+	void *userdata;
+};
+
+void initUpdateProgress(UpdateProgress *progress, UpdateProgressFn notify,
+			void *userdata);
+void destroyUpdateProgress(UpdateProgress *progress);
+void setUpdateProgress(UpdateProgress *progress);
+void getUpdateProgressState(UpdateProgress *progress,
+			    UpdateProgressState *state);
+void progressPlan(const update_operation *update_ops, int update_ops_count);
+void progressOperation(size_t len, RetimerBitmap retimerBitmap);
+void progressPhase(UpdatePhase phase);
+void progressRetimers(RetimerBitmap retimerBitmap, RetimerProgress status);
+void progressUploaded(size_t bytes);
+void progressFinished(int result);
+
+#endif
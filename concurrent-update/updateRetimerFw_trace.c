@@ -0,0 +1,422 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2022-2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sys/eventfd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "updateRetimerFw_trace.h"
+
+#define TRACE_HDR_SIZE 8
+#define TRACE_REC_SIZE 18
+#define TRACE_MSG_SIZE 6
+
+struct I2CTrace {
+	I2CTransport transport;
+	const I2CTransport *inner; /**< recording: transport being traced */
+	FILE *fp; /**< recording: output file */
+	bool writeError;
+	unsigned char *data; /**< replay: whole trace file */
+	size_t size;
+	size_t pos; /**< replay: next record */
+	bool realTime;
+	struct timespec start;
+	pthread_mutex_t lock;
+	I2CTraceStats stats;
+};
+
+static void put16(unsigned char *p, uint16_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static void put32(unsigned char *p, uint32_t v)
+{
+	put16(p, v);
+	put16(p + 2, v >> 16);
+}
+
+static void put64(unsigned char *p, uint64_t v)
+{
+	put32(p, v);
+	put32(p + 4, v >> 32);
+}
+
+static uint16_t get16(const unsigned char *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const unsigned char *p)
+{
+	return get16(p) | ((uint32_t)get16(p + 2) << 16);
+}
+
+static uint64_t traceNowUs(I2CTrace *trace)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)(now.tv_sec - trace->start.tv_sec) * 1000000 +
+	       (now.tv_nsec - trace->start.tv_nsec) / 1000;
+}
+
+static I2CTrace *traceAlloc(void)
+{
+	I2CTrace *trace = calloc(1, sizeof(*trace));
+
+	if (trace) {
+		pthread_mutex_init(&trace->lock, NULL);
+		clock_gettime(CLOCK_MONOTONIC, &trace->start);
+		trace->transport.priv = trace;
+	}
+	return trace;
+}
+
+static void traceWrite(I2CTrace *trace, const void *buf, size_t len)
+{
+	if (len && fwrite(buf, 1, len, trace->fp) != len) {
+		trace->writeError = true;
+	}
+}
+
+static int traceRecOpen(void *priv, unsigned int bus)
+{
+	I2CTrace *trace = priv;
+
+	return trace->inner->open(trace->inner->priv, bus);
+}
+
+static void traceRecClose(void *priv, int fd)
+{
+	I2CTrace *trace = priv;
+
+	trace->inner->close(trace->inner->priv, fd);
+}
+
+static int traceRecTransfer(void *priv, int fd, struct i2c_msg *msgs,
+			    unsigned int nmsgs)
+{
+	I2CTrace *trace = priv;
+	unsigned char rec[TRACE_REC_SIZE];
+	unsigned char hdr[TRACE_MSG_SIZE];
+	uint64_t start = traceNowUs(trace);
+	int ret = trace->inner->transfer(trace->inner->priv, fd, msgs, nmsgs);
+	uint32_t duration = traceNowUs(trace) - start;
+
+	put64(rec, start);
+	put32(rec + 8, duration);
+	put32(rec + 12, (uint32_t)ret);
+	put16(rec + 16, nmsgs);
+
+	pthread_mutex_lock(&trace->lock);
+	traceWrite(trace, rec, sizeof(rec));
+	for (unsigned int i = 0; i < nmsgs; i++) {
+		put16(hdr, msgs[i].addr);
+		put16(hdr + 2, msgs[i].flags);
+		put16(hdr + 4, msgs[i].len);
+		traceWrite(trace, hdr, sizeof(hdr));
+		if (!(msgs[i].flags & I2C_M_RD) || ret == 0) {
+			traceWrite(trace, msgs[i].buf, msgs[i].len);
+		}
+		trace->stats.bytes += msgs[i].len + 1;
+	}
+	// keep the trace usable when a daemon is killed
+	if (fflush(trace->fp)) {
+		trace->writeError = true;
+	}
+	trace->stats.transfers++;
+	trace->stats.busTimeUs += duration;
+	pthread_mutex_unlock(&trace->lock);
+	return ret;
+}
+
+/**************************************************************
+ * i2cTraceRecord()
+ *
+ * Record every transfer passed to inner into a trace file
+ *
+ * path: trace file, truncated
+ * inner: transport doing the real transfers, NULL for i2c-dev
+ *
+ * RETURN: trace or NULL on failure
+ *****************************************************************/
+I2CTrace *i2cTraceRecord(const char *path, const I2CTransport *inner)
+{
+	unsigned char hdr[TRACE_HDR_SIZE] = { 0 };
+	I2CTrace *trace = traceAlloc();
+
+	if (!trace) {
+		return NULL;
+	}
+	trace->fp = fopen(path, "wb");
+	if (!trace->fp) {
+		fprintf(stderr, "Unable to create I2C trace %s: %s\n", path,
+			strerror(errno));
+		i2cTraceClose(trace);
+		return NULL;
+	}
+	memcpy(hdr, I2C_TRACE_MAGIC, 4);
+	put16(hdr + 4, I2C_TRACE_VERSION);
+	traceWrite(trace, hdr, sizeof(hdr));
+
+	trace->inner = inner ? inner : &i2cDevTransport;
+	trace->transport.name = "trace-record";
+	trace->transport.open = traceRecOpen;
+	trace->transport.close = traceRecClose;
+	trace->transport.transfer = traceRecTransfer;
+	return trace;
+}
+
+/**************************************************************
+ * traceReplayRecord()
+ *
+ * Compare the record at *pos with msgs. With fill set the record
+ * is known to match and its read data is copied into msgs.
+ *
+ * RETURN: true if the record matches, *pos is moved past it
+ *****************************************************************/
+static bool traceReplayRecord(I2CTrace *trace, size_t *pos,
+			      struct i2c_msg *msgs, unsigned int nmsgs,
+			      bool fill, int *result, uint32_t *duration)
+{
+	const unsigned char *p = trace->data + *pos;
+	size_t left = trace->size - *pos;
+
+	if (left < TRACE_REC_SIZE || (msgs && get16(p + 16) != nmsgs)) {
+		return false;
+	}
+	*duration = get32(p + 8);
+	*result = (int32_t)get32(p + 12);
+	nmsgs = get16(p + 16);
+	p += TRACE_REC_SIZE;
+	left -= TRACE_REC_SIZE;
+
+	for (unsigned int i = 0; i < nmsgs; i++) {
+		uint16_t flags, len;
+		bool hasData;
+
+		if (left < TRACE_MSG_SIZE) {
+			return false;
+		}
+		flags = get16(p + 2);
+		len = get16(p + 4);
+		if (msgs && (get16(p) != msgs[i].addr ||
+			     flags != msgs[i].flags || len != msgs[i].len)) {
+			return false;
+		}
+		p += TRACE_MSG_SIZE;
+		left -= TRACE_MSG_SIZE;
+
+		hasData = !(flags & I2C_M_RD) || *result == 0;
+		if (hasData && left < len) {
+			return false;
+		}
+		if (hasData && msgs) {
+			if (!(flags & I2C_M_RD)) {
+				if (memcmp(p, msgs[i].buf, len)) {
+					return false;
+				}
+			} else if (fill) {
+				memcpy(msgs[i].buf, p, len);
+			}
+		}
+		if (hasData) {
+			p += len;
+			left -= len;
+		}
+	}
+	*pos = p - trace->data;
+	return true;
+}
+
+static int traceReplayOpen(__attribute__((unused)) void *priv,
+			   __attribute__((unused)) unsigned int bus)
+{
+	return eventfd(0, EFD_CLOEXEC);
+}
+
+static void traceReplayClose(__attribute__((unused)) void *priv, int fd)
+{
+	close(fd);
+}
+
+static int traceReplayTransfer(void *priv, __attribute__((unused)) int fd,
+			       struct i2c_msg *msgs, unsigned int nmsgs)
+{
+	I2CTrace *trace = priv;
+	size_t pos;
+	uint32_t duration = 0;
+	int result = 0;
+
+	pthread_mutex_lock(&trace->lock);
+	pos = trace->pos;
+	if (!traceReplayRecord(trace, &pos, msgs, nmsgs, false, &result,
+			       &duration)) {
+		trace->stats.mismatches++;
+		fprintf(stderr,
+			"I2C trace mismatch at transfer %lu, offset %zu\n",
+			trace->stats.transfers, trace->pos);
+		pthread_mutex_unlock(&trace->lock);
+		return -EPROTO;
+	}
+	pos = trace->pos;
+	traceReplayRecord(trace, &pos, msgs, nmsgs, true, &result, &duration);
+	trace->pos = pos;
+	trace->stats.transfers++;
+	trace->stats.busTimeUs += duration;
+	for (unsigned int i = 0; i < nmsgs; i++) {
+		trace->stats.bytes += msgs[i].len + 1;
+	}
+	pthread_mutex_unlock(&trace->lock);
+
+	if (trace->realTime && duration) {
+		usleep(duration);
+	}
+	return result;
+}
+
+/**************************************************************
+ * i2cTraceReplay()
+ *
+ * Act as the device recorded in a trace. Transfers must arrive in
+ * the recorded order with identical addresses, flags, lengths and
+ * write data, they get the recorded read data and result.
+ * Anything else fails with EPROTO and counts as a mismatch.
+ *
+ * path: trace file
+ * realTime: sleep for the recorded transfer durations
+ *
+ * RETURN: trace or NULL on failure
+ *****************************************************************/
+I2CTrace *i2cTraceReplay(const char *path, bool realTime)
+{
+	I2CTrace *trace = traceAlloc();
+	FILE *fp = NULL;
+	long size;
+
+	if (!trace) {
+		return NULL;
+	}
+	fp = fopen(path, "rb");
+	if (!fp || fseek(fp, 0, SEEK_END) || (size = ftell(fp)) < 0 ||
+	    fseek(fp, 0, SEEK_SET)) {
+		fprintf(stderr, "Unable to open I2C trace %s: %s\n", path,
+			strerror(errno));
+		goto err;
+	}
+	trace->size = size;
+	trace->data = malloc(trace->size ? trace->size : 1);
+	if (!trace->data ||
+	    fread(trace->data, 1, trace->size, fp) != trace->size) {
+		fprintf(stderr, "Unable to read I2C trace %s\n", path);
+		goto err;
+	}
+	if (trace->size < TRACE_HDR_SIZE ||
+	    memcmp(trace->data, I2C_TRACE_MAGIC, 4) ||
+	    get16(trace->data + 4) != I2C_TRACE_VERSION) {
+		fprintf(stderr, "%s is not an I2C trace\n", path);
+		goto err;
+	}
+	fclose(fp);
+
+	trace->pos = TRACE_HDR_SIZE;
+	trace->realTime = realTime;
+	trace->transport.name = "trace-replay";
+	trace->transport.open = traceReplayOpen;
+	trace->transport.close = traceReplayClose;
+	trace->transport.transfer = traceReplayTransfer;
+	return trace;
+
+err:
+	if (fp) {
+		fclose(fp);
+	}
+	i2cTraceClose(trace);
+	return NULL;
+}
+
+/**************************************************************
+ * i2cTraceTransport()
+ *
+ * RETURN: transport to pass to setI2CTransport()
+ *****************************************************************/
+const I2CTransport *i2cTraceTransport(I2CTrace *trace)
+{
+	return &trace->transport;
+}
+
+/**************************************************************
+ * i2cTraceGetStats()
+ *
+ * Snapshot the counters, remaining is only set on replay
+ *****************************************************************/
+void i2cTraceGetStats(I2CTrace *trace, I2CTraceStats *stats)
+{
+	size_t pos;
+	uint32_t duration;
+	int result;
+
+	pthread_mutex_lock(&trace->lock);
+	*stats = trace->stats;
+	stats->remaining = 0;
+	pos = trace->pos;
+	while (trace->data &&
+	       traceReplayRecord(trace, &pos, NULL, 0, false, &result,
+				 &duration)) {
+		stats->remaining++;
+	}
+	pthread_mutex_unlock(&trace->lock);
+}
+
+/**************************************************************
+ * i2cTraceClose()
+ *
+ * Finish a recording or replay and free the trace, it must not be
+ * the active transport anymore
+ *
+ * RETURN: 0 if the recording was written completely or the replay
+ *         consumed the whole trace without mismatch
+ *****************************************************************/
+int i2cTraceClose(I2CTrace *trace)
+{
+	I2CTraceStats stats;
+	int ret = 0;
+
+	if (!trace) {
+		return 0;
+	}
+	i2cTraceGetStats(trace, &stats);
+	if (trace->fp) {
+		if (fclose(trace->fp) || trace->writeError) {
+			ret = -1;
+		}
+	}
+	if (trace->data && (stats.mismatches || stats.remaining)) {
+		ret = -1;
+	}
+	free(trace->data);
+	pthread_mutex_destroy(&trace->lock);
+	free(trace);
+	return ret;
+}
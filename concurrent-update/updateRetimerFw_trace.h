@@ -0,0 +1,56 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2022-2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UPDATERETIMERFW_TRACE_H_
+#define UPDATERETIMERFW_TRACE_H_
+#include <stdbool.h>
+#include "updateRetimerFw_transport.h"
+
+/*
+ * Binary I2C transaction trace, all fields little endian
+ *
+ * header : "RTTR" u16 version u16 reserved
+ * record : u64 start_us u32 duration_us i32 result u16 nmsgs
+ *          nmsgs x { u16 addr u16 flags u16 len u8 data[] }
+ *
+ * data holds the written bytes of a write message and the returned
+ * bytes of a read message, read data is omitted when result != 0.
+ */
+#define I2C_TRACE_MAGIC "RTTR"
+#define I2C_TRACE_VERSION 1
+
+typedef struct I2CTrace I2CTrace;
+
+/**
+* @brief *
+* Counters of a recording or replay
+**/
+typedef struct I2CTraceStats {
+	unsigned long transfers; /**< transfers recorded or replayed */
+	unsigned long mismatches; /**< replayed transfers not matching the trace */
+	unsigned long remaining; /**< trace records not replayed */
+	unsigned long long bytes; /**< payload bytes incl. address bytes */
+	unsigned long long busTimeUs; /**< sum of recorded transfer durations */
+} I2CTraceStats;
+
+I2CTrace *i2cTraceRecord(const char *path, const I2CTransport *inner);
+I2CTrace *i2cTraceReplay(const char *path, bool realTime);
+const I2CTransport *i2cTraceTransport(I2CTrace *trace);
+void i2cTraceGetStats(I2CTrace *trace, I2CTraceStats *stats);
+int i2cTraceClose(I2CTrace *trace);
+
+#endif
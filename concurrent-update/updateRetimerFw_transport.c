@@ -0,0 +1,88 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2022-2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <linux/i2c-dev.h>
+#include <sys/ioctl.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "updateRetimerFwOverI2C.h"
+#include "updateRetimerFw_transport.h"
+
+static int i2cDevOpen(__attribute__((unused)) void *priv, unsigned int bus)
+{
+	char i2c_device[MAX_NAME_SIZE] = { 0 };
+
+	snprintf(i2c_device, sizeof(i2c_device), "/dev/i2c-%u", bus);
+	return open(i2c_device, O_RDWR | O_NONBLOCK);
+}
+
+static void i2cDevClose(__attribute__((unused)) void *priv, int fd)
+{
+	close(fd);
+}
+
+static int i2cDevTransfer(__attribute__((unused)) void *priv, int fd,
+			  struct i2c_msg *msgs, unsigned int nmsgs)
+{
+	struct i2c_rdwr_ioctl_data rdwr_msg;
+
+	memset(&rdwr_msg, 0, sizeof(rdwr_msg));
+	rdwr_msg.msgs = msgs;
+	rdwr_msg.nmsgs = nmsgs;
+
+	if (ioctl(fd, I2C_RDWR, &rdwr_msg) < 0) {
+		return -errno;
+	}
+	return 0;
+}
+
+const I2CTransport i2cDevTransport = {
+	.name = "i2c-dev",
+	.open = i2cDevOpen,
+	.close = i2cDevClose,
+	.transfer = i2cDevTransfer,
+	.priv = NULL,
+};
+
+static const I2CTransport *activeTransport = &i2cDevTransport;
+
+/**************************************************************
+ * setI2CTransport()
+ *
+ * Route all following I2C transfers through transport. Bus
+ * descriptors opened through the previous transport are closed.
+ *
+ * transport: backend to use, NULL for i2cDevTransport
+ *****************************************************************/
+void setI2CTransport(const I2CTransport *transport)
+{
+	closeI2CBuses();
+	activeTransport = transport ? transport : &i2cDevTransport;
+}
+
+/**************************************************************
+ * getI2CTransport()
+ *
+ * RETURN: transport currently in use
+ *****************************************************************/
+const I2CTransport *getI2CTransport(void)
+{
+	return activeTransport;
+}
@@ -0,0 +1,49 @@
+/*
+ * SPDX-FileCopyrightText: Copyright (c) 2022-2024 NVIDIA CORPORATION & AFFILIATES. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef UPDATERETIMERFW_TRANSPORT_H_
+#define UPDATERETIMERFW_TRANSPORT_H_
+#include <linux/i2c.h>
+
+/**
+* @brief *
+* I2C transport used underneath send_i2c_cmd()/send_i2c_batch().
+* Every op receives the transport's priv pointer.
+*
+* open: return a descriptor for i2c bus number bus, -1 on failure
+* close: release a descriptor returned by open
+* transfer: run msgs as one combined transaction (I2C_RDWR semantics),
+*           return 0 or -errno
+**/
+typedef struct I2CTransport {
+	const char *name;
+	int (*open)(void *priv, unsigned int bus);
+	void (*close)(void *priv, int fd);
+	int (*transfer)(void *priv, int fd, struct i2c_msg *msgs,
+			unsigned int nmsgs);
+	void *priv;
+} I2CTransport;
+
+/* Linux i2c-dev backend, /dev/i2c-<bus> and ioctl(I2C_RDWR) */
+extern const I2CTransport i2cDevTransport;
+
+/* Select the transport for all following transfers, NULL restores
+ * i2cDevTransport. Pooled bus descriptors are closed on change. */
+void setI2CTransport(const I2CTransport *transport);
+const I2CTransport *getI2CTransport(void);
+
+#endif
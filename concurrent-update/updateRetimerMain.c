@@ -32,12 +32,17 @@
 #include <time.h>
 #include <unistd.h> // for lseek()
 #include <fcntl.h>
+#include <getopt.h>
 #include "updateRetimerFwOverI2C.h"
+#include "updateRetimerFw_trace.h"
+#include "updateRetimerFw_lease.h"
+#include "updateRetimerFw_job.h"
+#include "updateRetimerFw_journal.h"
+#include "updateRetimerFw_manifest.h"
+#include "updateRetimerFw_plan.h"
+#include "updateRetimerFw_poll.h"
 
 extern uint8_t verbosity;
-extern const uint8_t mask_retimer[];
-extern char *arrRetimer[];
-extern uint8_t retimerBitmap;
 
 /************************************************
  * show_usage()
@@ -51,34 +56,109 @@ extern uint8_t retimerBitmap;
  ***********************************************/
 void show_usage(char *exec)
 {
-	printf("\nUsage: %s <i2c bus number> <retimer number> <firmware filename> <update/read> <versionStr> <verbosity>\n",
+	printf("\nUsage: %s [options] <i2c bus number> <retimer number> <firmware filename> <update/read> <versionStr> <verbosity>\n",
 	       exec);
 	printf("        i2c bus number	: must be digits [3-12]\n");
-	printf("        retimer bitmap		: bitmap for retimer indices 0-7, 255 to update all retimers\n");
-	printf("        update/read/write	: 0=Update, 1=Read \n");
+	printf("        retimer bitmap		: bitmap for retimer indices 0-%u, %u to update all retimers\n",
+	       getRetimerCount() - 1, retimerAllMask());
+	printf("        update/read/write	: 0=Update, 1=Read, 2=Version (retimer bitmap, filename unused)\n");
 	printf("        versionStr(optional): versionStr for message registry \n");
 	printf("        verbosity(debug)	: 1=enabled, 0=disable \n");
 	printf("        EX: %s 12 255 <FW_image>.bin 0 <1>\n\n", exec);
+	printf("Options:\n");
+	printf("        -b, --batch <n>		: I2C messages per I2C_RDWR ioctl [1-%d], 1 disables batching\n",
+	       I2C_RDWR_IOCTL_MAX_MSGS);
+	printf("        -s, --burst <bytes>	: DPRAM payload bytes per I2C message [%d-%d]\n",
+	       MIN_BURST_SIZE, MAX_BURST_SIZE);
+	printf("        -p, --probe-burst	: probe FPGA address auto-increment for the largest burst\n");
+	printf("        -d, --delta		: only upload DPRAM pages that differ from what this run last wrote\n");
+	printf("        -r, --retries <n>	: re-sends per DPRAM page on transient I2C errors, default %d\n",
+	       I2C_PAGE_RETRIES);
+	printf("        -n, --no-clear		: do not clear DPRAM before a read, FPGA reports the read length\n");
+	printf("        -V, --verify		: read DPRAM back after upload and re-send differing pages\n");
+	printf("        -P, --no-preflight	: skip the CPLD, FPGA and write protect checks before an update\n");
+	printf("        -k, --skip-current	: do not update retimers already running the component version\n");
+	printf("        -K, --skip-current-image	: as -k, a component without x.y.z version is compared by image CRC,\n");
+	printf("				  reading up to %d KB back per retimer\n",
+	       MAX_FW_IMAGE_SIZE / 1024);
+	printf("        -R, --resume		: skip retimers an interrupted run of the same image already updated\n");
+	printf("        -F, --fpga <bus:addr[:sideband]>	: update this FPGA instead of the i2c bus argument, repeat for parallel updates (max %d)\n",
+	       MAX_RETIMER_TARGETS);
+	printf("				  sideband is the bus of its CPLD and secondary regtbl, %d for the FPGA on bus %d\n",
+	       HMC_I2CBUS_FPGA_SEC_REGTBL, FPGA_I2C_BUS);
+	printf("        -m, --manifest <file>	: run the update/read/verify/version steps of a manifest, no positional arguments\n");
+	printf("        -N, --plan		: print the uploads, triggers, I2C transactions and time of an update, device untouched\n");
+	printf("        -S, --bus-speed <hz>	: I2C clock the plan assumes, default %d\n",
+	       PLAN_BUS_HZ);
+	printf("        -E, --flash-time <us>	: expected flash time per KB, default learned from earlier updates, never saved as learned\n");
+	printf("        -t, --record <file>	: record every I2C transaction to a binary trace\n");
+	printf("        -T, --replay <file>	: replay a recorded trace instead of accessing the bus\n");
+	printf("        -c, --retimers <n>	: retimers behind the FPGA [1-%d], default %d\n\n",
+	       RETIMER_MAX_NUM, RETIMER_COUNT);
 }
 
 /******************************************************************************
 * Usage:  updateRetimerFw  <i2c bus number>  <retimer number> <firmware filename> <update/read> <VersionStr> <verbosity>
 * i2c bus number          : must be digits [3-12]
-* retimer bitmap          : bitmap for retimer indices 0-7, 255 to update all retimers
-* update/read/write       : 0=Update, 1=Read
+* retimer bitmap          : bitmap for retimer indices 0-(n-1), 2^n-1 to update all n retimers
+* update/read/write       : 0=Update, 1=Read, 2=Version
 * versionStr(optional)    : versionStr for message registry
 * verbosity(debug)        : 1=enabled, 0=disable 
+*
+* Options (any position):
+* -b, --batch <n>         : I2C messages per I2C_RDWR ioctl
+* -s, --burst <bytes>     : DPRAM payload bytes per I2C message
+* -p, --probe-burst       : probe FPGA address auto-increment before upload
+* -d, --delta             : skip DPRAM pages already holding the image bytes
+* -r, --retries <n>       : re-sends per DPRAM page on transient I2C errors
+* -n, --no-clear          : skip the DPRAM clear before a read
+* -V, --verify            : verify DPRAM after upload, re-send bad pages
+* -P, --no-preflight      : skip the readiness checks before an update
+* -k, --skip-current      : skip retimers that already run the component
+* -K, --skip-current-image: as -k, reading the image back without a version
+* -R, --resume            : continue an interrupted run from its journal
+* -F, --fpga <bus:addr[:sideband]> : FPGA to update, repeat to update FPGAs
+*                           in parallel, sideband is the CPLD and regtbl bus
+* -m, --manifest <file>   : run the steps of a manifest instead of one command
+* -N, --plan              : dry run of an update with transaction counts and time
+* -S, --bus-speed <hz>    : I2C clock of the plan
+* -E, --flash-time <us>   : flash time per KB of the poll model, not saved
+* -t, --record <file>     : record every I2C transaction to a binary trace
+* -T, --replay <file>     : use a recorded trace as the device
+* -c, --retimers <n>      : retimers behind the FPGA, default RETIMER_COUNT
 *******************************************************************************/
 
+static const struct option longOptions[] = {
+	{ "batch", required_argument, NULL, 'b' },
+	{ "burst", required_argument, NULL, 's' },
+	{ "probe-burst", no_argument, NULL, 'p' },
+	{ "delta", no_argument, NULL, 'd' },
+	{ "retries", required_argument, NULL, 'r' },
+	{ "no-clear", no_argument, NULL, 'n' },
+	{ "verify", no_argument, NULL, 'V' },
+	{ "no-preflight", no_argument, NULL, 'P' },
+	{ "skip-current", no_argument, NULL, 'k' },
+	{ "skip-current-image", no_argument, NULL, 'K' },
+	{ "resume", no_argument, NULL, 'R' },
+	{ "fpga", required_argument, NULL, 'F' },
+	{ "manifest", required_argument, NULL, 'm' },
+	{ "plan", no_argument, NULL, 'N' },
+	{ "bus-speed", required_argument, NULL, 'S' },
+	{ "flash-time", required_argument, NULL, 'E' },
+	{ "record", required_argument, NULL, 't' },
+	{ "replay", required_argument, NULL, 'T' },
+	{ "retimers", required_argument, NULL, 'c' },
+	{ NULL, 0, NULL, 0 },
+};
+
 int main(int argc, char *argv[])
 {
-	char i2c_device[MAX_NAME_SIZE] = { 0 };
 	int fd = -1;
 	int ret = 0;
 	char imageFilename[MAX_NAME_SIZE];
-	uint8_t retimerToUpdate = INIT_UINT8;
-	uint8_t retimerNotUpdated = INIT_UINT8;
-	uint8_t retimerToRead = INIT_UINT8;
+	RetimerBitmap retimerBitmap = 0;
+	RetimerBitmap retimerToUpdate = 0;
+	unsigned int retimerToRead = 0;
 	uint8_t command = INIT_UINT8;
 	char *versionStr = NULL;
 	uint32_t imageFilenameSize = 0;
@@ -89,70 +169,294 @@ int main(int argc, char *argv[])
 	const unsigned char *imageMappedAddr = NULL;
 	update_operation *update_ops = NULL;
 	int update_ops_count = -1;
-	int updateFirstErrRet = 0;
+	char **args = NULL;
+	int nargs = 0;
+	const char *recordFile = NULL;
+	const char *replayFile = NULL;
+	I2CTrace *trace = NULL;
+	I2CTraceStats traceStats;
+	DpramLease lease = { .fd = -1 };
+	bool preflight = true;
+	RetimerUpdateOptions options = { 0 };
+	char journalPath[MAX_NAME_SIZE];
+	RetimerTarget targets[MAX_RETIMER_TARGETS];
+	int targetCount = 0;
+	const char *manifestFile = NULL;
+	ManifestStep *manifest = NULL;
+	int manifestCount = 0;
+	FILE *manifestStream = NULL;
+	bool plan = false;
+	RetimerPlanModel planModel = { .busHz = PLAN_BUS_HZ,
+				       .transferUs = PLAN_TRANSFER_US };
+	RetimerPlan planTotals;
 
 	// set stdout to line-buffered so it interleaves correctly with stderr
 	setvbuf(stdout, NULL, _IOLBF, 0);
 
+	// Parse options, remaining positional arguments start at optind
+	for (int opt; (opt = getopt_long(argc, argv, "b:s:pdr:nVPkKRF:m:NS:E:t:T:c:", longOptions,
+					 NULL)) != -1;) {
+		switch (opt) {
+		case 'b':
+			fpgaTransferConfig.batchMsgs = atoi(optarg);
+			if (fpgaTransferConfig.batchMsgs < 1 ||
+			    fpgaTransferConfig.batchMsgs >
+				    I2C_RDWR_IOCTL_MAX_MSGS) {
+				ret = -ERROR_INPUT_ARGUMENTS;
+				goto exit;
+			}
+			break;
+		case 's':
+			fpgaTransferConfig.burstSize = atoi(optarg);
+			if (fpgaTransferConfig.burstSize < MIN_BURST_SIZE ||
+			    fpgaTransferConfig.burstSize > MAX_BURST_SIZE ||
+			    fpgaTransferConfig.burstSize % BYTE_PER_PAGE) {
+				ret = -ERROR_INPUT_ARGUMENTS;
+				goto exit;
+			}
+			break;
+		case 'p':
+			fpgaTransferConfig.probeBurst = true;
+			break;
+		case 'd':
+			fpgaTransferConfig.deltaUpload = true;
+			break;
+		case 'r':
+			if (!*optarg ||
+			    strspn(optarg, "0123456789") != strlen(optarg)) {
+				ret = -ERROR_INPUT_ARGUMENTS;
+				goto exit;
+			}
+			fpgaTransferConfig.pageRetries = atoi(optarg);
+			break;
+		case 'n':
+			fpgaTransferConfig.skipReadClear = true;
+			break;
+		case 'V':
+			fpgaTransferConfig.verifyUpload = true;
+			break;
+		case 'P':
+			preflight = false;
+			break;
+		case 'k':
+			options.skipCurrent = true;
+			break;
+		case 'K':
+			options.skipCurrent = true;
+			options.skipCurrentImage = true;
+			break;
+		case 'R':
+			options.resume = true;
+			break;
+		case 'F': {
+			unsigned int bus;
+			int addr;
+			int sideband = -1;
+			char end;
+			int n = sscanf(optarg, "%u:%i:%i%c", &bus, &addr,
+				       &sideband, &end);
+
+			if (targetCount == MAX_RETIMER_TARGETS ||
+			    (n != 2 && n != 3) || bus >= MAX_I2C_BUS_NUM ||
+			    addr < 0 || addr > 0x7F) {
+				ret = -ERROR_INPUT_ARGUMENTS;
+				goto exit;
+			}
+			// CPLD and regtbl checks must reach this baseboard
+			if (n == 2) {
+				sideband = fpgaSidebandBus(bus);
+			}
+			if (sideband < 0 || sideband >= MAX_I2C_BUS_NUM) {
+				fprintf(stderr,
+					"Sideband bus of FPGA bus %u unknown, use -F %u:%#x:<sideband bus>\n",
+					bus, bus, addr);
+				ret = -ERROR_INPUT_ARGUMENTS;
+				goto exit;
+			}
+			targets[targetCount].bus = bus;
+			targets[targetCount].slaveId = addr;
+			targets[targetCount].sidebandBus = sideband;
+			targetCount++;
+			break;
+		}
+		case 'm':
+			manifestFile = optarg;
+			break;
+		case 'N':
+			plan = true;
+			break;
+		case 'S':
+		case 'E':
+			if (!*optarg ||
+			    strspn(optarg, "0123456789") != strlen(optarg) ||
+			    atoi(optarg) < 1) {
+				ret = -ERROR_INPUT_ARGUMENTS;
+				goto exit;
+			}
+			if (opt == 'S') {
+				planModel.busHz = atoi(optarg);
+			} else {
+				// also times the first status poll of a real update
+				setFpgaPollUsPerKb(FPGA_OP_UPDATE, atoi(optarg));
+			}
+			break;
+		case 't':
+			recordFile = optarg;
+			break;
+		case 'T':
+			replayFile = optarg;
+			break;
+		case 'c':
+			// bitmaps and manifests below are checked against it
+			if (!*optarg ||
+			    strspn(optarg, "0123456789") != strlen(optarg) ||
+			    strlen(optarg) > 2) {
+				ret = -ERROR_INPUT_ARGUMENTS;
+				goto exit;
+			}
+			ret = setRetimerCount(atoi(optarg));
+			if (ret) {
+				goto exit;
+			}
+			break;
+		default:
+			ret = -ERROR_INPUT_ARGUMENTS;
+			goto exit;
+		}
+	}
+	args = argv + optind;
+	nargs = argc - optind;
+
+	if (recordFile && replayFile) {
+		ret = -ERROR_INPUT_ARGUMENTS;
+		goto exit;
+	}
+	if (recordFile) {
+		trace = i2cTraceRecord(recordFile, NULL);
+	} else if (replayFile) {
+		trace = i2cTraceReplay(replayFile, false);
+	}
+	if ((recordFile || replayFile) && !trace) {
+		ret = -ERROR_OPEN_I2C_DEVICE;
+		goto exit;
+	}
+	if (trace) {
+		setI2CTransport(i2cTraceTransport(trace));
+	}
+
+	// every step of a manifest shares this process
+	if (manifestFile) {
+		if (nargs || targetCount || plan) {
+			ret = -ERROR_INPUT_ARGUMENTS;
+			goto exit;
+		}
+		manifestStream = fopen(manifestFile, "r");
+		if (!manifestStream) {
+			fprintf(stderr, "Error opening manifest: %s\n",
+				strerror(errno));
+			ret = -ERROR_INPUT_ARGUMENTS;
+			goto exit;
+		}
+		ret = parseRetimerManifest(manifestStream, &manifest,
+					   &manifestCount);
+		fclose(manifestStream);
+		if (!ret) {
+			options.journalPath = RETIMER_JOURNAL_FILE;
+			options.preflight = preflight;
+			ret = runRetimerManifest(manifest, manifestCount,
+						 &options);
+		}
+		free(manifest);
+		releaseRetimerImages();
+		goto exit;
+	}
+
 	// Check input argument number
-	if (argc < 5) {
+	if (nargs < 4) {
 		ret = -ERROR_INPUT_ARGUMENTS;
 		goto exit;
 	}
 
 	// Check i2c_bus input
-	if (checkDigit_i2c(argv[1])) {
+	if (checkDigit_i2c(args[0])) {
 		ret = -ERROR_INPUT_I2C_ARGUMENT;
 		goto exit;
 	}
 
 	// Check input argument for valid retimer number
-	if (checkDigit_retimer(argv[2])) {
+	if (checkDigit_retimer(args[1])) {
 		ret = -ERROR_INPUT_I2C_ARGUMENT;
 		goto exit;
 	}
 
-	retimerBitmap = atoi(argv[2]);
-	retimerToUpdate = atoi(argv[2]);
-	retimerToRead = atoi(argv[2]);
+	retimerBitmap = strtoul(args[1], NULL, 10);
+	retimerToUpdate = retimerBitmap;
+	retimerToRead = retimerBitmap;
 
 	/* Check if passed filename is too small for imageFilename buffer*/
-	imageFilenameSize = strlen(argv[3]);
+	imageFilenameSize = strlen(args[2]);
 
 	if (imageFilenameSize >= MAX_NAME_SIZE) {
 		ret = -ERROR_INPUT_ARGUMENTS;
 		goto exit;
 	}
 
-	strncpy(imageFilename, argv[3], imageFilenameSize + 1);
+	strncpy(imageFilename, args[2], imageFilenameSize + 1);
 
-	command = atoi(argv[4]);
+	command = atoi(args[3]);
 
 	// FW Version
-	if (argc > 5) {
-		versionStr = argv[5];
+	if (nargs > 4) {
+		versionStr = args[4];
 		fprintf(stdout, "[DEBUG]%s, %d %s\n", __func__, __LINE__,
-			argv[5]);
+			args[4]);
 	} else {
 		versionStr = DEFAULT_VERSION;
 	}
 
 	// Enable verbose mode
-	if (argc == 7) {
-		verbosity = atoi(argv[6]);
+	if (nargs == 6) {
+		verbosity = atoi(args[5]);
 		fprintf(stdout, "[DEBUG]%s, %d %d\n", __func__, __LINE__,
 			verbosity);
 	}
 
-	sprintf(i2c_device, "/dev/i2c-%d", atoi(argv[1]));
+	// -F targets are opened, checked and leased by their own worker
+	if ((targetCount || plan) && command != RETIMER_FW_UPDATE) {
+		ret = -ERROR_INPUT_ARGUMENTS;
+		goto exit;
+	}
+	// a plan never touches the device
+	if (!targetCount && !plan) {
+		fd = openI2CBus(atoi(args[0]));
+
+		if (fd < 0) {
+			ret = -ERROR_OPEN_I2C_DEVICE;
+			goto exit;
+		}
 
-	fd = open(i2c_device, O_RDWR | O_NONBLOCK);
+		// serialize with hash requests of dbus-service-retimer
+		ret = acquireFpgaLease(&lease, atoi(args[0]),
+				       getFpgaCntrlAddr(), DPRAM_LEASE_HIGH,
+				       DPRAM_LEASE_UPDATE_TIMEOUT_MS,
+				       "updateRetimerFw");
+		if (ret) {
+			goto exit;
+		}
 
-	if (fd < 0) {
-		fprintf(stderr, "Error opening i2c file: %s\n",
-			strerror(errno));
-		ret = -ERROR_OPEN_I2C_DEVICE;
-		goto exit;
+		// a baseboard that can not take the update fails before any image byte is sent,
+		// under the lease so no other DPRAM user changes the FPGA status meanwhile
+		if (command == RETIMER_FW_UPDATE && preflight) {
+			ret = preflightRetimerUpdate(fd, FPGA_I2C_CNTRL_ADDR);
+			if (ret) {
+				prepareMessageRegistry(
+					retimerToUpdate, "TransferFailed", versionStr,
+					MSG_REG_VER_FOLLOWED_BY_DEV,
+					"xyz.openbmc_project.Logging.Entry.Level.Critical",
+					NULL, 0);
+				goto exit;
+			}
+		}
 	}
 
 	switch (command) {
@@ -162,7 +466,7 @@ int main(int argc, char *argv[])
 		fprintf(stdout, "Start FW update procedure...\n");
 		fprintf(stdout, "Read FW Image...%s Verion %s \n",
 			imageFilename, versionStr);
-		fprintf(stdout, "Retimer under update ...%d \n", retimerBitmap);
+		fprintf(stdout, "Retimer under update ...%u \n", retimerBitmap);
 
 		imagefd = open(imageFilename, O_RDONLY);
 
@@ -203,8 +507,10 @@ int main(int argc, char *argv[])
 		close(imagefd);
 		imagefd = -1;
 
-		ret = parseCompositeImage(imageMappedAddr, fw_size, versionStr,
-					  &update_ops, &update_ops_count);
+		// image data CRCs are checked by the pipeline while uploading
+		ret = parseCompositeImageHeaders(imageMappedAddr, fw_size,
+						 versionStr, &update_ops,
+						 &update_ops_count);
 		if (ret) {
 			fprintf(stderr, "parseCompositeImage returned: [%d]\n",
 				ret);
@@ -231,128 +537,47 @@ int main(int argc, char *argv[])
 			goto exit;
 		}
 
-		// Composite and bare images reconverge here with update_operations filled in
-		// Perform target filtering intersection and log TargetDetermined logs
-		for (int uo = 0; uo < update_ops_count; uo++) {
-			fprintf(stdout,
-				"update operation %d, startOffset %#zx, "
-				"imageLength %zu, applyBitmap %#x, actual bitmap %#x, "
-				"imageCrc %#x, versionString %s\n",
-				uo, update_ops[uo].startOffset,
-				update_ops[uo].imageLength,
-				update_ops[uo].applyBitmap,
-				update_ops[uo].applyBitmap & retimerToUpdate,
-				update_ops[uo].imageCrc,
-				update_ops[uo].versionString);
-			update_ops[uo].applyBitmap &= retimerToUpdate;
-			prepareMessageRegistry(
-				update_ops[uo].applyBitmap, "TargetDetermined",
-				update_ops[uo].versionString,
-				MSG_REG_DEV_FOLLOWED_BY_VER,
-				"xyz.openbmc_project.Logging.Entry.Level.Informational",
-				NULL, 0);
-		}
-
-		for (int uo = 0; uo < update_ops_count; uo++) {
-			fprintf(stderr, "performing update_ops[%d]\n", uo);
-			if (!update_ops[uo].applyBitmap) {
+		if (plan) {
+			ret = planRetimerUpdate(imageMappedAddr, update_ops,
+						update_ops_count,
+						retimerToUpdate, preflight,
+						&planModel, stdout,
+						&planTotals);
+			if (!ret && targetCount > 1) {
 				fprintf(stdout,
-					"applyBitmap for update_ops[%d] is 0, skipping\n",
-					uo);
-				continue;
-			}
-			prepareMessageRegistry(
-				update_ops[uo].applyBitmap,
-				"TransferringToComponent",
-				update_ops[uo].versionString,
-				MSG_REG_VER_FOLLOWED_BY_DEV,
-				"xyz.openbmc_project.Logging.Entry.Level.Informational",
-				NULL, 0);
-
-			ret = copyImageFromMemToFpga(
-				imageMappedAddr + update_ops[uo].startOffset,
-				update_ops[uo].imageLength,
-				update_ops[uo].imageCrc, fd,
-				FPGA_I2C_CNTRL_ADDR);
-			if (ret) {
-				fprintf(stderr,
-					"FW Update FW image copy to FPGA failed  error code%d!!!\n",
-					ret);
-				prepareMessageRegistry(
-					update_ops[uo].applyBitmap,
-					"TransferFailed",
-					update_ops[uo].versionString,
-					MSG_REG_VER_FOLLOWED_BY_DEV,
-					"xyz.openbmc_project.Logging.Entry.Level.Critical",
-					NULL, 0);
-				updateFirstErrRet = ret;
-				continue;
-			}
-
-			// Trigger FW Update to one or more retimer at a time and monitor the update progress and its completion
-			ret = startRetimerFwUpdate(fd,
-						   update_ops[uo].applyBitmap,
-						   update_ops[uo].versionString,
-						   &retimerNotUpdated);
-			if (ret) {
-				fprintf(stderr,
-					"FW Update for Retimer %d failed for retimer with error code "
-					"%d retimerNotUpdated %d!!!\n",
-					update_ops[uo].applyBitmap, ret,
-					retimerNotUpdated);
-				prepareMessageRegistry(
-					retimerNotUpdated, "ApplyFailed",
-					update_ops[uo].versionString,
-					MSG_REG_VER_FOLLOWED_BY_DEV,
-					"xyz.openbmc_project.Logging.Entry.Level.Critical",
-					NULL, 0);
-
-				if (update_ops[uo].applyBitmap ^
-				    retimerNotUpdated) {
-					prepareMessageRegistry(
-						(update_ops[uo].applyBitmap ^
-						 retimerNotUpdated),
-						"UpdateSuccessful",
-						update_ops[uo].versionString,
-						MSG_REG_DEV_FOLLOWED_BY_VER,
-						"xyz.openbmc_project.Logging.Entry.Level.Informational",
-						NULL, 0);
-
-					prepareMessageRegistry(
-						(update_ops[uo].applyBitmap ^
-						 retimerNotUpdated),
-						"AwaitToActivate",
-						update_ops[uo].versionString,
-						MSG_REG_VER_FOLLOWED_BY_DEV,
-						"xyz.openbmc_project.Logging.Entry.Level.Informational",
-						"AC power cycle", 0);
-				}
-				updateFirstErrRet = ret;
-				continue;
+					"%d FPGAs are updated in parallel, each in the estimated time\n",
+					targetCount);
 			}
-			prepareMessageRegistry(
-				update_ops[uo].applyBitmap, "UpdateSuccessful",
-				update_ops[uo].versionString,
-				MSG_REG_DEV_FOLLOWED_BY_VER,
-				"xyz.openbmc_project.Logging.Entry.Level.Informational",
-				NULL, 0);
-
-			prepareMessageRegistry(
-				update_ops[uo].applyBitmap, "AwaitToActivate",
-				update_ops[uo].versionString,
-				MSG_REG_VER_FOLLOWED_BY_DEV,
-				"xyz.openbmc_project.Logging.Entry.Level.Informational",
-				"AC power cycle", 0);
+			break;
 		}
-		if (!ret && updateFirstErrRet) {
-			ret = updateFirstErrRet;
+
+		options.journalPath = RETIMER_JOURNAL_FILE;
+		if (targetCount) {
+			options.preflight = preflight;
+			ret = runRetimerUpdateTargets(imageMappedAddr, fw_size,
+						      update_ops,
+						      update_ops_count,
+						      retimerToUpdate, &options,
+						      targets, targetCount);
+			break;
 		}
+		updateJournalPath(journalPath, sizeof(journalPath),
+				  RETIMER_JOURNAL_FILE, atoi(args[0]),
+				  getFpgaCntrlAddr(), 0);
+		options.journalPath = journalPath;
+		ret = runRetimerUpdate(fd, imageMappedAddr, fw_size, update_ops,
+				       update_ops_count, retimerToUpdate,
+				       &options);
 		break;
 
 	case RETIMER_FW_READ: // 10.0 Read Retimer image
 
-		fprintf(stdout, "#10 Trigger Retimer Read ...%d\n",
+		fprintf(stdout, "#10 Trigger Retimer Read ...%u\n",
 			retimerToRead);
+		if (retimerToRead >= getRetimerCount()) {
+			ret = -ERROR_INPUT_ARGUMENTS;
+			goto exit;
+		}
 		dummyfd = open("/tmp/Dummyfile", O_RDWR | O_CREAT, 0644);
 
 		if (dummyfd < 0) {
@@ -361,42 +586,18 @@ int main(int argc, char *argv[])
 			goto exit;
 		}
 
-		if (ftruncate(dummyfd, MAX_FW_IMAGE_SIZE) < 0) {
-			fprintf(stderr,
-				"FW READ for Retimer failed for retimer !!!");
-			close(dummyfd);
-			dummyfd = -1;
-			goto exit;
-		}
-
-		// Create and Pass dummy blank FILE of 256KB to clear DPRAM before reading content from Retimer
-		ret = copyImageFromFileToFpga(dummyfd, fd, FPGA_I2C_CNTRL_ADDR);
-		if (ret) {
-			fprintf(stderr,
-				"FW read FW image copy to FPGA failed  error code%d!!!",
-				ret);
-			goto exit;
-		}
-		// Initiate FW READ to one of the retimer at a time and monitor the read progress and status
-		ret = readRetimerfw(fd, retimerToRead);
+		ret = runRetimerRead(fd, retimerToRead, dummyfd);
 		if (ret) {
-			fprintf(stderr,
-				"FW READ for Retimer failed for retimer %d!!!",
-				retimerToRead);
-			goto exit;
-		}
-		lseek(dummyfd, 0, 0);
-		ret = copyImageFromFpga(dummyfd, fd, FPGA_I2C_CNTRL_ADDR);
-		if (ret) {
-			fprintf(stderr,
-				"FW read FW image copy from FPGA failed  error code%d!!!",
-				ret);
 			goto exit;
 		}
 		close(dummyfd);
 		dummyfd = -1;
 		break;
 
+	case RETIMER_FW_VERSION: // version record only, retimer argument is a bitmap
+		ret = runRetimerVersion(fd, retimerBitmap);
+		break;
+
 	default:
 		fprintf(stderr,
 			"Incorrect option passed to FWUpdate utility %d!!!",
@@ -407,8 +608,19 @@ int main(int argc, char *argv[])
 	} // end of switch case
 
 exit:
-	if (fd != -1) {
-		close(fd);
+	releaseDpramLease(&lease);
+	closeI2CBuses();
+	if (trace) {
+		setI2CTransport(NULL);
+		i2cTraceGetStats(trace, &traceStats);
+		fprintf(stdout,
+			"I2C trace: %lu transfers, %llu bytes, %llu us on bus, %lu mismatches, %lu not replayed\n",
+			traceStats.transfers, traceStats.bytes,
+			traceStats.busTimeUs, traceStats.mismatches,
+			traceStats.remaining);
+		if (i2cTraceClose(trace) && !ret) {
+			ret = -ERROR_IOCTL_I2C_RDWR_FAILURE;
+		}
 	}
 	if (imagefd != -1) {
 		close(imagefd);
@@ -423,6 +635,8 @@ exit:
 	if (update_ops) {
 		free(update_ops);
 	}
+	printI2CRetryStats();
+	releaseFpgaTransferCtx();
 
 	if ((ret == -ERROR_INPUT_ARGUMENTS) ||
 	    (ret == -ERROR_INPUT_I2C_ARGUMENT)) {
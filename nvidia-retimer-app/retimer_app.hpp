@@ -16,6 +16,8 @@
  */
 
 #pragma once
+#include "config.h"
+
 #include <sdbusplus/bus.hpp>
 #include <sdbusplus/bus/match.hpp>
 #include <sdeventplus/event.hpp>
@@ -31,7 +33,7 @@ struct DBusMapping
     std::string propertyName;
 };
 
-const size_t numOfRetimers = 8;
+const size_t numOfRetimers = RETIMER_COUNT;
 // software id maps to component identifer in the package
 constexpr auto retimerSoftwareId = "0x8000";
 const std::string retimerSwitchesBasePath =
@@ -17,13 +17,29 @@
 #include <cstdint>
 #include <fstream>
 #include <iostream>
+#include <thread>
+#include <vector>
 
 extern "C"
 {
 #include "updateRetimerFwOverI2C.h"
+#include "updateRetimerFw_fpga_sim.h"
+#include "updateRetimerFw_fpgaop.h"
+#include "updateRetimerFw_job.h"
+#include "updateRetimerFw_lease.h"
+#include "updateRetimerFw_pipeline.h"
+#include "updateRetimerFw_plan.h"
+#include "updateRetimerFw_poll.h"
+#include "updateRetimerFw_progress.h"
+#include "updateRetimerFw_journal.h"
+#include "updateRetimerFw_manifest.h"
+#include "updateRetimerFw_trace.h"
+#include "updateRetimerFw_transport.h"
 }
 
+#include <fcntl.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
@@ -41,11 +57,63 @@ using ::testing::StrEq;
 class TestFwupdate : public testing::Test
 {
   public:
-    TestFwupdate() {}
+    TestFwupdate()
+    {
+        // stay away from the DPRAM stamps and leases of the services
+        // on this host
+        setDpramStampDir((testing::TempDir() + "nvidia-retimer").c_str());
+        // and from the poll history of real updates, each test starts
+        // untrained
+        unlink(pollHistory().c_str());
+        setFpgaPollHistoryFile(pollHistory().c_str());
+    }
+
+    ~TestFwupdate()
+    {
+        setDpramStampDir(nullptr);
+        setFpgaPollHistoryFile(nullptr);
+    }
+
+    static std::string pollHistory()
+    {
+        return testing::TempDir() + "nvidia-retimer-poll.history";
+    }
+};
+
+// Routes all I2C transfers to an in-process FPGA for one test
+struct SimTransport
+{
+    explicit SimTransport(const FpgaSimConfig* cfg = nullptr) :
+        sim(fpgaSimCreate(cfg))
+    {
+        setI2CTransport(fpgaSimTransport(sim));
+        fd = openI2CBus(FPGA_I2C_BUS);
+        // the model completes by status reads, not by time
+        setFpgaPollUsPerKb(FPGA_OP_UPDATE, 1);
+        setFpgaPollUsPerKb(FPGA_OP_READ, 1);
+    }
+
+    ~SimTransport()
+    {
+        setI2CTransport(nullptr);
+        fpgaSimDestroy(sim);
+    }
 
-    ~TestFwupdate() {}
+    FpgaSim* sim;
+    int fd;
 };
 
+static std::vector<unsigned char> testImage(size_t len, unsigned seed)
+{
+    std::vector<unsigned char> img(len);
+    for (size_t i = 0; i < len; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        img[i] = seed >> 16;
+    }
+    return img;
+}
+
 TEST_F(TestFwupdate, crc32)
 {
     unsigned char* str = NULL;
@@ -98,9 +166,104 @@ TEST_F(TestFwupdate, checkDigit_retimer)
     EXPECT_EQ(1, checkDigit_retimer(ss2));
 }
 
-TEST_F(TestFwupdate, checkfpgaready) {}
+TEST_F(TestFwupdate, checkfpgaready)
+{
+    SimTransport t;
+    ASSERT_TRUE(t.sim);
+    ASSERT_GE(t.fd, 0);
+
+    EXPECT_EQ(0, preflightRetimerUpdate(t.fd, FPGA_I2C_CNTRL_ADDR));
+    EXPECT_LE(t.sim->transfers, 3u);
+
+    // baseboard not present or CPLD not ready
+    t.sim->cpld[CPLD_GB_OFFSET] =
+        GPU_BASE1_CPLD_READY_MASK | GPU_BASE1_PRSNT_N_MASK;
+    EXPECT_EQ(-ERROR_RETIMER_NOT_READY,
+              preflightRetimerUpdate(t.fd, FPGA_I2C_CNTRL_ADDR));
+    t.sim->cpld[CPLD_GB_OFFSET] = 0;
+    EXPECT_EQ(-ERROR_RETIMER_NOT_READY,
+              preflightRetimerUpdate(t.fd, FPGA_I2C_CNTRL_ADDR));
+    t.sim->cpld[CPLD_GB_OFFSET] = GPU_BASE1_CPLD_READY_MASK;
+
+    // FPGA still busy with an update
+    t.sim->updateStatus = 0x1;
+    EXPECT_EQ(-ERROR_FPGA_NOT_READY,
+              preflightRetimerUpdate(t.fd, FPGA_I2C_CNTRL_ADDR));
+    t.sim->updateStatus = 0;
+
+    // global write protect is active low
+    fpgaSimExtendedErrors(t.sim)->globalWp = 0;
+    EXPECT_EQ(-ERROR_GLOBAL_WP,
+              preflightRetimerUpdate(t.fd, FPGA_I2C_CNTRL_ADDR));
+    fpgaSimExtendedErrors(t.sim)->globalWp = GLOBAL_WP_L_MASK;
+
+    fpgaSimExtendedErrors(t.sim)->retimerEEPROMmuxSel = 0x4;
+    EXPECT_EQ(-ERROR_RETIMER_MUX_SEL,
+              preflightRetimerUpdate(t.fd, FPGA_I2C_CNTRL_ADDR));
+    fpgaSimExtendedErrors(t.sim)->retimerEEPROMmuxSel = 0;
+
+    // FPGA not answering
+    t.sim->cfg.failErrno = ENXIO;
+    t.sim->cfg.failAfter = t.sim->transfers + 1;
+    t.sim->cfg.failCount = 1000;
+    EXPECT_EQ(-ERROR_FPGA_NOT_READY,
+              preflightRetimerUpdate(t.fd, FPGA_I2C_CNTRL_ADDR));
+}
+
+TEST_F(TestFwupdate, read_fwVersion)
+{
+    char out[16];
+    char* ver = NULL;
+    char rec[RETIMER_FW_VERSION_SIZE] = {2, 9, 7, 0};
+
+    EXPECT_EQ(3, parseStr("v2.9.7", 1, 4, out));
+    EXPECT_STREQ("2.9", out);
+    EXPECT_EQ(-1, parseStr("v2.9.7", 4, 1, out));
 
-TEST_F(TestFwupdate, read_fwVersion) {}
+    EXPECT_EQ(0, readFwVersion(rec, &ver));
+    EXPECT_STREQ("2.9.7", ver);
+    free(ver);
+    memset(rec, 0xFF, sizeof(rec));
+    EXPECT_NE(0, readFwVersion(rec, &ver));
+
+    SimTransport t;
+    ASSERT_TRUE(t.sim);
+    std::vector<unsigned char> img = testImage(MAX_FW_IMAGE_SIZE, 6);
+#ifdef FW_VERSION_OFFSET
+    img[FW_VERSION_OFFSET] = 1;
+    img[FW_VERSION_OFFSET + 1] = 2;
+    img[FW_VERSION_OFFSET + 2] = 0x2C;
+    img[FW_VERSION_OFFSET + 3] = 0x01;
+#endif
+    memcpy(t.sim->eeprom[3], img.data(), img.size());
+
+    // only the 2 pages covering the range are cleared and read back,
+    // size and checksum registers are set as for a full read
+    t.sim->imgSize = 0;
+    t.sim->imgCrc = 0;
+    unsigned long long bytes = t.sim->bytes;
+    std::vector<unsigned char> part(300);
+    EXPECT_EQ(0, readRetimerFwRange(t.fd, 3, 0x1F00 + 10, part.data(),
+                                    part.size()));
+    EXPECT_EQ(0, memcmp(part.data(), img.data() + 0x1F00 + 10, part.size()));
+    EXPECT_LT(t.sim->bytes - bytes, 5u * BYTE_PER_PAGE);
+    EXPECT_EQ((uint32_t)MAX_FW_IMAGE_SIZE, t.sim->imgSize);
+    EXPECT_EQ(zeroImageCrc(), t.sim->imgCrc);
+
+    char version[RETIMER_FW_VERSION_STR_LEN];
+#ifdef FW_VERSION_OFFSET
+    EXPECT_EQ(0, readRetimerFwVersion(t.fd, 3, version, sizeof(version)));
+    EXPECT_STREQ("1.2.300", version);
+
+    // erased EEPROM has no version
+    EXPECT_NE(0, readRetimerFwVersion(t.fd, 5, version, sizeof(version)));
+#else
+    // the platform has not told where the version record is
+    EXPECT_NE(0, readRetimerFwVersion(t.fd, 3, version, sizeof(version)));
+#endif
+    EXPECT_NE(0, readRetimerFwRange(t.fd, 3, MAX_FW_IMAGE_SIZE - 1,
+                                    part.data(), 2));
+}
 
 unsigned char* readfile(std::string filePath, size_t& len)
 {
@@ -204,6 +367,11 @@ TEST_F(TestFwupdate, parsecompositeimage)
                 uoVersionStringObj = update_ops[i].versionString;
                 EXPECT_EQ(uoVersionStringObj, "2.9.7");
             }
+            // all components carry the same image
+            EXPECT_EQ(7, mergeUpdateOperations(fw, update_ops,
+                                               &update_ops_count));
+            EXPECT_EQ(update_ops_count, 1);
+            EXPECT_EQ(update_ops[0].applyBitmap, 0xFFu);
             free(update_ops);
         }
         free(fw);
@@ -222,7 +390,1163 @@ TEST_F(TestFwupdate, parsecompositeimage)
     }
 }
 
-TEST_F(TestFwupdate, copy_image_to_fpga) {}
+TEST_F(TestFwupdate, merge_update_operations)
+{
+    std::vector<unsigned char> a = testImage(0x1000, 1);
+    std::vector<unsigned char> b = testImage(0x1000, 2);
+    std::vector<unsigned char> file;
+    update_operation ops[5] = {};
+    const std::vector<unsigned char>* parts[5] = {&a, &b, &a, &b, &a};
+    int count = 5;
+
+    for (int i = 0; i < 5; i++)
+    {
+        ops[i].startOffset = file.size();
+        ops[i].imageLength = parts[i]->size();
+        ops[i].imageCrc = crc32(parts[i]->data(), parts[i]->size());
+        ops[i].applyBitmap = 1 << i;
+        file.insert(file.end(), parts[i]->begin(), parts[i]->end());
+    }
+    // same length and CRC field but other data is not merged
+    file[ops[4].startOffset] ^= 1;
+
+    EXPECT_EQ(2, mergeUpdateOperations(file.data(), ops, &count));
+    ASSERT_EQ(3, count);
+    EXPECT_EQ(0x5u, ops[0].applyBitmap);
+    EXPECT_EQ(0u, ops[0].startOffset);
+    EXPECT_EQ(0xAu, ops[1].applyBitmap);
+    EXPECT_EQ(0x10u, ops[2].applyBitmap);
+    EXPECT_EQ(0x4000u, ops[2].startOffset);
+
+    // nothing to merge
+    EXPECT_EQ(0, mergeUpdateOperations(file.data(), ops, &count));
+    EXPECT_EQ(3, count);
+
+    // the same image under another version string is kept apart
+    ops[3] = ops[0];
+    ops[3].applyBitmap = 0x20;
+    strcpy(ops[3].versionString, "2.0");
+    count = 4;
+    EXPECT_EQ(0, mergeUpdateOperations(file.data(), ops, &count));
+    EXPECT_EQ(4, count);
+    EXPECT_EQ(0x5u, ops[0].applyBitmap);
+}
+
+TEST_F(TestFwupdate, update_pipeline)
+{
+    std::vector<unsigned char> img = testImage(3 * 0x1000, 5);
+    update_operation* update_ops = NULL;
+    int update_ops_count = 0;
+
+    // bare image: CRC is computed by the pipeline, not by the parser
+    ASSERT_EQ(0, parseCompositeImageHeaders(img.data(), img.size(), "1.0",
+                                            &update_ops, &update_ops_count));
+    ASSERT_EQ(1, update_ops_count);
+    EXPECT_TRUE(update_ops[0].imageCrcPending);
+    UpdatePipeline* pipeline =
+        startUpdatePipeline(img.data(), update_ops, update_ops_count);
+    ASSERT_TRUE(pipeline);
+    EXPECT_EQ(0, waitUpdateOperationVerified(pipeline, 0));
+    EXPECT_EQ(crc32(img.data(), img.size()), update_ops[0].imageCrc);
+    EXPECT_FALSE(update_ops[0].imageCrcPending);
+    stopUpdatePipeline(pipeline);
+    free(update_ops);
+
+    // components are checked against their header CRC, in order
+    update_operation ops[3] = {};
+    for (int i = 0; i < 3; i++)
+    {
+        ops[i].startOffset = i * 0x1000;
+        ops[i].imageLength = 0x1000;
+        ops[i].applyBitmap = 1 << i;
+        ops[i].imageCrc = crc32(img.data() + i * 0x1000, 0x1000);
+        ops[i].imageCrcPending = true;
+    }
+    ops[1].imageCrc ^= 1;
+    pipeline = startUpdatePipeline(img.data(), ops, 3);
+    ASSERT_TRUE(pipeline);
+    EXPECT_EQ(0, waitUpdateOperationVerified(pipeline, 0));
+    EXPECT_EQ(-ERROR_WRONG_CRC32_CHKSM,
+              waitUpdateOperationVerified(pipeline, 1));
+    EXPECT_EQ(0, waitUpdateOperationVerified(pipeline, 2));
+    stopUpdatePipeline(pipeline);
+}
+
+TEST_F(TestFwupdate, copy_image_to_fpga)
+{
+    SimTransport t;
+    ASSERT_TRUE(t.sim);
+    ASSERT_GE(t.fd, 0);
+
+    std::vector<unsigned char> img = testImage(0x10000 + 100, 1);
+    unsigned int crc = crc32(img.data(), img.size());
+
+    EXPECT_EQ(0, copyImageFromMemToFpga(img.data(), img.size(), crc, t.fd,
+                                        FPGA_I2C_CNTRL_ADDR));
+    EXPECT_EQ(0, memcmp(t.sim->dpram, img.data(), img.size()));
+    EXPECT_EQ(t.sim->imgSize, img.size());
+    EXPECT_EQ(t.sim->imgCrc, crc);
+
+    // transient NACKs are retried per page
+    t.sim->cfg.failErrno = EAGAIN;
+    t.sim->cfg.failAfter = t.sim->transfers + 2;
+    t.sim->cfg.failCount = 2;
+    memset(t.sim->dpram, 0, MAX_FW_IMAGE_SIZE);
+    invalidateDpramShadow(t.fd, FPGA_I2C_CNTRL_ADDR);
+    EXPECT_EQ(0, copyImageFromMemToFpga(img.data(), img.size(), crc, t.fd,
+                                        FPGA_I2C_CNTRL_ADDR));
+    EXPECT_EQ(0, memcmp(t.sim->dpram, img.data(), img.size()));
+    EXPECT_EQ(2u, t.sim->failed);
+
+    // pages that go through on their first re-send count as recovered
+    I2CRetryStats* stats = &getFpgaTransferCtx()->retryStats;
+    memset(stats, 0, sizeof(*stats));
+    t.sim->cfg.failAfter = t.sim->transfers + 2;
+    t.sim->cfg.failCount = 1;
+    invalidateDpramShadow(t.fd, FPGA_I2C_CNTRL_ADDR);
+    EXPECT_EQ(0, copyImageFromMemToFpga(img.data(), img.size(), crc, t.fd,
+                                        FPGA_I2C_CNTRL_ADDR));
+    EXPECT_LT(0u, stats->retries);
+    EXPECT_EQ(stats->retries, stats->recovered);
+    t.sim->cfg.failCount = 2;
+
+    // the first re-send of a page counts against the budget
+    unsigned int pageRetries = fpgaTransferConfig.pageRetries;
+    fpgaTransferConfig.pageRetries = 1;
+    t.sim->cfg.failAfter = t.sim->transfers;
+    invalidateDpramShadow(t.fd, FPGA_I2C_CNTRL_ADDR);
+    EXPECT_NE(0, copyImageFromMemToFpga(img.data(), img.size(), crc, t.fd,
+                                        FPGA_I2C_CNTRL_ADDR));
+    EXPECT_EQ(5u, t.sim->failed);
+
+    // no re-send at all without a budget
+    fpgaTransferConfig.pageRetries = 0;
+    t.sim->cfg.failAfter = t.sim->transfers;
+    t.sim->cfg.failCount = 1;
+    invalidateDpramShadow(t.fd, FPGA_I2C_CNTRL_ADDR);
+    unsigned long transfers = t.sim->transfers;
+    EXPECT_NE(0, copyImageFromMemToFpga(img.data(), img.size(), crc, t.fd,
+                                        FPGA_I2C_CNTRL_ADDR));
+    EXPECT_EQ(6u, t.sim->failed);
+    EXPECT_EQ(transfers + 1, t.sim->transfers);
+    fpgaTransferConfig.pageRetries = pageRetries;
+
+    // persistent failure is reported
+    t.sim->cfg.failErrno = ENXIO;
+    t.sim->cfg.failAfter = t.sim->transfers;
+    t.sim->cfg.failCount = 1000;
+    invalidateDpramShadow(t.fd, FPGA_I2C_CNTRL_ADDR);
+    EXPECT_NE(0, copyImageFromMemToFpga(img.data(), img.size(), crc, t.fd,
+                                        FPGA_I2C_CNTRL_ADDR));
+}
+
+TEST_F(TestFwupdate, delta_upload)
+{
+    SimTransport t;
+    ASSERT_TRUE(t.sim);
+    ASSERT_GE(t.fd, 0);
+    // no shadow left over from earlier tests
+    releaseFpgaTransferCtx();
+    fpgaTransferConfig.deltaUpload = true;
+
+    std::vector<unsigned char> img = testImage(0x8000, 14);
+    auto upload = [&](int busFd) {
+        unsigned long long bytes = t.sim->bytes;
+        EXPECT_EQ(0, uploadImageToFpga(img.data(), img.size(), busFd,
+                                       FPGA_I2C_CNTRL_ADDR));
+        EXPECT_EQ(0, memcmp(t.sim->dpram, img.data(), img.size()));
+        return t.sim->bytes - bytes;
+    };
+
+    // an unchanged image is not sent again
+    EXPECT_GE(upload(t.fd), img.size());
+    EXPECT_EQ(0u, upload(t.fd));
+
+    // only the changed pages are
+    img[0x10] ^= 1;
+    img[0x4000] ^= 1;
+    unsigned long long sent = upload(t.fd);
+    EXPECT_GE(sent, 2u * BYTE_PER_PAGE);
+    EXPECT_LT(sent, 3u * BYTE_PER_PAGE);
+
+    // another process restamped and wrote the DPRAM
+    char stamp[MAX_NAME_SIZE];
+    snprintf(stamp, sizeof(stamp), "%s/dpram-%u-%02x", getDpramStampDir(),
+             FPGA_I2C_BUS, FPGA_I2C_CNTRL_ADDR);
+    uint64_t token = 1;
+    std::ofstream(stamp, std::ios::binary)
+        .write(reinterpret_cast<const char*>(&token), sizeof(token));
+    memset(t.sim->dpram, 0, img.size());
+    EXPECT_GE(upload(t.fd), img.size());
+    EXPECT_EQ(0u, upload(t.fd));
+
+    // the FPGA fills DPRAM itself on a retimer read
+    ASSERT_EQ(0, readRetimerfw(t.fd, 0));
+    EXPECT_GE(upload(t.fd), img.size());
+
+    // the shadow follows one FPGA, a switch sends everything
+    int other = openI2CBus(FPGA_I2C_BUS + 1);
+    ASSERT_GE(other, 0);
+    EXPECT_GE(upload(other), img.size());
+    EXPECT_GE(upload(t.fd), img.size());
+    EXPECT_EQ(0u, upload(t.fd));
+
+    fpgaTransferConfig.deltaUpload = false;
+    releaseFpgaTransferCtx();
+}
+
+TEST_F(TestFwupdate, clear_fpga_dpram)
+{
+    SimTransport t;
+    ASSERT_TRUE(t.sim);
+    ASSERT_GE(t.fd, 0);
+
+    std::vector<unsigned char> blank(MAX_FW_IMAGE_SIZE, 0);
+    EXPECT_EQ(crc32(blank.data(), blank.size()), zeroImageCrc());
+
+    memset(t.sim->dpram, 0xA5, MAX_FW_IMAGE_SIZE);
+    EXPECT_EQ(0, clearFpgaDpram(t.fd, FPGA_I2C_CNTRL_ADDR));
+    EXPECT_EQ(0, memcmp(t.sim->dpram, blank.data(), blank.size()));
+    EXPECT_EQ(t.sim->imgSize, (uint32_t)MAX_FW_IMAGE_SIZE);
+    EXPECT_EQ(t.sim->imgCrc, zeroImageCrc());
+
+    // partial range only touches its own pages
+    memset(t.sim->dpram, 0xA5, MAX_FW_IMAGE_SIZE);
+    EXPECT_EQ(0, zeroFpgaDpram(t.fd, FPGA_I2C_CNTRL_ADDR, 0x200, 0x300));
+    EXPECT_EQ(0xA5, t.sim->dpram[0x1FF]);
+    EXPECT_EQ(0, memcmp(t.sim->dpram + 0x200, blank.data(), 0x300));
+    EXPECT_EQ(0xA5, t.sim->dpram[0x500]);
+
+    // nothing is sent when the FPGA reports the read length
+    unsigned long transfers = t.sim->transfers;
+    fpgaTransferConfig.skipReadClear = true;
+    EXPECT_EQ(0, clearFpgaDpram(t.fd, FPGA_I2C_CNTRL_ADDR));
+    fpgaTransferConfig.skipReadClear = false;
+    EXPECT_EQ(transfers, t.sim->transfers);
+    EXPECT_EQ(0xA5, t.sim->dpram[0]);
+}
+
+TEST_F(TestFwupdate, verify_fpga_dpram)
+{
+    SimTransport t;
+    ASSERT_TRUE(t.sim);
+    ASSERT_GE(t.fd, 0);
+
+    std::vector<unsigned char> img = testImage(0x4000 + 100, 6);
+    unsigned int resent = 0;
+
+    // corrupted pages are found on readback and re-sent alone
+    t.sim->cfg.corruptWrites = 2;
+    ASSERT_EQ(0, writeFpgaDpram(t.fd, FPGA_I2C_CNTRL_ADDR, 0, img.data(),
+                                img.size()));
+    EXPECT_NE(0, memcmp(t.sim->dpram, img.data(), img.size()));
+    EXPECT_EQ(0, verifyFpgaDpram(t.fd, FPGA_I2C_CNTRL_ADDR, img.data(),
+                                 img.size(), &resent));
+    EXPECT_EQ(2u, resent);
+    EXPECT_EQ(0, memcmp(t.sim->dpram, img.data(), img.size()));
+
+    // a clean upload is only read
+    EXPECT_EQ(0, verifyFpgaDpram(t.fd, FPGA_I2C_CNTRL_ADDR, img.data(),
+                                 img.size(), &resent));
+    EXPECT_EQ(0u, resent);
+
+    // pages that stay bad fail before the flash is started
+    t.sim->dpram[0x1000] ^= 0xFF;
+    t.sim->cfg.corruptWrites = 1000;
+    EXPECT_EQ(-ERROR_TRANS_PAGE,
+              verifyFpgaDpram(t.fd, FPGA_I2C_CNTRL_ADDR, img.data(),
+                              img.size(), &resent));
+    EXPECT_EQ(fpgaTransferConfig.pageRetries, resent);
+
+    // systematic corruption stops the readback early
+    t.sim->cfg.corruptWrites = 1000;
+    ASSERT_EQ(0, writeFpgaDpram(t.fd, FPGA_I2C_CNTRL_ADDR, 0, img.data(),
+                                img.size()));
+    t.sim->cfg.corruptWrites = 0;
+    unsigned long bytes = t.sim->bytes;
+    EXPECT_EQ(-ERROR_TRANS_PAGE,
+              verifyFpgaDpram(t.fd, FPGA_I2C_CNTRL_ADDR, img.data(),
+                              img.size(), &resent));
+    EXPECT_EQ(0u, resent);
+    EXPECT_LT(t.sim->bytes - bytes, img.size());
+
+    // upload honours the verify option
+    t.sim->cfg.corruptWrites = 1;
+    invalidateDpramShadow(t.fd, FPGA_I2C_CNTRL_ADDR);
+    fpgaTransferConfig.verifyUpload = true;
+    EXPECT_EQ(0, uploadImageToFpga(img.data(), img.size(), t.fd,
+                                   FPGA_I2C_CNTRL_ADDR));
+    fpgaTransferConfig.verifyUpload = false;
+    EXPECT_EQ(0, memcmp(t.sim->dpram, img.data(), img.size()));
+}
+
+TEST_F(TestFwupdate, update_journal)
+{
+    std::string dir = testing::TempDir() + "retimer-journal";
+    std::string path = dir + "/update.journal";
+    std::vector<unsigned char> img = testImage(0x2000, 9);
+    update_operation ops[2] = {};
+    UpdateJournal journal;
+
+    unlink(path.c_str());
+    rmdir(dir.c_str());
+    for (int i = 0; i < 2; i++)
+    {
+        ops[i].startOffset = i * 0x1000;
+        ops[i].imageLength = 0x1000;
+        ops[i].imageCrc = crc32(img.data() + i * 0x1000, 0x1000);
+        ops[i].applyBitmap = 0x0F << (4 * i);
+    }
+
+    // nothing to resume from, the run is journaled from scratch
+    ASSERT_EQ(0, openUpdateJournal(&journal, path.c_str(), img.data(),
+                                   img.size(), ops, 2, true));
+    EXPECT_EQ(0x0Fu, ops[0].applyBitmap);
+    EXPECT_EQ(0, journalPhase(&journal, 0, JOURNAL_UPLOADED));
+    EXPECT_EQ(0, journalPhase(&journal, 0, JOURNAL_TRIGGERED));
+    EXPECT_EQ(0, journalResult(&journal, 0, 0x0B, 0x04));
+    // interrupted while the second operation was flashing
+    EXPECT_EQ(0, journalPhase(&journal, 1, JOURNAL_TRIGGERED));
+    closeUpdateJournal(&journal, false);
+
+    // resume only redoes the failed and unfinished retimers
+    ops[0].applyBitmap = 0x0F;
+    ops[1].applyBitmap = 0xF0;
+    ASSERT_EQ(0, openUpdateJournal(&journal, path.c_str(), img.data(),
+                                   img.size(), ops, 2, true));
+    EXPECT_EQ(0x04u, ops[0].applyBitmap);
+    EXPECT_EQ(0xF0u, ops[1].applyBitmap);
+    EXPECT_EQ(0, journalResult(&journal, 0, 0x04, 0));
+    closeUpdateJournal(&journal, false);
+
+    // done retimers accumulate across runs
+    ops[0].applyBitmap = 0x0F;
+    ASSERT_EQ(0, openUpdateJournal(&journal, path.c_str(), img.data(),
+                                   img.size(), ops, 2, true));
+    EXPECT_EQ(0u, ops[0].applyBitmap);
+    closeUpdateJournal(&journal, false);
+
+    // without resume everything is done again
+    ops[0].applyBitmap = 0x0F;
+    ASSERT_EQ(0, openUpdateJournal(&journal, path.c_str(), img.data(),
+                                   img.size(), ops, 2, false));
+    EXPECT_EQ(0x0Fu, ops[0].applyBitmap);
+    EXPECT_EQ(0, journalResult(&journal, 0, 0x0F, 0));
+    closeUpdateJournal(&journal, false);
+
+    // a different image does not resume, its component headers differ
+    img[0x1800] ^= 1;
+    ops[1].imageCrc = crc32(img.data() + 0x1000, 0x1000);
+    ops[0].applyBitmap = 0x0F;
+    ASSERT_EQ(0, openUpdateJournal(&journal, path.c_str(), img.data(),
+                                   img.size(), ops, 2, true));
+    EXPECT_EQ(0x0Fu, ops[0].applyBitmap);
+
+    // a run that updated every retimer leaves nothing to resume
+    closeUpdateJournal(&journal, true);
+    EXPECT_NE(0, access(path.c_str(), F_OK));
+
+    // a bare image CRC is journaled once the upload verified it
+    update_operation bare = {};
+    bare.imageLength = img.size();
+    bare.applyBitmap = 0x03;
+    bare.imageCrcPending = true;
+    bare.crcFromData = true;
+    ASSERT_EQ(0, openUpdateJournal(&journal, path.c_str(), img.data(),
+                                   img.size(), &bare, 1, false));
+    EXPECT_TRUE(bare.imageCrcPending);
+    ASSERT_EQ(0, verifyUpdateOperation(img.data(), &bare));
+    EXPECT_EQ(0, journalPhase(&journal, 0, JOURNAL_UPLOADED));
+    EXPECT_EQ(0, journalResult(&journal, 0, 0x01, 0x02));
+    closeUpdateJournal(&journal, false);
+    bare.applyBitmap = 0x03;
+    bare.imageCrc = 0;
+    bare.imageCrcPending = true;
+    ASSERT_EQ(0, openUpdateJournal(&journal, path.c_str(), img.data(),
+                                   img.size(), &bare, 1, true));
+    EXPECT_EQ(0x02u, bare.applyBitmap);
+    closeUpdateJournal(&journal, true);
+
+    // FPGAs and manifest steps journal apart
+    char name[MAX_NAME_SIZE];
+    updateJournalPath(name, sizeof(name), "/j", 3, 0x60, 0);
+    EXPECT_STREQ("/j.3-60", name);
+    updateJournalPath(name, sizeof(name), "/j", 3, 0x60, 12);
+    EXPECT_STREQ("/j.3-60.12", name);
+
+    rmdir(dir.c_str());
+}
+
+TEST_F(TestFwupdate, i2c_trace_replay)
+{
+    std::string path = testing::TempDir() + "retimer-upload.trace";
+    std::vector<unsigned char> img = testImage(0x3000, 4);
+    unsigned int crc = crc32(img.data(), img.size());
+    I2CTraceStats rec = {};
+    I2CTraceStats rep = {};
+
+    // record an upload against the simulator
+    FpgaSim* sim = fpgaSimCreate(nullptr);
+    ASSERT_TRUE(sim);
+    I2CTrace* trace = i2cTraceRecord(path.c_str(), fpgaSimTransport(sim));
+    ASSERT_TRUE(trace);
+    setI2CTransport(i2cTraceTransport(trace));
+    int fd = openI2CBus(FPGA_I2C_BUS);
+    EXPECT_EQ(0, copyImageFromMemToFpga(img.data(), img.size(), crc, fd,
+                                        FPGA_I2C_CNTRL_ADDR));
+    setI2CTransport(nullptr);
+    i2cTraceGetStats(trace, &rec);
+    EXPECT_EQ(0, i2cTraceClose(trace));
+    fpgaSimDestroy(sim);
+    EXPECT_GT(rec.transfers, 0u);
+
+    // the same upload replays without any device
+    trace = i2cTraceReplay(path.c_str(), false);
+    ASSERT_TRUE(trace);
+    setI2CTransport(i2cTraceTransport(trace));
+    fd = openI2CBus(FPGA_I2C_BUS);
+    EXPECT_EQ(0, copyImageFromMemToFpga(img.data(), img.size(), crc, fd,
+                                        FPGA_I2C_CNTRL_ADDR));
+    setI2CTransport(nullptr);
+    i2cTraceGetStats(trace, &rep);
+    EXPECT_EQ(rec.transfers, rep.transfers);
+    EXPECT_EQ(rec.bytes, rep.bytes);
+    EXPECT_EQ(0u, rep.mismatches);
+    EXPECT_EQ(0u, rep.remaining);
+    EXPECT_EQ(0, i2cTraceClose(trace));
+
+    // a different image no longer matches the trace
+    img[0x1000] ^= 0x5A;
+    crc = crc32(img.data(), img.size());
+    trace = i2cTraceReplay(path.c_str(), false);
+    ASSERT_TRUE(trace);
+    setI2CTransport(i2cTraceTransport(trace));
+    fd = openI2CBus(FPGA_I2C_BUS);
+    EXPECT_NE(0, copyImageFromMemToFpga(img.data(), img.size(), crc, fd,
+                                        FPGA_I2C_CNTRL_ADDR));
+    setI2CTransport(nullptr);
+    i2cTraceGetStats(trace, &rep);
+    EXPECT_GT(rep.mismatches, 0u);
+    EXPECT_NE(0, i2cTraceClose(trace));
+    remove(path.c_str());
+}
+
+TEST_F(TestFwupdate, dpram_lease)
+{
+    DpramLease hash = {-1};
+    DpramLease other = {-1};
+    DpramLease update = {-1};
+    char holder[DPRAM_LEASE_HOLDER_SIZE];
+
+    ASSERT_EQ(0, acquireDpramLease(&hash, DPRAM_LEASE_LOW, 0, "hash"));
+    ASSERT_EQ(0, getDpramLeaseHolder(holder, sizeof(holder)));
+    EXPECT_NE(nullptr, strstr(holder, "(hash) low"));
+
+    // a waiting update keeps further low priority requests out
+    int updateRet = -1;
+    std::thread waiter([&] {
+        updateRet = acquireDpramLease(&update, DPRAM_LEASE_HIGH, 5000,
+                                      "update");
+    });
+    usleep(50 * DELAY_1MS);
+    EXPECT_EQ(-ERROR_DPRAM_BUSY,
+              acquireDpramLease(&other, DPRAM_LEASE_LOW, 20, "other"));
+    releaseDpramLease(&hash);
+    waiter.join();
+    EXPECT_EQ(0, updateRet);
+    ASSERT_EQ(0, getDpramLeaseHolder(holder, sizeof(holder)));
+    EXPECT_NE(nullptr, strstr(holder, "(update) high"));
+    EXPECT_EQ(-ERROR_DPRAM_BUSY,
+              acquireDpramLease(&other, DPRAM_LEASE_LOW, 20, "other"));
+
+
+    // another controller on the same bus has its own lease
+    DpramLease second = {-1};
+    EXPECT_EQ(0, acquireFpgaLease(&second, FPGA_I2C_BUS,
+                                  FPGA_I2C_CNTRL_ADDR + 1, DPRAM_LEASE_HIGH,
+                                  0, "second"));
+    EXPECT_NE(0, getFpgaLeaseHolder(FPGA_I2C_BUS + 1, FPGA_I2C_CNTRL_ADDR + 1,
+                                    holder, sizeof(holder)));
+    releaseDpramLease(&second);
+
+    releaseDpramLease(&update);
+    EXPECT_NE(0, getDpramLeaseHolder(holder, sizeof(holder)));
+    EXPECT_EQ(0, acquireDpramLease(&other, DPRAM_LEASE_LOW, 20, "other"));
+    releaseDpramLease(&other);
+}
+
+TEST_F(TestFwupdate, adaptive_polling)
+{
+    SimTransport t;
+    ASSERT_TRUE(t.sim);
+    ASSERT_GE(t.fd, 0);
+    unsigned char status[READ_BUF_SIZE];
+    FpgaPollResult r;
+    FpgaPoll poll;
+
+    // expected time scales with length
+    setFpgaPollUsPerKb(FPGA_OP_UPDATE, 100);
+    EXPECT_EQ(200u, expectedFpgaOpUs(FPGA_OP_UPDATE, 2048, 1));
+    EXPECT_EQ(100u, expectedFpgaOpUs(FPGA_OP_UPDATE, 1, 8));
+
+    // untrained, the status is read every FPGA_POLL_MAX_US from the
+    // trigger on instead of after the build time estimate
+    setFpgaPollUsPerKb(FPGA_OP_UPDATE, 0);
+    EXPECT_EQ((uint64_t)FPGA_POLL_MAX_US,
+              startFpgaPoll(&poll, FPGA_OP_UPDATE, MAX_FW_IMAGE_SIZE, 4));
+    EXPECT_EQ((uint64_t)FPGA_POLL_MAX_US, poll.interval);
+
+    // deadline never below the MAX_TIMEOUT_SEC the trigger always had
+    EXPECT_EQ((uint64_t)MAX_TIMEOUT_SEC * DELAY_1SEC,
+              fpgaOpDeadlineUs(FPGA_OP_UPDATE, MAX_FW_IMAGE_SIZE, 4));
+    EXPECT_EQ((uint64_t)MAX_TIMEOUT_SEC * DELAY_1SEC,
+              fpgaOpDeadlineUs(FPGA_OP_UPDATE, 1024, 1));
+    setFpgaPollUsPerKb(FPGA_OP_UPDATE, 1000000);
+    EXPECT_EQ(3ull * 1000000 * 64,
+              fpgaOpDeadlineUs(FPGA_OP_UPDATE, 0x10000, 1));
+
+    // an untrained update is found done at the first read, the
+    // measurement is saved and serves other retimer counts
+    setFpgaPollUsPerKb(FPGA_OP_UPDATE, 0);
+    t.sim->cfg.busyPolls = 0;
+    ASSERT_EQ(0, writeFpgaReg(t.fd, FPGA_I2C_CNTRL_ADDR,
+                              FPGA_UPDATE_STATUS_REG, 0x3));
+    EXPECT_EQ(0, waitFpgaOperation(t.fd, FPGA_OP_UPDATE, 0x1000, 2, status,
+                                   &r));
+    EXPECT_FALSE(r.timedOut);
+    EXPECT_EQ(1u, r.polls);
+    EXPECT_LT(r.elapsedUs, (uint64_t)2 * FPGA_POLL_MAX_US);
+    uint64_t learned = expectedFpgaOpUs(FPGA_OP_UPDATE, 1024, 2);
+    EXPECT_LE(learned * 4, r.elapsedUs / 2);
+    EXPECT_EQ(learned, expectedFpgaOpUs(FPGA_OP_UPDATE, 1024, 8));
+    std::string kind;
+    uint64_t saved[RETIMER_MAX_NUM];
+    std::ifstream in(pollHistory());
+    ASSERT_TRUE(in >> kind);
+    EXPECT_EQ("update", kind);
+    for (uint64_t& v : saved)
+    {
+        ASSERT_TRUE(in >> v);
+    }
+    EXPECT_EQ(0u, saved[0]);
+    EXPECT_EQ(learned, saved[1]);
+    in.close();
+
+    // first status read close to the expected finish, completion
+    // found there halves the estimate
+    setFpgaPollUsPerKb(FPGA_OP_READ, 2000);
+    uint64_t expected = expectedFpgaOpUs(FPGA_OP_READ, 0x10000, 1);
+    t.sim->readStatus = FW_READ_STATUS_MASK;
+    t.sim->readPolls = 0;
+    t.sim->readRetimer = 0;
+    EXPECT_EQ(0, waitFpgaOperation(t.fd, FPGA_OP_READ, 0x10000, 1, status,
+                                   &r));
+    EXPECT_FALSE(r.timedOut);
+    EXPECT_EQ(1u, r.polls);
+    EXPECT_GE(r.elapsedUs, expected * FPGA_POLL_FIRST_PCT / 100);
+    EXPECT_LT(r.elapsedUs, expected);
+    EXPECT_LE(expectedFpgaOpUs(FPGA_OP_READ, 0x10000, 1), r.elapsedUs / 2);
+
+    // slower than expected, polled at sub-second intervals and learned
+    // from the busy reads, an overridden value is never saved
+    setFpgaPollUsPerKb(FPGA_OP_UPDATE, 1);
+    t.sim->cfg.busyPolls = 5;
+    ASSERT_EQ(0, writeFpgaReg(t.fd, FPGA_I2C_CNTRL_ADDR,
+                              FPGA_UPDATE_STATUS_REG, 0x1));
+    EXPECT_EQ(0, waitFpgaOperation(t.fd, FPGA_OP_UPDATE, 0x1000, 1, status,
+                                   &r));
+    EXPECT_EQ(FW_UPDATE_COMPLETE_FLAG, status[0]);
+    EXPECT_EQ(6u, r.polls);
+    EXPECT_LT(r.elapsedUs, (uint64_t)6 * FPGA_POLL_MAX_US);
+    expected = expectedFpgaOpUs(FPGA_OP_UPDATE, 0x1000, 1);
+    EXPECT_GT(expected, 4u);
+    EXPECT_LT(expected, r.elapsedUs);
+    in.open(pollHistory());
+    ASSERT_TRUE(in >> kind >> saved[0] >> saved[1]);
+    EXPECT_EQ(0u, saved[0]);
+    EXPECT_EQ(learned, saved[1]);
+    in.close();
+
+    // unmeasured counts borrow the nearest one, fewer retimers first,
+    // lines of another format are ignored
+    std::ofstream(pollHistory()) << "update 4000 0 0 0 0 0 0 6000\n"
+                                 << "314 1\n";
+    setFpgaPollHistoryFile(pollHistory().c_str());
+    setFpgaPollUsPerKb(FPGA_OP_UPDATE, 0);
+    setFpgaPollUsPerKb(FPGA_OP_READ, 0);
+    EXPECT_EQ(4000u, expectedFpgaOpUs(FPGA_OP_UPDATE, 1024, 1));
+    EXPECT_EQ(4000u, expectedFpgaOpUs(FPGA_OP_UPDATE, 1024, 4));
+    EXPECT_EQ(6000u, expectedFpgaOpUs(FPGA_OP_UPDATE, 1024, 6));
+    EXPECT_EQ(6000u, expectedFpgaOpUs(FPGA_OP_UPDATE, 1024, 8));
+    EXPECT_EQ((uint64_t)FPGA_POLL_READ_US_PER_KB,
+              expectedFpgaOpUs(FPGA_OP_READ, 1024, 1));
+    EXPECT_EQ((uint64_t)FPGA_POLL_MAX_US,
+              startFpgaPoll(&poll, FPGA_OP_READ, 1024, 1));
+    setFpgaPollUsPerKb(FPGA_OP_UPDATE, 1);
+    setFpgaPollUsPerKb(FPGA_OP_READ, 1);
+}
+
+TEST_F(TestFwupdate, skip_current_firmware)
+{
+    SimTransport t;
+    ASSERT_TRUE(t.sim);
+    ASSERT_GE(t.fd, 0);
+
+    std::vector<unsigned char> img = testImage(0x3000, 8);
+#ifdef FW_VERSION_OFFSET
+    img[FW_VERSION_OFFSET] = 1;
+    img[FW_VERSION_OFFSET + 1] = 2;
+    img[FW_VERSION_OFFSET + 2] = 0x03;
+    img[FW_VERSION_OFFSET + 3] = 0x01;
+#endif
+    memcpy(t.sim->eeprom[2], img.data(), img.size());
+    update_operation op = {};
+    op.imageLength = img.size();
+    op.imageCrc = crc32(img.data(), img.size());
+    bool current = true;
+
+#ifdef FW_VERSION_OFFSET
+    // version record against versionString, build is 16 bit
+    strcpy(op.versionString, "1.2.259");
+    EXPECT_EQ(0, checkRetimerFwCurrent(t.fd, 2, img.data(), &op, true,
+                                       &current));
+    EXPECT_TRUE(current);
+    // blank EEPROM has no version
+    EXPECT_NE(0, checkRetimerFwCurrent(t.fd, 3, img.data(), &op, true,
+                                       &current));
+    EXPECT_FALSE(current);
+    strcpy(op.versionString, "1.2.260");
+    EXPECT_EQ(0, checkRetimerFwCurrent(t.fd, 2, img.data(), &op, true,
+                                       &current));
+    EXPECT_FALSE(current);
+#endif
+
+    // other version strings compare the image digest, if asked to
+    strcpy(op.versionString, "RT_2024_07");
+    unsigned long transfers = t.sim->transfers;
+    EXPECT_EQ(0, checkRetimerFwCurrent(t.fd, 2, img.data(), &op, false,
+                                       &current));
+    EXPECT_FALSE(current);
+    EXPECT_EQ(transfers, t.sim->transfers);
+    EXPECT_EQ(0, checkRetimerFwCurrent(t.fd, 2, img.data(), &op, true,
+                                       &current));
+    EXPECT_TRUE(current);
+    t.sim->eeprom[2][0x2FFF] ^= 1;
+    EXPECT_EQ(0, checkRetimerFwCurrent(t.fd, 2, img.data(), &op, true,
+                                       &current));
+    EXPECT_FALSE(current);
+
+    // bare image CRC is computed from the file first
+    t.sim->eeprom[2][0x2FFF] ^= 1;
+    op.imageCrc = 0;
+    op.imageCrcPending = true;
+    op.crcFromData = true;
+    EXPECT_EQ(0, checkRetimerFwCurrent(t.fd, 2, img.data(), &op, true,
+                                       &current));
+    EXPECT_TRUE(current);
+    EXPECT_FALSE(op.imageCrcPending);
+
+    // a retimer that can not be read is not current
+    t.sim->cfg.fwReadNackMask = 0x4;
+    EXPECT_EQ(0, checkRetimerFwCurrent(t.fd, 2, img.data(), &op, true,
+                                       &current));
+    EXPECT_FALSE(current);
+    t.sim->cfg.fwReadNackMask = 0;
+}
+
+TEST_F(TestFwupdate, run_retimer_update)
+{
+    SimTransport t;
+    ASSERT_TRUE(t.sim);
+    ASSERT_GE(t.fd, 0);
+
+    std::vector<unsigned char> img = testImage(0x4000, 9);
+    update_operation* ops = nullptr;
+    int count = 0;
+    RetimerUpdateOptions options = {};
+
+    // bare image targets every retimer, the caller narrows it down
+    ASSERT_EQ(0, parseCompositeImageHeaders(img.data(), img.size(), "1.0.0",
+                                            &ops, &count));
+    ASSERT_EQ(1, count);
+    EXPECT_EQ(0, runRetimerUpdate(t.fd, img.data(), img.size(), ops, count,
+                                  0x05, &options));
+    EXPECT_EQ(1u, t.sim->updates);
+    EXPECT_EQ(0, memcmp(t.sim->eeprom[0], img.data(), img.size()));
+    EXPECT_EQ(0, memcmp(t.sim->eeprom[2], img.data(), img.size()));
+    EXPECT_EQ(0xFF, t.sim->eeprom[1][0]);
+    free(ops);
+
+    // the read lands in the output file
+    FILE* out = tmpfile();
+    ASSERT_TRUE(out);
+    EXPECT_EQ(0, runRetimerRead(t.fd, 2, fileno(out)));
+    std::vector<unsigned char> back(img.size());
+    ASSERT_EQ(back.size(), pread(fileno(out), back.data(), back.size(), 0));
+    EXPECT_EQ(img, back);
+    fclose(out);
+}
+
+TEST_F(TestFwupdate, update_progress)
+{
+    SimTransport t;
+    ASSERT_TRUE(t.sim);
+    ASSERT_GE(t.fd, 0);
+
+    std::vector<unsigned char> img = testImage(0x10000, 12);
+    memcpy(t.sim->eeprom[2], img.data(), img.size());
+    update_operation* ops = nullptr;
+    int count = 0;
+    RetimerUpdateOptions options = {};
+    options.skipCurrent = true;
+    options.skipCurrentImage = true;
+    ASSERT_EQ(0, parseCompositeImageHeaders(img.data(), img.size(), "RT_1",
+                                            &ops, &count));
+
+    std::vector<UpdateProgressState> seen;
+    auto record = [](UpdateProgress* p, void* userdata) {
+        UpdateProgressState state;
+        getUpdateProgressState(p, &state);
+        static_cast<std::vector<UpdateProgressState>*>(userdata)->push_back(
+            state);
+    };
+    UpdateProgress progress;
+    initUpdateProgress(&progress, record, &seen);
+    setUpdateProgress(&progress);
+
+    // page level progress is rate limited, status changes are not
+    progress.minIntervalUs = 3600ull * DELAY_1SEC;
+    EXPECT_EQ(0, runRetimerUpdate(t.fd, img.data(), img.size(), ops, count,
+                                  0x05, &options));
+    ASSERT_FALSE(seen.empty());
+    std::vector<UpdatePhase> phases;
+    for (const UpdateProgressState& s : seen)
+    {
+        EXPECT_TRUE(s.bytesDone == 0 || s.bytesDone == s.bytesTotal);
+        if (phases.empty() || phases.back() != s.phase)
+        {
+            phases.push_back(s.phase);
+        }
+    }
+    EXPECT_THAT(phases,
+                ::testing::ElementsAre(
+                    UPDATE_PHASE_IDLE, UPDATE_PHASE_PREPARING,
+                    UPDATE_PHASE_UPLOADING, UPDATE_PHASE_VERIFYING,
+                    UPDATE_PHASE_FLASHING, UPDATE_PHASE_COMPLETE));
+    UpdateProgressState last = seen.back();
+    EXPECT_EQ(100, last.percent);
+    EXPECT_EQ(img.size(), last.bytesTotal);
+    EXPECT_EQ(0u, last.etaUs);
+    EXPECT_EQ(RETIMER_PROGRESS_UPDATED, last.retimer[0]);
+    EXPECT_EQ(RETIMER_PROGRESS_NONE, last.retimer[1]);
+    EXPECT_EQ(RETIMER_PROGRESS_CURRENT, last.retimer[2]);
+
+    // without the limit every page batch is reported, percent only grows
+    seen.clear();
+    progress.minIntervalUs = 0;
+    options.skipCurrent = false;
+    free(ops);
+    ASSERT_EQ(0, parseCompositeImageHeaders(img.data(), img.size(), "RT_1",
+                                            &ops, &count));
+    EXPECT_EQ(0, runRetimerUpdate(t.fd, img.data(), img.size(), ops, count,
+                                  0x02, &options));
+    size_t partial = 0;
+    uint8_t percent = 0;
+    for (const UpdateProgressState& s : seen)
+    {
+        partial += s.bytesDone && s.bytesDone < s.bytesTotal;
+        EXPECT_GE(s.percent, percent);
+        EXPECT_TRUE(s.percent < 100 || s.phase == UPDATE_PHASE_COMPLETE);
+        percent = s.percent;
+    }
+    EXPECT_GT(partial, 1u);
+    EXPECT_EQ(100, percent);
+    EXPECT_EQ(RETIMER_PROGRESS_UPDATED, seen.back().retimer[1]);
+
+    setUpdateProgress(nullptr);
+    destroyUpdateProgress(&progress);
+    free(ops);
+}
+
+TEST_F(TestFwupdate, plan_retimer_update)
+{
+    SimTransport t;
+    ASSERT_TRUE(t.sim);
+    ASSERT_GE(t.fd, 0);
+
+    std::vector<unsigned char> img = testImage(0x8000, 13);
+    update_operation* ops = nullptr;
+    int count = 0;
+    RetimerUpdateOptions options = {};
+    RetimerPlanModel model = {PLAN_BUS_HZ, PLAN_TRANSFER_US};
+    RetimerPlan plan;
+    ASSERT_EQ(0, parseCompositeImageHeaders(img.data(), img.size(), "1.0.0",
+                                            &ops, &count));
+
+    // flash time follows the poll model, bus time the bus speed
+    setFpgaPollUsPerKb(FPGA_OP_UPDATE, 1000);
+    EXPECT_EQ(0, planRetimerUpdate(img.data(), ops, count, 0x05, false,
+                                   &model, nullptr, &plan));
+    EXPECT_EQ(1u, plan.uploads);
+    EXPECT_EQ(1u, plan.triggers);
+    EXPECT_EQ(32000u, plan.flashUs);
+    unsigned long chunks = img.size() / xferChunkSize();
+    EXPECT_GT(plan.bytes, img.size() + chunks * DPRAM_ADDR_BYTES);
+    uint64_t busUs = plan.busUs;
+    model.busHz = 2 * PLAN_BUS_HZ;
+    free(ops);
+    ASSERT_EQ(0, parseCompositeImageHeaders(img.data(), img.size(), "1.0.0",
+                                            &ops, &count));
+    EXPECT_EQ(0, planRetimerUpdate(img.data(), ops, count, 0x05, false,
+                                   &model, nullptr, &plan));
+    EXPECT_LT(plan.busUs, busUs);
+    model.busHz = 0;
+    EXPECT_EQ(-ERROR_INPUT_ARGUMENTS,
+              planRetimerUpdate(img.data(), ops, count, 0x05, false, &model,
+                                nullptr, &plan));
+
+    // the planned transactions are the ones the update sends, the
+    // FPGA model finishes at the first of the planned status polls
+    setFpgaPollUsPerKb(FPGA_OP_UPDATE, 1);
+    model.busHz = PLAN_BUS_HZ;
+    free(ops);
+    ASSERT_EQ(0, parseCompositeImageHeaders(img.data(), img.size(), "1.0.0",
+                                            &ops, &count));
+    EXPECT_EQ(0, planRetimerUpdate(img.data(), ops, count, 0x05, false,
+                                   &model, nullptr, &plan));
+    unsigned int polls = expectedFpgaPolls(FPGA_OP_UPDATE, img.size(), 2);
+    free(ops);
+    ASSERT_EQ(0, parseCompositeImageHeaders(img.data(), img.size(), "1.0.0",
+                                            &ops, &count));
+    unsigned long before = t.sim->transfers;
+    EXPECT_EQ(0, runRetimerUpdate(t.fd, img.data(), img.size(), ops, count,
+                                  0x05, &options));
+    EXPECT_EQ(plan.transfers - polls + 1, t.sim->transfers - before);
+    free(ops);
+}
+
+// Two FPGAs, one per bus, buses without an FPGA reach the first one
+struct BoardRouter
+{
+    FpgaSim* sims[2];
+    unsigned int buses[2];
+    int fds[2];
+    // CPLD and secondary regtbl bus of the second baseboard
+    unsigned int sideband = HMC_I2CBUS_FPGA_SEC_REGTBL + 10;
+    int sidebandFd = -1;
+
+    static FpgaSim* route(BoardRouter* r, int fd)
+    {
+        return r->fds[1] == fd || r->sidebandFd == fd ? r->sims[1]
+                                                      : r->sims[0];
+    }
+
+    I2CTransport transport()
+    {
+        I2CTransport t = {};
+        t.name = "board-router";
+        t.priv = this;
+        t.open = [](void* priv, unsigned int bus) -> int {
+            auto* b = static_cast<BoardRouter*>(priv);
+            int fd = b->sims[0]->transport.open(nullptr, bus);
+            if (bus == b->buses[1])
+            {
+                b->fds[1] = fd;
+            }
+            if (bus == b->sideband)
+            {
+                b->sidebandFd = fd;
+            }
+            return fd;
+        };
+        t.close = [](void*, int fd) { close(fd); };
+        t.transfer = [](void* priv, int fd, struct i2c_msg* msgs,
+                        unsigned int nmsgs) -> int {
+            FpgaSim* sim = route(static_cast<BoardRouter*>(priv), fd);
+            return sim->transport.transfer(sim, fd, msgs, nmsgs);
+        };
+        return t;
+    }
+};
+
+TEST_F(TestFwupdate, update_multiple_fpgas)
+{
+    BoardRouter r = {{fpgaSimCreate(nullptr), fpgaSimCreate(nullptr)},
+                     {FPGA_I2C_BUS, FPGA_I2C_BUS + 1},
+                     {-1, -1}};
+    ASSERT_TRUE(r.sims[0] && r.sims[1]);
+    I2CTransport router = r.transport();
+    setI2CTransport(&router);
+    setFpgaPollUsPerKb(FPGA_OP_UPDATE, 1);
+
+    std::vector<unsigned char> img = testImage(0x2000, 10);
+    update_operation* ops = nullptr;
+    int count = 0;
+    ASSERT_EQ(0, parseCompositeImageHeaders(img.data(), img.size(), "1.0.0",
+                                            &ops, &count));
+    RetimerUpdateOptions options = {};
+    options.preflight = true;
+    RetimerTarget targets[2] = {
+        {r.buses[0], FPGA_I2C_CNTRL_ADDR,
+         static_cast<unsigned int>(fpgaSidebandBus(r.buses[0])), 0},
+        {r.buses[1], FPGA_I2C_CNTRL_ADDR, r.sideband, 0}};
+    EXPECT_EQ(-1, fpgaSidebandBus(r.buses[1]));
+
+    // both baseboards are flashed, the caller's operations stay untouched
+    EXPECT_EQ(0, runRetimerUpdateTargets(img.data(), img.size(), ops, count,
+                                         0x03, &options, targets, 2));
+    EXPECT_TRUE(ops[0].imageCrcPending);
+    EXPECT_EQ(0xFFu, ops[0].applyBitmap);
+    for (FpgaSim* sim : r.sims)
+    {
+        EXPECT_EQ(1u, sim->updates);
+        EXPECT_EQ(0, memcmp(sim->eeprom[1], img.data(), img.size()));
+        EXPECT_EQ(0xFF, sim->eeprom[2][0]);
+    }
+
+    // a busy FPGA fails its own target only
+    r.sims[1]->updateStatus = 1;
+    EXPECT_EQ(-ERROR_FPGA_NOT_READY,
+              runRetimerUpdateTargets(img.data(), img.size(), ops, count,
+                                      0x04, &options, targets, 2));
+    EXPECT_EQ(0, targets[0].result);
+    EXPECT_EQ(-ERROR_FPGA_NOT_READY, targets[1].result);
+    EXPECT_EQ(2u, r.sims[0]->updates);
+    EXPECT_EQ(1u, r.sims[1]->updates);
+    r.sims[1]->updateStatus = 0;
+
+    // each target is preflighted on its own baseboard CPLD
+    r.sims[1]->cpld[CPLD_GB_OFFSET] = 0;
+    EXPECT_EQ(-ERROR_RETIMER_NOT_READY,
+              runRetimerUpdateTargets(img.data(), img.size(), ops, count,
+                                      0x04, &options, targets, 2));
+    EXPECT_EQ(0, targets[0].result);
+    EXPECT_EQ(3u, r.sims[0]->updates);
+    EXPECT_EQ(1u, r.sims[1]->updates);
+
+    // a target without a sideband bus is refused up front
+    targets[1].sidebandBus = MAX_I2C_BUS_NUM;
+    EXPECT_EQ(-ERROR_INPUT_ARGUMENTS,
+              runRetimerUpdateTargets(img.data(), img.size(), ops, count,
+                                      0x04, &options, targets, 2));
+    EXPECT_EQ(3u, r.sims[0]->updates);
+    free(ops);
+
+    setI2CTransport(nullptr);
+    fpgaSimDestroy(r.sims[0]);
+    fpgaSimDestroy(r.sims[1]);
+}
+
+TEST_F(TestFwupdate, fpga_op_interleaved)
+{
+    BoardRouter r = {{fpgaSimCreate(nullptr), fpgaSimCreate(nullptr)},
+                     {FPGA_I2C_BUS, FPGA_I2C_BUS + 1},
+                     {-1, -1}};
+    ASSERT_TRUE(r.sims[0] && r.sims[1]);
+    I2CTransport router = r.transport();
+    setI2CTransport(&router);
+    setFpgaPollUsPerKb(FPGA_OP_UPDATE, 1);
+
+    std::vector<unsigned char> img = testImage(0x4000, 11);
+    unsigned int crc = crc32(img.data(), img.size());
+    char version[] = "1.0.0";
+    int fds[2];
+    for (int b = 0; b < 2; b++)
+    {
+        fds[b] = openI2CBus(r.buses[b]);
+        ASSERT_GE(fds[b], 0);
+        ASSERT_EQ(0, copyImageFromMemToFpga(img.data(), img.size(), crc,
+                                            fds[b], FPGA_I2C_CNTRL_ADDR));
+        r.sims[b]->cfg.busyPolls = 3;
+    }
+
+    // one thread steps both FPGAs, neither finishes before the other
+    // was triggered
+    FpgaOp ops[2];
+    initFpgaUpdateOp(&ops[0], fds[0], 0x01, version);
+    initFpgaUpdateOp(&ops[1], fds[1], 0x06, version);
+    bool running[2] = {true, true};
+    bool overlapped = false;
+    uint64_t delayUs;
+    for (int i = 0; i < 100 && (running[0] || running[1]); i++)
+    {
+        for (int b = 0; b < 2; b++)
+        {
+            if (running[b] && !stepFpgaOp(&ops[b], &delayUs))
+            {
+                running[b] = false;
+                if (running[1 - b])
+                {
+                    overlapped = ops[1 - b].state == FPGA_OP_WAIT;
+                }
+            }
+        }
+    }
+    EXPECT_FALSE(running[0] || running[1]);
+    EXPECT_TRUE(overlapped);
+    EXPECT_EQ(FPGA_OP_FINISHED, ops[0].state);
+    EXPECT_EQ(0, ops[0].result);
+    EXPECT_EQ(0, ops[1].result);
+    EXPECT_EQ(4u, ops[0].poll.result.polls);
+    EXPECT_EQ(0, memcmp(r.sims[0]->eeprom[0], img.data(), img.size()));
+    EXPECT_EQ(0, memcmp(r.sims[1]->eeprom[1], img.data(), img.size()));
+    EXPECT_EQ(0, memcmp(r.sims[1]->eeprom[2], img.data(), img.size()));
+    EXPECT_EQ(0xFF, r.sims[0]->eeprom[1][0]);
+
+    closeI2CBuses();
+    setI2CTransport(nullptr);
+    fpgaSimDestroy(r.sims[0]);
+    fpgaSimDestroy(r.sims[1]);
+}
+
+// FpgaOpDoneFn setting the bool userdata
+static void fpgaOpFinished(FpgaOp*, void* finished)
+{
+    *static_cast<bool*>(finished) = true;
+}
+
+TEST_F(TestFwupdate, fpga_op_event_loop)
+{
+    SimTransport t;
+    ASSERT_TRUE(t.sim);
+    ASSERT_GE(t.fd, 0);
+    sd_event* event = nullptr;
+    ASSERT_GE(sd_event_new(&event), 0);
+
+    // a runner drives the operations behind runFpgaOp() from timers,
+    // as the update service does from its main loop
+    struct Loop
+    {
+        sd_event* event;
+        int runs;
+        bool cancelled;
+    } loop = {event, 0, false};
+    auto run = [](FpgaOp* op, void* userdata) {
+        auto* l = static_cast<Loop*>(userdata);
+        bool finished = false;
+        l->runs++;
+        if (l->cancelled)
+        {
+            return -ECANCELED;
+        }
+        int ret = startFpgaOp(l->event, op, fpgaOpFinished, &finished);
+        while (ret >= 0 && !finished)
+        {
+            ret = sd_event_run(l->event, UINT64_MAX);
+        }
+        return ret < 0 ? ret : op->result;
+    };
+    setFpgaOpRunner(run, &loop);
+    t.sim->cfg.busyPolls = 2;
+    EXPECT_EQ(0, readRetimerfw(t.fd, 4));
+    EXPECT_EQ(1, loop.runs);
+    EXPECT_EQ(4u, t.sim->readRetimer);
+
+    // a cancelled read copies nothing back
+    loop.cancelled = true;
+    FILE* out = tmpfile();
+    ASSERT_TRUE(out);
+    EXPECT_EQ(-ECANCELED, runRetimerRead(t.fd, 2, fileno(out)));
+    EXPECT_EQ(2, loop.runs);
+    fclose(out);
+    setFpgaOpRunner(nullptr, nullptr);
+
+    // a cancelled operation stops polling and never completes
+    t.sim->cfg.busyPolls = 1000;
+    FpgaOp op;
+    bool finished = false;
+    initFpgaReadOp(&op, t.fd, 3);
+    ASSERT_EQ(0, startFpgaOp(event, &op, fpgaOpFinished, &finished));
+    for (int i = 0; i < 3; i++)
+    {
+        ASSERT_GE(sd_event_run(event, UINT64_MAX), 0);
+    }
+    EXPECT_EQ(FPGA_OP_WAIT, op.state);
+    cancelFpgaOp(&op);
+    EXPECT_EQ(FPGA_OP_FINISHED, op.state);
+    EXPECT_EQ(-ECANCELED, op.result);
+    EXPECT_EQ(nullptr, op.timer);
+    EXPECT_EQ(0, sd_event_run(event, 0));
+    EXPECT_FALSE(finished);
+
+    sd_event_unref(event);
+}
+
+TEST_F(TestFwupdate, retimer_manifest)
+{
+    SimTransport t;
+    ASSERT_TRUE(t.sim);
+
+    std::vector<unsigned char> img = testImage(0x3000, 11);
+    std::string image = "/tmp/test_manifest_image.bin";
+    std::string out = "/tmp/test_manifest_read.bin";
+    std::ofstream(image, std::ios::binary)
+        .write(reinterpret_cast<const char*>(img.data()), img.size());
+    std::string bus = std::to_string(FPGA_I2C_BUS);
+    std::string text = "# provisioning\n"
+                       "update " + bus + " 0x03 " + image + " 1.0.0\n"
+                       "\n"
+                       "verify " + bus + " 0x03 " + image + " 1.0.0 # both\n"
+                       "read " + bus + " 1 " + out + "\n"
+                       "verify " + bus + " 0x04 " + image + " 1.0.0\n";
+    FILE* f = fmemopen(text.data(), text.size(), "r");
+    ManifestStep* steps = nullptr;
+    int count = 0;
+    RetimerUpdateOptions options = {};
+
+    ASSERT_EQ(0, parseRetimerManifest(f, &steps, &count));
+    fclose(f);
+    ASSERT_EQ(4, count);
+    EXPECT_EQ(RETIMER_FW_VERIFY, steps[1].command);
+    EXPECT_EQ(4u, steps[1].line);
+    EXPECT_EQ(FPGA_I2C_CNTRL_ADDR, steps[2].slaveId);
+    EXPECT_EQ((unsigned int)HMC_I2CBUS_FPGA_SEC_REGTBL, steps[2].sidebandBus);
+
+    // the last step finds retimer 2 blank
+    EXPECT_EQ(-ERROR_WRONG_FIRMWARE,
+              runRetimerManifest(steps, count, &options));
+    EXPECT_EQ(1u, t.sim->updates);
+    EXPECT_EQ(0, memcmp(t.sim->eeprom[0], img.data(), img.size()));
+    std::vector<unsigned char> back(img.size());
+    std::ifstream(out, std::ios::binary)
+        .read(reinterpret_cast<char*>(back.data()), back.size());
+    EXPECT_EQ(img, back);
+    free(steps);
+
+    // the cache lets go of a deleted firmware file
+    int err = 0;
+    const RetimerImage* cached = getRetimerImage(image.c_str(), "1.0.0", &err);
+    ASSERT_NE(nullptr, cached);
+    EXPECT_EQ(cached, getRetimerImage(image.c_str(), "1.0.0", &err));
+    unlink(image.c_str());
+    pruneRetimerImages();
+    EXPECT_EQ(nullptr, cached->image);
+    releaseRetimerImages();
+    unlink(out.c_str());
+
+    // nothing runs when a line is malformed
+    std::string bad = "update " + bus + " 0x03\nread 3 9 /tmp/x\n";
+    f = fmemopen(bad.data(), bad.size(), "r");
+    EXPECT_EQ(-ERROR_INPUT_ARGUMENTS, parseRetimerManifest(f, &steps, &count));
+    EXPECT_EQ(nullptr, steps);
+    fclose(f);
+
+    // another baseboard needs its sideband bus
+    std::string board = std::to_string(FPGA_I2C_BUS + 1) + ":0x31";
+    std::string other = "version " + board + " 0xff\n";
+    f = fmemopen(other.data(), other.size(), "r");
+    EXPECT_EQ(-ERROR_INPUT_ARGUMENTS, parseRetimerManifest(f, &steps, &count));
+    fclose(f);
+    other = "version " + board + ":6 0xff\n";
+    f = fmemopen(other.data(), other.size(), "r");
+    ASSERT_EQ(0, parseRetimerManifest(f, &steps, &count));
+    fclose(f);
+    ASSERT_EQ(1, count);
+    EXPECT_EQ(FPGA_I2C_BUS + 1u, steps[0].bus);
+    EXPECT_EQ(0x31u, steps[0].slaveId);
+    EXPECT_EQ(6u, steps[0].sidebandBus);
+    free(steps);
+}
 
 TEST_F(TestFwupdate, check_writeNackError)
 {
@@ -244,8 +1568,143 @@ TEST_F(TestFwupdate, check_writeNackError)
 
 TEST_F(TestFwupdate, readFwVerionOverSMBPBI) {}
 
-TEST_F(TestFwupdate, startRetimerFwUpdate) {}
+TEST_F(TestFwupdate, startRetimerFwUpdate)
+{
+    SimTransport t;
+    ASSERT_TRUE(t.sim);
+
+    std::vector<unsigned char> img = testImage(0x8000, 2);
+    unsigned int crc = crc32(img.data(), img.size());
+    char version[] = "1.2.3";
+    RetimerBitmap notUpdated = 0;
+
+    ASSERT_EQ(0, copyImageFromMemToFpga(img.data(), img.size(), crc, t.fd,
+                                        FPGA_I2C_CNTRL_ADDR));
+    EXPECT_EQ(0, startRetimerFwUpdate(t.fd, 0x05, version, &notUpdated));
+    EXPECT_EQ(0, notUpdated);
+    EXPECT_EQ(1u, t.sim->updates);
+    EXPECT_EQ(0, memcmp(t.sim->eeprom[0], img.data(), img.size()));
+    EXPECT_EQ(0, memcmp(t.sim->eeprom[2], img.data(), img.size()));
+    EXPECT_EQ(0xFF, t.sim->eeprom[1][0]);
+
+    // checksum failure on retimer 1 is reported and retried for it only
+    t.sim->cfg.checksumMask = 0x02;
+    EXPECT_EQ(0, startRetimerFwUpdate(t.fd, 0x03, version, &notUpdated));
+    EXPECT_EQ(0x02, notUpdated);
+    EXPECT_EQ(3u, t.sim->updates);
+    EXPECT_EQ(0, memcmp(t.sim->eeprom[1], img.data(), img.size()));
+
+    // corrupted DPRAM fails the image checksum for every target
+    t.sim->dpram[10] ^= 0xFF;
+    notUpdated = 0;
+    startRetimerFwUpdate(t.fd, 0x08, version, &notUpdated);
+    EXPECT_EQ(0x08, notUpdated);
+    EXPECT_EQ(0xFF, t.sim->eeprom[3][0]);
+}
+
+TEST_F(TestFwupdate, readRetimerfw)
+{
+    SimTransport t;
+    ASSERT_TRUE(t.sim);
+
+    std::vector<unsigned char> img = testImage(MAX_FW_IMAGE_SIZE, 3);
+    std::vector<unsigned char> out(MAX_FW_IMAGE_SIZE);
+
+    memcpy(t.sim->eeprom[4], img.data(), img.size());
+    t.sim->cfg.busyPolls = 1;
+    EXPECT_EQ(0, readRetimerfw(t.fd, 4));
+    EXPECT_EQ(1u, t.sim->reads);
+    EXPECT_EQ(0, copyImageFromFpgaToMem(t.fd, FPGA_I2C_CNTRL_ADDR, out.data(),
+                                        out.size()));
+    EXPECT_EQ(img, out);
+
+    // pages reach the sink in order, a sink error stops the readback
+    struct PageCount
+    {
+        size_t pages;
+        size_t next;
+    } count = {0, 0};
+    auto sink = [](void* ctx, size_t offset, const unsigned char*,
+                   size_t len) -> int {
+        auto* c = static_cast<PageCount*>(ctx);
+        if (offset != c->next || len != BYTE_PER_PAGE)
+        {
+            return -1;
+        }
+        c->next += len;
+        return ++c->pages == 100 ? 42 : 0;
+    };
+    EXPECT_EQ(42, readFpgaDpramPages(t.fd, FPGA_I2C_CNTRL_ADDR, 0,
+                                     MAX_FW_IMAGE_SIZE, sink, &count));
+    EXPECT_EQ(100u, count.pages);
+
+    // NACK from the retimer is retried once and leaves DPRAM untouched
+    t.sim->cfg.busyPolls = 0;
+    t.sim->cfg.fwReadNackMask = 1 << 6;
+    readRetimerfw(t.fd, 6);
+    EXPECT_EQ(3u, t.sim->reads);
+    EXPECT_EQ(0, memcmp(t.sim->dpram, img.data(), img.size()));
+}
+
+TEST_F(TestFwupdate, retimer_count)
+{
+    // the FPGA register map covers 8 retimers
+    EXPECT_EQ(-ERROR_INPUT_ARGUMENTS, setRetimerCount(0));
+    EXPECT_EQ(-ERROR_INPUT_ARGUMENTS, setRetimerCount(RETIMER_MAX_NUM + 1));
+    EXPECT_EQ(static_cast<unsigned int>(RETIMER_COUNT), getRetimerCount());
+
+    ASSERT_EQ(0, setRetimerCount(4));
+    FpgaSimConfig cfg = {};
+    cfg.retimers = 4;
+    cfg.busyPolls = 1;
+    SimTransport t(&cfg);
+    ASSERT_TRUE(t.sim);
 
-TEST_F(TestFwupdate, readRetimerfw) {}
+    EXPECT_EQ(0xFu, retimerAllMask());
+    EXPECT_EQ(2u, countRetimers(0x5));
+    char all[] = "15";
+    char tooWide[] = "16";
+    EXPECT_EQ(0, checkDigit_retimer(all));
+    EXPECT_EQ(1, checkDigit_retimer(tooWide));
+
+    std::vector<unsigned char> img = testImage(0x4000, 7);
+    unsigned int crc = crc32(img.data(), img.size());
+    update_operation* ops = nullptr;
+    int count = 0;
+    ASSERT_EQ(0, parseCompositeImage(img.data(), img.size(), "1.0", &ops,
+                                     &count));
+    ASSERT_EQ(1, count);
+    EXPECT_EQ(0xFu, ops[0].applyBitmap);
+    free(ops);
+
+    // status bits of absent retimers are ignored, the code carries
+    // the failing retimers of the status byte
+    RetimerBitmap failed = 0;
+    EXPECT_EQ(-ERROR_CHECKSUM | 0x4, checkChecksumError(0x34, &failed));
+    EXPECT_EQ(0x4u, failed);
+
+    // only the failed retimer is retried
+    char version[] = "2.0.0";
+    RetimerBitmap notUpdated = 0;
+    ASSERT_EQ(0, copyImageFromMemToFpga(img.data(), img.size(), crc, t.fd,
+                                        FPGA_I2C_CNTRL_ADDR));
+    t.sim->cfg.checksumMask = 0x4;
+    EXPECT_EQ(0, startRetimerFwUpdate(t.fd, 0x5, version, &notUpdated));
+    EXPECT_EQ(0x4u, notUpdated);
+    EXPECT_EQ(2u, t.sim->updates);
+    for (int r : {0, 2})
+    {
+        EXPECT_EQ(0, memcmp(t.sim->eeprom[r], img.data(), img.size())) << r;
+    }
+    EXPECT_EQ(0xFF, t.sim->eeprom[1][0]);
+
+    // all retimers of the platform failing are reported together
+    ASSERT_EQ(0, setRetimerCount(RETIMER_MAX_NUM));
+    failed = 0;
+    EXPECT_EQ(-ERROR_WRITE_NACK | 0xFF, checkWriteNackError(0xFF, &failed));
+    EXPECT_EQ(0xFFu, failed);
+
+    setRetimerCount(RETIMER_COUNT);
+}
 
 } // namespace phosphor